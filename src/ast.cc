@@ -15,6 +15,10 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
 #include <string.h>
 
 #include "ast.h"
@@ -27,96 +31,202 @@
 #include "storage.h"
 #include "utils.h"
 
-struct entry {
-    void *ptr;
-    Memory_Type type;
+/* All the nodes and strings of a syntax tree come out of one arena, handed
+ * out by bumping a pointer through a list of chunks, and the whole tree is
+ * thrown away at once by releasing the arena.  Nothing in a tree owns
+ * anything outside of it: the parser and code generator copy out the names
+ * and literals they keep, and the decompiler borrows the literals of the
+ * program it is decompiling.
+ *
+ * A tree may still be in use when the next one is started, so arenas are
+ * kept on a stack; free_stmt() releases the newest.  Each thread has its own
+ * stack, since verbs are compiled on several threads at once while the
+ * database is being loaded.
+ */
+
+#define ARENA_CHUNK_SIZE        16384   /* bytes, including the header */
+#define ARENA_SPARE_CHUNKS      8       /* kept around for the next tree */
+#define ARENA_ALIGN             alignof(std::max_align_t)
+
+struct alignas(std::max_align_t) arena_chunk {
+    arena_chunk *next;
+    size_t size;
 };
 
-static int pool_size, next_pool_slot;
-static struct entry *pool;
+struct code_arena {
+    code_arena *prev;           /* the arena of an older tree still in use */
+    arena_chunk *chunks;
+    char *next, *end;           /* the free part of the newest chunk */
+    char **strings;             /* open-addressed table of alloc_string()s */
+    unsigned num_strings, max_strings;
+};
 
-void
-begin_code_allocation()
-{
-    pool_size = 10;
-    next_pool_slot = 0;
-    pool = (struct entry *)mymalloc(pool_size * sizeof(struct entry), M_AST_POOL);
-}
+static thread_local code_arena *arena;
 
-void
-end_code_allocation(int aborted)
+static std::mutex spare_lock;
+static arena_chunk *spare_chunks;      /* protected by spare_lock */
+static int num_spare_chunks;           /* protected by spare_lock */
+
+static arena_chunk *
+new_chunk(size_t size)
 {
-    if (aborted) {
-        int i;
+    arena_chunk *c = nullptr;
+
+    if (size == ARENA_CHUNK_SIZE) {
+        std::lock_guard<std::mutex> lock(spare_lock);
 
-        for (i = 0; i < next_pool_slot; i++) {
-            if (pool[i].ptr != nullptr)
-                myfree(pool[i].ptr, pool[i].type);
+        if ((c = spare_chunks)) {
+            spare_chunks = c->next;
+            num_spare_chunks--;
         }
     }
-    myfree(pool, M_AST_POOL);
+    if (!c) {
+        c = (arena_chunk *)mymalloc(size, M_AST);
+        c->size = size;
+    }
+    return c;
 }
 
 static void *
-allocate(int size, Memory_Type type)
+arena_alloc(code_arena *a, size_t size)
 {
-    if (next_pool_slot >= pool_size) {  /* enlarge the pool */
-        struct entry *new_pool;
-        int i;
-
-        pool_size *= 2;
-        new_pool = (struct entry *)mymalloc(pool_size * sizeof(struct entry), M_AST_POOL);
-        for (i = 0; i < next_pool_slot; i++) {
-            new_pool[i] = pool[i];
-        }
-        myfree(pool, M_AST_POOL);
-        pool = new_pool;
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->next) < size) {
+        size_t chunk_size = std::max((size_t)ARENA_CHUNK_SIZE, sizeof(arena_chunk) + size);
+        arena_chunk *c = new_chunk(chunk_size);
+
+        c->next = a->chunks;
+        a->chunks = c;
+        a->next = (char *)(c + 1);
+        a->end = (char *)c + chunk_size;
     }
-    pool[next_pool_slot].type = type;
-    return pool[next_pool_slot++].ptr = mymalloc(size, type);
+    ptr = a->next;
+    a->next += size;
+    return ptr;
 }
 
 static void
-deallocate(void *ptr)
+release_arena()
 {
-    int i;
-
-    for (i = 0; i < next_pool_slot; i++) {
-        if (ptr == pool[i].ptr) {
-            myfree(ptr, pool[i].type);
-            pool[i].ptr = nullptr;
-            return;
+    code_arena *a = arena;
+    arena_chunk *c, *next;
+
+    arena = a->prev;
+    /* `a' lives in its own first chunk, so nothing of it is used once the
+     * chunks start going back. */
+    for (c = a->chunks; c; c = next) {
+        next = c->next;
+        if (c->size == ARENA_CHUNK_SIZE) {
+            std::lock_guard<std::mutex> lock(spare_lock);
+
+            if (num_spare_chunks < ARENA_SPARE_CHUNKS) {
+                c->next = spare_chunks;
+                spare_chunks = c;
+                num_spare_chunks++;
+                continue;
+            }
         }
+        myfree(c, M_AST);
     }
+}
 
-    errlog("DEALLOCATE: Unknown pointer deallocated\n");
+void
+begin_code_allocation()
+{
+    code_arena a, *ap;
+
+    a.prev = arena;
+    a.chunks = nullptr;
+    a.next = a.end = nullptr;
+    a.strings = nullptr;
+    a.num_strings = a.max_strings = 0;
+    ap = (code_arena *)arena_alloc(&a, sizeof(code_arena));
+    *ap = a;
+    arena = ap;
 }
 
-char *
-alloc_string(const char *buffer)
+void
+end_code_allocation(int aborted)
 {
-    char *string = (char *)allocate(strlen(buffer) + 1, M_STRING);
+    if (aborted)
+        release_arena();
+}
 
-    strcpy(string, buffer);
-    return string;
+static void *
+allocate(size_t size)
+{
+    return arena_alloc(arena, size);
 }
 
-void
-dealloc_string(char *str)
+static unsigned
+string_hash(const char *s, size_t *len)
 {
-    deallocate(str);
+    const char *p;
+    unsigned h = 2166136261u;
+
+    for (p = s; *p; p++)
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    *len = p - s;
+    return h;
 }
 
-void
-dealloc_node(void *node)
+static void
+grow_strings(code_arena *a)
 {
-    deallocate(node);
+    unsigned old_max = a->max_strings, i, j, mask;
+    char **old = a->strings;
+    size_t len;
+
+    a->max_strings = old_max ? old_max * 2 : 64;
+    a->strings = (char **)arena_alloc(a, a->max_strings * sizeof(char *));
+    memset(a->strings, 0, a->max_strings * sizeof(char *));
+    mask = a->max_strings - 1;
+    for (i = 0; i < old_max; i++)
+        if (old[i]) {
+            for (j = string_hash(old[i], &len) & mask; a->strings[j]; j = (j + 1) & mask)
+                ;
+            a->strings[j] = old[i];
+        }
+}
+
+/* The same name or literal tends to turn up many times in a verb, so each
+ * distinct string is copied into the arena only once.  They carry the
+ * header of a real MOO string, so the code generator can treat them as the
+ * values of literals; the reference count is never dropped.
+ */
+char *
+alloc_string(const char *buffer)
+{
+    code_arena *a = arena;
+    size_t len;
+    unsigned h = string_hash(buffer, &len), i, mask;
+    var_metadata *metadata;
+    char *string;
+
+    if (a->num_strings * 2 >= a->max_strings)
+        grow_strings(a);
+    mask = a->max_strings - 1;
+    for (i = h & mask; a->strings[i]; i = (i + 1) & mask)
+        if (!strcmp(a->strings[i], buffer))
+            return a->strings[i];
+
+    metadata = (var_metadata *)arena_alloc(a, sizeof(var_metadata) + len + 1);
+    metadata->refcount = 1;
+#ifdef MEMO_SIZE
+    metadata->size = len;
+#endif
+    string = (char *)(metadata + 1);
+    memcpy(string, buffer, len + 1);
+    a->num_strings++;
+    return a->strings[i] = string;
 }
 
 Stmt *
 alloc_stmt(enum Stmt_Kind kind)
 {
-    Stmt *result = (Stmt *)allocate(sizeof(Stmt), M_AST);
+    Stmt *result = (Stmt *)allocate(sizeof(Stmt));
 
     result->kind = kind;
     result->next = nullptr;
@@ -126,7 +236,7 @@ alloc_stmt(enum Stmt_Kind kind)
 Cond_Arm *
 alloc_cond_arm(Expr * condition, Stmt * stmt)
 {
-    Cond_Arm *result = (Cond_Arm *)allocate(sizeof(Cond_Arm), M_AST);
+    Cond_Arm *result = (Cond_Arm *)allocate(sizeof(Cond_Arm));
 
     result->condition = condition;
     result->stmt = stmt;
@@ -137,7 +247,7 @@ alloc_cond_arm(Expr * condition, Stmt * stmt)
 Except_Arm *
 alloc_except(int id, Arg_List * codes, Stmt * stmt)
 {
-    Except_Arm *result = (Except_Arm *)allocate(sizeof(Except_Arm), M_AST);
+    Except_Arm *result = (Except_Arm *)allocate(sizeof(Except_Arm));
 
     result->id = id;
     result->codes = codes;
@@ -150,7 +260,7 @@ alloc_except(int id, Arg_List * codes, Stmt * stmt)
 Expr *
 alloc_expr(enum Expr_Kind kind)
 {
-    Expr *result = (Expr *)allocate(sizeof(Expr), M_AST);
+    Expr *result = (Expr *)allocate(sizeof(Expr));
 
     result->kind = kind;
     return result;
@@ -189,7 +299,7 @@ alloc_verb(Expr * obj, Expr * verb, Arg_List * args)
 Map_List *
 alloc_map_list(Expr * key, Expr * value)
 {
-    Map_List *result = (Map_List *)allocate(sizeof(Map_List), M_AST);
+    Map_List *result = (Map_List *)allocate(sizeof(Map_List));
 
     result->key = key;
     result->value = value;
@@ -200,7 +310,7 @@ alloc_map_list(Expr * key, Expr * value)
 Arg_List *
 alloc_arg_list(enum Arg_Kind kind, Expr * expr)
 {
-    Arg_List *result = (Arg_List *)allocate(sizeof(Arg_List), M_AST);
+    Arg_List *result = (Arg_List *)allocate(sizeof(Arg_List));
 
     result->kind = kind;
     result->expr = expr;
@@ -211,7 +321,7 @@ alloc_arg_list(enum Arg_Kind kind, Expr * expr)
 Scatter *
 alloc_scatter(enum Scatter_Kind kind, int id, Expr * expr)
 {
-    Scatter *sc = (Scatter *)allocate(sizeof(Scatter), M_AST);
+    Scatter *sc = (Scatter *)allocate(sizeof(Scatter));
 
     sc->kind = kind;
     sc->id = id;
@@ -222,217 +332,15 @@ alloc_scatter(enum Scatter_Kind kind, int id, Expr * expr)
     return sc;
 }
 
-static void free_expr(Expr *);
-
-static void
-free_map_list(Map_List * map)
-{
-    Map_List *m, *next_m;
-
-    for (m = map; m; m = next_m) {
-        next_m = m->next;
-        free_expr(m->key);
-        free_expr(m->value);
-        myfree(m, M_AST);
-    }
-}
-
-static void
-free_arg_list(Arg_List * args)
-{
-    Arg_List *arg, *next_arg;
-
-    for (arg = args; arg; arg = next_arg) {
-        next_arg = arg->next;
-        free_expr(arg->expr);
-        myfree(arg, M_AST);
-    }
-}
-
-static void
-free_scatter(Scatter * sc)
-{
-    Scatter *next_sc;
-
-    for (; sc; sc = next_sc) {
-        next_sc = sc->next;
-        if (sc->expr)
-            free_expr(sc->expr);
-        myfree(sc, M_AST);
-    }
-}
-
-static void
-free_expr(Expr * expr)
-{
-    switch (expr->kind) {
-
-        case EXPR_VAR:
-            free_var(expr->e.var);
-            break;
-
-        case EXPR_ID:
-        case EXPR_FIRST:
-        case EXPR_LAST:
-            /* Do nothing. */
-            break;
-
-        case EXPR_PROP:
-        case EXPR_INDEX:
-        case EXPR_PLUS:
-        case EXPR_MINUS:
-        case EXPR_TIMES:
-        case EXPR_DIVIDE:
-        case EXPR_MOD:
-        case EXPR_AND:
-        case EXPR_OR:
-        case EXPR_EQ:
-        case EXPR_NE:
-        case EXPR_LT:
-        case EXPR_LE:
-        case EXPR_GT:
-        case EXPR_GE:
-        case EXPR_IN:
-        case EXPR_ASGN:
-        case EXPR_EXP:
-        case EXPR_BITOR:
-        case EXPR_BITAND:
-        case EXPR_BITXOR:
-        case EXPR_BITSHL:
-        case EXPR_BITSHR:
-            free_expr(expr->e.bin.lhs);
-            free_expr(expr->e.bin.rhs);
-            break;
-
-        case EXPR_COND:
-            free_expr(expr->e.cond.condition);
-            free_expr(expr->e.cond.consequent);
-            free_expr(expr->e.cond.alternate);
-            break;
-
-        case EXPR_VERB:
-            free_expr(expr->e.verb.obj);
-            free_expr(expr->e.verb.verb);
-            free_arg_list(expr->e.verb.args);
-            break;
-
-        case EXPR_RANGE:
-            free_expr(expr->e.range.base);
-            free_expr(expr->e.range.from);
-            free_expr(expr->e.range.to);
-            break;
-
-        case EXPR_CALL:
-            free_arg_list(expr->e.call.args);
-            break;
-
-        case EXPR_NEGATE:
-        case EXPR_NOT:
-        case EXPR_COMPLEMENT:
-            free_expr(expr->e.expr);
-            break;
-
-        case EXPR_MAP:
-            free_map_list(expr->e.map);
-            break;
-
-        case EXPR_LIST:
-            free_arg_list(expr->e.list);
-            break;
-
-        case EXPR_CATCH:
-            free_expr(expr->e._catch._try);
-            free_arg_list(expr->e._catch.codes);
-            if (expr->e._catch.except)
-                free_expr(expr->e._catch.except);
-            break;
-
-        case EXPR_SCATTER:
-            free_scatter(expr->e.scatter);
-            break;
-
-        default:
-            errlog("FREE_EXPR: Unknown Expr_Kind: %d\n", expr->kind);
-            break;
-    }
-
-    myfree(expr, M_AST);
-}
-
+/* The tree being freed is always the newest one, so this only has to give
+ * back its arena.
+ */
 void
 free_stmt(Stmt * stmt)
 {
-    Stmt *next_stmt;
-    Cond_Arm *arm, *next_arm;
-    Except_Arm *except, *next_e;
-
-    for (; stmt; stmt = next_stmt) {
-        next_stmt = stmt->next;
-
-        switch (stmt->kind) {
-
-            case STMT_COND:
-                for (arm = stmt->s.cond.arms; arm; arm = next_arm) {
-                    next_arm = arm->next;
-                    free_expr(arm->condition);
-                    free_stmt(arm->stmt);
-                    myfree(arm, M_AST);
-                }
-                if (stmt->s.cond.otherwise)
-                    free_stmt(stmt->s.cond.otherwise);
-                break;
-
-            case STMT_LIST:
-                free_expr(stmt->s.list.expr);
-                free_stmt(stmt->s.list.body);
-                break;
-
-            case STMT_RANGE:
-                free_expr(stmt->s.range.from);
-                free_expr(stmt->s.range.to);
-                free_stmt(stmt->s.range.body);
-                break;
-
-            case STMT_WHILE:
-                free_expr(stmt->s.loop.condition);
-                free_stmt(stmt->s.loop.body);
-                break;
-
-            case STMT_FORK:
-                free_expr(stmt->s.fork.time);
-                free_stmt(stmt->s.fork.body);
-                break;
-
-            case STMT_EXPR:
-            case STMT_RETURN:
-                if (stmt->s.expr)
-                    free_expr(stmt->s.expr);
-                break;
-
-            case STMT_TRY_EXCEPT:
-                free_stmt(stmt->s._catch.body);
-                for (except = stmt->s._catch.excepts; except; except = next_e) {
-                    next_e = except->next;
-                    free_arg_list(except->codes);
-                    free_stmt(except->stmt);
-                    myfree(except, M_AST);
-                }
-                break;
-
-            case STMT_TRY_FINALLY:
-                free_stmt(stmt->s.finally.body);
-                free_stmt(stmt->s.finally.handler);
-                break;
-
-            case STMT_BREAK:
-            case STMT_CONTINUE:
-                break;      /* Nothing extra to free */
-
-            default:
-                errlog("FREE_STMT: unknown Stmt_Kind: %d\n", stmt->kind);
-                break;
-        }
-
-        myfree(stmt, M_AST);
+    if (!arena) {
+        errlog("FREE_STMT: No syntax tree to free\n");
+        return;
     }
+    release_arena();
 }
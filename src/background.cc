@@ -187,7 +187,7 @@ static void network_callback(int fd, void *data)
 }
 
 /* Creates the background_waiter struct and starts the worker thread. */
-static enum error
+enum error
 background_suspender(vm the_vm, void *data)
 {
     background_waiter *w = (background_waiter*)data;
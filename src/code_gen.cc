@@ -18,6 +18,7 @@
 #include <limits.h>
 
 #include "ast.h"
+#include "functions.h"
 #include "opcode.h"
 #include "program.h"
 #include "server.h"
@@ -53,6 +54,7 @@ struct gstate {
     Var *literals;
     unsigned num_fork_vectors, max_fork_vectors;
     Bytecodes *fork_vectors;
+    DB_Version version;
 };
 typedef struct gstate GState;
 
@@ -104,13 +106,14 @@ typedef struct state State;
 #endif              /* BYTECODE_REDUCE_REF */
 
 static void
-init_gstate(GState * gstate)
+init_gstate(GState * gstate, DB_Version version)
 {
     gstate->total_var_refs = 0;
     gstate->num_literals = gstate->num_fork_vectors = 0;
     gstate->max_literals = gstate->max_fork_vectors = 0;
     gstate->fork_vectors = nullptr;
     gstate->literals = nullptr;
+    gstate->version = version;
 }
 
 static void
@@ -552,6 +555,33 @@ generate_arg_list(Arg_List * args, State * state)
     }
 }
 
+/* A call to a function registered with register_function_fast() and
+ * without `@' leaves its arguments on the stack rather than building a
+ * list of them.  Returns 0, having generated nothing, for other calls.
+ */
+static int
+generate_fast_call(Expr * expr, State * state)
+{
+    Arg_List *args;
+    unsigned nargs = 0;
+
+    if (state->gstate->version < DBV_FastCall
+            || !bi_func_is_fast(expr->e.call.func))
+        return 0;
+    for (args = expr->e.call.args; args; args = args->next, nargs++)
+        if (args->kind != ARG_NORMAL || nargs == 255)
+            return 0;
+
+    for (args = expr->e.call.args; args; args = args->next)
+        generate_expr(args->expr, state);
+    emit_extended_byte(EOP_BI_FUNC_CALL_FAST, state);
+    emit_byte(expr->e.call.func, state);
+    emit_byte(nargs, state);
+    pop_stack(nargs, state);
+    push_stack(1, state);
+    return 1;
+}
+
 static void
 push_lvalue(Expr * expr, int indexed_above, State * state)
 {
@@ -807,9 +837,11 @@ generate_expr(Expr * expr, State * state)
             generate_arg_list(expr->e.list, state);
             break;
         case EXPR_CALL:
-            generate_arg_list(expr->e.call.args, state);
-            emit_byte(OP_BI_FUNC_CALL, state);
-            emit_byte(expr->e.call.func, state);
+            if (!generate_fast_call(expr, state)) {
+                generate_arg_list(expr->e.call.args, state);
+                emit_byte(OP_BI_FUNC_CALL, state);
+                emit_byte(expr->e.call.func, state);
+            }
             break;
         case EXPR_VERB:
             generate_expr(expr->e.verb.obj, state);
@@ -1391,7 +1423,7 @@ generate_code(Stmt * stmt, DB_Version version)
     Program *prog = new_program();
     GState gstate;
 
-    init_gstate(&gstate);
+    init_gstate(&gstate, version);
 
     prog->main_vector = stmt_to_code(stmt, &gstate);
     prog->version = version;
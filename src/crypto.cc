@@ -35,6 +35,7 @@
 #include "functions.h"
 #include "crypto.h"
 #include "list.h"
+#include "map.h"
 #include <nettle/hmac.h>
 #include <nettle/md5.h>
 #include <nettle/ripemd160.h>
@@ -177,24 +178,50 @@ static char digits[] = "0123456789ABCDEF";
 #define MOO_DIGEST(fn, ctx, size, result) fn((ctx), (size), (result))
 #endif
 
+static const char *
+digest_to_string(const unsigned char *result, int size, int binary)
+{
+    char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);
+    const char *answer = hex;
+
+    for (int i = 0; i < size; i++) {
+        if (binary) *hex++ = '~';
+        *hex++ = digits[result[i] >> 4];
+        *hex++ = digits[result[i] & 0xF];
+    }
+    *hex = 0;
+
+    return answer;
+}
+
+/* `algo##_hash_value' hashes the literal form of a value as it is produced,
+ * rather than unparsing all of it first.
+ */
 #define DEF_HASH(algo, size)                            \
     static const char *                             \
     algo##_hash_bytes(const char *input, int length, int binary)            \
     {                                       \
         algo##_ctx context;                             \
         unsigned char result[size];                         \
-        char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);    \
-        const char *answer = hex;                           \
         algo##_init(&context);                          \
         algo##_update(&context, length, (unsigned char *)input);            \
         MOO_DIGEST(algo##_digest, &context, size, result);                  \
-        for (int i = 0; i < size; i++) {                        \
-            if (binary) *hex++ = '~';                       \
-            *hex++ = digits[result[i] >> 4];                    \
-            *hex++ = digits[result[i] & 0xF];                   \
-        }                                       \
-        *hex = 0;                                   \
-        return answer;                              \
+        return digest_to_string(result, size, binary);              \
+    }                                       \
+    static void                                 \
+    algo##_sink(void *context, const char *bytes, int length)           \
+    {                                       \
+        algo##_update((algo##_ctx *)context, length, (unsigned char *)bytes);   \
+    }                                       \
+    static const char *                             \
+    algo##_hash_value(Stream *s, Var value, int binary)             \
+    {                                       \
+        algo##_ctx context;                             \
+        unsigned char result[size];                         \
+        algo##_init(&context);                          \
+        unparse_value_chunked(s, value, algo##_sink, &context);         \
+        MOO_DIGEST(algo##_digest, &context, size, result);                  \
+        return digest_to_string(result, size, binary);              \
     }
 
 DEF_HASH(md5, 16)
@@ -213,18 +240,25 @@ DEF_HASH(ripemd160, 20)
     {                                                   \
         algo##_ctx context;                                         \
         unsigned char result[size];                                     \
-        char *hex = (char *)mymalloc(size * (binary ? 3 : 2) + 1, M_STRING);                \
-        const char *answer = hex;                                       \
         algo##_set_key(&context, key_length, (unsigned char *)key);                     \
         algo##_update(&context, message_length, (unsigned char *)message);                  \
         MOO_DIGEST(algo##_digest, &context, size, result);                              \
-        for (int i = 0; i < size; i++) {                                    \
-            if (binary) *hex++ = '~';                                   \
-            *hex++ = digits[result[i] >> 4];                                \
-            *hex++ = digits[result[i] & 0xF];                               \
-        }                                                   \
-        *hex = 0;                                               \
-        return answer;                                          \
+        return digest_to_string(result, size, binary);                          \
+    }                                                   \
+    static void                                             \
+    algo##_sink(void *context, const char *bytes, int length)                       \
+    {                                                   \
+        algo##_update((algo##_ctx *)context, length, (unsigned char *)bytes);               \
+    }                                                   \
+    static const char *                                         \
+    algo##_value(Stream *s, Var value, const char *key, int key_length, int binary)         \
+    {                                                   \
+        algo##_ctx context;                                         \
+        unsigned char result[size];                                     \
+        algo##_set_key(&context, key_length, (unsigned char *)key);                     \
+        unparse_value_chunked(s, value, algo##_sink, &context);                     \
+        MOO_DIGEST(algo##_digest, &context, size, result);                              \
+        return digest_to_string(result, size, binary);                          \
     }
 
 DEF_HMAC(hmac_sha1, 20)
@@ -233,6 +267,229 @@ DEF_HMAC(hmac_sha256, 32)
 #undef DEF_HMAC
 #undef MOO_DIGEST
 
+/* A streaming XXH64, for value_hash64().  Not for anything that needs to
+ * resist a deliberate collision.
+ */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+struct hash64_state {
+    uint64_t acc[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint64_t
+read32(const unsigned char *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint64_t
+hash64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t
+hash64_merge(uint64_t h, uint64_t acc)
+{
+    h ^= hash64_round(0, acc);
+    return h * PRIME64_1 + PRIME64_4;
+}
+
+static void
+hash64_init(hash64_state *h, uint64_t seed)
+{
+    h->acc[0] = seed + PRIME64_1 + PRIME64_2;
+    h->acc[1] = seed + PRIME64_2;
+    h->acc[2] = seed;
+    h->acc[3] = seed - PRIME64_1;
+    h->seed = seed;
+    h->total = 0;
+    h->buffered = 0;
+}
+
+static inline void
+hash64_stripe(hash64_state *h, const unsigned char *p)
+{
+    h->acc[0] = hash64_round(h->acc[0], read64(p));
+    h->acc[1] = hash64_round(h->acc[1], read64(p + 8));
+    h->acc[2] = hash64_round(h->acc[2], read64(p + 16));
+    h->acc[3] = hash64_round(h->acc[3], read64(p + 24));
+}
+
+static void
+hash64_update(hash64_state *h, const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    h->total += length;
+
+    if (h->buffered + length < 32) {
+        memcpy(h->buffer + h->buffered, p, length);
+        h->buffered += length;
+        return;
+    }
+
+    if (h->buffered) {
+        const size_t fill = 32 - h->buffered;
+        memcpy(h->buffer + h->buffered, p, fill);
+        hash64_stripe(h, h->buffer);
+        p += fill;
+        length -= fill;
+        h->buffered = 0;
+    }
+
+    for (; length >= 32; p += 32, length -= 32)
+        hash64_stripe(h, p);
+
+    memcpy(h->buffer, p, length);
+    h->buffered = length;
+}
+
+static uint64_t
+hash64_digest(const hash64_state *h)
+{
+    uint64_t result;
+
+    if (h->total >= 32) {
+        result = rotl64(h->acc[0], 1) + rotl64(h->acc[1], 7) + rotl64(h->acc[2], 12) + rotl64(h->acc[3], 18);
+        for (int i = 0; i < 4; i++)
+            result = hash64_merge(result, h->acc[i]);
+    }
+    else
+        result = h->seed + PRIME64_5;
+
+    result += h->total;
+
+    const unsigned char *p = h->buffer;
+    size_t length = h->buffered;
+
+    for (; length >= 8; p += 8, length -= 8) {
+        result ^= hash64_round(0, read64(p));
+        result = rotl64(result, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (length >= 4) {
+        result ^= read32(p) * PRIME64_1;
+        result = rotl64(result, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        length -= 4;
+    }
+    for (; length > 0; p++, length--) {
+        result ^= *p * PRIME64_5;
+        result = rotl64(result, 11) * PRIME64_1;
+    }
+
+    result ^= result >> 33;
+    result *= PRIME64_2;
+    result ^= result >> 29;
+    result *= PRIME64_3;
+    result ^= result >> 32;
+
+    return result;
+}
+
+#undef PRIME64_1
+#undef PRIME64_2
+#undef PRIME64_3
+#undef PRIME64_4
+#undef PRIME64_5
+
+static inline void
+hash64_add_int(hash64_state *h, int64_t n)
+{
+    hash64_update(h, &n, sizeof(n));
+}
+
+static void hash64_value(hash64_state *, Var);
+
+static int
+hash64_map_pair(Var key, Var value, void *data, int first)
+{
+    hash64_value((hash64_state *)data, key);
+    hash64_value((hash64_state *)data, value);
+    return 0;
+}
+
+/* Every value is encoded as its type followed by its contents, with lengths
+ * ahead of strings, lists and maps, so no two different values share an
+ * encoding.  Maps are walked in key order, so equal maps encode the same.
+ */
+static void
+hash64_value(hash64_state *h, Var v)
+{
+    const unsigned char type = v.type;
+    hash64_update(h, &type, 1);
+
+    switch (v.type) {
+        case TYPE_INT:
+            hash64_add_int(h, v.v.num);
+            break;
+        case TYPE_OBJ:
+            hash64_add_int(h, v.v.obj);
+            break;
+        case TYPE_ERR:
+            hash64_add_int(h, v.v.err);
+            break;
+        case TYPE_BOOL:
+            hash64_add_int(h, v.v.truth ? 1 : 0);
+            break;
+        case TYPE_FLOAT:
+        {
+            /* 0.0 == -0.0, so they must hash the same. */
+            double d = v.v.fnum == 0.0 ? 0.0 : v.v.fnum;
+            hash64_update(h, &d, sizeof(d));
+        }
+        break;
+        case TYPE_STR:
+        {
+            const int length = memo_strlen(v.v.str);
+            hash64_add_int(h, length);
+            hash64_update(h, v.v.str, length);
+        }
+        break;
+        case TYPE_LIST:
+            hash64_add_int(h, v.v.list[0].v.num);
+            for (int i = 1; i <= v.v.list[0].v.num; i++)
+                hash64_value(h, v.v.list[i]);
+            break;
+        case TYPE_MAP:
+            hash64_add_int(h, maplength(v));
+            mapforeach(v, hash64_map_pair, h);
+            break;
+        case TYPE_WAIF:
+            hash64_add_int(h, v.v.waif->_class);
+            hash64_add_int(h, v.v.waif->owner);
+            break;
+        default:
+            break;
+    }
+}
+
 /**** built in functions ****/
 
 static package
@@ -483,12 +740,10 @@ bf_value_hash(Var arglist, Byte next, void *vdata, Objid progr)
         const char *algo = (1 < nargs) ? arglist.v.list[2].v.str : "sha256";
         int binary = (2 < nargs) ? is_true(arglist.v.list[3]) : 0;
 
-        unparse_value(s, arglist.v.list[1]);
-
 #define CASE(op, temp)                                  \
     op (!strcasecmp(#temp, algo)) {                     \
         r.type = TYPE_STR;                              \
-        r.v.str = temp##_hash_bytes(stream_contents(s), stream_length(s), binary);  \
+        r.v.str = temp##_hash_value(s, arglist.v.list[1], binary);  \
         p = make_var_pack(r);                           \
     }
 
@@ -516,6 +771,29 @@ bf_value_hash(Var arglist, Byte next, void *vdata, Objid progr)
     return p;
 }
 
+/* value_hash64(value [, seed]) => INT
+ *   A fast, non-cryptographic hash of `value'.  Values that are equal() hash
+ *   the same, which makes the result usable as a map key for deduplication.
+ */
+static package
+bf_value_hash64(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    const int nargs = arglist.v.list[0].v.num;
+    hash64_state h;
+
+    hash64_init(&h, (1 < nargs) ? (uint64_t)arglist.v.list[2].v.num : 0);
+    hash64_value(&h, arglist.v.list[1]);
+    uint64_t result = hash64_digest(&h);
+
+    free_var(arglist);
+
+#ifdef ONLY_32_BITS
+    result ^= result >> 32;
+#endif
+
+    return make_var_pack(Var::new_int((Num)result));
+}
+
 static package
 bf_string_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -653,15 +931,10 @@ bf_value_hmac(Var arglist, Byte next, void *vdata, Objid progr)
         const char *algo = (2 < nargs) ? arglist.v.list[3].v.str : "sha256";
         int binary = (3 < nargs) ? is_true(arglist.v.list[4]) : 0;
 
-        unparse_value(s, arglist.v.list[1]);
-        const char *lit = str_dup(stream_contents(s));
-        int lit_length = stream_length(s);
-
         int key_length;
         const char *key = binary_to_raw_bytes(arglist.v.list[2].v.str, &key_length);
 
         if (!key) {
-            free_str(lit);
             p = make_error_pack(E_INVARG);
         }
         else {
@@ -672,7 +945,7 @@ bf_value_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 #define CASE(op, temp)                                      \
     op (!strcasecmp(#temp, algo)) {                         \
         r.type = TYPE_STR;                              \
-        r.v.str = hmac_##temp##_bytes(lit, lit_length, key, key_length, binary);    \
+        r.v.str = hmac_##temp##_value(s, arglist.v.list[1], key, key_length, binary);  \
         p = make_var_pack(r);                               \
     }
 
@@ -684,7 +957,6 @@ bf_value_hmac(Var arglist, Byte next, void *vdata, Objid progr)
 
 #undef CASE
 
-            free_str(lit);
             free_str(key);
         }
     }
@@ -718,6 +990,7 @@ register_crypto(void)
     register_function("string_hash", 1, 3, bf_string_hash, TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("binary_hash", 1, 3, bf_binary_hash, TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("value_hash", 1, 3, bf_value_hash, TYPE_ANY, TYPE_STR, TYPE_ANY);
+    register_function("value_hash64", 1, 2, bf_value_hash64, TYPE_ANY, TYPE_INT);
 
     register_function("string_hmac", 2, 4, bf_string_hmac, TYPE_STR, TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("binary_hmac", 2, 4, bf_binary_hmac, TYPE_STR, TYPE_STR, TYPE_STR, TYPE_ANY);
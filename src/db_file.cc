@@ -23,20 +23,27 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "collection.h"
 #include "config.h"
 #include "db.h"
 #include "db_io.h"
 #include "db_private.h"
+#include "functions.h"
 #include "list.h"
 #include "log.h"
 #include "options.h"
+#include "parser.h"
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
 #include "str_intern.h"
 #include "tasks.h"
+#include "thpool.h"
 #include "timers.h"
 #include "utils.h"
 #include "version.h"
@@ -834,6 +841,116 @@ fmt_verb_name(void *data)
     return reset_stream(s);
 }
 
+/* Verb programs don't depend on one another, so once the source of all of
+ * them has been read they are compiled on a pool of threads.  Errors and
+ * warnings are kept with each program and logged afterwards, in the order
+ * the programs were read.
+ */
+struct program_job {
+    Objid oid;
+    Num vnum;
+    char *text;
+    Program *program;
+    std::vector<std::pair<bool, std::string>> messages; /* true for errors */
+};
+
+struct program_reader {
+    program_job *job;
+    const char *next;
+};
+
+static void
+job_error(void *data, const char *msg)
+{
+    ((program_reader *)data)->job->messages.emplace_back(true, msg);
+}
+
+static void
+job_warning(void *data, const char *msg)
+{
+    ((program_reader *)data)->job->messages.emplace_back(false, msg);
+}
+
+static int
+job_getc(void *data)
+{
+    program_reader *r = (program_reader *)data;
+
+    return *r->next ? (unsigned char) *r->next++ : EOF;
+}
+
+static Parser_Client job_parser_client = {job_error, job_warning, job_getc};
+
+struct compile_work {
+    std::vector<program_job> *jobs;
+    std::atomic<size_t> next;
+};
+
+static void
+compile_programs_worker(void *data)
+{
+    compile_work *work = (compile_work *)data;
+    size_t i;
+
+    while ((i = work->next++) < work->jobs->size()) {
+        program_job &job = (*work->jobs)[i];
+        program_reader r = {&job, job.text};
+
+        job.program = parse_program(dbio_input_version, job_parser_client, &r);
+        free_str(job.text);
+        job.text = nullptr;
+    }
+}
+
+static int
+compile_programs(std::vector<program_job> &jobs)
+{
+    compile_work work;
+    int threads = DB_LOAD_THREADS > 0 ? DB_LOAD_THREADS : std::thread::hardware_concurrency();
+    int ok = 1;
+
+    work.jobs = &jobs;
+    work.next = 0;
+    if (threads > (int)jobs.size())
+        threads = jobs.size();
+
+    if (threads > 1) {
+        threadpool pool = thpool_init(threads);
+
+        oklog("LOADING: Compiling %zu MOO verb programs on %d threads ...\n", jobs.size(), threads);
+        for (int t = 0; t < threads; t++)
+            thpool_add_work(pool, compile_programs_worker, &work);
+        thpool_wait(pool);
+        thpool_destroy(pool);
+    } else
+        compile_programs_worker(&work);
+
+    for (auto &job : jobs) {
+        /* Verb handles don't last, so find the verb again. */
+        db_verb_handle h = db_find_indexed_verb(Var::new_obj(job.oid), job.vnum + 1);
+
+        for (auto &m : job.messages) {
+            const char *name = fmt_verb_name(&h);
+
+            if (m.first) {
+                errlog("PARSER: Error in %s:\n", name);
+                errlog("           %s\n", m.second.c_str());
+            } else {
+                oklog("PARSER: Warning in %s:\n", name);
+                oklog("           %s\n", m.second.c_str());
+            }
+        }
+        if (job.program)
+            db_set_verb_program(h, job.program);
+        else {
+            errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", job.oid, job.vnum);
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
+
 static int
 read_db_file(void)
 {
@@ -841,7 +958,8 @@ read_db_file(void)
     Var user_list;
     Num i, nobjs, nprogs, nusers, vnum, dummy;
     db_verb_handle h;
-    Program *program;
+    char *text;
+    std::vector<program_job> jobs;
 
     waif_before_loading();
 
@@ -993,16 +1111,19 @@ read_db_file(void)
             errlog("READ_DB_FILE: Unknown verb index: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
             return 0;
         }
-        program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
-        if (!program) {
-            errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
+        text = dbio_read_program_text();
+        if (!text) {
+            errlog("READ_DB_FILE: Unexpected EOF in program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
             return 0;
         }
-        db_set_verb_program(h, program);
+        jobs.push_back({oid, vnum, text, nullptr, {}});
         if (i % 5000 == 0 || i == nprogs)
             oklog("LOADING: Done reading %" PRIdN " verb program%s ...\n", i, i > 1 ? "s" : "");
     }
 
+    if (!compile_programs(jobs))
+        return 0;
+
     if (DBV_Anon > dbio_input_version) {
         oklog("LOADING: Reading forked and suspended tasks ...\n");
         if (!read_task_queue()) {
@@ -1136,6 +1257,15 @@ retryDumping:
 
     oklog("%s on %s ...\n", reason_names[reason], temp_name);
 
+#ifdef MEMORY_STATS
+    if (reason == DUMP_CHECKPOINT)
+        log_memory_stats();
+#endif
+#ifdef FUNCTION_STATS
+    if (reason == DUMP_CHECKPOINT)
+        log_function_stats();
+#endif
+
 #ifdef UNFORKED_CHECKPOINTS
     reset_command_history();
 #else
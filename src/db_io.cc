@@ -281,6 +281,28 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
     s.data = data;
     return parse_program(version, parser_client, &s);
 }
+
+char *
+dbio_read_program_text(void)
+{
+    static Stream *str = nullptr;
+    int c, prev_char = '\n';
+
+    if (str == nullptr)
+        str = new_stream(1024);
+
+    while ((c = fgetc(input)) != EOF) {
+        if (c == '.' && prev_char == '\n') {
+            /* end-of-verb marker in DB */
+            fgetc(input);   /* skip next newline */
+            return str_dup(reset_stream(str));
+        }
+        stream_add_char(str, c);
+        prev_char = c;
+    }
+    reset_stream(str);
+    return nullptr;
+}
 
 
 /*********** Output ***********/
@@ -19,7 +19,9 @@
  * Routines for manipulating DB objects
  *****************************************************************************/
 
+#include <ctype.h>
 #include <string.h>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +42,7 @@
 #include "map.h"
 #include "options.h"
 #include "log.h"
+#include "waif.h"
 
 static Object **objects;
 static Num num_objects = 0;
@@ -62,6 +65,100 @@ static std::unordered_map <Num, Var> ancestor_cache;
 static unsigned char *bit_array;
 static size_t array_size = 0;
 
+/* Secondary indexes backing owned_objects() and locate_by_name().  Neither
+ * is built until the first time it's needed; after that they're kept up to
+ * date as owners and names change.  Only numbered objects are indexed.
+ *
+ * The name index maps every (case-folded) three-character substring of an
+ * object's name to the sorted list of objects whose names contain it, so a
+ * substring search only has to look at objects sharing its rarest trigram.
+ */
+static bool owner_index_built = false;
+static std::unordered_map<Objid, std::set<Objid>> owner_index;
+
+static bool name_index_built = false;
+static std::unordered_map<uint32_t, std::vector<Objid>> name_index;
+
+static inline bool
+indexed(Object *o)
+{
+    return o->id != NOTHING && o->id < max_objects && objects[o->id] == o;
+}
+
+static void
+name_trigrams(const char *name, int len, std::vector<uint32_t> *out)
+{
+    out->clear();
+    for (int i = 0; i + 3 <= len; i++)
+        out->push_back((uint32_t) (unsigned char) tolower(name[i]) << 16
+                       | (uint32_t) (unsigned char) tolower(name[i + 1]) << 8
+                       | (uint32_t) (unsigned char) tolower(name[i + 2]));
+    std::sort(out->begin(), out->end());
+    out->erase(std::unique(out->begin(), out->end()), out->end());
+}
+
+static void
+name_index_update(Objid oid, const char *name, bool add)
+{
+    std::vector<uint32_t> trigrams;
+
+    if (!name_index_built || !name)
+        return;
+
+    name_trigrams(name, memo_strlen(name), &trigrams);
+    for (uint32_t t : trigrams) {
+        std::vector<Objid> &postings = name_index[t];
+        auto it = std::lower_bound(postings.begin(), postings.end(), oid);
+
+        if (add) {
+            if (it == postings.end() || *it != oid)
+                postings.insert(it, oid);
+        } else if (it != postings.end() && *it == oid) {
+            postings.erase(it);
+            if (postings.empty())
+                name_index.erase(t);
+        }
+    }
+}
+
+static void
+owner_index_update(Objid oid, Objid owner, bool add)
+{
+    if (!owner_index_built)
+        return;
+
+    if (add) {
+        owner_index[owner].insert(oid);
+    } else {
+        auto it = owner_index.find(owner);
+        if (it != owner_index.end()) {
+            it->second.erase(oid);
+            if (it->second.empty())
+                owner_index.erase(it);
+        }
+    }
+}
+
+/* Remove a numbered object from both indexes before it's destroyed or
+ * turned into an anonymous object.
+ */
+static void
+unindex_object(Object *o)
+{
+    owner_index_update(o->id, o->owner, false);
+    name_index_update(o->id, o->name, false);
+}
+
+/* Drop both indexes; they'll be rebuilt the next time they're needed. */
+static void
+invalidate_object_indexes(void)
+{
+    owner_index.clear();
+    owner_index_built = false;
+    name_index.clear();
+    name_index_built = false;
+}
+
 /*********** Objects qua objects ***********/
 
 Object *
@@ -305,6 +402,8 @@ db_create_object(Num new_objid, bool anonymous)
 
     o = dbpriv_new_object(new_objid, anonymous);
     db_init_object(o, anonymous);
+    o->owner = NOTHING;
+    owner_index_update(o->id, NOTHING, true);
 
     return o->id;
 }
@@ -328,6 +427,8 @@ db_destroy_object(Objid oid)
             o->children.v.list[0].v.num != 0)
         panic_moo("DB_DESTROY_OBJECT: Not a barren orphan!");
 
+    unindex_object(o);
+
     free_var(o->parents);
     free_var(o->children);
 
@@ -426,6 +527,7 @@ db_make_anonymous(Objid oid, Objid last)
 {
     Object *o = objects[oid];
 
+    unindex_object(o);
     objects[oid] = nullptr;
     db_set_last_used_objid(last);
 
@@ -494,6 +596,7 @@ void
 dbpriv_cleanup_failed_anonymous_create(Objid oid)
 {
     Object *o = objects[oid];
+    unindex_object(o);
     objects[oid] = nullptr;
     db_destroy_anonymous_object(o);
     myfree(o, M_ANON);
@@ -552,6 +655,10 @@ db_renumber_object(Objid old)
 
     for (_new = 0; _new < old; _new++) {
         if (objects[_new] == nullptr) {
+            /* Renumbering rewrites owners all over the database; rather than
+             * chase each one, start the indexes over. */
+            invalidate_object_indexes();
+
             /* Change the identity of the object. */
             o = objects[_new] = objects[old];
             objects[old] = nullptr;
@@ -609,6 +716,23 @@ db_renumber_object(Objid old)
 #undef      FIX
 #undef      RENUMBER_IN_LIST
 
+            /* The waif slot tables of this object and everything below it
+             * name the object that defines each property; drop them so
+             * they are rebuilt with the new number.
+             */
+            {
+                Var descendant, descendants = db_descendants(Var::new_obj(_new), true);
+
+                FOR_EACH(descendant, descendants, i1, c1) {
+                    Object *d = dbpriv_dereference(descendant);
+                    if (d && d->waif_propdefs) {
+                        free_waif_propdefs((WaifPropdefs *)d->waif_propdefs);
+                        d->waif_propdefs = nullptr;
+                    }
+                }
+                free_var(descendants);
+            }
+
             /* Fix up anonymous children's parent references */
             {
                 auto it = anonymous_objects.find(old);
@@ -923,6 +1047,10 @@ dbpriv_object_owner(Object *o)
 void
 dbpriv_set_object_owner(Object *o, Objid owner)
 {
+    if (indexed(o)) {
+        owner_index_update(o->id, o->owner, false);
+        owner_index_update(o->id, owner, true);
+    }
     o->owner = owner;
 }
 
@@ -947,6 +1075,10 @@ dbpriv_object_name(Object *o)
 void
 dbpriv_set_object_name(Object *o, const char *name)
 {
+    if (indexed(o)) {
+        name_index_update(o->id, o->name, false);
+        name_index_update(o->id, name, true);
+    }
     if (o->name)
         free_str(o->name);
     o->name = name;
@@ -1342,6 +1474,80 @@ dbpriv_set_all_users(Var v)
     all_users = v;
 }
 
+Var
+db_owned_objects(Objid owner)
+{
+    if (!owner_index_built) {
+        for (Objid oid = 0; oid < num_objects; oid++)
+            if (objects[oid])
+                owner_index[objects[oid]->owner].insert(oid);
+        owner_index_built = true;
+    }
+
+    auto it = owner_index.find(owner);
+    if (it == owner_index.end())
+        return new_list(0);
+
+    Var r = new_list(it->second.size());
+    int i = 1;
+    for (Objid oid : it->second)
+        r.v.list[i++] = Var::new_obj(oid);
+
+    return r;
+}
+
+Var
+db_locate_by_name(const char *what, int what_len, int case_matters)
+{
+    std::vector<Objid> found;
+
+    if (!name_index_built) {
+        std::vector<uint32_t> trigrams;
+
+        for (Objid oid = 0; oid < num_objects; oid++) {
+            if (!objects[oid])
+                continue;
+            name_trigrams(objects[oid]->name, memo_strlen(objects[oid]->name), &trigrams);
+            for (uint32_t t : trigrams)
+                name_index[t].push_back(oid);   /* ascending by construction */
+        }
+        name_index_built = true;
+    }
+
+    if (what_len < 3) {
+        /* Too short to have a trigram; look at every name. */
+        for (Objid oid = 0; oid < num_objects; oid++) {
+            const char *name = objects[oid] ? objects[oid]->name : nullptr;
+            if (name && strindex(name, memo_strlen(name), what, what_len, case_matters))
+                found.push_back(oid);
+        }
+    } else {
+        std::vector<uint32_t> trigrams;
+        const std::vector<Objid> *rarest = nullptr;
+
+        name_trigrams(what, what_len, &trigrams);
+        for (uint32_t t : trigrams) {
+            auto it = name_index.find(t);
+            if (it == name_index.end())
+                return new_list(0);
+            if (!rarest || it->second.size() < rarest->size())
+                rarest = &it->second;
+        }
+
+        for (Objid oid : *rarest) {
+            const char *name = objects[oid]->name;
+            if (strindex(name, memo_strlen(name), what, what_len, case_matters))
+                found.push_back(oid);
+        }
+    }
+
+    Var r = new_list(found.size());
+    for (size_t i = 0; i < found.size(); i++)
+        r.v.list[i + 1] = Var::new_obj(found[i]);
+
+    return r;
+}
+
 int
 db_object_isa(Var object, Var parent)
 {
@@ -1424,6 +1630,14 @@ void do_fixup_owners(Object *o, const Objid obj)
 void
 db_fixup_owners(const Objid obj)
 {
+    if (owner_index_built) {
+        auto it = owner_index.find(obj);
+        if (it != owner_index.end()) {
+            owner_index[NOTHING].insert(it->second.begin(), it->second.end());
+            owner_index.erase(obj);
+        }
+    }
+
     for (Objid oid = 0; oid < num_objects; oid++)
         do_fixup_owners(objects[oid], obj);
 
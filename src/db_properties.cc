@@ -595,35 +595,38 @@ done:
     if (!h.ptr)
         return h;
 
-    if (value) {
-        Pval *prop = (Pval *)h.ptr;
+    if (value)
+        *value = dbpriv_inherited_property_value(o, (Pval *)h.ptr, (Object *)h.definer, i);
 
-        while (prop->var.type == TYPE_CLEAR) {
-            /* We take a few liberties at this point.  If a property
-             * value on an object is clear, then its `definer' must be
-             * a permanent (not an anonymous) object, because
-             * anonymous objects can't currently be parents of other
-             * objects.  Thus `new_obj()' below is okay.
-             */
-            if (TYPE_LIST == o->parents.type) {
-                Var parent, parents = o->parents;
-                int i2, c2, offset = 0;
-                FOR_EACH(parent, parents, i2, c2)
-                if ((offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), parent)) > -1)
-                    break;
-                o = dbpriv_find_object(parent.v.obj);
-                prop = o->propval + offset + i;
-            }
-            else if (TYPE_OBJ == o->parents.type && NOTHING != o->parents.v.obj) {
-                int offset = properties_offset(Var::new_obj(((Object *)h.definer)->id), o->parents);
-                o = dbpriv_find_object(o->parents.v.obj);
-                prop = o->propval + offset + i;
-            }
+    return h;
+}
+
+Var
+dbpriv_inherited_property_value(Object *o, Pval *prop, Object *definer, int index)
+{
+    while (prop->var.type == TYPE_CLEAR) {
+        /* We take a few liberties at this point.  If a property
+         * value on an object is clear, then its `definer' must be
+         * a permanent (not an anonymous) object, because
+         * anonymous objects can't currently be parents of other
+         * objects.  Thus `new_obj()' below is okay.
+         */
+        if (TYPE_LIST == o->parents.type) {
+            Var parent, parents = o->parents;
+            int i2, c2, offset = 0;
+            FOR_EACH(parent, parents, i2, c2)
+            if ((offset = properties_offset(Var::new_obj(definer->id), parent)) > -1)
+                break;
+            o = dbpriv_find_object(parent.v.obj);
+            prop = o->propval + offset + index;
+        }
+        else if (TYPE_OBJ == o->parents.type && NOTHING != o->parents.v.obj) {
+            int offset = properties_offset(Var::new_obj(definer->id), o->parents);
+            o = dbpriv_find_object(o->parents.v.obj);
+            prop = o->propval + offset + index;
         }
-        *value = prop->var;
     }
-
-    return h;
+    return prop->var;
 }
 
 int
@@ -291,7 +291,8 @@ finish_while:
                 break;
             case OP_IMM:
                 e = alloc_expr(EXPR_VAR);
-                e->e.var = var_ref(READ_LITERAL());
+                /* Borrowed: the program outlives its tree. */
+                e->e.var = READ_LITERAL();
                 push_expr((Expr *)HOT_OP(e));
                 break;
             case OP_G_PUSH:
@@ -387,7 +388,6 @@ finish_binary:
                     panic_moo("Missing arglist for BI_FUNC_CALL in DECOMPILE!");
                 e = alloc_expr(EXPR_CALL);
                 e->e.call.args = a->e.list;
-                dealloc_node(a);
                 e->e.call.func = READ_BYTES(1);
                 push_expr((Expr *)HOT_OP1(a, e));
             }
@@ -400,7 +400,6 @@ finish_binary:
                 if (a->kind != EXPR_LIST)
                     panic_moo("Missing arglist for CALL_VERB in DECOMPILE!");
                 e = alloc_verb(pop_expr(), e2, a->e.list);
-                dealloc_node(a);
                 push_expr((Expr *)HOT_OP3(e->e.verb.obj, a, e2, e));
             }
             break;
@@ -608,8 +607,6 @@ finish_indexed_assignment:
                                         || defallt->e.bin.lhs->e.id != sc->id)
                                     panic_moo("Wrong variable in DECOMPILE!");
                                 sc->expr = defallt->e.bin.rhs;
-                                dealloc_node(defallt->e.bin.lhs);
-                                dealloc_node(defallt);
                                 is_hot = (is_hot || ptr == hot_byte);
                                 if (*ptr++ != OP_POP)
                                     panic_moo("Missing default POP in DECOMPILE!");
@@ -638,7 +635,6 @@ finish_indexed_assignment:
                                 || label_expr->e.var.type != TYPE_INT)
                             panic_moo("Not a catch label in DECOMPILE!");
                         label = label_expr->e.var.v.num;
-                        dealloc_node(label_expr);
                         if (codes->kind == EXPR_LIST)
                             a = codes->e.list;
                         else if (codes->kind == EXPR_VAR
@@ -647,7 +643,6 @@ finish_indexed_assignment:
                             a = nullptr;
                         else
                             panic_moo("Not a codes expression in DECOMPILE!");
-                        dealloc_node(codes);
                         DECOMPILE(bc, ptr, end, nullptr, nullptr);
                         is_hot = (is_hot || ptr++ == hot_byte);
                         if (*ptr++ != EOP_END_CATCH)
@@ -701,7 +696,6 @@ finish_indexed_assignment:
                                     || label_expr->e.var.type != TYPE_INT)
                                 panic_moo("Not an except label in DECOMPILE!");
                             label = label_expr->e.var.v.num;
-                            dealloc_node(label_expr);
                             e = pop_expr();
                             if (e->kind == EXPR_LIST)
                                 a = e->e.list;
@@ -711,7 +705,6 @@ finish_indexed_assignment:
                                 a = nullptr;
                             else
                                 panic_moo("Not a codes expression in DECOMPILE!");
-                            dealloc_node(e);
                             ex = alloc_except(-1, a, nullptr);
                             ex->label = label;
                             ex->next = s->s._catch.excepts;
@@ -815,8 +808,6 @@ finish_indexed_assignment:
                         if (iter->kind != EXPR_VAR
                                 || iter->e.var.type != TYPE_NONE)
                             panic_moo("Not a `none' value in DECOMPILE!");
-                        else
-                            dealloc_node(iter);
                         s = alloc_stmt(STMT_LIST);
                         s->s.list.id = id;
                         s->s.list.index = -1;
@@ -843,8 +834,6 @@ finish_indexed_assignment:
                         if (iter->kind != EXPR_VAR
                                 || iter->e.var.type != TYPE_NONE)
                             panic_moo("Not a `none' value in DECOMPILE!");
-                        else
-                            dealloc_node(iter);
                         s = alloc_stmt(STMT_LIST);
                         s->s.list.id = id;
                         s->s.list.index = index;
@@ -884,6 +873,25 @@ finish_extended_binary:
                         push_expr((Expr *)HOT_OP1(e->e.expr, e));
                         break;
 
+                    case EOP_BI_FUNC_CALL_FAST:
+                    {
+                        int is_hot = op_hot;
+                        Arg_List *args = nullptr;
+
+                        e = alloc_expr(EXPR_CALL);
+                        e->e.call.func = READ_BYTES(1);
+                        for (int nargs = READ_BYTES(1); nargs > 0; nargs--) {
+                            Arg_List *a = alloc_arg_list(ARG_NORMAL, pop_expr());
+
+                            is_hot = is_hot || hot_node == a->expr;
+                            a->next = args;
+                            args = a;
+                        }
+                        e->e.call.args = args;
+                        push_expr((Expr *)HOT(is_hot, e));
+                    }
+                    break;
+
                     default:
                         panic_moo("Unknown extended opcode in DECOMPILE!");
                 }
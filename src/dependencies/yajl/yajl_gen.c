@@ -224,17 +224,14 @@ yajl_gen_integer(yajl_gen g, long int number)
 
 /* Imported `dbl_fmt()' and the "make it look floating" hack from
  * streams.cc for consistent formatting of floating point numbers. */
+#define DBL_FMT_DIGITS(d) "%." #d "g"
+#define DBL_FMT(d) DBL_FMT_DIGITS(d)
+
+/* A constant, since generators may run on several threads at once. */
 static const char *
 dbl_fmt(void)
 {
-    static const char *fmt = NULL;
-    static char buffer[10];
-
-    if (!fmt) {
-	sprintf(buffer, "%%.%dg", DBL_DIG);
-	fmt = buffer;
-    }
-    return fmt;
+    return DBL_FMT(DBL_DIG);
 }
 
 yajl_gen_status
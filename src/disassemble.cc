@@ -119,7 +119,8 @@ struct mapping ext_mappings[] =
     {EOP_BITXOR, "BITXOR"},
     {EOP_BITSHL, "BITSHL"},
     {EOP_BITSHR, "BITSHR"},
-    {EOP_COMPLEMENT, "COMPLEMENT"}
+    {EOP_COMPLEMENT, "COMPLEMENT"},
+    {EOP_BI_FUNC_CALL_FAST, "CALL_FUNC_FAST"}
 };
 
 static void
@@ -330,6 +331,11 @@ disassemble(Program * prog, Printer p, void *data)
                         a3 = ADD_BYTES(bc.numbytes_label);
                         stream_printf(insn, " %s %s %d", NAMES(a1), NAMES(a2), a3);
                         break;
+                    case EOP_BI_FUNC_CALL_FAST:
+                        a1 = ADD_BYTES(1);
+                        a2 = ADD_BYTES(1);
+                        stream_printf(insn, " %s %d", name_func_by_num(a1), a2);
+                        break;
                     default:
                         break;
                 }
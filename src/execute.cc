@@ -35,6 +35,7 @@
 #include "opcode.h"
 #include "options.h"
 #include "parse_cmd.h"
+#include "profiler.h"
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
@@ -61,6 +62,10 @@ static Num root_activ_vector;   /* root_activ_vector == MAIN_VECTOR
 /* these globals are not part of the vm because they get re-initialized after a suspend */
 static int ticks_remaining;
 int task_timed_out;
+std::atomic<int> interpreter_interrupt(0);
+std::atomic<int> stall_report_due(0);
+static_assert(std::atomic<int>::is_always_lock_free,
+              "interpreter_interrupt is set from signal handlers");
 static int interpreter_is_running = 0;
 static Timer_ID task_alarm_id;
 
@@ -198,6 +203,12 @@ output_to_log(const char *line)
     applog(LOG_INFO2, "%s\n", line);
 }
 
+static void
+log_stalled_line(const char *line)
+{
+    errlog("WATCHDOG: %s\n", line);
+}
+
 static Var backtrace_list;
 
 static void
@@ -312,6 +323,8 @@ unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
             bi_func_id = a->bi_func_id;
             bi_func_data = a->bi_func_data;
         }
+        if (profiler_active)
+            profile_return(activ_stack, top_activ_stack, root_activ_vector, ticks_remaining);
         free_activation(a, 0);  /* 0 == don't free bi_func_data */
 
         if (top_activ_stack == 0) { /* done */
@@ -395,6 +408,8 @@ unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
                         case package::BI_KILL:
                             break;
                         case package::BI_CALL:
+                            if (profiler_active)
+                                profile_return(activ_stack, top_activ_stack, root_activ_vector, ticks_remaining);
                             free_activation(&activ_stack[top_activ_stack--], 0);
                             bi_func_pc = p.u.call.pc;
                             bi_func_data = p.u.call.data;
@@ -779,6 +794,9 @@ call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool
     set_rt_env_var(env, SLOT_VERB, v);  /* no var_dup */
     set_rt_env_var(env, SLOT_ARGS, args);   /* no var_dup */
 
+    if (profiler_active)
+        profile_call(activ_stack, top_activ_stack, root_activ_vector, ticks_remaining);
+
     return E_NONE;
 }
 
@@ -808,6 +826,7 @@ run(char raise, enum error resumption_error, Var * result)
     enum Opcode op;
     Var error_var;
     enum outcome outcome;
+    unsigned func_id;   /* of the built-in function being called */
 
     /** a bunch of macros that work *ONLY* inside run() **/
 
@@ -980,10 +999,23 @@ next_opcode:
                 abort_task(ABORT_TICKS);
                 return OUTCOME_ABORTED;
             }
-            if (task_timed_out) {
-                STORE_STATE_VARIABLES();
-                abort_task(ABORT_SECONDS);
-                return OUTCOME_ABORTED;
+            if (interpreter_interrupt.load(std::memory_order_acquire)) {
+                interpreter_interrupt.store(0, std::memory_order_relaxed);
+                if (task_timed_out) {
+                    STORE_STATE_VARIABLES();
+                    abort_task(ABORT_SECONDS);
+                    return OUTCOME_ABORTED;
+                }
+                if (profile_sample_due.load(std::memory_order_relaxed)) {
+                    STORE_STATE_VARIABLES();
+                    profile_sample(activ_stack, top_activ_stack, root_activ_vector);
+                    profile_sample_due.store(0, std::memory_order_relaxed);
+                }
+                if (stall_report_due.load(std::memory_order_relaxed)) {
+                    STORE_STATE_VARIABLES();
+                    print_error_backtrace("Main loop stalled", log_stalled_line);
+                    stall_report_due.store(0, std::memory_order_relaxed);
+                }
             }
         }
         switch (op) {
@@ -2223,11 +2255,11 @@ else if (obj.type == TYPE_##t1) {           \
             break;
 
             case OP_BI_FUNC_CALL:
+                func_id = READ_BYTES(bv, 1);    /* 1 == numbytes of func_id */
+do_bi_func_call:
             {
-                unsigned func_id;
                 Var args;
 
-                func_id = READ_BYTES(bv, 1);    /* 1 == numbytes of func_id */
                 args = POP();   /* should be list */
                 if (args.type != TYPE_LIST) {
                     free_var(args);
@@ -2876,6 +2908,47 @@ else if (obj.type == TYPE_##t1) {           \
                     }
                     break;
 
+                    case EOP_BI_FUNC_CALL_FAST:
+                    {
+                        int nargs;
+                        package p;
+
+                        func_id = READ_BYTES(bv, 1);
+                        nargs = READ_BYTES(bv, 1);
+                        if (bi_func_is_overridden(func_id)) {
+                            /* Collect the arguments into a list, as
+                             * #0:bf_FUNCNAME() will need, and call it as
+                             * BI_FUNC_CALL would.
+                             */
+                            Var args = new_list(nargs);
+
+                            rts -= nargs;
+                            for (int i = 0; i < nargs; i++)
+                                args.v.list[i + 1] = rts[i];
+                            PUSH(args);
+                            goto do_bi_func_call;
+                        }
+
+                        p = call_bi_func_fast(func_id, rts - nargs, nargs, RUN_ACTIV.progr);
+                        while (nargs-- > 0)
+                            free_var(POP());
+
+                        if (p.kind == package::BI_RETURN)
+                            PUSH(p.u.ret);
+                        else if (RUN_ACTIV.debug) {
+                            STORE_STATE_VARIABLES();
+                            if (raise_error(p, nullptr))
+                                return OUTCOME_ABORTED;
+                            else
+                                LOAD_STATE_VARIABLES();
+                        } else {
+                            PUSH(p.u.raise.code);
+                            free_str(p.u.raise.msg);
+                            free_var(p.u.raise.value);
+                        }
+                    }
+                    break;
+
                     default:
                         panic_moo("Unknown extended opcode!");
                 }
@@ -3050,6 +3123,7 @@ static void
 task_timeout(Timer_ID id, Timer_Data data)
 {
     task_timed_out = timeouts_enabled;
+    interpreter_interrupt.store(task_timed_out, std::memory_order_release);
 }
 
 static Timer_ID
@@ -3058,6 +3132,9 @@ setup_task_execution_limits(int seconds, int ticks)
     task_alarm_id = set_virtual_timer(seconds < 1 ? 1 : seconds,
                                       task_timeout, nullptr);
     task_timed_out = 0;
+    interpreter_interrupt.store(0, std::memory_order_relaxed);
+    profile_sample_due.store(0, std::memory_order_relaxed);
+    stall_report_due.store(0, std::memory_order_relaxed);
     ticks_remaining = (ticks < 100 ? 100 : ticks);
     return task_alarm_id;
 }
@@ -3110,7 +3187,11 @@ run_interpreter(char raise, enum error e,
 
     interpreter_is_running = 1;
     std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    if (profiler_active)
+        profile_task_begin(activ_stack, top_activ_stack, root_activ_vector, ticks_remaining);
     ret = run(raise, e, result);
+    if (profiler_active)
+        profile_task_end(ticks_remaining);
     std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
     total_cputime.v.fnum = elapsed.count();
     interpreter_is_running = 0;
@@ -3119,6 +3200,7 @@ run_interpreter(char raise, enum error e,
 
     cancel_timer(task_alarm_id);
     task_timed_out = 0;
+    interpreter_interrupt.store(0, std::memory_order_relaxed);
 
     double lag_threshold = server_float_option("task_lag_threshold", DEFAULT_LAG_THRESHOLD);
     if (total_cputime.v.fnum >= lag_threshold && lag_threshold >= 0.1)
@@ -4007,7 +4089,9 @@ check_pc_validity(Program * prog, int which_vector, unsigned pc)
      */
     return (pc < bc->size
             && (bc->vector[pc - 1] == OP_CALL_VERB
-                || bc->vector[pc - 2] == OP_BI_FUNC_CALL));
+                || bc->vector[pc - 2] == OP_BI_FUNC_CALL
+                || (pc >= 4 && bc->vector[pc - 4] == OP_EXTENDED
+                    && bc->vector[pc - 3] == EOP_BI_FUNC_CALL_FAST)));
 }
 
 int
@@ -16,6 +16,9 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <string.h>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "structures.h"
 #include "bf_register.h"
 #include "functions.h"
@@ -28,7 +31,10 @@
 #include <unordered_map>
 #include "tasks.h"
 #include "log.h"
+#include "background.h"
+#include "execute.h"
 #include "fileio.h"
+#include "json.h"
 
 /******************************************************
  * Module-internal data structures
@@ -62,60 +68,91 @@ struct file_handle {
     file_type type;            /* text or binary, sir?     */
     file_mode mode;            /* readin', writin' or both */
     FILE  *file;               /* the actual file handle   */
+    char  busy;                /* in use by a background thread */
+    Num   hint_line;           /* lines before hint_offset, or -1 */
+    size_t hint_offset;
+    off_t hint_size;           /* the file as it was when the hint was taken */
+    time_t hint_mtime;
+    long  hint_mtime_nsec;
 };
 
-typedef struct line_buffer line_buffer;
-
-struct line_buffer {
-    char *line;
-    struct line_buffer *next;
-};
+#ifdef __MACH__
+#define ST_MTIME_NSEC(st)   ((st)->st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st)   ((st)->st_mtim.tv_nsec)
+#endif
 
 /***************************************************************
  * File <-> FHANDLE descriptor table interface
  ***************************************************************/
 
 
+/* The table is only changed on the main thread, but background threads
+ * release the handles they've been working on, so every access is locked. */
 static std::unordered_map <Num, file_handle> file_table;
+static std::mutex file_table_mutex;
 static Num next_handle = 1;
 
+/* Busy handles are being read or written by a background thread and can't
+ * be used until it's done. */
 static char file_handle_valid(Var fhandle) {
     if (fhandle.type != TYPE_INT)
         return 0;
     
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     
     if ((i < 0) || (i >= next_handle))
         return 0;
     
-    if (file_table.count(i) == 0)
+    auto it = file_table.find(i);
+    if (it == file_table.end())
         return 0;
     
-    return file_table[i].valid;
+    return it->second.valid && !it->second.busy;
+}
+
+static char file_handle_busy(Var fhandle) {
+    if (fhandle.type != TYPE_INT)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(file_table_mutex);
+    auto it = file_table.find(fhandle.v.num);
+    return it != file_table.end() && it->second.busy;
+}
+
+static void file_handle_set_busy(Num i, char busy) {
+    std::lock_guard<std::mutex> lock(file_table_mutex);
+    file_table[i].busy = busy;
 }
 
 static FILE *file_handle_file(Var fhandle) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     return file_table[i].file;
 }
 
 static const char *file_handle_name(Var fhandle) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     return file_table[i].name;
 }
 
 static file_type file_handle_type(Var fhandle) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     return file_table[i].type;
 }
 
 static file_mode file_handle_mode(Var fhandle) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     return file_table[i].mode;
 }
 
 static void file_handle_destroy(Var fhandle) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     free_str(file_table[i].name);
     file_table.erase(i);
     if (file_table.size() == 0)
@@ -130,6 +167,7 @@ static Num file_allocate_next_handle(void) {
 }
 
 static Var file_handle_new(const char *name, file_type type, file_mode mode) {
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     Num handle = file_allocate_next_handle();
 
     if (file_table.size() >= server_int_option("file_io_max_files", FILE_IO_MAX_FILES))
@@ -146,6 +184,8 @@ static Var file_handle_new(const char *name, file_type type, file_mode mode) {
         file.type = type;
         file.mode = mode;
         file.file = nullptr;
+        file.busy = 0;
+        file.hint_line = -1;
         file_table[handle] = file;
         next_handle++;
     }
@@ -155,9 +195,51 @@ static Var file_handle_new(const char *name, file_type type, file_mode mode) {
 
 static void file_handle_set_file(Var fhandle, FILE *f) {
     Num i = fhandle.v.num;
+    std::lock_guard<std::mutex> lock(file_table_mutex);
     file_table[i].file = f;
 }
 
+/*
+ * Each handle remembers where one line starts, so reading or searching a
+ * file a chunk at a time picks up where the last chunk left off instead of
+ * counting lines from the top again. The hint is dropped when the handle
+ * writes and ignored if the file's size or modification time has changed.
+ */
+
+static bool file_hint_matches(const file_handle &h, const struct stat *st) {
+    return h.hint_line >= 0
+           && h.hint_size == st->st_size
+           && h.hint_mtime == st->st_mtime
+           && h.hint_mtime_nsec == ST_MTIME_NSEC(st);
+}
+
+/* Move *line and *offset forward to the hint if it's no further than `want'. */
+static void file_handle_use_line_hint(Num i, const struct stat *st, Num want, Num *line, size_t *offset) {
+    std::lock_guard<std::mutex> lock(file_table_mutex);
+    const file_handle &h = file_table[i];
+
+    if (file_hint_matches(h, st) && h.hint_line > *line && h.hint_line <= want) {
+        *line = h.hint_line;
+        *offset = h.hint_offset;
+    }
+}
+
+static void file_handle_set_line_hint(Num i, const struct stat *st, Num line, size_t offset) {
+    std::lock_guard<std::mutex> lock(file_table_mutex);
+    file_handle &h = file_table[i];
+
+    h.hint_line = line;
+    h.hint_offset = offset;
+    h.hint_size = st->st_size;
+    h.hint_mtime = st->st_mtime;
+    h.hint_mtime_nsec = ST_MTIME_NSEC(st);
+}
+
+static void file_handle_forget_line_hint(Num i) {
+    std::lock_guard<std::mutex> lock(file_table_mutex);
+    file_table[i].hint_line = -1;
+}
+
 
 /***************************************************************
  * Interface for modestrings
@@ -252,6 +334,13 @@ static package file_raise_errno(const char *value_str) {
 
 }
 
+static package file_raise_badhandle(Var fhandle) {
+    if (file_handle_busy(fhandle))
+        return make_raise_pack(E_INVARG, "FHANDLE is in use by another task", var_ref(fhandle));
+    else
+        return make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+}
+
 static package file_raise_notokcall(const char *funcid, Objid progr) {
     return make_error_pack(E_PERM);
 }
@@ -335,6 +424,351 @@ const char *file_resolve_path(const char *pathname) {
 }
 
 
+/***************************************************************
+ * Per-task I/O limit
+ ***************************************************************/
+
+/* Bytes read and written so far by each task, checked against
+ * $server_options.file_io_max_bytes. Background threads add to the totals,
+ * so the map is locked. */
+static std::unordered_map<int, Num> task_io_bytes;
+static std::mutex task_io_mutex;
+
+/* How many more bytes the current task may read or write, or -1 if there's
+ * no limit. Only called on the main thread. */
+static Num file_io_budget(void) {
+    static size_t prune_at = 64;
+    const Num max = server_int_option("file_io_max_bytes", FILE_IO_MAX_BYTES);
+
+    if (max <= 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(task_io_mutex);
+
+    /* Forget tasks that have finished. */
+    if (task_io_bytes.size() > prune_at) {
+        for (auto it = task_io_bytes.begin(); it != task_io_bytes.end();) {
+            if (it->first != current_task_id && find_suspended_task(it->first) == nullptr)
+                it = task_io_bytes.erase(it);
+            else
+                it++;
+        }
+        prune_at = MAX(64, task_io_bytes.size() * 2);
+    }
+
+    auto it = task_io_bytes.find(current_task_id);
+    const Num used = (it == task_io_bytes.end() ? 0 : it->second);
+
+    return used >= max ? 0 : max - used;
+}
+
+static void file_io_charge(int task_id, Num bytes) {
+    std::lock_guard<std::mutex> lock(task_io_mutex);
+    task_io_bytes[task_id] += bytes;
+}
+
+static package file_raise_quota(void) {
+    return make_raise_pack(E_QUOTA, "File I/O limit exceeded", var_ref(zero));
+}
+
+
+/***************************************************************
+ * Reading whole files
+ ***************************************************************/
+
+/*
+ * Reads a file a line at a time with pread(), a chunk at a time, without
+ * moving the stream. A line is only valid until the next call; lines longer
+ * than a chunk grow the buffer to fit. The file is never mapped, since
+ * another process truncating it mid-scan would fault the thread scanning it.
+ */
+
+#define FILE_LINES_CHUNK (16 * FILE_IO_BUFFER_LENGTH)
+
+struct file_lines {
+    int fd = -1;
+    struct stat st;
+    std::string buffer;
+    size_t next = 0;            /* where the next line starts in buffer */
+    off_t buffer_offset = 0;    /* where buffer starts in the file */
+    bool eof = false;
+
+    /* The offset in the file of the next line. */
+    size_t tell() const { return buffer_offset + next; }
+};
+
+static bool file_lines_open(FILE *f, file_mode mode, file_lines *lines) {
+    if (mode & FILE_O_WRITE)
+        fflush(f);
+
+    lines->fd = fileno(f);
+    return fstat(lines->fd, &lines->st) == 0;
+}
+
+/*
+ * Point *line at the next line, newline included, and *len at its length.
+ * Returns false at the end of the file, or with errno set if a read failed.
+ */
+
+static bool file_lines_next(file_lines *lines, const char **line, size_t *len) {
+    std::string &buffer = lines->buffer;
+    size_t scanned = lines->next;
+
+    for (;;) {
+        const char *nl = (const char *)memchr(buffer.data() + scanned, '\n', buffer.size() - scanned);
+
+        if (nl || (lines->eof && lines->next < buffer.size())) {
+            *line = buffer.data() + lines->next;
+            *len = (nl ? nl + 1 : buffer.data() + buffer.size()) - *line;
+            lines->next += *len;
+            return true;
+        }
+        if (lines->eof)
+            return false;
+
+        /* Keep the partial line, then read the next chunk after it. */
+        buffer.erase(0, lines->next);
+        lines->buffer_offset += lines->next;
+        lines->next = 0;
+        scanned = buffer.size();
+
+        buffer.resize(scanned + FILE_LINES_CHUNK);
+        const ssize_t n = pread(lines->fd, &buffer[scanned], FILE_LINES_CHUNK, lines->buffer_offset + scanned);
+        buffer.resize(scanned + (n > 0 ? n : 0));
+        if (n < 0)
+            return false;
+        if (n == 0)
+            lines->eof = true;
+    }
+}
+
+/*
+ * Skip to the line after the first `want' lines, starting from `handle's
+ * hint if it's usable. *line is left short of `want' if the file doesn't
+ * have that many lines. Returns the offset scanning started from, or -1
+ * with errno set if a read failed.
+ */
+
+static off_t file_lines_seek(file_lines *lines, Num handle, Num want, Num *line) {
+    const char *text;
+    size_t len, offset = 0;
+
+    *line = 0;
+    file_handle_use_line_hint(handle, &lines->st, want, line, &offset);
+    lines->buffer_offset = offset;
+
+    errno = 0;
+    while (*line != want && file_lines_next(lines, &text, &len))
+        (*line)++;
+    return errno ? -1 : offset;
+}
+
+/*
+ * Read up to `want' bytes from the current position straight into `out'
+ * with pread(), bypassing stdio's buffer, and move the stream past them.
+ * Like fread(), a short read leaves the stream at end of file.
+ */
+
+static bool file_read_at_position(FILE *f, file_mode mode, size_t want, std::string *out) {
+    const int fd = fileno(f);
+    struct stat st;
+    off_t pos;
+
+    if (mode & FILE_O_WRITE)
+        fflush(f);
+
+    if ((pos = ftello(f)) < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        char buffer[FILE_IO_BUFFER_LENGTH];
+        size_t n;
+
+        errno = 0;
+        while (out->size() < want
+                && (n = fread(buffer, sizeof(char), MIN(sizeof(buffer), want - out->size()), f)) > 0)
+            out->append(buffer, n);
+        return !ferror(f);
+    }
+
+    const size_t available = (st.st_size > pos ? st.st_size - pos : 0);
+    size_t got = 0;
+    ssize_t n = 0;
+
+    out->resize(MIN(want, available));
+    while (got < out->size() && (n = pread(fd, &(*out)[got], out->size() - got, pos + got)) > 0)
+        got += n;
+    out->resize(got);
+
+    if (n < 0 || fseeko(f, pos + got, SEEK_SET) != 0)
+        return false;
+
+    if (got < want) {
+        /* Set the end-of-file indicator. */
+        int c = fgetc(f);
+        if (c != EOF)
+            ungetc(c, f);
+    }
+    errno = 0;
+    return true;
+}
+
+/* Convert raw bytes read from a file according to its type, using `s' as
+ * scratch space; the type's own filters share static buffers. */
+static Var file_filter_in(Stream *s, file_type type, const char *data, size_t len) {
+    if (type == file_type_binary)
+        stream_add_raw_bytes_to_binary(s, data, len);
+    else
+        stream_add_raw_bytes_to_clean(s, data, len);
+
+    return str_dup_to_var(reset_stream(s));
+}
+
+static Var file_line_to_var(Stream *s, file_type type, const char *line, size_t len) {
+#ifndef UNSAFE_FIO
+    return file_filter_in(s, type, line, len);
+#else
+    if (len > 0 && line[len - 1] == '\n')
+        len--;
+    stream_add_bytes(s, line, len);
+    return str_dup_to_var(reset_stream(s));
+#endif
+}
+
+
+/***************************************************************
+ * Background file I/O
+ ***************************************************************/
+
+/*
+ * Reading, writing, searching and listing can take a long time on large
+ * files, so those builtins hand the work to the background thread pool and
+ * suspend the task, unless threading has been disabled for the verb. The
+ * file handle is marked busy until the thread is done with it.
+ *
+ * A background thread can only resume the task with a value, so errors
+ * that happen in the work itself are returned as an error map, as the other
+ * threaded builtins do, whether or not the work was done in the background.
+ */
+
+struct file_io_request;
+typedef void (*file_io_op)(Var arglist, Var *ret, file_io_request *req);
+
+struct file_io_request {
+    file_io_op op;
+    Num handle;                 /* -1 for operations on pathnames */
+    FILE *file;
+    file_type type;
+    file_mode mode;
+    std::string data;           /* raw bytes to write, or a resolved pathname */
+    int task_id;
+    int embedded_types;         /* JSON mode, for the JSON functions */
+    int disable_binary_escapes;
+    int max_depth;
+    Num budget;                 /* bytes this call may transfer, or -1 */
+    Num transferred;
+    enum error error;           /* why file_write_json() stopped */
+};
+
+static void file_io_fail(Var *ret, enum error e, const char *msg) {
+    make_error_map(e, msg, ret);
+}
+
+static void file_io_fail_errno(Var *ret) {
+    file_io_fail(ret, E_FILE, errno ? strerror(errno) : "End of file");
+}
+
+static void file_io_fail_quota(Var *ret) {
+    file_io_fail(ret, E_QUOTA, "File I/O limit exceeded");
+}
+
+static void file_io_release(file_io_request *req) {
+    if (req->handle >= 0) {
+        file_handle_set_busy(req->handle, 0);
+        req->handle = -1;
+    }
+}
+
+static void file_io_callback(Var arglist, Var *ret, void *data) {
+    file_io_request *req = (file_io_request *)data;
+
+    errno = 0;
+    req->op(arglist, ret, req);
+
+    if (req->budget >= 0 && req->transferred > 0)
+        file_io_charge(req->task_id, req->transferred);
+
+    /* Before the task resumes, so it can use the handle again straight away. */
+    file_io_release(req);
+}
+
+static void file_io_request_free(void *data) {
+    file_io_request *req = (file_io_request *)data;
+
+    /* Still claimed if the thread never ran. */
+    file_io_release(req);
+    delete req;
+}
+
+static file_io_request *file_io_new_request(file_io_op op, package *r) {
+    const Num budget = file_io_budget();
+
+    if (budget == 0) {
+        *r = file_raise_quota();
+        return nullptr;
+    }
+
+    file_io_request *req = new file_io_request;
+    req->op = op;
+    req->handle = -1;
+    req->file = nullptr;
+    req->type = nullptr;
+    req->mode = 0;
+    req->task_id = current_task_id;
+    req->embedded_types = 0;
+    req->disable_binary_escapes = 0;
+    req->max_depth = 0;
+    req->budget = budget;
+    req->transferred = 0;
+    req->error = E_NONE;
+    return req;
+}
+
+/*
+ * Check that `fhandle' is open for `need' and claim it for `op'. Returns
+ * nullptr, with the error in *r, if it can't be used.
+ */
+
+static file_io_request *file_io_begin(Var fhandle, file_mode need, file_io_op op, package *r) {
+    FILE *f;
+    file_mode mode;
+
+    if ((f = file_handle_file_safe(fhandle)) == nullptr) {
+        *r = file_raise_badhandle(fhandle);
+        return nullptr;
+    } else if (!((mode = file_handle_mode(fhandle)) & need)) {
+        *r = make_raise_pack(E_INVARG, need == FILE_O_READ ? "File is open write-only" : "File is open read-only",
+                             var_ref(fhandle));
+        return nullptr;
+    }
+
+    file_io_request *req = file_io_new_request(op, r);
+    if (req == nullptr)
+        return nullptr;
+
+    req->handle = fhandle.v.num;
+    req->file = f;
+    req->type = file_handle_type(fhandle);
+    req->mode = mode;
+    file_handle_set_busy(req->handle, 1);
+
+    return req;
+}
+
+/* Run `req' in the background, or right away if threading is disabled.
+ * Takes ownership of `arglist'. */
+static package file_io_run(Var arglist, file_io_request *req) {
+    return background_thread(file_io_callback, &arglist, req, file_io_request_free);
+}
+
+
 /***************************************************************
  * Built in functions
 
@@ -398,7 +832,7 @@ bf_file_close(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr))
         r = file_raise_notokcall("file_close", progr);
     else if ((f = file_handle_file_safe(fhandle)) == nullptr)
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     else {
         fclose(f);
         file_handle_destroy(fhandle);
@@ -423,7 +857,7 @@ bf_file_name(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_name", progr);
     } else if ((name = file_handle_name_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else {
         rv.type = TYPE_STR;
         rv.v.str = str_dup(name);
@@ -446,7 +880,7 @@ bf_file_openmode(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_name", progr);
     } else if (!file_handle_valid(fhandle)) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else {
         type = file_handle_type(fhandle);
         mode = file_handle_mode(fhandle);
@@ -507,8 +941,45 @@ static const char *file_get_line(Var fhandle, int *count)
 
 /*
  * STR file_readline(FHANDLE handle)
+ * LIST file_readline(FHANDLE handle, INT count)
+ *
+ * With a count, up to that many lines are read from the current position,
+ * so a file can be worked through in chunks without holding all of it. At
+ * the end of the file the list is empty.
  */
 
+static void file_readline_op(Var arglist, Var *ret, file_io_request *req) {
+    const Num count = arglist.v.list[2].v.num;
+    std::vector<Var> lines;
+    char *line = nullptr;
+    size_t size = 0;
+    ssize_t len;
+    Stream *s = new_stream(100);
+
+    while ((Num)lines.size() < count && (len = getline(&line, &size, req->file)) != -1) {
+        req->transferred += len;
+        lines.push_back(file_line_to_var(s, req->type, line, len));
+        if (req->budget >= 0 && req->transferred > req->budget)
+            break;
+    }
+    free(line);
+    free_stream(s);
+
+    if (ferror(req->file) || (req->budget >= 0 && req->transferred > req->budget)) {
+        for (auto &v : lines)
+            free_var(v);
+        if (ferror(req->file))
+            file_io_fail_errno(ret);
+        else
+            file_io_fail_quota(ret);
+        return;
+    }
+
+    *ret = new_list(lines.size());
+    for (size_t i = 0; i < lines.size(); i++)
+        ret->v.list[i + 1] = lines[i];
+}
+
 static package
 bf_file_readline(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -518,19 +989,32 @@ bf_file_readline(Var arglist, Byte next, void *vdata, Objid progr)
     int len;
     file_mode mode;
     const char *line;
+    Num budget;
+    file_io_request *req;
 
     errno = 0;
 
-    if (!file_verify_caller(progr)) {
+    if (arglist.v.list[0].v.num > 1) {
+        if (arglist.v.list[2].v.num < 1)
+            r = make_error_pack(E_INVARG);
+        else if (!file_verify_caller(progr))
+            r = file_raise_notokcall("file_readline", progr);
+        else if ((req = file_io_begin(fhandle, FILE_O_READ, file_readline_op, &r)) != nullptr)
+            return file_io_run(arglist, req);
+    } else if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_readline", progr);
     } else if (!file_handle_valid(fhandle)) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else if (!((mode = file_handle_mode(fhandle)) & FILE_O_READ))
         r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
+    else if ((budget = file_io_budget()) == 0)
+        r = file_raise_quota();
     else {
         if ((line = file_get_line(fhandle, &len)) == nullptr)
             r = file_raise_errno("readline");
         else {
+            if (budget > 0)
+                file_io_charge(current_task_id, len);
             rv.type = TYPE_STR;
 #ifndef UNSAFE_FIO
             file_type type = file_handle_type(fhandle);
@@ -549,30 +1033,72 @@ bf_file_readline(Var arglist, Byte next, void *vdata, Objid progr)
 }
 
 /*
- * STR file_readlines(FHANDLE handle, INT start, INT end)
+ * LIST file_readlines(FHANDLE handle, INT start, INT end)
  */
 
-static void free_line_buffer(line_buffer *head, int strings_too) {
-    line_buffer *next;
-    if (head) {
-        next = head->next;
-        myfree(head, M_STRUCT);
-        head = next;
-        while (head != nullptr) {
-            next = head->next;
-            if (strings_too)
-                free_str(head->line);
-            myfree(head, M_STRUCT);
-            head = next;
-        }
+static void file_readlines_op(Var arglist, Var *ret, file_io_request *req) {
+    const Num begin = arglist.v.list[2].v.num - 1;
+    const Num end = arglist.v.list[3].v.num;
+    std::vector<Var> lines;
+    Num current_line = 0;
+    off_t scan_start;
+    file_lines file;
+    const char *line;
+    size_t len;
+
+    if (!file_lines_open(req->file, req->mode, &file)) {
+        file_io_fail_errno(ret);
+        return;
     }
-}
 
-static line_buffer *new_line_buffer(char *line) {
-    line_buffer *p = (line_buffer *)mymalloc(sizeof(line_buffer), M_STRUCT);
-    p->line = line;
-    p->next = nullptr;
-    return p;
+    /* "seek" to that line */
+    if ((scan_start = file_lines_seek(&file, req->handle, begin, &current_line)) < 0) {
+        file_io_fail_errno(ret);
+        return;
+    }
+    if (current_line != begin) {
+        errno = 0;
+        file_io_fail_errno(ret);
+        return;
+    }
+
+    /*
+     * now that we have where to begin, it's time to find the lines
+     * up to EOF or to the end_line, whichever comes first
+     */
+
+    const size_t begin_loc = file.tell();
+    Stream *s = new_stream(100);
+    errno = 0;
+    while (current_line != end && file_lines_next(&file, &line, &len)) {
+        lines.push_back(file_line_to_var(s, req->type, line, len));
+        current_line++;
+        if (req->budget >= 0 && (Num)(file.tell() - scan_start) > req->budget)
+            break;
+    }
+    free_stream(s);
+
+    *ret = new_list(lines.size());
+    for (size_t i = 0; i < lines.size(); i++)
+        ret->v.list[i + 1] = lines[i];
+
+    if (errno) {
+        free_var(*ret);
+        file_io_fail_errno(ret);
+        return;
+    }
+    if (req->budget >= 0 && (Num)(file.tell() - scan_start) > req->budget) {
+        free_var(*ret);
+        file_io_fail_quota(ret);
+        return;
+    }
+    req->transferred = file.tell() - scan_start;
+    file_handle_set_line_hint(req->handle, &file.st, current_line, file.tell());
+
+    if (fseeko(req->file, begin_loc, SEEK_SET) == -1) {
+        free_var(*ret);
+        file_io_fail_errno(ret);
+    }
 }
 
 static package
@@ -582,87 +1108,16 @@ bf_file_readlines(Var arglist, Byte next, void *vdata, Objid progr)
     Var fhandle = arglist.v.list[1];
     Num begin = arglist.v.list[2].v.num;
     Num end   = arglist.v.list[3].v.num;
-    Num begin_loc = 0, linecount = 0;
-    file_mode mode;
-    Var rv;
-    int current_line = 0, len = 0, i = 0;
-    const char *line = nullptr;
-    FILE *f;
-    line_buffer *linebuf_head = nullptr, *linebuf_cur = nullptr;
-
-    errno = 0;
+    file_io_request *req;
 
     if ((begin < 1) || (begin > end)) {
         free_var(arglist);
         return make_error_pack(E_INVARG);
     }
-    if (!file_verify_caller(progr)) {
+    if (!file_verify_caller(progr))
         r = file_raise_notokcall("file_readlines", progr);
-    } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
-    } else if (!((mode = file_handle_mode(fhandle)) & FILE_O_READ))
-        r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
-    else {
-#ifndef UNSAFE_FIO
-        file_type type = file_handle_type(fhandle); /* Quiet warning */
-#endif
-        /* Back to the beginning ... */
-        rewind(f);
-
-        /* "seek" to that line */
-        begin--;
-        while ((current_line != begin)
-                && ((line = file_get_line(fhandle, &len)) != nullptr))
-            current_line++;
-
-        if (((begin != 0) && (line == nullptr)) || ((begin_loc = ftell(f)) == -1))
-            r = file_raise_errno("read_line");
-        else {
-            /*
-             * now that we have where to begin, it's time to slurp lines
-             * and seek to EOF or to the end_line, whichever comes first
-             */
-
-            linebuf_head = linebuf_cur = new_line_buffer(nullptr);
-
-            while ((current_line != end)
-                    && ((line = file_get_line(fhandle, &len)) != nullptr)) {
-#ifndef UNSAFE_FIO
-                linebuf_cur->next = new_line_buffer(str_dup((type->in_filter)(line, len)));
-#else
-                /* For good reason, you can't modify a const char. But shh, we're doing it anyway. */
-                char *dirty_hack = (char*)line;
-                if (dirty_hack[len - 1] == '\n')
-                    dirty_hack[len - 1] = '\0';
-                else
-                    dirty_hack[len] = '\0';
-                linebuf_cur->next = new_line_buffer(str_dup(dirty_hack));
-#endif
-                linebuf_cur = linebuf_cur->next;
-
-                current_line++;
-            }
-            linecount =  current_line - begin;
-
-            linebuf_cur = linebuf_head->next;
-
-            if (fseek(f, begin_loc, SEEK_SET) == -1) {
-                free_line_buffer(linebuf_head, 1);
-                r = file_raise_errno("seeking");
-            } else {
-                rv = new_list(linecount);
-                i = 1;
-                while (linebuf_cur != nullptr) {
-                    rv.v.list[i].type = TYPE_STR;
-                    rv.v.list[i].v.str = linebuf_cur->line;
-                    linebuf_cur = linebuf_cur->next;
-                    i++;
-                }
-                free_line_buffer(linebuf_head, 0);
-                r = make_var_pack(rv);
-            }
-        }
-    }
+    else if ((req = file_io_begin(fhandle, FILE_O_READ, file_readlines_op, &r)) != nullptr)
+        return file_io_run(arglist, req);
 
     free_var(arglist);
     return r;
@@ -683,25 +1138,31 @@ bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
     file_type type;
     int len;
     FILE *f;
+    Num budget;
 
     errno = 0;
 
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_writeline", progr);
     } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else if (!((mode = file_handle_mode(fhandle)) & FILE_O_WRITE))
         r = make_raise_pack(E_INVARG, "File is open read-only", var_ref(fhandle));
     else {
         type = file_handle_type(fhandle);
         if ((rawbuffer = (type->out_filter)(buffer, &len)) == nullptr)
             r = make_raise_pack(E_INVARG, "Invalid binary string", var_ref(fhandle));
+        else if ((budget = file_io_budget()) == 0 || (budget > 0 && len + 1 > budget))
+            r = file_raise_quota();
         else if ((fputs(rawbuffer, f) == EOF) || (fputc('\n', f) != '\n'))
             r = file_raise_errno(file_handle_name(fhandle));
         else {
             if (mode & FILE_O_FLUSH) {
                 fflush(f);
             }
+            if (budget > 0)
+                file_io_charge(current_task_id, len + 1);
+            file_handle_forget_line_hint(fhandle.v.num);
             r = no_var_pack();
         }
     }
@@ -717,73 +1178,50 @@ bf_file_writeline(Var arglist, Byte next, void *vdata, Objid progr)
  * STR file_read(FHANDLE handle, INT record_length)
  */
 
-static package
-bf_file_read(Var arglist, Byte next, void *vdata, Objid progr)
-{
-    package r;
-
-    Var fhandle = arglist.v.list[1];
-    file_mode mode;
-    file_type type;
-    Num record_length = arglist.v.list[2].v.num;
-    Num read_length;
-
-    char buffer[FILE_IO_BUFFER_LENGTH];
-
-    Var rv;
+static void file_read_op(Var arglist, Var *ret, file_io_request *req) {
+    const Num record_length = arglist.v.list[2].v.num;
+    std::string buffer;
 
-    static Stream *str = nullptr;
-    int len = 0, read = 0;
+    if (req->budget >= 0 && record_length > req->budget) {
+        file_io_fail_quota(ret);
+        return;
+    }
 
-    FILE *f;
+    if (record_length <= FILE_IO_BUFFER_LENGTH) {
+        buffer.resize(MAX(record_length, 0));
+        buffer.resize(fread(&buffer[0], sizeof(char), buffer.size(), req->file));
+    } else if (!file_read_at_position(req->file, req->mode, record_length, &buffer)) {
+        file_io_fail_errno(ret);
+        return;
+    }
 
-    errno = 0;
+    if (buffer.empty()) {
+        /*
+         * No more to read.  This is only an error if nothing
+         * has been read so far.
+         */
+        file_io_fail_errno(ret);
+        return;
+    }
+    req->transferred = buffer.size();
 
-    read_length = (record_length > sizeof(buffer)) ? sizeof(buffer) : record_length;
+    Stream *s = new_stream(buffer.size() + 1);
+    *ret = file_filter_in(s, req->type, buffer.data(), buffer.size());
+    free_stream(s);
+}
 
-    if (str == nullptr)
-        str = new_stream(FILE_IO_BUFFER_LENGTH);
+static package
+bf_file_read(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    package r;
+    Var fhandle = arglist.v.list[1];
+    file_io_request *req;
 
-    if (!file_verify_caller(progr)) {
+    if (!file_verify_caller(progr))
         r = file_raise_notokcall("file_read", progr);
-    } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
-    } else if (!((mode = file_handle_mode(fhandle)) & FILE_O_READ))
-        r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
-    else {
-        type = file_handle_type(fhandle);
+    else if ((req = file_io_begin(fhandle, FILE_O_READ, file_read_op, &r)) != nullptr)
+        return file_io_run(arglist, req);
 
-try_again:
-        read = fread(buffer, sizeof(char), MIN(read_length, (record_length - len)), f);
-        if (!read && !len) {
-            /*
-             * No more to read.  This is only an error if nothing
-             * has been read so far.
-             *
-             */
-            r = file_raise_errno(file_handle_name(fhandle));
-        } else if (read && ((len += read) < record_length)) {
-            /*
-             * We got something this time, but it isn't enough.
-             */
-            stream_add_string(str, (type->in_filter)(buffer, read));
-            read = 0;
-            goto try_again;
-        } else {
-            /*
-             * We didn't get anything last time, but we have something already
-             * OR
-             * We got everything we need.
-             */
-
-            stream_add_string(str, (type->in_filter)(buffer, read));
-
-            rv.type = TYPE_STR;
-            rv.v.str = str_dup(reset_stream(str));
-
-            r = make_var_pack(rv);
-        }
-    }
     free_var(arglist);
     return r;
 }
@@ -804,7 +1242,7 @@ bf_file_flush(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_flush", progr);
     } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else {
         if (fflush(f))
             r = file_raise_errno("flushing");
@@ -820,41 +1258,47 @@ bf_file_flush(Var arglist, Byte next, void *vdata, Objid progr)
  * INT file_write(FHANDLE fh, STR data)
  */
 
+static void file_write_op(Var arglist, Var *ret, file_io_request *req) {
+    const size_t written = fwrite(req->data.data(), sizeof(char), req->data.size(), req->file);
+
+    file_handle_forget_line_hint(req->handle);
+
+    if (!written) {
+        file_io_fail_errno(ret);
+        return;
+    }
+    if (req->mode & FILE_O_FLUSH)
+        fflush(req->file);
+
+    req->transferred = written;
+    *ret = Var::new_int(written);
+}
+
 static package
 bf_file_write(Var arglist, Byte next, void *vdata, Objid progr)
 {
     package r;
-    Var fhandle = arglist.v.list[1], rv;
+    Var fhandle = arglist.v.list[1];
     const char *buffer = arglist.v.list[2].v.str;
     const char *rawbuffer;
-    file_mode mode;
-    file_type type;
+    file_io_request *req;
     int len;
-    int written;
-    FILE *f;
 
-    errno = 0;
-
-    if (!file_verify_caller(progr)) {
+    if (!file_verify_caller(progr))
         r = file_raise_notokcall("file_write", progr);
-    } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
-    } else if (!((mode = file_handle_mode(fhandle)) & FILE_O_WRITE))
-        r = make_raise_pack(E_INVARG, "File is open read-only", var_ref(fhandle));
-    else {
-        type = file_handle_type(fhandle);
-        if ((rawbuffer = (type->out_filter)(buffer, &len)) == nullptr)
+    else if ((req = file_io_begin(fhandle, FILE_O_WRITE, file_write_op, &r)) != nullptr) {
+        /* The filters share static buffers, so convert before handing off. */
+        if ((rawbuffer = (req->type->out_filter)(buffer, &len)) == nullptr)
             r = make_raise_pack(E_INVARG, "Invalid binary string", var_ref(fhandle));
-        else if (!(written = fwrite(rawbuffer, sizeof(char), len, f)))
-            r = file_raise_errno(file_handle_name(fhandle));
+        else if (req->budget >= 0 && len > req->budget)
+            r = file_raise_quota();
         else {
-            if (mode & FILE_O_FLUSH)
-                fflush(f);
-            rv.type = TYPE_INT;
-            rv.v.num = written;
-            r = make_var_pack(rv);
+            req->data.assign(rawbuffer, len);
+            return file_io_run(arglist, req);
         }
+        file_io_request_free(req);
     }
+
     free_var(arglist);
     return r;
 }
@@ -893,7 +1337,7 @@ bf_file_seek(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_seek", progr);
     } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else if (!whence_ok) {
         r = make_raise_pack(E_INVARG, "Invalid whence", zero);
     } else {
@@ -923,7 +1367,7 @@ bf_file_tell(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_tell", progr);
     } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else {
         rv.type = TYPE_INT;
         if ((rv.v.num = ftell(f)) < 0)
@@ -952,7 +1396,7 @@ bf_file_eof(Var arglist, Byte next, void *vdata, Objid progr)
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_eof", progr);
     } else if ((f = file_handle_file_safe(fhandle)) == nullptr) {
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
+        r = file_raise_badhandle(fhandle);
     } else {
         rv.type = TYPE_INT;
         rv.v.num = feof(f);
@@ -991,7 +1435,7 @@ static int file_stat(Objid progr, Var filespec, package *r, struct stat *buf) {
     } else {
         FILE *f;
         if ((f = file_handle_file_safe(filespec)) == nullptr)
-            * r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(filespec));
+            *r = file_raise_badhandle(filespec);
         else {
             if (fstat(fileno(f), buf) != 0)
                 *r = file_raise_errno(file_handle_name(filespec));
@@ -1019,7 +1463,7 @@ static const char *file_type_string(mode_t st_mode) {
 }
 
 static const char *file_mode_string(mode_t st_mode) {
-    static Stream *s = nullptr;
+    static thread_local Stream *s = nullptr;
     if (!s)
         s = new_stream(4);
     stream_printf(s, "%03o", st_mode & 0777);
@@ -1215,6 +1659,59 @@ static int file_list_select(const struct dirent *d) {
         return 1;
 }
 
+static void file_list_op(Var arglist, Var *ret, file_io_request *req) {
+    const int detailed = (arglist.v.list[0].v.num > 1
+                          ? is_true(arglist.v.list[2])
+                          : 0);
+    const char *real_pathname = req->data.c_str();
+    DIR *curdir;
+    Stream *s = new_stream(64);
+    int failed = 0;
+    struct stat buf;
+    Var     rv, detail;
+    struct dirent *curfile;
+
+    if (!(curdir = opendir (real_pathname)))
+        file_io_fail_errno(ret);
+    else {
+        rv = new_list(0);
+        while ( (curfile = readdir(curdir)) != nullptr ) {
+            if (strncmp(curfile->d_name, ".", 2) != 0 && strncmp(curfile->d_name, "..", 3) != 0) {
+                if (detailed) {
+                    stream_add_string(s, real_pathname);
+                    stream_add_char(s, '/');
+                    stream_add_string(s, curfile->d_name);
+                    if (stat(reset_stream(s), &buf) != 0) {
+                        failed = 1;
+                        break;
+                    } else {
+                        detail = new_list(4);
+                        detail.v.list[1].type = TYPE_STR;
+                        detail.v.list[1].v.str = str_dup(curfile->d_name);
+                        detail.v.list[2].type = TYPE_STR;
+                        detail.v.list[2].v.str = str_dup(file_type_string(buf.st_mode));
+                        detail.v.list[3].type = TYPE_STR;
+                        detail.v.list[3].v.str = str_dup(file_mode_string(buf.st_mode));
+                        detail.v.list[4].type = TYPE_INT;
+                        detail.v.list[4].v.num = buf.st_size;
+                    }
+                } else {
+                    detail.type = TYPE_STR;
+                    detail.v.str = str_dup(curfile->d_name);
+                }
+                rv = listappend(rv, detail);
+            }
+        }
+        if (failed) {
+            free_var(rv);
+            file_io_fail_errno(ret);
+        } else
+            *ret = rv;
+        closedir(curdir);
+    }
+    free_stream(s);
+}
+
 static package
 bf_file_list(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -1224,61 +1721,15 @@ bf_file_list(Var arglist, Byte next, void *vdata, Objid progr)
     package r;
     const char *pathspec = arglist.v.list[1].v.str;
     const char *real_pathname;
-    int   detailed = (arglist.v.list[0].v.num > 1
-                      ? is_true(arglist.v.list[2])
-                      : 0);
+    file_io_request *req;
 
     if (!file_verify_caller(progr)) {
         r = file_raise_notokcall("file_list", progr);
     } else if ((real_pathname = file_resolve_path(pathspec)) == nullptr) {
         r =  file_raise_notokfilename("file_list", pathspec);
-    } else {
-        DIR *curdir;
-        Stream *s = new_stream(64);
-        int failed = 0;
-        struct stat buf;
-        Var     rv, detail;
-        struct dirent *curfile;
-
-        if (!(curdir = opendir (real_pathname)))
-            r = file_raise_errno(pathspec);
-        else {
-            rv = new_list(0);
-            while ( (curfile = readdir(curdir)) != nullptr ) {
-                if (strncmp(curfile->d_name, ".", 2) != 0 && strncmp(curfile->d_name, "..", 3) != 0) {
-                    if (detailed) {
-                        stream_add_string(s, real_pathname);
-                        stream_add_char(s, '/');
-                        stream_add_string(s, curfile->d_name);
-                        if (stat(reset_stream(s), &buf) != 0) {
-                            failed = 1;
-                            break;
-                        } else {
-                            detail = new_list(4);
-                            detail.v.list[1].type = TYPE_STR;
-                            detail.v.list[1].v.str = str_dup(curfile->d_name);
-                            detail.v.list[2].type = TYPE_STR;
-                            detail.v.list[2].v.str = str_dup(file_type_string(buf.st_mode));
-                            detail.v.list[3].type = TYPE_STR;
-                            detail.v.list[3].v.str = str_dup(file_mode_string(buf.st_mode));
-                            detail.v.list[4].type = TYPE_INT;
-                            detail.v.list[4].v.num = buf.st_size;
-                        }
-                    } else {
-                        detail.type = TYPE_STR;
-                        detail.v.str = str_dup(curfile->d_name);
-                    }
-                    rv = listappend(rv, detail);
-                }
-            }
-            if (failed) {
-                free_var(rv);
-                r = file_raise_errno(pathspec);
-            } else
-                r = make_var_pack(rv);
-            closedir(curdir);
-        }
-        free_stream(s);
+    } else if ((req = file_io_new_request(file_list_op, &r)) != nullptr) {
+        req->data = real_pathname;
+        return file_io_run(arglist, req);
     }
     free_var(arglist);
     return r;
@@ -1466,100 +1917,343 @@ static package bf_file_handles(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+/*
+ * LIST file_grep(FHANDLE handle, STR search [, INT all [, INT start [, INT limit]]])
+ *
+ * Searching can begin at line `start' and, when `all' is true, stop after
+ * `limit' matches, so a large file can be searched a chunk at a time by
+ * starting each call on the line after the last match.
+ */
+
+static void file_grep_op(Var arglist, Var *ret, file_io_request *req) {
+    const int nargs = arglist.v.list[0].v.num;
+    const char *needle = arglist.v.list[2].v.str;
+    const int needle_len = memo_strlen(needle);
+    const bool match_all = nargs >= 3 && is_true(arglist.v.list[3]);
+    const Num start = (nargs >= 4 ? arglist.v.list[4].v.num : 1);
+    const size_t limit = (!match_all ? 1 : nargs >= 5 ? arglist.v.list[5].v.num : 0);
+    std::vector<std::string> matches;
+    std::vector<Num> line_nums;
+    Num line_num = 0;
+    off_t scan_start;
+    file_lines file;
+    const char *line;
+    size_t len;
+
+    if (!file_lines_open(req->file, req->mode, &file)
+            || (scan_start = file_lines_seek(&file, req->handle, start - 1, &line_num)) < 0) {
+        file_io_fail_errno(ret);
+        return;
+    }
+
+    errno = 0;
+    while (file_lines_next(&file, &line, &len)) {
+        line_num++;
+
+        if (strindex(line, len, needle, needle_len, 0)) {
+            if (line[len - 1] == '\n')
+                len--;
+            matches.emplace_back(line, len);
+            line_nums.push_back(line_num);
+
+            if (matches.size() == limit)
+                break;
+        }
+        if (req->budget >= 0 && (Num)(file.tell() - scan_start) > req->budget)
+            break;
+    }
+
+    if (errno) {
+        file_io_fail_errno(ret);
+        return;
+    }
+    if (req->budget >= 0 && (Num)(file.tell() - scan_start) > req->budget) {
+        file_io_fail_quota(ret);
+        return;
+    }
+    req->transferred = file.tell() - scan_start;
+    file_handle_set_line_hint(req->handle, &file.st, line_num, file.tell());
+    fseeko(req->file, file.tell(), SEEK_SET);
+
+    *ret = new_list(matches.size());
+    for (size_t i = 0; i < matches.size(); i++) {
+        Var match = new_list(2);
+        match.v.list[1] = str_dup_to_var(matches[i].c_str());
+        match.v.list[2] = Var::new_int(line_nums[i]);
+        ret->v.list[i + 1] = match;
+    }
+}
+
 static package
 bf_file_grep(Var arglist, Byte next, void *vdata, Objid progr)
 {
     package r;
     Var fhandle = arglist.v.list[1];
-    int len;
-    file_mode mode;
-    const char *line = nullptr;
-    int line_num = 0;
-    int match_all = 0;
-    int arg_length = 0;
-    Var ret, tmp, tmp_name, tmp_num;
+    const int nargs = arglist.v.list[0].v.num;
+    file_io_request *req;
 
-    if (!file_verify_caller(progr))
-        r = file_raise_notokcall("file_readline", progr);
-    else if (!file_handle_valid(fhandle))
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
-    else if (!((mode = file_handle_mode(fhandle)) & FILE_O_READ))
-        r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
-    else
-    {
-        tmp_name.type = TYPE_STR;
-        tmp_num.type = TYPE_INT;
-        arg_length = memo_strlen(arglist.v.list[2].v.str);
-        ret = new_list(0);
-
-        if (arglist.v.list[0].v.num >= 3 && is_true(arglist.v.list[3]))
-            match_all = 1;
-
-        rewind(file_handle_file_safe(fhandle));
-
-        while ((line = file_get_line(fhandle, &len)) != nullptr)
-        {
-            line_num++;
-            if (len > 0 && strindex(line, len, arglist.v.list[2].v.str, arg_length, 0))
-            {
-                tmp = new_list(0);
-                // Have to get rid of the newline, woops
-//        line[strcspn(line, "\r\n")] = 0;
-                // strcspn is more elegant but slower
-                /* For good reason, you can't modify a const char. But shh, we're doing it anyway. */
-                char *dirty_hack = (char*)line;
-                dirty_hack[strlen(dirty_hack) - 1] = '\0';
-                tmp_name.v.str = str_dup(dirty_hack);
-                tmp = listappend(tmp, tmp_name);
-                tmp_num.v.num = line_num;
-                tmp = listappend(tmp, tmp_num);
-                ret = listappend(ret, tmp);
-
-                if (!match_all)
-                    break;
-            }
-        }
-        r = make_var_pack(ret);
+    if ((nargs >= 4 && arglist.v.list[4].v.num < 1) || (nargs >= 5 && arglist.v.list[5].v.num < 0)) {
+        free_var(arglist);
+        return make_error_pack(E_INVARG);
     }
+
+    if (!file_verify_caller(progr))
+        r = file_raise_notokcall("file_grep", progr);
+    else if ((req = file_io_begin(fhandle, FILE_O_READ, file_grep_op, &r)) != nullptr)
+        return file_io_run(arglist, req);
+
     free_var(arglist);
     return r;
 }
 
 /*
- * STR file_count_lines(FHANDLE handle)
+ * INT file_count_lines(FHANDLE handle)
  */
 
+static void file_count_lines_op(Var arglist, Var *ret, file_io_request *req) {
+    file_lines file;
+    Num count = 0;
+    const char *line;
+    size_t len;
+
+    if (!file_lines_open(req->file, req->mode, &file)) {
+        file_io_fail_errno(ret);
+        return;
+    }
+
+    if (req->budget >= 0 && (Num)file.st.st_size > req->budget) {
+        file_io_fail_quota(ret);
+        return;
+    }
+
+    errno = 0;
+    while (file_lines_next(&file, &line, &len))
+        count++;
+    if (errno) {
+        file_io_fail_errno(ret);
+        return;
+    }
+
+    req->transferred = file.tell();
+    fseeko(req->file, file.tell(), SEEK_SET);
+    *ret = Var::new_int(count);
+}
+
 static package
 bf_file_count_lines(Var arglist, Byte next, void *vdata, Objid progr)
 {
     package r;
     Var fhandle = arglist.v.list[1];
-    free_var(arglist);
-    file_mode mode;
-    Var rv;
+    file_io_request *req;
 
     if (!file_verify_caller(progr))
-        r = file_raise_notokcall("file_readline", progr);
-    else if (!file_handle_valid(fhandle))
-        r = make_raise_pack(E_INVARG, "Invalid FHANDLE", var_ref(fhandle));
-    else if (!((mode = file_handle_mode(fhandle)) & FILE_O_READ))
-        r = make_raise_pack(E_INVARG, "File is open write-only", var_ref(fhandle));
+        r = file_raise_notokcall("file_count_lines", progr);
+    else if ((req = file_io_begin(fhandle, FILE_O_READ, file_count_lines_op, &r)) != nullptr)
+        return file_io_run(arglist, req);
+
+    free_var(arglist);
+    return r;
+}
+
+/************************************************************************
+ * JSON i/o
+ *
+ * Documents are generated straight into the file and parsed as they're
+ * read, JSON_CHUNK_SIZE bytes at a time, so neither the text nor a copy
+ * of it is ever held in memory as a whole. The text is written and read
+ * as is, whether the file was opened in text or binary mode.
+ ************************************************************************/
+
+static int file_json_mode(Var arglist, int arg, int *embedded_types) {
+    if (arglist.v.list[0].v.num < arg)
+        *embedded_types = 0;
+    else if (!strcasecmp(arglist.v.list[arg].v.str, "common-subset"))
+        *embedded_types = 0;
+    else if (!strcasecmp(arglist.v.list[arg].v.str, "embedded-types"))
+        *embedded_types = 1;
     else
-    {
-        int throwaway = 0;
-        FILE *fp = file_handle_file_safe(fhandle);
+        return 0;
+    return 1;
+}
 
-        rewind(fp);
+/*
+ * INT file_write_json(FHANDLE handle, ANY value [, STR mode [, INT disable-binary-escapes]])
+ *
+ * Writes `value' as a JSON document followed by a newline, and returns the
+ * number of bytes written. Documents written one after another can be read
+ * back one at a time with file_read_json().
+ */
 
-        long count = 0;
-        while (file_get_line(fhandle, &throwaway) != nullptr)
-            count++;
+static int file_write_json_sink(void *data, const char *bytes, size_t len) {
+    file_io_request *req = (file_io_request *)data;
 
-        rv.type = TYPE_INT;
-        rv.v.num = count;
-        r = make_var_pack(rv);
+    if (req->budget >= 0 && req->transferred + (Num)len > req->budget) {
+        req->error = E_QUOTA;
+        return 0;
+    }
+    if (fwrite(bytes, sizeof(char), len, req->file) != len) {
+        req->error = E_FILE;
+        return 0;
     }
+    req->transferred += len;
+    return 1;
+}
+
+static void file_write_json_op(Var arglist, Var *ret, file_io_request *req) {
+    file_handle_forget_line_hint(req->handle);
+
+    if (!json_generate_chunked(arglist.v.list[2], req->embedded_types, req->disable_binary_escapes,
+                               file_write_json_sink, req)
+            || !file_write_json_sink(req, "\n", 1)) {
+        if (req->error == E_QUOTA)
+            file_io_fail_quota(ret);
+        else if (req->error == E_FILE)
+            file_io_fail_errno(ret);
+        else
+            file_io_fail(ret, E_INVARG, "Value can't be represented as JSON");
+        return;
+    }
+    if (req->mode & FILE_O_FLUSH)
+        fflush(req->file);
+
+    *ret = Var::new_int(req->transferred);
+}
+
+static package
+bf_file_write_json(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    package r;
+    Var fhandle = arglist.v.list[1];
+    file_io_request *req;
+    int embedded_types;
+
+    if (!file_verify_caller(progr))
+        r = file_raise_notokcall("file_write_json", progr);
+    else if (!file_json_mode(arglist, 3, &embedded_types))
+        r = make_raise_pack(E_INVARG, "Invalid JSON mode", var_ref(arglist.v.list[3]));
+    else if ((req = file_io_begin(fhandle, FILE_O_WRITE, file_write_json_op, &r)) != nullptr) {
+        req->embedded_types = embedded_types;
+        req->disable_binary_escapes = arglist.v.list[0].v.num >= 4 && is_true(arglist.v.list[4]);
+        return file_io_run(arglist, req);
+    }
+
+    free_var(arglist);
+    return r;
+}
+
+/*
+ * LIST file_read_json(FHANDLE handle [, STR mode [, INT count]])
+ *
+ * Reads up to `count' (by default one) JSON documents from the current
+ * position and returns them in a list, which is empty at the end of the
+ * file. The position is left just after the last document read.
+ */
+
+static void file_read_json_op(Var arglist, Var *ret, file_io_request *req) {
+    const Num count = arglist.v.list[0].v.num >= 3 ? arglist.v.list[3].v.num : 1;
+    std::vector<Var> values;
+    char buffer[JSON_CHUNK_SIZE];
+    size_t length = 0, offset = 0;
+    json_parser *parser = nullptr;
+    bool started = false, invalid = false;
+
+    while ((Num)values.size() < count) {
+        if (offset == length) {
+            if ((length = fread(buffer, sizeof(char), sizeof(buffer), req->file)) == 0)
+                break;
+            offset = 0;
+        }
 
+        /* Skip whitespace between documents, so a parser is only started
+         * for a document that's really there. */
+        if (!started) {
+            while (offset < length && isspace((unsigned char)buffer[offset]))
+                offset++;
+            req->transferred += offset;
+            if (offset == length)
+                continue;
+            parser = json_parser_new(req->embedded_types, req->max_depth, 0);
+            started = true;
+        }
+
+        const size_t piece = length - offset;
+        if (!json_parser_feed(parser, buffer + offset, piece)) {
+            invalid = true;
+            break;
+        }
+        const size_t unconsumed = json_parser_unconsumed(parser);
+        req->transferred += piece - unconsumed;
+        offset = length - unconsumed;
+
+        if (unconsumed > 0) {
+            Var v;
+            if (!json_parser_finish(parser, &v)) {
+                invalid = true;
+                break;
+            }
+            values.push_back(v);
+            json_parser_free(parser);
+            parser = nullptr;
+            started = false;
+        }
+
+        if (req->budget >= 0 && req->transferred > req->budget)
+            break;
+    }
+
+    /* A document that runs to the end of the file. */
+    if (!invalid && started && (Num)values.size() < count && !ferror(req->file)) {
+        Var v;
+        if (json_parser_finish(parser, &v))
+            values.push_back(v);
+        else
+            invalid = true;
+    }
+    if (parser)
+        json_parser_free(parser);
+
+    /* Give back what was read past the last document. */
+    if (offset < length)
+        fseeko(req->file, -(off_t)(length - offset), SEEK_CUR);
+
+    if (invalid || ferror(req->file) || (req->budget >= 0 && req->transferred > req->budget)) {
+        for (auto &v : values)
+            free_var(v);
+        if (ferror(req->file))
+            file_io_fail_errno(ret);
+        else if (invalid)
+            file_io_fail(ret, E_INVARG, "Invalid JSON");
+        else
+            file_io_fail_quota(ret);
+        return;
+    }
+
+    *ret = new_list(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        ret->v.list[i + 1] = values[i];
+}
+
+static package
+bf_file_read_json(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    package r;
+    Var fhandle = arglist.v.list[1];
+    file_io_request *req;
+    int embedded_types;
+
+    if (!file_verify_caller(progr))
+        r = file_raise_notokcall("file_read_json", progr);
+    else if (!file_json_mode(arglist, 2, &embedded_types))
+        r = make_raise_pack(E_INVARG, "Invalid JSON mode", var_ref(arglist.v.list[2]));
+    else if (arglist.v.list[0].v.num >= 3 && arglist.v.list[3].v.num < 1)
+        r = make_raise_pack(E_INVARG, "Count must be positive", var_ref(arglist.v.list[3]));
+    else if ((req = file_io_begin(fhandle, FILE_O_READ, file_read_json_op, &r)) != nullptr) {
+        req->embedded_types = embedded_types;
+        req->max_depth = server_int_option("json_max_parse_depth", JSON_MAX_PARSE_DEPTH);
+        return file_io_run(arglist, req);
+    }
+
+    free_var(arglist);
     return r;
 }
 
@@ -1578,10 +2272,10 @@ register_fileio(void)
     register_function("file_openmode", 1, 1, bf_file_openmode, TYPE_INT);
 
 
-    register_function("file_readline", 1, 1, bf_file_readline, TYPE_INT);
+    register_function("file_readline", 1, 2, bf_file_readline, TYPE_INT, TYPE_INT);
     register_function("file_readlines", 3, 3, bf_file_readlines, TYPE_INT, TYPE_INT, TYPE_INT);
     register_function("file_writeline", 2, 2, bf_file_writeline, TYPE_INT, TYPE_STR);
-    register_function("file_grep", 2, 3, bf_file_grep, TYPE_INT, TYPE_STR, TYPE_INT);
+    register_function("file_grep", 2, 5, bf_file_grep, TYPE_INT, TYPE_STR, TYPE_INT, TYPE_INT, TYPE_INT);
 
     register_function("file_read", 2, 2, bf_file_read, TYPE_INT, TYPE_INT);
     register_function("file_write", 2, 2, bf_file_write, TYPE_INT, TYPE_STR);
@@ -1594,6 +2288,9 @@ register_fileio(void)
     register_function("file_eof", 1, 1, bf_file_eof, TYPE_INT);
     register_function("file_count_lines", 1, 1, bf_file_count_lines, TYPE_INT);
 
+    register_function("file_read_json", 1, 3, bf_file_read_json, TYPE_INT, TYPE_STR, TYPE_INT);
+    register_function("file_write_json", 2, 4, bf_file_write_json, TYPE_INT, TYPE_ANY, TYPE_STR, TYPE_ANY);
+
     register_function("file_list", 1, 2, bf_file_list, TYPE_STR, TYPE_ANY);
     register_function("file_mkdir", 1, 1, bf_file_mkdir, TYPE_STR);
     register_function("file_rmdir", 1, 1, bf_file_rmdir, TYPE_STR);
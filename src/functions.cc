@@ -16,7 +16,11 @@
  *****************************************************************************/
 
 #include <stdarg.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
+#include "background.h"
 #include "bf_register.h"
 #include "config.h"
 #include "db_io.h"
@@ -28,6 +32,7 @@
 #include "storage.h"
 #include "streams.h"
 #include "structures.h"
+#include "tasks.h"
 #include "unparse.h"
 #include "utils.h"
 
@@ -69,8 +74,11 @@ static registry bi_function_registries[] =
     register_crypto,
     register_sqlite,
     register_pcre,
+    register_regex_cache,
+    register_program_cache,
     register_background,
     register_waif,
+    register_profiler,
     register_simplexnoise,
     register_argon2,
     register_spellcheck,
@@ -89,6 +97,22 @@ register_bi_functions()
 
 /*** register ***/
 
+#ifdef FUNCTION_STATS
+/* Call times are counted in buckets of under 1us, 10us, 100us, 1ms, 10ms,
+ * 100ms and the rest.
+ */
+#define BF_TIME_BUCKETS 7
+
+struct bf_stats {
+    Num calls;
+    Num errors;
+    Num threaded;               /* handed off to a background thread */
+    double seconds;             /* only while function_timing is set */
+    double max_seconds;
+    Num times[BF_TIME_BUCKETS];
+};
+#endif
+
 struct bft_entry {
     const char *name;
     const char *protect_str;
@@ -97,9 +121,13 @@ struct bft_entry {
     int maxargs;
     var_type *prototype;
     bf_type func;
+    bf_fast_type fast;
     bf_read_type read;
     bf_write_type write;
     int _protected;
+#ifdef FUNCTION_STATS
+    struct bf_stats stats;
+#endif
 };
 
 static struct bft_entry bf_table[MAX_FUNC];
@@ -107,7 +135,8 @@ static unsigned top_bf_table = 0;
 
 static unsigned
 register_common(const char *name, int minargs, int maxargs, bf_type func,
-                bf_read_type read, bf_write_type write, va_list args)
+                bf_fast_type fast, bf_read_type read, bf_write_type write,
+                va_list args)
 {
     int va_index;
     int num_arg_types = maxargs == -1 ? minargs : maxargs;
@@ -128,6 +157,7 @@ register_common(const char *name, int minargs, int maxargs, bf_type func,
     bf_table[top_bf_table].minargs = minargs;
     bf_table[top_bf_table].maxargs = maxargs;
     bf_table[top_bf_table].func = func;
+    bf_table[top_bf_table].fast = fast;
     bf_table[top_bf_table].read = read;
     bf_table[top_bf_table].write = write;
     bf_table[top_bf_table]._protected = 0;
@@ -151,7 +181,7 @@ register_function(const char *name, int minargs, int maxargs,
     unsigned ans;
 
     va_start(args, func);
-    ans = register_common(name, minargs, maxargs, func, nullptr, nullptr, args);
+    ans = register_common(name, minargs, maxargs, func, nullptr, nullptr, nullptr, args);
     va_end(args);
     return ans;
 }
@@ -165,7 +195,20 @@ register_function_with_read_write(const char *name, int minargs, int maxargs,
     unsigned ans;
 
     va_start(args, write);
-    ans = register_common(name, minargs, maxargs, func, read, write, args);
+    ans = register_common(name, minargs, maxargs, func, nullptr, read, write, args);
+    va_end(args);
+    return ans;
+}
+
+unsigned
+register_function_fast(const char *name, int minargs, int maxargs,
+                       bf_fast_type fast, ...)
+{
+    va_list args;
+    unsigned ans;
+
+    va_start(args, fast);
+    ans = register_common(name, minargs, maxargs, nullptr, fast, nullptr, nullptr, args);
     va_end(args);
     return ans;
 }
@@ -197,6 +240,92 @@ number_func_by_name(const char *name)
 
 /*** calling built-in functions ***/
 
+static inline package
+run_bi_func(struct bft_entry *f, Var arglist, Byte func_pc, void *vdata,
+            Objid progr)
+{
+    if (f->fast) {
+        package p = (*(f->fast)) (arglist.v.list + 1, arglist.v.list[0].v.num, progr);
+        free_var(arglist);
+        return p;
+    }
+    return (*(f->func)) (arglist, func_pc, vdata, progr);
+    /* f->func is responsible for freeing/using up arglist. */
+}
+
+#ifdef FUNCTION_STATS
+static inline package
+count_bi_result(struct bft_entry *f, package p)
+{
+    if (p.kind == package::BI_RAISE)
+        f->stats.errors++;
+    else if (p.kind == package::BI_SUSPEND && p.u.susp.proc == background_suspender)
+        f->stats.threaded++;
+    return p;
+}
+
+static void
+time_bi_func(struct bft_entry *f, std::chrono::steady_clock::time_point start)
+{
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int bucket = 0;
+
+    for (double limit = 0.000001; bucket < BF_TIME_BUCKETS - 1 && t >= limit; limit *= 10)
+        bucket++;
+    f->stats.times[bucket]++;
+    f->stats.seconds += t;
+    if (t > f->stats.max_seconds)
+        f->stats.max_seconds = t;
+}
+#endif
+
+static Stream *error_msg = nullptr;
+
+/* Check the count and types of the arguments to F, filling in *P and
+ * returning 0 if they don't fit its prototype.
+ * (Can't always check the count in the compiler, because of @)
+ */
+static int
+check_bi_args(struct bft_entry *f, const Var *args, int nargs, package *p)
+{
+    int k, max;
+
+    if (error_msg == nullptr)
+        error_msg = new_stream(20);
+
+    if (nargs < f->minargs || (f->maxargs != -1 && nargs > f->maxargs)) {
+        stream_printf(error_msg, "%s (expected", unparse_error(E_ARGS));
+        if (f->minargs != f->maxargs)
+            stream_printf(error_msg, " %i-%i", f->minargs, f->maxargs);
+        else
+            stream_printf(error_msg, " %i", f->minargs);
+
+        stream_printf(error_msg, "; got %i)", nargs);
+
+        *p = make_raise_pack(E_ARGS, reset_stream(error_msg), var_ref(zero));
+        return 0;
+    }
+
+    max = (f->maxargs == -1) ? f->minargs : nargs;
+
+    for (k = 0; k < max; k++) {
+        var_type proto = f->prototype[k];
+        var_type arg = args[k].type;
+
+        if (!(proto == TYPE_ANY
+                || (proto == TYPE_NUMERIC && (arg == TYPE_INT
+                                              || arg == TYPE_FLOAT))
+                || proto == arg)) {
+            stream_printf(error_msg, "%s (args[%i] of %s() expected %s; got %s)",
+                          unparse_error(E_TYPE), k + 1, f->name, parse_type(proto), parse_type(arg));
+
+            *p = make_raise_pack(E_TYPE, reset_stream(error_msg), var_ref(zero));
+            return 0;
+        }
+    }
+    return 1;
+}
+
 package
 call_bi_func(unsigned n, Var arglist, Byte func_pc,
              Objid progr, void *vdata)
@@ -204,6 +333,7 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
    call_bi_func will free arglist */
 {
     struct bft_entry *f;
+    package p;
 
     if (n >= top_bf_table) {
 	errlog("CALL_BI_FUNC: Unknown function number: %d\n", n);
@@ -212,18 +342,11 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
     }
     f = bf_table + n;
 
-    static Stream *error_msg = nullptr;
-    if (error_msg == nullptr)
-        error_msg = new_stream(20);
-
     if (func_pc == 1) {     /* check arg types and count *ONLY* for first entry */
-        int k, max;
-        Var *args = arglist.v.list;
-
         /*
          * Check permissions, if protected
          */
-        if ((!caller().is_obj() || caller().v.obj != SYSTEM_OBJECT) && f->_protected) {
+        if (bi_func_is_overridden(n)) {
             /* Try calling #0:bf_FUNCNAME(@ARGS) instead */
             enum error e = call_verb2(SYSTEM_OBJECT, f->verb_str, Var::new_obj(SYSTEM_OBJECT), arglist, 0, get_thread_mode());
 
@@ -235,44 +358,15 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
                 return make_error_pack(e == E_MAXREC ? e : E_PERM);
             }
         }
-        /*
-         * Check argument count
-         * (Can't always check in the compiler, because of @)
-         */
-        if (args[0].v.num < f->minargs
-                || (f->maxargs != -1 && args[0].v.num > f->maxargs)) {
-            int num_args = args[0].v.num;
+#ifdef FUNCTION_STATS
+        f->stats.calls++;
+#endif
+        if (!check_bi_args(f, arglist.v.list + 1, arglist.v.list[0].v.num, &p)) {
+#ifdef FUNCTION_STATS
+            f->stats.errors++;
+#endif
             free_var(arglist);
-            stream_printf(error_msg, "%s (expected", unparse_error(E_ARGS));
-            if (f->minargs != f->maxargs)
-                stream_printf(error_msg, " %i-%i", f->minargs, f->maxargs);
-            else
-                stream_printf(error_msg, " %i", f->minargs);
-
-            stream_printf(error_msg, "; got %i)", num_args);
-
-            return make_raise_pack(E_ARGS, reset_stream(error_msg), var_ref(zero));
-        }
-        /*
-         * Check argument types
-         */
-        max = (f->maxargs == -1) ? f->minargs : args[0].v.num;
-
-        for (k = 0; k < max; k++) {
-            var_type proto = f->prototype[k];
-            var_type arg = args[k + 1].type;
-
-            if (!(proto == TYPE_ANY
-                    || (proto == TYPE_NUMERIC && (arg == TYPE_INT
-                                                  || arg == TYPE_FLOAT))
-                    || proto == arg)) {
-                free_var(arglist);
-
-                stream_printf(error_msg, "%s (args[%i] of %s() expected %s; got %s)",
-                              unparse_error(E_TYPE), k + 1, f->name, parse_type(proto), parse_type(arg));
-
-                return make_raise_pack(E_TYPE, reset_stream(error_msg), var_ref(zero));
-            }
+            return p;
         }
     } else if (func_pc == 2 && vdata == &call_bi_func) {
         /* This is a return from calling #0:bf_FUNCNAME(@ARGS); return what
@@ -283,8 +377,63 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
     /*
      * do the function
      */
-    return (*(f->func)) (arglist, func_pc, vdata, progr);
-    /* f->func is responsible for freeing/using up arglist. */
+#ifdef FUNCTION_STATS
+    if (server_flag_option_cached(SVO_FUNCTION_TIMING)) {
+        auto start = std::chrono::steady_clock::now();
+        p = run_bi_func(f, arglist, func_pc, vdata, progr);
+        time_bi_func(f, start);
+    } else
+        p = run_bi_func(f, arglist, func_pc, vdata, progr);
+    return count_bi_result(f, p);
+#else
+    return run_bi_func(f, arglist, func_pc, vdata, progr);
+#endif
+}
+
+int
+bi_func_is_fast(unsigned n)
+{
+    return n < top_bf_table && bf_table[n].fast != nullptr;
+}
+
+/* Whether a call to function N from the running verb should go to
+ * #0:bf_FUNCNAME() instead.
+ */
+int
+bi_func_is_overridden(unsigned n)
+{
+    return bf_table[n]._protected
+           && (!caller().is_obj() || caller().v.obj != SYSTEM_OBJECT);
+}
+
+/* Call a function registered with register_function_fast() on arguments
+ * that stay owned by the caller.  The caller has already checked
+ * bi_func_is_overridden().
+ */
+package
+call_bi_func_fast(unsigned n, Var *args, int nargs, Objid progr)
+{
+    struct bft_entry *f = bf_table + n;
+    package p;
+
+#ifdef FUNCTION_STATS
+    f->stats.calls++;
+    if (!check_bi_args(f, args, nargs, &p)) {
+        f->stats.errors++;
+        return p;
+    }
+    if (server_flag_option_cached(SVO_FUNCTION_TIMING)) {
+        auto start = std::chrono::steady_clock::now();
+        p = (*(f->fast)) (args, nargs, progr);
+        time_bi_func(f, start);
+    } else
+        p = (*(f->fast)) (args, nargs, progr);
+    return count_bi_result(f, p);
+#else
+    if (!check_bi_args(f, args, nargs, &p))
+        return p;
+    return (*(f->fast)) (args, nargs, progr);
+#endif
 }
 
 void
@@ -509,6 +658,86 @@ bf_function_info(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+#ifdef FUNCTION_STATS
+static Var
+function_stats(unsigned n)
+{
+    const struct bf_stats &st = bf_table[n].stats;
+    Num timed = 0;
+    Var times = new_list(BF_TIME_BUCKETS);
+
+    for (int i = 0; i < BF_TIME_BUCKETS; i++) {
+        times.v.list[i + 1] = Var::new_int(st.times[i]);
+        timed += st.times[i];
+    }
+
+    Var r = new_map();
+    r = mapinsert(r, str_dup_to_var("calls"), Var::new_int(st.calls));
+    r = mapinsert(r, str_dup_to_var("errors"), Var::new_int(st.errors));
+    r = mapinsert(r, str_dup_to_var("threaded"), Var::new_int(st.threaded));
+    r = mapinsert(r, str_dup_to_var("seconds"), Var::new_float(st.seconds));
+    r = mapinsert(r, str_dup_to_var("average"), Var::new_float(timed ? st.seconds / timed : 0.0));
+    r = mapinsert(r, str_dup_to_var("max"), Var::new_float(st.max_seconds));
+    r = mapinsert(r, str_dup_to_var("times"), times);
+
+    return r;
+}
+
+static package
+bf_function_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r;
+
+    if (!is_wizard(progr)) {
+        free_var(arglist);
+        return make_error_pack(E_PERM);
+    }
+
+    if (arglist.v.list[0].v.num == 1) {
+        unsigned n = number_func_by_name(arglist.v.list[1].v.str);
+        if (n == FUNC_NOT_FOUND) {
+            free_var(arglist);
+            return make_error_pack(E_INVARG);
+        }
+        r = function_stats(n);
+    } else {
+        r = new_map();
+        for (unsigned i = 0; i < top_bf_table; i++)
+            if (bf_table[i].stats.calls)
+                r = mapinsert(r, str_dup_to_var(bf_table[i].name), function_stats(i));
+    }
+
+    free_var(arglist);
+    return make_var_pack(r);
+}
+
+/* Log the functions that have taken the most time, or been called the most
+ * if nothing has been timed.
+ */
+void
+log_function_stats(void)
+{
+    std::vector<unsigned> called;
+
+    for (unsigned i = 0; i < top_bf_table; i++)
+        if (bf_table[i].stats.calls)
+            called.push_back(i);
+
+    std::sort(called.begin(), called.end(), [](unsigned a, unsigned b) {
+        const struct bf_stats &x = bf_table[a].stats, &y = bf_table[b].stats;
+        return x.seconds != y.seconds ? x.seconds > y.seconds : x.calls > y.calls;
+    });
+    if (called.size() > 10)
+        called.resize(10);
+
+    for (auto i : called) {
+        const struct bf_stats &st = bf_table[i].stats;
+        oklog("FUNCTIONS: %-20s %12" PRIdN " calls %8" PRIdN " errors %8" PRIdN " threaded %10.3f seconds\n",
+              bf_table[i].name, st.calls, st.errors, st.threaded, st.seconds);
+    }
+}
+#endif /* FUNCTION_STATS */
+
 static void
 load_server_protect_function_flags(void)
 {
@@ -547,6 +776,8 @@ _server_int_option_cache[SVO_MISC_OPTION] = value;    \
     SERVER_OPTIONS_CACHED_MISC(_SVO_DO, value);
 
 # undef _SVO_DO
+
+    load_scheduler_weights();
 }
 
 static package
@@ -567,4 +798,7 @@ register_functions(void)
 {
     register_function("function_info", 0, 1, bf_function_info, TYPE_STR);
     register_function("load_server_options", 0, 0, bf_load_server_options);
+#ifdef FUNCTION_STATS
+    register_function("function_stats", 0, 1, bf_function_stats, TYPE_STR);
+#endif
 }
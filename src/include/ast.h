@@ -204,9 +204,13 @@ struct Stmt {
     union Stmt_Data s;
 };
 
-
+/* Everything allocated between begin_code_allocation() and
+ * end_code_allocation() belongs to one tree and is freed along with it by
+ * free_stmt(), or straight away if the tree was aborted.  Trees must be freed
+ * newest first.
+ */
 extern void begin_code_allocation(void);
-extern void end_code_allocation(int);
+extern void end_code_allocation(int aborted);
 
 extern Stmt *alloc_stmt(enum Stmt_Kind);
 extern Cond_Arm *alloc_cond_arm(Expr *, Stmt *);
@@ -220,8 +224,6 @@ extern Except_Arm *alloc_except(int, Arg_List *, Stmt *);
 extern Scatter *alloc_scatter(enum Scatter_Kind, int, Expr *);
 extern char *alloc_string(const char *);
 
-extern void dealloc_node(void *);
-extern void dealloc_string(char *);
 extern void free_stmt(Stmt *);
 
 #endif				/* !AST_h */
@@ -34,4 +34,8 @@ extern package background_thread(void (*callback)(Var, Var*, void*), Var* data,
 extern void make_error_map(enum error error_type, const char *msg, Var *ret);
 extern void background_shutdown();
 
+/* The suspend procedure background_thread() hands to the task; built-in
+ * function statistics count the calls that return it. */
+extern enum error background_suspender(vm the_vm, void *data);
+
 #endif /* EXTENSION_BACKGROUND_H */
@@ -38,8 +38,11 @@ extern void register_exec(void);
 extern void register_crypto(void);
 extern void register_sqlite(void);
 extern void register_pcre(void);
+extern void register_regex_cache(void);
+extern void register_program_cache(void);
 extern void register_background(void);
 extern void register_waif(void);
+extern void register_profiler(void);
 extern void register_simplexnoise(void);
 extern void register_argon2(void);
 extern void register_spellcheck(void);
@@ -306,6 +306,19 @@ extern Var db_all_users(void);
 				 * to make it persistent.
 				 */
 
+extern Var db_owned_objects(Objid owner);
+				/* Returns a new list, in ascending order, of the
+				 * numbered objects owned by OWNER.
+				 */
+
+extern Var db_locate_by_name(const char *what, int what_len,
+			     int case_matters);
+				/* Returns a new list, in ascending order, of the
+				 * numbered objects whose names contain WHAT.
+				 * Both functions use indexes that are built on
+				 * first use and maintained from then on.
+				 */
+
 extern int db_object_isa(Var, Var);
 
 
@@ -72,6 +72,13 @@ extern Program *dbio_read_program(DB_Version version,
 				 * be the required string.
 				 */
 
+extern char *dbio_read_program_text(void);
+				/* Reads the source of a program, as
+				 * dbio_read_program() would, without compiling
+				 * it.  The caller should free_str() the result.
+				 * Returns null at an unexpected end of file.
+				 */
+
 
 /*********** Output ***********/
 
@@ -191,6 +191,15 @@ extern void dbpriv_after_load(void);
 
 extern Propdef dbpriv_new_propdef(const char *);
 
+extern Var dbpriv_inherited_property_value(Object *o, Pval *prop,
+                        Object *definer, int index);
+                /* Return the value of the property in slot PROP
+                 * of O, following clear values up through O's
+                 * parents.  DEFINER is the object defining the
+                 * property and INDEX its position in DEFINER's
+                 * propdefs.  The value is not referenced.
+                 */
+
 extern int dbpriv_check_properties_for_chparent(Var obj,
                         Var parents,
                         Var anon_kids);
@@ -18,6 +18,9 @@
 #ifndef Execute_h
 #define Execute_h 1
 
+#include <atomic>
+#include <signal.h>
+
 #include "config.h"
 #include "db.h"
 #include "opcode.h"
@@ -117,6 +120,18 @@ extern enum outcome do_server_program_task(Var _this, const char *verb,
 extern enum outcome resume_from_previous_vm(vm the_vm, Var value);
 
 extern int task_timed_out;
+
+/* Set from signal handlers and the watchdog thread to make the interpreter
+ * stop at the next tick and look at why: `task_timed_out',
+ * `profile_sample_due' or `stall_report_due'.  Whoever sets it stores the
+ * reason first, with release ordering, so the reason is visible once the
+ * interpreter sees the interrupt.  Lock-free atomics are safe to use from
+ * signal handlers.
+ */
+extern std::atomic<int> interpreter_interrupt;
+
+/* Set by the main loop's watchdog to have the running task's stack logged. */
+extern std::atomic<int> stall_report_due;
 extern void abort_running_task(void);
 extern void print_error_backtrace(const char *, void (*)(const char *));
 extern Var caller(void);
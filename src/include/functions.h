@@ -72,6 +72,13 @@ package make_int_pack(Num v);
 package make_float_pack(double v);
 
 typedef package(*bf_type) (Var, Byte, void *, Objid);
+/* A function registered with register_function_fast() reads its arguments
+ * from ARGS[0] to ARGS[NARGS - 1] without taking ownership of them, and
+ * only returns or raises; a returned value must be its own reference.
+ * Calls to it without `@' compile to EOP_BI_FUNC_CALL_FAST, which passes
+ * the arguments straight from the runtime stack.
+ */
+typedef package(*bf_fast_type) (Var *, int, Objid);
 typedef void (*bf_write_type) (void *vdata);
 typedef void *(*bf_read_type) (void);
 
@@ -90,7 +97,14 @@ extern unsigned register_function_with_read_write(const char *, int, int,
 						  bf_type, bf_read_type,
 						  bf_write_type,...);
 
+extern unsigned register_function_fast(const char *, int, int,
+				       bf_fast_type,...);
+
 extern package call_bi_func(unsigned, Var, Byte, Objid, void *);
+extern int bi_func_is_fast(unsigned);
+extern int bi_func_is_overridden(unsigned);
+extern package call_bi_func_fast(unsigned, Var *, int, Objid);
+extern void log_function_stats(void);
 /* will free or use Var arglist */
 
 extern void write_bi_func_data(void *vdata, Byte f_id);
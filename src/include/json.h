@@ -32,6 +32,10 @@
 
 #include "structures.h"
 
+/* Generated text is passed to sinks, and parsers are fed, at most this
+ * many bytes at a time. */
+#define JSON_CHUNK_SIZE 16384
+
 /* Parse `len' bytes of JSON text into a MOO value.  Returns 1 and
  * stores the value in `out' on success, 0 on failure.  `max_depth'
  * bounds nesting (callers on the main thread normally pass
@@ -42,7 +46,35 @@ extern int json_parse_string(const char *str, size_t len, int embedded_types,
                              int max_depth, int strict, Var *out);
 
 /* Generate JSON text for a MOO value.  Returns a str_dup()'d string
- * (release with free_str()) or nullptr on failure.  Main thread only. */
+ * (release with free_str()) or nullptr on failure.  Safe to call from
+ * background threads. */
 extern char *json_generate_string(Var v, int embedded_types, int disable_binary_escapes);
 
+/* Receives generated text; returns 0 to stop generation. */
+typedef int (*json_sink)(void *data, const char *bytes, size_t len);
+
+/* Generate JSON text for a MOO value into `sink', in pieces of up to
+ * JSON_CHUNK_SIZE bytes (longer strings are passed on whole).  Returns
+ * 1 on success, or 0 if the value can't be represented or the sink
+ * failed, possibly after some text was written.  Safe to call from
+ * background threads. */
+extern int json_generate_chunked(Var v, int embedded_types, int disable_binary_escapes,
+                                 json_sink sink, void *data);
+
+/* An incremental parser, for documents read a piece at a time.  Feed
+ * it text with json_parser_feed(), which returns 0 once the text is
+ * known to be invalid, then collect the value with json_parser_finish().
+ * After a complete value, json_parser_unconsumed() is the number of
+ * bytes at the end of the last piece fed that weren't part of it.
+ * Always release the parser with json_parser_free().  Safe to use from
+ * background threads; `embedded_types', `max_depth' and `strict' are as
+ * for json_parse_string(). */
+typedef struct json_parser json_parser;
+
+extern json_parser *json_parser_new(int embedded_types, int max_depth, int strict);
+extern int json_parser_feed(json_parser *p, const char *str, size_t len);
+extern size_t json_parser_unconsumed(json_parser *p);
+extern int json_parser_finish(json_parser *p, Var *out);
+extern void json_parser_free(json_parser *p);
+
 #endif /* JSON_H */
@@ -48,6 +48,11 @@ extern Var strget(Var str, int i);
 extern const char *value2str(Var);
 extern void unparse_value(Stream *, Var);
 
+/* Pieces handed to an unparse_sink are at least this long, except the last. */
+#define UNPARSE_CHUNK_SIZE 16384
+typedef void (*unparse_sink) (void *data, const char *bytes, int length);
+extern void unparse_value_chunked(Stream *, Var, unparse_sink, void *data);
+
 extern Var emptylist; /* Bandaid: See list.cc */
 
 /*
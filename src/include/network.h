@@ -54,6 +54,10 @@ typedef struct {		/* Network's handle on a listening point */
     void *ptr;
 } network_listener;
 
+typedef struct {		/* Network's handle on a shared output buffer */
+    void *ptr;
+} network_buffer;
+
 struct nhandle; /* Forward declaration of nhandle. */
 
 #include "server.h"		/* Include this *after* defining the types */
@@ -244,6 +248,33 @@ extern int network_send_bytes(network_handle nh,
 				 * fail if FLUSH_OK is false.
 				 */
 
+extern network_buffer network_new_buffer(const char *bytes, int length,
+				      bool add_eol);
+				/* Returns a new, reference-counted buffer
+				 * holding a copy of the first LENGTH bytes of
+				 * BYTES, followed by the protocol's end-of-line
+				 * sequence if ADD_EOL is true.  The buffer is
+				 * immutable and can be queued for output on
+				 * any number of connections without further
+				 * copying.  The caller owns one reference and
+				 * must give it up with network_release_buffer().
+				 */
+
+extern int network_send_buffer(network_handle nh, network_buffer buf,
+			       int flush_ok);
+				/* Queues the contents of BUF for output on the
+				 * specified connection, exactly as
+				 * network_send_bytes() would, but sharing the
+				 * buffer rather than copying it.  Returns true
+				 * iff the buffer was successfully queued.
+				 */
+
+extern void network_release_buffer(network_buffer buf);
+				/* Gives up the caller's reference to BUF.  The
+				 * memory is freed once every connection that
+				 * queued it has finished writing it.
+				 */
+
 extern int network_buffered_output_length(network_handle nh);
 				/* Returns the number of bytes of output
 				 * currently queued up on the given connection.
@@ -320,6 +351,13 @@ extern uint16_t network_source_port(const network_handle nh);
 extern const char *network_protocol(const network_handle nh);
 				/* Return a string indicating the protocol (IPv4, IPv6) of the connection. */
 
+extern Var network_read_stats(const network_handle nh);
+				/* Return a map describing how input has been
+				 * read from the connection: the number of reads,
+				 * total and average bytes per read, the largest
+				 * read, and the current read buffer size.
+				 */
+
 extern Var network_connection_options(network_handle nh,
 				      Var list);
 				/* Add the current option settings for the
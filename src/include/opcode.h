@@ -40,6 +40,9 @@ enum Extended_Opcode {
     EOP_BITOR, EOP_BITAND, EOP_BITXOR,
     EOP_BITSHL, EOP_BITSHR, EOP_COMPLEMENT,
 
+    /* built-in function call with its arguments left on the stack */
+    EOP_BI_FUNC_CALL_FAST,
+
     Last_Extended_Opcode = 255
 };
 
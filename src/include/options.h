@@ -206,6 +206,12 @@
  *
  * DEFAULT_TLS_CERT can be overridden with the command-line option --tls-cert (-r)
  * DEFAULT_TLS_KEY can be overridden with the command-line option --tls-key (-k)
+ *
+ * TLS_HANDSHAKE_THREADS is the number of threads used to perform the
+ * (CPU-intensive) server side of TLS handshakes, so that a burst of new TLS
+ * connections doesn't stall the main loop. Set it to 0 to perform handshakes
+ * on the main thread. Reading and writing established TLS connections is
+ * always done on the main thread.
  */
 
 #define USE_TLS
@@ -213,6 +219,7 @@
 #define DEFAULT_TLS_CERT    "/etc/letsencrypt/live/fullchain.pem"
 #define DEFAULT_TLS_KEY     "/etc/letsencrypt/live/privkey.pem"
 #define LOG_TLS_CONNECTIONS
+#define TLS_HANDSHAKE_THREADS   2
 
 /******************************************************************************
  * The following constants define certain aspects of the server's network
@@ -256,6 +263,27 @@
 
 #define MIN_MAX_QUEUED_OUTPUT         2048
 
+/* Each connection reads into its own buffer, which starts out at
+ * NETWORK_READ_BUFFER_MIN bytes, doubles (up to NETWORK_READ_BUFFER_MAX) each
+ * time a read fills it, and shrinks again once reads become small.  During
+ * a single pass through the main loop the server keeps reading from a
+ * connection until the socket is drained or NETWORK_READ_BUDGET bytes have
+ * been read, so that one busy connection can't starve the others.
+ */
+
+#define NETWORK_READ_BUFFER_MIN       1024
+#define NETWORK_READ_BUFFER_MAX       65536
+#define NETWORK_READ_BUDGET           262144
+
+/* If NETWORK_THREAD is defined, the sockets of ordinary (non-TLS) connections
+ * are read and written by a dedicated network thread instead of the main loop.
+ * Input is handed to the main thread, and output to the network thread, through
+ * lock-free single-producer/single-consumer rings, so output keeps streaming to
+ * clients while long-running tasks execute. TLS connections are unaffected.
+ */
+
+/* #define NETWORK_THREAD */
+
 /******************************************************************************
  * On connections that have not been set to binary mode, the server normally
  * discards incoming characters that are not printable ASCII, including
@@ -266,15 +294,75 @@
 #define INPUT_APPLY_BACKSPACE
 
 /******************************************************************************
- * The server maintains a cache of the most recently used patterns from calls
- * to the match(), rmatch(), and pcre_match() built-in functions.
- * PATTERN_CACHE_SIZE controls how many past patterns are remembered by the
- * server for the former and PCRE_PATTERN_CACHE_SIZE for the latter.
+ * The server maintains a single cache of the most recently used compiled
+ * patterns from calls to the match(), rmatch(), and pcre_match() built-in
+ * functions. PATTERN_CACHE_SIZE is the default number of patterns it holds
+ * and PATTERN_CACHE_BYTES the default estimate of the memory they may use;
+ * the least recently used patterns are discarded when either is exceeded.
+ * Both can be changed at runtime with $server_options.pattern_cache_size and
+ * $server_options.pattern_cache_bytes.
  * Do not set either value to a number less than 1.
  */
 
-#define PATTERN_CACHE_SIZE      20
-#define PCRE_PATTERN_CACHE_SIZE 20
+#define PATTERN_CACHE_SIZE      256
+#define PATTERN_CACHE_BYTES     (4 * 1024 * 1024)
+
+/******************************************************************************
+ * The server keeps the most recently used programs compiled by eval() and
+ * set_verb_code(), keyed by their source text, so that code evaluated over
+ * and over isn't parsed again every time.  PROGRAM_CACHE_SIZE is the default
+ * number of programs it holds and PROGRAM_CACHE_BYTES the default estimate of
+ * the memory they may use; the least recently used programs are discarded
+ * when either is exceeded.  Both can be changed at runtime with
+ * $server_options.program_cache_size and $server_options.program_cache_bytes.
+ * A size of 0 turns the cache off.
+ */
+
+#define PROGRAM_CACHE_SIZE      256
+#define PROGRAM_CACHE_BYTES     (4 * 1024 * 1024)
+
+/******************************************************************************
+ * Each pass through the server's main loop runs the tasks that are ready,
+ * one at a time, taking them from each player's queue in turn, before going
+ * back to check the network for input.  DEFAULT_TASK_BATCH_SIZE is the most
+ * tasks it will run in one pass and DEFAULT_TASK_BATCH_USECONDS the number of
+ * microseconds after which it stops starting new ones, so that a long run of
+ * forked tasks doesn't keep connections waiting.  They can be changed at
+ * runtime with $server_options.task_batch_size and
+ * $server_options.task_batch_useconds.  A size of 1 runs a single task per
+ * pass, as older servers did.
+ */
+
+#define DEFAULT_TASK_BATCH_SIZE         100
+#define DEFAULT_TASK_BATCH_USECONDS     10000
+
+/******************************************************************************
+ * The server times each phase of every pass through its main loop, for the
+ * main_loop_stats() builtin.  A pass that spends more than
+ * DEFAULT_MAIN_LOOP_LAG_MSECS milliseconds on anything but waiting for
+ * network input is logged along with the time each phase took.  A watchdog
+ * thread logs a warning when the main loop hasn't finished a pass in
+ * DEFAULT_WATCHDOG_SECONDS seconds, followed by the stack of the task that
+ * was running, if any, as soon as that task runs another tick.  They can be
+ * changed at runtime with $server_options.main_loop_lag_msecs and
+ * $server_options.watchdog_seconds; 0 turns either off.  Since a pass can
+ * wait a second for input, the watchdog never fires in under 2 seconds.
+ */
+
+#define DEFAULT_MAIN_LOOP_LAG_MSECS     1000
+#define DEFAULT_WATCHDOG_SECONDS        10
+
+/******************************************************************************
+ * Ready tasks are taken first from the player whose tasks have used the least
+ * of the server's time, so that one player's long-running tasks can't keep
+ * everyone else waiting.  Time used counts for less as it gets older: it is
+ * halved every DEFAULT_SCHEDULER_HALF_LIFE seconds, which can be changed with
+ * $server_options.scheduler_half_life.  $server_options.scheduler_weights,
+ * a map from players to positive numbers, gives some players a larger share
+ * of the server than others; the default weight is 1.
+ */
+
+#define DEFAULT_SCHEDULER_HALF_LIFE     60
 
 /******************************************************************************
  * Prior to 1.8.4 property lookups were required on every reference to a
@@ -333,6 +421,16 @@
 
 #define STRING_INTERNING /* */
 
+/******************************************************************************
+ * When the database is loaded, the source of every verb is read first and
+ * then compiled on DB_LOAD_THREADS threads at once.  0 uses one thread for
+ * each processor; 1 compiles them one after another on the main thread, as
+ * older servers did.
+ ******************************************************************************
+ */
+
+#define DB_LOAD_THREADS 0
+
 /******************************************************************************
  * For size operations, store the data with the type rather than recomputing.
  * String:     Store the length of the string.
@@ -342,6 +440,42 @@
 
 #define MEMO_SIZE
 
+/******************************************************************************
+ * POOL_ALLOCATOR serves small allocations of the most heavily churned types
+ * (short strings, small lists and maps, map nodes and tasks) from size-class
+ * slabs with per-thread free lists instead of going to malloc every time.
+ * Allocations larger than POOL_MAX_BLOCK bytes still come from malloc.  Freed
+ * blocks are reused, but memory taken by the pools is never returned to the
+ * operating system.
+ ******************************************************************************
+ */
+
+#define POOL_ALLOCATOR
+#define POOL_MAX_BLOCK 256
+
+/******************************************************************************
+ * MEMORY_STATS keeps a count of live bytes, live blocks and total allocations
+ * for every Memory_Type (see storage.h).  The counters are per-thread and only
+ * added up when read, by the memory_stats() builtin and in the log at every
+ * checkpoint.  Byte counts are the usable sizes of the blocks, so they include
+ * the allocator's rounding.
+ ******************************************************************************
+ */
+
+#define MEMORY_STATS
+
+/******************************************************************************
+ * FUNCTION_STATS counts the calls to every built-in function, the calls that
+ * raised an error and the calls handed off to a background thread, for the
+ * function_stats() builtin and the log at every checkpoint.  Setting
+ * $server_options.function_timing also times each call and keeps the total,
+ * the longest and a histogram of times; that costs two clock reads per call,
+ * so it is off unless set.
+ ******************************************************************************
+ */
+
+#define FUNCTION_STATS
+
 /******************************************************************************
  * DEFAULT_MAX_STRING_CONCAT,      if set to a positive value, is the length
  *                                 of the largest constructible string.
@@ -410,12 +544,17 @@
  * FILE_IO_MAX_FILES indicated the maximum number of files that can be open at
  * once. It can be overridden in-database by adding
  * the $server_options.file_io_max_files property and calling load_server_options()
+ *
+ * FILE_IO_MAX_BYTES is the number of bytes a single task may read and write
+ * through the file I/O functions, or 0 for no limit. It can be overridden
+ * with $server_options.file_io_max_bytes.
  ******************************************************************************
  */
 
 #define FILE_SUBDIR "files/"
 #define FILE_IO_BUFFER_LENGTH 4096
 #define FILE_IO_MAX_FILES     256
+#define FILE_IO_MAX_BYTES     0
 
 /******************************************************************************
  * Enable log output colorization.
@@ -627,6 +766,12 @@
 #if PATTERN_CACHE_SIZE < 1
 #  error Illegal match() pattern cache size!
 #endif
+#if PATTERN_CACHE_BYTES < 1
+#  error Illegal match() pattern cache byte budget!
+#endif
+#if PROGRAM_CACHE_SIZE < 0 || PROGRAM_CACHE_BYTES < 0
+#  error Illegal eval() program cache size!
+#endif
 
 #define NP_TCP		1
 
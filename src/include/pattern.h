@@ -33,3 +33,6 @@ extern Pattern new_pattern(const char *pattern, int case_matters);
 extern Match_Result match_pattern(Pattern p, const char *string,
 				Match_Indices * indices, int is_reverse);
 extern void free_pattern(Pattern p);
+
+/* Approximate memory held by a compiled pattern, for the pattern cache. */
+extern size_t pattern_size(Pattern p);
@@ -3,6 +3,7 @@
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
+#include <atomic>
 
 #include "structures.h"
 
@@ -12,18 +13,14 @@
 #define FIND_ALL            8
 
 struct pcre_cache_entry {
-    char *error;
     pcre2_code *re;
     uint32_t captures;
-    unsigned int cache_hits;
-    std::atomic_uint refcount;
+    pcre2_match_data *match_data;       /* reused by one match at a time */
+    std::atomic_flag match_data_busy;
 };
 
-typedef std::pair<const char*, unsigned char> cache_type;
-
-static void free_entry(pcre_cache_entry *);
-static void delete_cache_entry(const char *pattern, unsigned char options);
 static Var result_indices(PCRE2_SIZE ovector[], int n);
+extern pcre2_match_context *pcre_match_context(void);
 extern void pcre_shutdown(void);
 
 #ifdef SQLITE3_FOUND
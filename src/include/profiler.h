@@ -0,0 +1,49 @@
+/* A profiler for MOO code, started and stopped with profile_start() and
+ * profile_stop() and read with profile_dump().
+ *
+ * Costs are kept per frame: a verb together with the place in its caller it
+ * was called from, so a frame stands for one path down the call tree.  In
+ * "calls" mode the interpreter reports every verb call and return, and the
+ * ticks and time between one and the next are charged to the frame that was
+ * running.  In "samples" mode a profiling timer interrupts the interpreter
+ * every so often and the running frame and line are counted instead.
+ *
+ * The interpreter only calls in here when `profiler_active' is set, so when
+ * no profile is being taken the cost is a test of that flag per verb call
+ * and return.
+ */
+
+#ifndef Profiler_h
+#define Profiler_h 1
+
+#include <signal.h>
+
+#include "execute.h"
+
+extern bool profiler_active;
+
+/* Set by the profiling timer; the interpreter takes a sample when it sees
+ * `interpreter_interrupt' with this set.
+ */
+extern std::atomic<int> profile_sample_due;
+
+/* The interpreter is starting or resuming the task whose activations are
+ * stack[0..top], with `ticks' ticks left to run.
+ */
+extern void profile_task_begin(activation *stack, int top, int root_vector, int ticks);
+
+/* stack[top] has just been pushed by a verb call. */
+extern void profile_call(activation *stack, int top, int root_vector, int ticks);
+
+/* stack[top] is about to be popped. */
+extern void profile_return(activation *stack, int top, int root_vector, int ticks);
+
+/* The interpreter has stopped running the current task, which has finished
+ * or suspended.
+ */
+extern void profile_task_end(int ticks);
+
+/* Count a sample for stack[top], which is at stack[top].error_pc. */
+extern void profile_sample(activation *stack, int top, int root_vector);
+
+#endif
@@ -0,0 +1,35 @@
+/* A cache of the programs compiled by eval() and set_verb_code(), so that
+ * code which is evaluated or set over and over is only parsed once.
+ *
+ * Entries are keyed by the database version the code is compiled for and
+ * the exact text of its lines, and kept in least-recently-used order.  The
+ * cache is bounded both by entry count and by the memory the programs hold;
+ * see the program_cache_size and program_cache_bytes server options.  Only
+ * code that compiles without errors is cached.
+ *
+ * Programs are shared: the cache keeps one reference and hands out others
+ * with program_ref(), so a program stays alive for as long as any running
+ * eval() or verb still uses it.
+ */
+
+#ifndef Program_Cache_h
+#define Program_Cache_h 1
+
+#include "program.h"
+#include "structures.h"
+
+/* Look up the program for CODE, a list of strings.  Returns a new reference
+ * to it, or nullptr.
+ */
+extern Program *program_cache_find(Var code);
+
+/* Remember PROGRAM as the compiled form of CODE, after a failed lookup.
+ * This is where the miss is counted; PROGRAM may be nullptr if CODE didn't
+ * compile.  The cache takes a reference of its own; the caller's is left
+ * alone.
+ */
+extern void program_cache_insert(Var code, Program *program);
+
+extern void program_cache_shutdown(void);
+
+#endif /* !Program_Cache_h */
@@ -0,0 +1,51 @@
+/* A single cache of compiled regular expressions shared by match(),
+ * rmatch() and pcre_match() (and SQLite's REGEXP).
+ *
+ * Entries are keyed by kind, compile options and pattern text and are
+ * kept in least-recently-used order, so lookups, promotions and evictions
+ * are all O(1). The cache is bounded both by entry count and by an estimate
+ * of the memory the compiled patterns hold; see the pattern_cache_size and
+ * pattern_cache_bytes server options.
+ *
+ * Lookups hand back a referenced entry which must be released with
+ * regex_cache_release() once the caller is done matching, so an entry
+ * evicted by another thread isn't freed out from under it.
+ */
+
+#ifndef Regex_Cache_h
+#define Regex_Cache_h 1
+
+#include <atomic>
+#include <stddef.h>
+
+#include "structures.h"
+
+enum regex_kind {
+    REGEX_MOO,      /* match() / rmatch(); value is a Pattern's ptr */
+    REGEX_PCRE      /* pcre_match(); value is a pcre_cache_entry */
+};
+
+struct regex_cache_entry {
+    void *value;
+    void (*free_value)(void *);
+    size_t bytes;
+    unsigned int hits;
+    std::atomic_uint refcount;
+};
+
+/* Look up a compiled pattern. Returns a referenced entry or nullptr. */
+extern regex_cache_entry *regex_cache_find(regex_kind kind, unsigned char options,
+                                           const char *pattern);
+
+/* Add a freshly compiled pattern, evicting the least recently used entries
+ * to stay within budget. Ownership of `value' passes to the cache. If
+ * another thread inserted the same pattern first, `value' is freed and the
+ * existing entry is returned instead. The result is always referenced. */
+extern regex_cache_entry *regex_cache_insert(regex_kind kind, unsigned char options,
+                                             const char *pattern, void *value,
+                                             size_t bytes, void (*free_value)(void *));
+
+extern void regex_cache_release(regex_cache_entry *entry);
+extern void regex_cache_shutdown(void);
+
+#endif /* !Regex_Cache_h */
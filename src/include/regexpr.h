@@ -102,6 +102,12 @@ void re_compile_fastmap(regexp_t compiled);
    the calling program must have initialized the fastmap field to point
    to an array of 256 characters. */
 
+int re_possessive_loops(regexp_t compiled, char *possessive, int max);
+/* For each star or plus loop of a freshly compiled regexp, in the order
+   their operators appear in the pattern, this stores in possessive[] (up
+   to max entries) whether re_match will never backtrack into fewer
+   iterations of it.  This returns the number of loops. */
+
 char *re_comp(char *s);
 /* BSD 4.2 regex library routine re_comp.  This compiles the regexp into
    an internal buffer.  This returns NULL if the regexp was compiled
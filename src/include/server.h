@@ -241,6 +241,88 @@ int proxy_connected(Objid connection, char *command);
 	 _STATEMENT({													\
 	     if (0 < value && value < MIN_MAX_QUEUED_OUTPUT)		    \
 		 value = MIN_MAX_QUEUED_OUTPUT;						        \
+	   }))															\
+																	\
+  DEFINE( SVO_PATTERN_CACHE_SIZE, pattern_cache_size,				\
+																	\
+	  int, PATTERN_CACHE_SIZE,										\
+	 _STATEMENT({													\
+	     if (value < 1)												\
+		 value = PATTERN_CACHE_SIZE;								\
+	   }))															\
+																	\
+  DEFINE( SVO_PATTERN_CACHE_BYTES, pattern_cache_bytes,				\
+																	\
+	  int, PATTERN_CACHE_BYTES,										\
+	 _STATEMENT({													\
+	     if (value < 1)												\
+		 value = PATTERN_CACHE_BYTES;								\
+	   }))															\
+																	\
+  DEFINE( SVO_PROGRAM_CACHE_SIZE, program_cache_size,				\
+																	\
+	  int, PROGRAM_CACHE_SIZE,										\
+	 _STATEMENT({													\
+	     if (value < 0)												\
+		 value = 0;													\
+	   }))															\
+																	\
+  DEFINE( SVO_PROGRAM_CACHE_BYTES, program_cache_bytes,				\
+																	\
+	  int, PROGRAM_CACHE_BYTES,										\
+	 _STATEMENT({													\
+	     if (value < 0)												\
+		 value = 0;													\
+	   }))															\
+																	\
+  DEFINE( SVO_LEGACY_MATCH_ENGINE, legacy_match_engine,				\
+	  flag, 0, /* already canonical */								\
+	  )																\
+																	\
+  DEFINE( SVO_FUNCTION_TIMING, function_timing,						\
+	  flag, 0, /* already canonical */								\
+	  )																\
+																	\
+  DEFINE( SVO_TASK_BATCH_SIZE, task_batch_size,						\
+																	\
+	  int, DEFAULT_TASK_BATCH_SIZE,									\
+	 _STATEMENT({													\
+	     if (value < 1)												\
+		 value = 1;													\
+	   }))															\
+																	\
+  DEFINE( SVO_TASK_BATCH_USECONDS, task_batch_useconds,				\
+																	\
+	  int, DEFAULT_TASK_BATCH_USECONDS,								\
+	 _STATEMENT({													\
+	     if (value < 0)												\
+		 value = 0;													\
+	   }))															\
+																	\
+  DEFINE( SVO_SCHEDULER_HALF_LIFE, scheduler_half_life,				\
+																	\
+	  int, DEFAULT_SCHEDULER_HALF_LIFE,								\
+	 _STATEMENT({													\
+	     if (value < 1)												\
+		 value = 1;													\
+	   }))															\
+																	\
+  DEFINE( SVO_MAIN_LOOP_LAG_MSECS, main_loop_lag_msecs,				\
+																	\
+	  int, DEFAULT_MAIN_LOOP_LAG_MSECS,								\
+	 _STATEMENT({													\
+	     if (value < 0)												\
+		 value = 0;													\
+	   }))															\
+																	\
+  DEFINE( SVO_WATCHDOG_SECONDS, watchdog_seconds,					\
+																	\
+	  int, DEFAULT_WATCHDOG_SECONDS,								\
+	 _STATEMENT({													\
+	     if (value < 0)												\
+		 value = 0;													\
+	     else if (value == 1)										\
+		 value = 2;													\
 	   }))															\
 
 /* List of all category (2) and (3) cached server options */
@@ -130,6 +130,10 @@ typedef enum Memory_Type {
     /* to be used when no more specific type applies */
     M_STRUCT, M_ARRAY
 } Memory_Type;
+		/* When adding a type, add its name to memory_type_names[] in
+		 * storage.cc as well. */
+
+#define NUM_MEMORY_TYPES (M_ARRAY + 1)
 
 extern char *str_dup(const char *);
 extern const char *str_ref(const char *);
@@ -138,6 +142,14 @@ extern void myfree(void *where, Memory_Type type);
 extern void *mymalloc(unsigned size, Memory_Type type);
 extern void *myrealloc(void *where, unsigned size, Memory_Type type);
 
+#ifdef MEMORY_STATS
+extern struct Var memory_stats(void);
+				/* Returns a map from the name of each type
+				 * with live allocations to a map of its
+				 * "bytes", "blocks" and "allocations". */
+extern void log_memory_stats(void);
+#endif
+
 static inline void		/* XXX was extern, fix for non-gcc compilers */
 free_str(const char *s)
 {
@@ -19,7 +19,8 @@ extern void str_intern_open(int table_size);
 extern void str_intern_close(void);
 
 /* Make an immutable copy of s.  If there's an intern table open,
-   possibly share storage. */
+   possibly share storage.  Safe to call from several threads at once,
+   though opening and closing the table is not. */
 extern const char *str_intern(const char *s);
 
 #endif
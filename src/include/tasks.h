@@ -59,6 +59,7 @@ extern void resume_task(vm the_vm, Var value);
 				 */
 extern vm find_suspended_task(int id);
 extern int check_user_task_limit(Objid user);
+extern void load_scheduler_weights(void);
 
 /* External task queues:
 
@@ -84,6 +84,10 @@ typedef enum {
                  */
     DBV_Bool,       /* Boolean type
                      */
+    DBV_FastCall,   /* Calls to fixed-arity built-in functions compile
+                     * to EOP_BI_FUNC_CALL_FAST, which changes the PCs
+                     * of suspended frames compiled from the same code.
+                     */
     Num_DB_Versions		/* Special: the current version is this - 1. */
 } DB_Version;
 
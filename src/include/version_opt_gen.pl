@@ -96,7 +96,7 @@ my @options =
 		DEFAULT_FG_SECONDS
 		DEFAULT_BG_SECONDS
 		PATTERN_CACHE_SIZE
-		PCRE_PATTERN_CACHE_SIZE
+		PATTERN_CACHE_BYTES
 		DEFAULT_MAX_STRING_CONCAT
 		MIN_STRING_CONCAT_LIMIT
 		DEFAULT_MAX_LIST_VALUE_BYTES
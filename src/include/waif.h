@@ -36,9 +36,30 @@ extern std::unordered_map<Waif *, bool> destroyed_waifs;
 
 #include "db_private.h"
 
+/* Where to find a waif property on the class object: the slot holding
+ * its value, flags and owner, and the definition, for following a clear
+ * value up to the ancestor it inherits from.
+ */
+typedef struct WaifPropinfo {
+	int		pval;		/* index into the class's propval */
+	Objid		definer;
+	int		index;		/* index into the definer's propdefs */
+} WaifPropinfo;
+
+/* An open-addressed table from property names (hashed without the
+ * WAIF_PROP_PREFIX) to their index in defs, or -1 for an empty slot.
+ */
+typedef struct WaifSlot {
+	int		hash;
+	int		def;
+} WaifSlot;
+
 typedef struct WaifPropdefs {
 	int		refcount;
 	int		length;
+	int		slot_mask;	/* slots has slot_mask + 1 entries */
+	WaifSlot	*slots;
+	WaifPropinfo	*info;		/* one for each of defs */
 	struct Propdef	defs[1];
 } WaifPropdefs;
 
@@ -33,6 +33,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "background.h"
+#include "execute.h"
 #include "functions.h"
 #include "json.h"
 #include "list.h"
@@ -117,21 +119,28 @@ struct parse_context {
     int max_depth;
 };
 
+struct json_writer;
+
+/* Everything the generator needs is reached from here, including its
+ * scratch streams, so several documents can be generated at once on
+ * different threads. */
 struct generate_context {
     mode_type mode;
+    Stream *literal;            /* scratch for value_to_literal() */
+    Stream *typed;              /* scratch for append_type() */
+    struct json_writer *writer;
 };
 
 #define ARRAY_SENTINEL -1
 #define MAP_SENTINEL -2
 
 static const char *
-value_to_literal(Var v)
+value_to_literal(struct generate_context *gctx, Var v)
 {
-    static Stream *s = nullptr;
-    if (!s)
-        s = new_stream(100);
-    unparse_value(s, v);
-    return reset_stream(s);
+    if (!gctx->literal)
+        gctx->literal = new_stream(100);
+    unparse_value(gctx->literal, v);
+    return reset_stream(gctx->literal);
 }
 
 /* If type information is present, extract it and return the type. */
@@ -164,11 +173,11 @@ valid_type(const char **val, size_t *len)
 
 /* Append type information. */
 static const char *
-append_type(const char *str, var_type type)
+append_type(struct generate_context *gctx, const char *str, var_type type)
 {
-    static Stream *stream = nullptr;
-    if (nullptr == stream)
-        stream = new_stream(20);
+    if (nullptr == gctx->typed)
+        gctx->typed = new_stream(20);
+    Stream *stream = gctx->typed;
     stream_add_string(stream, str);
     switch (type) {
         case TYPE_OBJ:
@@ -388,12 +397,19 @@ static int
 handle_end_array(void *ctx)
 {
     struct parse_context *pctx = (struct parse_context *)ctx;
-    Var list = new_list(0);
-    Var v;
-    for (v = POP(pctx->top); (int)v.type > ARRAY_SENTINEL;
-            v = POP(pctx->top)) {
-        list = listinsert(list, v, 1);
-    }
+
+    /* Count the elements first, so the list is allocated once rather
+     * than grown by an insertion at the front for each of them. */
+    Num count = 0;
+    for (struct stack_item *item = pctx->top; (int)item->v.type > ARRAY_SENTINEL;
+            item = item->prev)
+        count++;
+
+    Var list = new_list(count);
+    for (Num i = count; i > 0; i--)
+        list.v.list[i] = POP(pctx->top);
+    POP(pctx->top);     /* the sentinel */
+
     PUSH(pctx->top, list);
     pctx->depth--;
     return 1;
@@ -411,9 +427,9 @@ generate_key(yajl_gen g, Var v, void *ctx)
         case TYPE_ERR:
         case TYPE_BOOL:
         {
-            const char *tmp = value_to_literal(v);
+            const char *tmp = value_to_literal(gctx, v);
             if (MODE_EMBEDDED_TYPES == gctx->mode)
-                tmp = append_type(tmp, v.type);
+                tmp = append_type(gctx, tmp, v.type);
             return yajl_gen_string(g, (const unsigned char *)tmp, strlen(tmp));
         }
         case TYPE_STR:
@@ -422,7 +438,7 @@ generate_key(yajl_gen g, Var v, void *ctx)
             size_t len = strlen(tmp);
             if (MODE_EMBEDDED_TYPES == gctx->mode)
                 if (TYPE_NONE != valid_type(&tmp, &len))
-                    tmp = append_type(tmp, v.type);
+                    tmp = append_type(gctx, tmp, v.type);
             return yajl_gen_string(g, (const unsigned char *)tmp, strlen(tmp));
         }
         case TYPE_ANON:
@@ -444,11 +460,60 @@ struct do_closure {
     yajl_gen_status status;
 };
 
+/* Generated text is collected into chunks of JSON_CHUNK_SIZE bytes and
+ * handed to a sink, so a document never has to be held in memory as a
+ * whole.  Once the sink has failed, nothing more is written. */
+struct json_writer {
+    json_sink sink;
+    void *data;
+    int failed;
+    size_t used;
+    char buffer[JSON_CHUNK_SIZE];
+};
+
+static void
+writer_flush(struct json_writer *w)
+{
+    if (w->used > 0 && !w->failed && !w->sink(w->data, w->buffer, w->used))
+        w->failed = 1;
+    w->used = 0;
+}
+
+static void
+writer_print(void *ctx, const char *str, unsigned int len)
+{
+    struct json_writer *w = (struct json_writer *)ctx;
+
+    if (w->failed)
+        return;
+    if (w->used + len > sizeof(w->buffer)) {
+        writer_flush(w);
+        if (len > sizeof(w->buffer)) {
+            /* Long strings go straight to the sink. */
+            if (!w->failed && !w->sink(w->data, str, len))
+                w->failed = 1;
+            return;
+        }
+    }
+    memcpy(w->buffer + w->used, str, len);
+    w->used += len;
+}
+
+static int
+writer_failed(struct generate_context *gctx)
+{
+    return gctx->writer->failed;
+}
+
 static int
 do_map(Var key, Var value, void *data, int first)
 {
     struct do_closure *dmc = (struct do_closure *)data;
 
+    if (writer_failed(dmc->gctx)) {
+        dmc->status = yajl_gen_in_error_state;
+        return 1;
+    }
     dmc->status = generate_key(dmc->g, key, dmc->gctx);
     if (yajl_gen_status_ok != dmc->status)
         return 1;
@@ -464,6 +529,10 @@ do_list(Var value, void *data, int first)
 {
     struct do_closure *dmc = (struct do_closure *)data;
 
+    if (writer_failed(dmc->gctx)) {
+        dmc->status = yajl_gen_in_error_state;
+        return 1;
+    }
     dmc->status = generate(dmc->g, value, dmc->gctx);
     if (yajl_gen_status_ok != dmc->status)
         return 1;
@@ -484,9 +553,9 @@ generate(yajl_gen g, Var v, void *ctx)
         case TYPE_OBJ:
         case TYPE_ERR:
         {
-            const char *tmp = value_to_literal(v);
+            const char *tmp = value_to_literal(gctx, v);
             if (MODE_EMBEDDED_TYPES == gctx->mode)
-                tmp = append_type(tmp, v.type);
+                tmp = append_type(gctx, tmp, v.type);
             return yajl_gen_string(g, (const unsigned char *)tmp, strlen(tmp));
         }
         case TYPE_STR:
@@ -495,7 +564,7 @@ generate(yajl_gen g, Var v, void *ctx)
             size_t len = strlen(tmp);
             if (MODE_EMBEDDED_TYPES == gctx->mode)
                 if (TYPE_NONE != valid_type(&tmp, &len))
-                    tmp = append_type(tmp, v.type);
+                    tmp = append_type(gctx, tmp, v.type);
             return yajl_gen_string(g, (const unsigned char *)tmp, strlen(tmp));
         }
         case TYPE_MAP:
@@ -547,6 +616,116 @@ static yajl_callbacks callbacks = {
 
 /**** shared helpers ****/
 
+/* An incremental parser.  Text can be fed to it in pieces of any size,
+ * so a document can be parsed as it's read from a file or a connection
+ * without first collecting all of it. */
+struct json_parser {
+    yajl_handle hand;
+    struct parse_context pctx;
+    int strict;
+    int failed;
+    int complete;               /* a whole value has been parsed */
+    size_t unconsumed;          /* bytes of the last feed after the value */
+};
+
+json_parser *
+json_parser_new(int embedded_types, int max_depth, int strict)
+{
+    yajl_parser_config cfg = { strict ? 0U : 1U, 1 };
+
+    json_parser *p = (json_parser *)malloc(sizeof(json_parser));
+    if (p == nullptr)
+        panic_moo("json_parser_new: allocation failed");
+
+    p->pctx.top = &p->pctx.stack;
+    p->pctx.stack.v.type = TYPE_INT;
+    p->pctx.stack.v.v.num = 0;
+    p->pctx.mode = embedded_types ? MODE_EMBEDDED_TYPES : MODE_COMMON_SUBSET;
+    p->pctx.depth = 0;
+    p->pctx.max_depth = max_depth;
+    p->strict = strict;
+    p->failed = 0;
+    p->complete = 0;
+    p->unconsumed = 0;
+    p->hand = yajl_alloc(&callbacks, &cfg, nullptr, (void *)&p->pctx);
+
+    return p;
+}
+
+static int
+only_whitespace(const char *str, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (str[i] != ' ' && str[i] != '\t' && str[i] != '\r' && str[i] != '\n')
+            return 0;
+    return 1;
+}
+
+int
+json_parser_feed(json_parser *p, const char *str, size_t len)
+{
+    while (len > 0 && !p->failed) {
+        /* yajl counts in unsigned ints. */
+        const unsigned int piece = len > JSON_CHUNK_SIZE ? JSON_CHUNK_SIZE : (unsigned int)len;
+
+        /* Note: an intermediate status of "insufficient data" is expected;
+         * for bare scalars it's reported until json_parser_finish() ends
+         * the value.  A handler refusing to go deeper than max_depth
+         * cancels the parse. */
+        const yajl_status stat = yajl_parse(p->hand, (const unsigned char *)str, piece);
+        if (stat != yajl_status_ok && stat != yajl_status_insufficient_data) {
+            p->failed = 1;
+            break;
+        }
+
+        const unsigned int consumed = yajl_get_bytes_consumed(p->hand);
+        if (consumed < piece) {
+            /* The value ended in this piece; whatever follows it is left
+             * for the caller. */
+            p->complete = 1;
+            p->unconsumed = len - consumed;
+            if (p->strict && !only_whitespace(str + consumed, p->unconsumed))
+                p->failed = 1;
+            break;
+        }
+        str += piece;
+        len -= piece;
+    }
+
+    return !p->failed;
+}
+
+size_t
+json_parser_unconsumed(json_parser *p)
+{
+    return p->complete ? p->unconsumed : 0;
+}
+
+int
+json_parser_finish(json_parser *p, Var *out)
+{
+    if (!p->failed && yajl_parse_complete(p->hand) != yajl_status_ok)
+        p->failed = 1;
+
+    if (p->failed || p->pctx.top == &p->pctx.stack)
+        return 0;
+
+    *out = POP(p->pctx.top);
+    return 1;
+}
+
+void
+json_parser_free(json_parser *p)
+{
+    /* clean up the stack */
+    while (p->pctx.top != &p->pctx.stack) {
+        Var v = POP(p->pctx.top);
+        free_var(v);
+    }
+    yajl_free(p->hand);
+    free(p);
+}
+
 /* Parse `len' bytes of JSON text into a MOO value.  Returns 1 and
  * stores the value in `out' on success; returns 0 on failure (and
  * stores nothing).
@@ -559,87 +738,78 @@ int
 json_parse_string(const char *str, size_t len, int embedded_types, int max_depth,
                   int strict, Var *out)
 {
-    yajl_handle hand;
-    yajl_parser_config cfg = { strict ? 0U : 1U, 1 };
-    yajl_status stat;
-    unsigned int consumed = 0;
-
-    struct parse_context pctx;
-    pctx.top = &pctx.stack;
-    pctx.stack.v.type = TYPE_INT;
-    pctx.stack.v.v.num = 0;
-    pctx.mode = embedded_types ? MODE_EMBEDDED_TYPES : MODE_COMMON_SUBSET;
-    pctx.depth = 0;
-    pctx.max_depth = max_depth;
-
-    hand = yajl_alloc(&callbacks, &cfg, nullptr, (void *)&pctx);
-
-    /* Note: the intermediate yajl_parse() status is deliberately ignored;
-     * for bare scalars it reports "insufficient data" until
-     * yajl_parse_complete() finishes the value, and any real error is
-     * reported by yajl_parse_complete() as well. */
-    if (len > 0) {
-        yajl_parse(hand, (const unsigned char *)str, len);
-        consumed = yajl_get_bytes_consumed(hand);
-    }
-    stat = yajl_parse_complete(hand);
-
-    if (strict) {
-        while (consumed < len && (str[consumed] == ' ' || str[consumed] == '\t'
-                                  || str[consumed] == '\r' || str[consumed] == '\n'))
-            consumed++;
-        if (consumed != len)
-            stat = yajl_status_error;
-    }
+    json_parser *p = json_parser_new(embedded_types, max_depth, strict);
 
-    int ok;
-    if (stat != yajl_status_ok || pctx.top == &pctx.stack) {
-        /* clean up the stack */
-        while (pctx.top != &pctx.stack) {
-            Var v = POP(pctx.top);
-            free_var(v);
-        }
-        ok = 0;
-    } else {
-        *out = POP(pctx.top);
-        ok = 1;
-    }
+    const int ok = json_parser_feed(p, str, len) && json_parser_finish(p, out);
 
-    yajl_free(hand);
+    json_parser_free(p);
     return ok;
 }
 
-/* Generate JSON text for a MOO value.  Returns a freshly str_dup()'d
- * string (release with free_str()) or nullptr if the value cannot be
- * represented.
- *
- * NOT thread-safe: the generator uses static scratch streams.  Only
- * call this from the main server thread.
+/* Generate JSON text for a MOO value, `JSON_CHUNK_SIZE' bytes at a time.
+ * Returns 1 if the whole document went to the sink, or 0 if the value
+ * can't be represented or the sink failed; some of the text may have
+ * been written by then.  Safe to call from a background thread.
  */
-char *
-json_generate_string(Var v, int embedded_types, int disable_binary_escapes)
+int
+json_generate_chunked(Var v, int embedded_types, int disable_binary_escapes,
+                      json_sink sink, void *data)
 {
-    yajl_gen g;
     yajl_gen_config cfg = { 0, "", 0 };
+    cfg.disable_binary_escapes = disable_binary_escapes ? 1 : 0;
+
+    struct json_writer *writer = (struct json_writer *)malloc(sizeof(struct json_writer));
+    if (writer == nullptr)
+        panic_moo("json_generate_chunked: allocation failed");
+    writer->sink = sink;
+    writer->data = data;
+    writer->failed = 0;
+    writer->used = 0;
 
     struct generate_context gctx;
     gctx.mode = embedded_types ? MODE_EMBEDDED_TYPES : MODE_COMMON_SUBSET;
+    gctx.literal = nullptr;
+    gctx.typed = nullptr;
+    gctx.writer = writer;
 
-    cfg.disable_binary_escapes = disable_binary_escapes ? 1 : 0;
+    yajl_gen g = yajl_gen_alloc2(writer_print, &cfg, nullptr, writer);
 
-    g = yajl_gen_alloc(&cfg, nullptr);
+    int ok = (yajl_gen_status_ok == generate(g, v, &gctx));
+    if (ok)
+        writer_flush(writer);
+    ok = ok && !writer->failed;
+
+    yajl_gen_free(g);
+    if (gctx.literal)
+        free_stream(gctx.literal);
+    if (gctx.typed)
+        free_stream(gctx.typed);
+    free(writer);
 
+    return ok;
+}
+
+static int
+stream_sink(void *data, const char *bytes, size_t len)
+{
+    stream_add_bytes((Stream *)data, bytes, len);
+    return 1;
+}
+
+/* Generate JSON text for a MOO value.  Returns a freshly str_dup()'d
+ * string (release with free_str()) or nullptr if the value cannot be
+ * represented.  Safe to call from a background thread.
+ */
+char *
+json_generate_string(Var v, int embedded_types, int disable_binary_escapes)
+{
+    Stream *s = new_stream(100);
     char *result = nullptr;
-    if (yajl_gen_status_ok == generate(g, v, &gctx)) {
-        const unsigned char *buf;
-        unsigned int len;
-        yajl_gen_get_buf(g, &buf, &len);
-        result = str_dup((const char *)buf);
-    }
 
-    yajl_gen_clear(g);
-    yajl_gen_free(g);
+    if (json_generate_chunked(v, embedded_types, disable_binary_escapes, stream_sink, s))
+        result = str_dup(stream_contents(s));
 
+    free_stream(s);
     return result;
 }
 
@@ -676,57 +846,66 @@ bf_parse_json(Var arglist, Byte next, void *vdata, Objid progr)
     return pack;
 }
 
-static package
-bf_generate_json(Var arglist, Byte next, void *vdata, Objid progr)
-{
-    yajl_gen g;
-    yajl_gen_config cfg = { 0, "", 0 };
-
-    struct generate_context gctx;
-    gctx.mode = MODE_COMMON_SUBSET;
+/* generate_json() runs on the background thread pool, unless threading
+ * is disabled for the verb. */
+struct generate_request {
+    int embedded_types;
+    int disable_binary_escapes;
+};
 
-    const char *buf;
-    unsigned int len;
+static void
+generate_json_callback(Var arglist, Var *ret, void *extra)
+{
+    struct generate_request *req = (struct generate_request *)extra;
+    char *json = json_generate_string(arglist.v.list[1], req->embedded_types,
+                                      req->disable_binary_escapes);
 
-    Var json;
+    if (json) {
+        ret->type = TYPE_STR;
+        ret->v.str = json;
+    } else {
+        ret->type = TYPE_ERR;
+        ret->v.err = E_INVARG;
+    }
+}
 
-    package pack;
+static void
+generate_request_free(void *extra)
+{
+    free(extra);
+}
 
+static package
+bf_generate_json(Var arglist, Byte next, void *vdata, Objid progr)
+{
     int nargs = arglist.v.list[0].v.num;
+    int embedded_types = 0;
 
     if (nargs >= 2) {
         if (!strcasecmp(arglist.v.list[2].v.str, "common-subset")) {
-            gctx.mode = MODE_COMMON_SUBSET;
+            embedded_types = 0;
         } else if (!strcasecmp(arglist.v.list[2].v.str, "embedded-types")) {
-            gctx.mode = MODE_EMBEDDED_TYPES;
+            embedded_types = 1;
         } else {
             free_var(arglist);
             return make_error_pack(E_INVARG);
         }
     }
 
-    if (nargs >= 3) {
-        cfg.disable_binary_escapes = is_true(arglist.v.list[3]);
-    }
-
-    g = yajl_gen_alloc(&cfg, nullptr);
+    struct generate_request *req = (struct generate_request *)malloc(sizeof(struct generate_request));
+    req->embedded_types = embedded_types;
+    req->disable_binary_escapes = nargs >= 3 && is_true(arglist.v.list[3]);
 
-    if (yajl_gen_status_ok == generate(g, arglist.v.list[1], &gctx)) {
-        yajl_gen_get_buf(g, (const unsigned char **)&buf, &len);
-
-        json.type = TYPE_STR;
-        json.v.str = str_dup(buf);
-
-        pack = make_var_pack(json);
-    } else {
-        pack = make_error_pack(E_INVARG);
-    }
-
-    yajl_gen_clear(g);
-    yajl_gen_free(g);
+    if (get_thread_mode())
+        return background_thread(generate_json_callback, &arglist, req, generate_request_free);
 
+    /* Done here, so a failure is raised rather than returned. */
+    Var json;
+    generate_json_callback(arglist, &json, req);
+    generate_request_free(req);
     free_var(arglist);
-    return pack;
+
+    return json.type == TYPE_ERR ? make_error_pack(json.v.err) : make_var_pack(json);
 }
 
 void
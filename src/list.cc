@@ -16,10 +16,14 @@
  *****************************************************************************/
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <algorithm> // std::sort
 #include "dependencies/strnatcmp.c" // natural sorting
+#include <atomic>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include <ctype.h>
@@ -35,6 +39,7 @@
 #include "map.h"
 #include "options.h"
 #include "pattern.h"
+#include "regex_cache.h"
 #include "streams.h"
 #include "storage.h"
 #include "structures.h"
@@ -520,6 +525,102 @@ unparse_value(Stream * s, Var v)
     }
 }
 
+struct chunked_unparse {
+    Stream *s;
+    unparse_sink sink;
+    void *data;
+};
+
+static void
+unparse_flush_if_full(chunked_unparse *u)
+{
+    if (stream_length(u->s) >= UNPARSE_CHUNK_SIZE) {
+        u->sink(u->data, stream_contents(u->s), stream_length(u->s));
+        reset_stream(u->s);
+    }
+}
+
+static void unparse_value_chunks(chunked_unparse *, Var);
+
+static int
+unparse_map_chunks(Var key, Var value, void *data, int first)
+{
+    chunked_unparse *u = (chunked_unparse *)data;
+
+    if (!first)
+        stream_add_string(u->s, ", ");
+
+    unparse_value_chunks(u, key);
+    stream_add_string(u->s, " -> ");
+    unparse_value_chunks(u, value);
+
+    return 0;
+}
+
+static void
+unparse_value_chunks(chunked_unparse *u, Var v)
+{
+    switch (v.type) {
+        case TYPE_STR:
+        {
+            const char *str = v.v.str;
+
+            stream_add_char(u->s, '"');
+            while (*str) {
+                const char *run = str;
+                while (*str && *str != '"' && *str != '\\' && str - run < UNPARSE_CHUNK_SIZE)
+                    str++;
+                stream_add_bytes(u->s, run, str - run);
+                if (*str == '"' || *str == '\\') {
+                    stream_add_char(u->s, '\\');
+                    stream_add_char(u->s, *str++);
+                }
+                unparse_flush_if_full(u);
+            }
+            stream_add_char(u->s, '"');
+        }
+        break;
+        case TYPE_LIST:
+        {
+            const int len = v.v.list[0].v.num;
+
+            stream_add_char(u->s, '{');
+            for (int i = 1; i <= len; i++) {
+                if (i > 1)
+                    stream_add_string(u->s, ", ");
+                unparse_value_chunks(u, v.v.list[i]);
+            }
+            stream_add_char(u->s, '}');
+        }
+        break;
+        case TYPE_MAP:
+            stream_add_char(u->s, '[');
+            mapforeach(v, unparse_map_chunks, u);
+            stream_add_char(u->s, ']');
+            break;
+        default:
+            unparse_value(u->s, v);
+    }
+
+    unparse_flush_if_full(u);
+}
+
+/* Produces exactly what unparse_value() would, but hands it to `sink' a
+ * piece at a time, so a large list or map never exists in memory as one
+ * literal.  `s' is used as scratch space and is left empty.
+ */
+void
+unparse_value_chunked(Stream *s, Var v, unparse_sink sink, void *data)
+{
+    chunked_unparse u = {s, sink, data};
+
+    unparse_value_chunks(&u, v);
+    if (stream_length(s) > 0) {
+        sink(data, stream_contents(s), stream_length(s));
+        reset_stream(s);
+    }
+}
+
 /* called from utils.c */
 int
 list_sizeof(Var *list)
@@ -629,29 +730,27 @@ make_space_pack()
 /**** built in functions ****/
 
 static package
-bf_length(Var arglist, Byte next, void *vdata, Objid progr)
+bf_length(Var *args, int nargs, Objid progr)
 {
     Var r;
-    switch (arglist.v.list[1].type) {
+    switch (args[0].type) {
         case TYPE_LIST:
             r.type = TYPE_INT;
-            r.v.num = arglist.v.list[1].v.list[0].v.num;
+            r.v.num = args[0].v.list[0].v.num;
             break;
         case TYPE_MAP:
             r.type = TYPE_INT;
-            r.v.num = maplength(arglist.v.list[1]);
+            r.v.num = maplength(args[0]);
             break;
         case TYPE_STR:
             r.type = TYPE_INT;
-            r.v.num = memo_strlen(arglist.v.list[1].v.str);
+            r.v.num = memo_strlen(args[0].v.str);
             break;
         default:
-            free_var(arglist);
             return make_error_pack(E_TYPE);
             break;
     }
 
-    free_var(arglist);
     return make_var_pack(r);
 }
 
@@ -942,7 +1041,404 @@ bf_slice(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(ret);
 }
 
-/* Sorts various MOO types using std::sort.
+/* Values of different types sort by type in this order, except that integers
+ * and floats are compared with each other by value.  Anonymous objects and
+ * WAIFs have no meaningful order and can't be sorted.
+ */
+static int
+sort_rank(var_type type)
+{
+    switch (type) {
+        case TYPE_BOOL:
+            return 0;
+        case TYPE_INT:
+        case TYPE_FLOAT:
+            return 1;
+        case TYPE_OBJ:
+            return 2;
+        case TYPE_ERR:
+            return 3;
+        case TYPE_STR:
+            return 4;
+        case TYPE_LIST:
+            return 5;
+        case TYPE_MAP:
+            return 6;
+        default:
+            return -1;
+    }
+}
+
+static bool
+sortable(Var v)
+{
+    if (sort_rank(v.type) < 0)
+        return false;
+
+    if (v.type == TYPE_LIST) {
+        for (int i = 1; i <= v.v.list[0].v.num; i++)
+            if (!sortable(v.v.list[i]))
+                return false;
+    }
+    else if (v.type == TYPE_MAP) {
+        bool ok = true;
+        mapforeach(v, [](Var key, Var value, void *data, int first) {
+            if (!sortable(key) || !sortable(value))
+                *(bool *)data = false;
+            return *(bool *)data ? 0 : 1;
+        }, &ok);
+        return ok;
+    }
+
+    return true;
+}
+
+static int compare_for_sort(const Var &lhs, const Var &rhs, bool natural);
+
+static std::vector<Var>
+map_pairs_for_sort(Var map)
+{
+    std::vector<Var> pairs;
+    pairs.reserve(maplength(map) * 2);
+    mapforeach(map, [](Var key, Var value, void *data, int first) {
+        ((std::vector<Var> *)data)->push_back(key);
+        ((std::vector<Var> *)data)->push_back(value);
+        return 0;
+    }, &pairs);
+    return pairs;
+}
+
+static int
+compare_sequences_for_sort(const Var *lhs, Num lhs_length, const Var *rhs, Num rhs_length, bool natural)
+{
+    for (Num i = 0; i < lhs_length && i < rhs_length; i++)
+        if (int c = compare_for_sort(lhs[i], rhs[i], natural))
+            return c;
+
+    return lhs_length < rhs_length ? -1 : lhs_length > rhs_length;
+}
+
+/* A total order over sortable values, for sort(). */
+static int
+compare_for_sort(const Var &lhs, const Var &rhs, bool natural)
+{
+    const int lhs_rank = sort_rank(lhs.type), rhs_rank = sort_rank(rhs.type);
+
+    if (lhs_rank != rhs_rank)
+        return lhs_rank < rhs_rank ? -1 : 1;
+
+    switch (lhs.type) {
+        case TYPE_BOOL:
+            return (int)lhs.v.truth - (int)rhs.v.truth;
+        case TYPE_INT:
+        case TYPE_FLOAT:
+        {
+            if (lhs.type == TYPE_INT && rhs.type == TYPE_INT)
+                return lhs.v.num < rhs.v.num ? -1 : lhs.v.num > rhs.v.num;
+            const double l = lhs.type == TYPE_INT ? (double)lhs.v.num : lhs.v.fnum;
+            const double r = rhs.type == TYPE_INT ? (double)rhs.v.num : rhs.v.fnum;
+            if (l != r)
+                return l < r ? -1 : 1;
+            /* An integer comes before a float of the same value. */
+            return (lhs.type == TYPE_FLOAT) - (rhs.type == TYPE_FLOAT);
+        }
+        case TYPE_OBJ:
+            return lhs.v.obj < rhs.v.obj ? -1 : lhs.v.obj > rhs.v.obj;
+        case TYPE_ERR:
+            return (int)lhs.v.err - (int)rhs.v.err;
+        case TYPE_STR:
+            return natural ? strnatcasecmp(lhs.v.str, rhs.v.str) : strcasecmp(lhs.v.str, rhs.v.str);
+        case TYPE_LIST:
+            return compare_sequences_for_sort(lhs.v.list + 1, lhs.v.list[0].v.num,
+                                              rhs.v.list + 1, rhs.v.list[0].v.num, natural);
+        case TYPE_MAP:
+        {
+            const std::vector<Var> l = map_pairs_for_sort(lhs), r = map_pairs_for_sort(rhs);
+            return compare_sequences_for_sort(l.data(), l.size(), r.data(), r.size(), natural);
+        }
+        default:
+            return 0;
+    }
+}
+
+/* Each element to be sorted gets a 64-bit key that orders it the same way
+ * compare_for_sort() would, as far as the key goes.  For integers, floats,
+ * objects and errors the key is the whole value.  For strings it's the
+ * first eight bytes, lowercased, so most comparisons never touch the strings
+ * themselves.  Natural sort keys are described at natural_sort_key().
+ */
+struct sort_entry {
+    uint64_t key;
+    Num index;
+};
+
+enum sort_key_kind {
+    SORT_KEY_EXACT,         /* equal keys mean equal values */
+    SORT_KEY_PREFIX,        /* equal keys need a full comparison */
+    SORT_KEY_NATURAL,       /* see natural_sort_key() */
+    SORT_KEY_NONE           /* keys are all zero; compare the values */
+};
+
+static inline uint64_t
+signed_sort_key(int64_t n)
+{
+    return (uint64_t)n ^ (1ULL << 63);
+}
+
+static inline uint64_t
+float_sort_key(double d)
+{
+    uint64_t bits;
+    if (d == 0.0)
+        d = 0.0;
+    memcpy(&bits, &d, sizeof(bits));
+    return (bits & (1ULL << 63)) ? ~bits : bits | (1ULL << 63);
+}
+
+static inline uint64_t
+string_sort_key(const char *str)
+{
+    uint64_t key = 0;
+    int i = 0;
+
+    for (; i < 8 && str[i]; i++)
+        key = (key << 8) | (unsigned char)tolower((unsigned char)str[i]);
+
+    return key << (8 * (8 - i));
+}
+
+/* strnatcasecmp() compares two strings character by character, uppercased
+ * and as plain `char's, until it meets whitespace (which it skips) or digits
+ * in both strings (which it compares as numbers).  The key holds the
+ * characters that come before any of that, at most seven, mapped so that
+ * they compare as unsigned bytes the way `char' compares, with the count of
+ * them in the low byte.  A digit is kept as the last character, since a
+ * digit opposite a non-digit compares as a character.
+ *
+ * Two keys decide a comparison only if they first differ at a position both
+ * of them cover, and not at a pair of digits.
+ */
+static inline int
+natural_key_byte(char c)
+{
+    return (unsigned char)((int)c - CHAR_MIN);
+}
+
+static inline bool
+natural_key_digit(uint64_t key, int position)
+{
+    const int c = (int)((key >> (8 * (7 - position))) & 0xFF) + CHAR_MIN;
+    return c >= '0' && c <= '9';
+}
+
+static inline uint64_t
+natural_sort_key(const char *str)
+{
+    uint64_t key = 0;
+    int i = 0;
+
+    for (; i < 7; i++) {
+        const char c = str[i];
+        if (isspace((unsigned char)c))
+            break;
+        key = (key << 8) | natural_key_byte(toupper((unsigned char)c));
+        if (!c || isdigit((unsigned char)c)) {
+            i++;
+            break;
+        }
+    }
+
+    return i ? (key << (8 * (8 - i))) | i : 0;
+}
+
+static int
+compare_natural_keys(uint64_t lhs, uint64_t rhs)
+{
+    const uint64_t diff = (lhs ^ rhs) >> 8;
+
+    if (!diff)
+        return 0;
+
+    const int position = __builtin_clzll(diff << 8) / 8;
+    if (position >= (int)std::min(lhs & 0xFF, rhs & 0xFF))
+        return 0;
+    if (natural_key_digit(lhs, position) && natural_key_digit(rhs, position))
+        return 0;
+
+    return lhs < rhs ? -1 : 1;
+}
+
+static sort_key_kind
+make_sort_keys(const Var *values, Num length, bool natural, std::vector<sort_entry> &entries)
+{
+    const var_type type = values[1].type;
+    sort_key_kind kind = SORT_KEY_EXACT;
+
+    for (Num i = 2; i <= length; i++)
+        if (values[i].type != type) {
+            kind = SORT_KEY_NONE;
+            break;
+        }
+
+    if (kind == SORT_KEY_EXACT) {
+        if (type == TYPE_STR)
+            kind = natural ? SORT_KEY_NATURAL : SORT_KEY_PREFIX;
+        else if (type != TYPE_INT && type != TYPE_FLOAT && type != TYPE_OBJ && type != TYPE_ERR)
+            kind = SORT_KEY_NONE;
+    }
+
+    for (Num i = 1; i <= length; i++) {
+        const Var &v = values[i];
+        uint64_t key = 0;
+
+        if (kind != SORT_KEY_NONE) {
+            switch (type) {
+                case TYPE_INT:
+                    key = signed_sort_key(v.v.num);
+                    break;
+                case TYPE_FLOAT:
+                    key = float_sort_key(v.v.fnum);
+                    break;
+                case TYPE_OBJ:
+                    key = signed_sort_key(v.v.obj);
+                    break;
+                case TYPE_ERR:
+                    key = (uint64_t)v.v.err;
+                    break;
+                case TYPE_STR:
+                    key = natural ? natural_sort_key(v.v.str) : string_sort_key(v.v.str);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        entries[i - 1] = {key, i};
+    }
+
+    return kind;
+}
+
+struct SortEntryCompare {
+    SortEntryCompare(const Var *values, sort_key_kind kind, bool natural, bool reverse)
+        : m_values(values), m_kind(kind), m_natural(natural), m_reverse(reverse) {}
+
+    bool operator()(const sort_entry &a, const sort_entry &b) const
+    {
+        const sort_entry &lhs = m_reverse ? b : a;
+        const sort_entry &rhs = m_reverse ? a : b;
+
+        if (m_kind == SORT_KEY_NATURAL) {
+            if (int c = compare_natural_keys(lhs.key, rhs.key))
+                return c < 0;
+        }
+        else if (lhs.key != rhs.key)
+            return lhs.key < rhs.key;
+        else if (m_kind == SORT_KEY_EXACT)
+            return false;
+        return compare_for_sort(m_values[lhs.index], m_values[rhs.index], m_natural) < 0;
+    }
+
+    const Var *m_values;
+    const sort_key_kind m_kind;
+    const bool m_natural;
+    const bool m_reverse;
+};
+
+/* Lists at least this long are sorted in pieces on several threads, which
+ * are then merged pairwise, also in parallel.  The thread running the sort
+ * does one piece itself; the helper threads for the others are shared by
+ * every sort in progress, PARALLEL_SORT_MAX_THREADS in all, so concurrent
+ * sorts can't pile up threads.  A sort that finds none free runs serially.
+ */
+#define PARALLEL_SORT_MIN 65536
+#define PARALLEL_SORT_MAX_THREADS 8
+
+static std::atomic<size_t> sort_helpers_in_use(0);
+
+/* Claim up to WANTED helper threads and return how many were granted. */
+static size_t
+claim_sort_helpers(size_t wanted)
+{
+    size_t in_use = sort_helpers_in_use.load();
+    size_t granted;
+
+    do {
+        granted = std::min(wanted, PARALLEL_SORT_MAX_THREADS - std::min<size_t>(in_use, PARALLEL_SORT_MAX_THREADS));
+    } while (granted > 0 && !sort_helpers_in_use.compare_exchange_weak(in_use, in_use + granted));
+
+    return granted;
+}
+
+/* Run each of JOBS, handing all but the last to a thread of its own. */
+static void
+run_sort_jobs(std::vector<std::function<void()>> &jobs)
+{
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i + 1 < jobs.size(); i++)
+        threads.emplace_back(jobs[i]);
+    if (!jobs.empty())
+        jobs.back()();
+    for (auto &t : threads)
+        t.join();
+}
+
+static void
+parallel_stable_sort(std::vector<sort_entry> &entries, const SortEntryCompare &compare)
+{
+    const size_t length = entries.size();
+    size_t pieces = std::min<size_t>(std::thread::hardware_concurrency(), PARALLEL_SORT_MAX_THREADS);
+    size_t helpers = 0;
+
+    if (length >= PARALLEL_SORT_MIN && pieces >= 2)
+        helpers = claim_sort_helpers(pieces - 1);
+
+    if (helpers == 0) {
+        std::stable_sort(entries.begin(), entries.end(), compare);
+        return;
+    }
+    pieces = helpers + 1;
+
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= pieces; i++)
+        bounds.push_back(length * i / pieces);
+
+    std::vector<std::function<void()>> jobs;
+    for (size_t i = 0; i < pieces; i++)
+        jobs.emplace_back([&, i]() {
+            std::stable_sort(entries.begin() + bounds[i], entries.begin() + bounds[i + 1], compare);
+        });
+    run_sort_jobs(jobs);
+
+    /* Merge neighbouring runs until one is left.  Taking from the left run on
+       ties keeps the sort stable. */
+    std::vector<sort_entry> merged(length);
+    while (bounds.size() > 2) {
+        std::vector<size_t> next_bounds;
+        jobs.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            next_bounds.push_back(bounds[i]);
+            if (i + 2 >= bounds.size()) {
+                std::copy(entries.begin() + bounds[i], entries.begin() + bounds[i + 1], merged.begin() + bounds[i]);
+                continue;
+            }
+            jobs.emplace_back([&, i]() {
+                std::merge(entries.begin() + bounds[i], entries.begin() + bounds[i + 1],
+                           entries.begin() + bounds[i + 1], entries.begin() + bounds[i + 2],
+                           merged.begin() + bounds[i], compare);
+            });
+        }
+        next_bounds.push_back(length);
+        run_sort_jobs(jobs);
+        entries.swap(merged);
+        bounds.swap(next_bounds);
+    }
+
+    sort_helpers_in_use -= helpers;
+}
+
+/* Sorts a list, stably, optionally by the elements of a second list of keys.
  * Args: LIST <values to sort>, [LIST <values to sort by>], [INT <natural sort ordering?>], [INT <reverse?>] */
 void sort_callback(Var arglist, Var *ret, void *extra_data)
 {
@@ -960,62 +1456,28 @@ void sort_callback(Var arglist, Var *ret, void *extra_data)
         return;
     }
 
-    // Create and sort a vector of indices rather than values. This makes it easier to sort a list by another list.
-    std::vector<size_t> s(arglist.v.list[list_to_sort].v.list[0].v.num);
-    const var_type type_to_sort = arglist.v.list[list_to_sort].v.list[1].type;
+    const Var *values = arglist.v.list[list_to_sort].v.list;
+    const Num list_length = values[0].v.num;
 
-    const Num list_length = arglist.v.list[list_to_sort].v.list[0].v.num;
-    for (int count = 1; count <= list_length; count++)
-    {
-        var_type type = arglist.v.list[list_to_sort].v.list[count].type;
-        if (type != type_to_sort || type == TYPE_LIST || type == TYPE_MAP || type == TYPE_ANON || type == TYPE_WAIF)
-        {
+    for (Num count = 1; count <= list_length; count++) {
+        if (!sortable(values[count])) {
             ret->type = TYPE_ERR;
             ret->v.err = E_TYPE;
             return;
         }
-        s[count - 1] = count;
     }
 
-    struct VarCompare {
-        VarCompare(const Var *Arglist, const bool Natural) : m_Arglist(Arglist), m_Natural(Natural) {}
-
-        bool operator()(const size_t a, const size_t b) const
-        {
-            const Var lhs = m_Arglist[a];
-            const Var rhs = m_Arglist[b];
-
-            switch (rhs.type) {
-                case TYPE_INT:
-                    return lhs.v.num < rhs.v.num;
-                case TYPE_FLOAT:
-                    return lhs.v.fnum < rhs.v.fnum;
-                case TYPE_OBJ:
-                    return lhs.v.obj < rhs.v.obj;
-                case TYPE_ERR:
-                    return ((int) lhs.v.err) < ((int) rhs.v.err);
-                case TYPE_STR:
-                    return (m_Natural ? strnatcasecmp(lhs.v.str, rhs.v.str) : strcasecmp(lhs.v.str, rhs.v.str)) < 0;
-                default:
-                    errlog("Unknown type in sort compare: %d\n", rhs.type);
-                    return 0;
-            }
-        }
-        const Var *m_Arglist;
-        const bool m_Natural;
-    };
+    // Sort indices rather than values. This makes it easier to sort a list by another list.
+    std::vector<sort_entry> s(list_length);
+    const sort_key_kind kind = make_sort_keys(values, list_length, natural, s);
 
-    std::sort(s.begin(), s.end(), VarCompare(arglist.v.list[list_to_sort].v.list, natural));
+    parallel_stable_sort(s, SortEntryCompare(values, kind, natural, reverse));
 
     *ret = new_list(s.size());
 
-    if (reverse)
-        std::reverse(std::begin(s), std::end(s));
-
     int moo_list_pos = 0;
     for (const auto &it : s) {
-        ret->v.list[++moo_list_pos] = var_ref(arglist.v.list[1].v.list[it]);
-
+        ret->v.list[++moo_list_pos] = var_ref(arglist.v.list[1].v.list[it.index]);
     }
 }
 
@@ -1209,73 +1671,31 @@ bf_toliteral(Var arglist, Byte next, void *vdata, Objid progr)
     return p;
 }
 
-struct pat_cache_entry {
-    char *string;
-    int case_matters;
-    Pattern pattern;
-    struct pat_cache_entry *next;
-};
-
-static struct pat_cache_entry *pat_cache;
-static struct pat_cache_entry pat_cache_entries[PATTERN_CACHE_SIZE];
-
 static void
-setup_pattern_cache()
+free_cached_pattern(void *ptr)
 {
-    int i;
-
-    for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
-        pat_cache_entries[i].string = nullptr;
-        pat_cache_entries[i].pattern.ptr = nullptr;
-    }
+    Pattern p;
 
-    for (i = 0; i < PATTERN_CACHE_SIZE - 1; i++)
-        pat_cache_entries[i].next = &(pat_cache_entries[i + 1]);
-    pat_cache_entries[PATTERN_CACHE_SIZE - 1].next = nullptr;
-
-    pat_cache = &(pat_cache_entries[0]);
+    p.ptr = ptr;
+    free_pattern(p);
 }
 
-static Pattern
+/* Returns a referenced cache entry holding the compiled pattern, or nullptr
+   if it doesn't compile. Release it with regex_cache_release(). */
+static regex_cache_entry *
 get_pattern(const char *string, int case_matters)
 {
-    struct pat_cache_entry *entry, **entry_ptr;
+    regex_cache_entry *entry = regex_cache_find(REGEX_MOO, case_matters, string);
 
-    entry = pat_cache;
-    entry_ptr = &pat_cache;
+    if (entry)
+        return entry;
 
-    while (1) {
-        if (entry->string && !strcmp(string, entry->string)
-                && case_matters == entry->case_matters) {
-            /* A cache hit; move this entry to the front of the cache. */
-            break;
-        } else if (!entry->next) {
-            /* A cache miss; this is the last entry in the cache, so reuse that
-             * one for this pattern, moving it to the front of the cache iff
-             * the compilation succeeds.
-             */
-            if (entry->string) {
-                free_str(entry->string);
-                free_pattern(entry->pattern);
-            }
-            entry->pattern = new_pattern(string, case_matters);
-            entry->case_matters = case_matters;
-            if (!entry->pattern.ptr)
-                entry->string = nullptr;
-            else
-                entry->string = str_dup(string);
-            break;
-        } else {
-            /* not done searching the cache... */
-            entry_ptr = &(entry->next);
-            entry = entry->next;
-        }
-    }
+    Pattern p = new_pattern(string, case_matters);
+    if (!p.ptr)
+        return nullptr;
 
-    *entry_ptr = entry->next;
-    entry->next = pat_cache;
-    pat_cache = entry;
-    return entry->pattern;
+    return regex_cache_insert(REGEX_MOO, case_matters, string, p.ptr,
+                              pattern_size(p), free_cached_pattern);
 }
 
 Var
@@ -1283,49 +1703,54 @@ do_match(Var arglist, int reverse)
 {
     const char *subject, *pattern;
     int i;
+    regex_cache_entry *entry;
     Pattern pat;
     Var ans;
     Match_Indices regs[10];
 
     subject = arglist.v.list[1].v.str;
     pattern = arglist.v.list[2].v.str;
-    pat = get_pattern(pattern, (arglist.v.list[0].v.num == 3
-                                && is_true(arglist.v.list[3])));
+    entry = get_pattern(pattern, (arglist.v.list[0].v.num == 3
+                                  && is_true(arglist.v.list[3])));
 
-    if (!pat.ptr) {
+    if (!entry) {
         ans.type = TYPE_ERR;
         ans.v.err = E_INVARG;
-    } else
-        switch (match_pattern(pat, subject, regs, reverse)) {
-            default:
-                panic_moo("do_match:  match_pattern returned unfortunate value.\n");
-            /*notreached*/
-            case MATCH_SUCCEEDED:
-                ans = new_list(4);
-                ans.v.list[1].type = TYPE_INT;
-                ans.v.list[2].type = TYPE_INT;
-                ans.v.list[4].type = TYPE_STR;
-                ans.v.list[1].v.num = regs[0].start;
-                ans.v.list[2].v.num = regs[0].end;
-                ans.v.list[3] = new_list(9);
-                ans.v.list[4].v.str = str_ref(subject);
-                for (i = 1; i <= 9; i++) {
-                    ans.v.list[3].v.list[i] = new_list(2);
-                    ans.v.list[3].v.list[i].v.list[1].type = TYPE_INT;
-                    ans.v.list[3].v.list[i].v.list[1].v.num = regs[i].start;
-                    ans.v.list[3].v.list[i].v.list[2].type = TYPE_INT;
-                    ans.v.list[3].v.list[i].v.list[2].v.num = regs[i].end;
-                }
-                break;
-            case MATCH_FAILED:
-                ans = new_list(0);
-                break;
-            case MATCH_ABORTED:
-                ans.type = TYPE_ERR;
-                ans.v.err = E_QUOTA;
-                break;
-        }
+        return ans;
+    }
+
+    pat.ptr = entry->value;
+    switch (match_pattern(pat, subject, regs, reverse)) {
+        default:
+            panic_moo("do_match:  match_pattern returned unfortunate value.\n");
+        /*notreached*/
+        case MATCH_SUCCEEDED:
+            ans = new_list(4);
+            ans.v.list[1].type = TYPE_INT;
+            ans.v.list[2].type = TYPE_INT;
+            ans.v.list[4].type = TYPE_STR;
+            ans.v.list[1].v.num = regs[0].start;
+            ans.v.list[2].v.num = regs[0].end;
+            ans.v.list[3] = new_list(9);
+            ans.v.list[4].v.str = str_ref(subject);
+            for (i = 1; i <= 9; i++) {
+                ans.v.list[3].v.list[i] = new_list(2);
+                ans.v.list[3].v.list[i].v.list[1].type = TYPE_INT;
+                ans.v.list[3].v.list[i].v.list[1].v.num = regs[i].start;
+                ans.v.list[3].v.list[i].v.list[2].type = TYPE_INT;
+                ans.v.list[3].v.list[i].v.list[2].v.num = regs[i].end;
+            }
+            break;
+        case MATCH_FAILED:
+            ans = new_list(0);
+            break;
+        case MATCH_ABORTED:
+            ans.type = TYPE_ERR;
+            ans.v.err = E_QUOTA;
+            break;
+    }
 
+    regex_cache_release(entry);
     return ans;
 }
 
@@ -1762,7 +2187,7 @@ register_list(void)
     register_function("encode_binary", 0, -1, bf_encode_binary);
     register_function("chr", 0, -1, bf_chr);
     /* list */
-    register_function("length", 1, 1, bf_length, TYPE_ANY);
+    register_function_fast("length", 1, 1, bf_length, TYPE_ANY);
     register_function("setadd", 2, 2, bf_setadd, TYPE_LIST, TYPE_ANY);
     register_function("setremove", 2, 2, bf_setremove, TYPE_LIST, TYPE_ANY);
     register_function("listappend", 2, 3, bf_listappend,
@@ -1782,7 +2207,6 @@ register_list(void)
     /* string */
     register_function("tostr", 0, -1, bf_tostr);
     register_function("toliteral", 1, 1, bf_toliteral, TYPE_ANY);
-    setup_pattern_cache();
     register_function("match", 2, 3, bf_match, TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("rmatch", 2, 3, bf_rmatch, TYPE_STR, TYPE_STR, TYPE_ANY);
     register_function("substitute", 2, 2, bf_substitute, TYPE_STR, TYPE_LIST);
@@ -21,6 +21,8 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <mutex>
 
 #include "bf_register.h"
 #include "config.h"
@@ -34,9 +36,22 @@
 static FILE *log_file = nullptr;
 static const char *log_file_name = nullptr;
 
+/* Threads other than the main one log too (the watchdog, background
+ * functions), so writing a message and switching log files take turns.
+ * Once set_log_file() returns, nothing is still writing to the old file.
+ * The lock is recursive so that a panic while logging can still log, and
+ * is held across fork() so that a checkpointer never inherits it locked.
+ */
+static std::recursive_mutex log_mutex;
+
+static void lock_log(void) { log_mutex.lock(); }
+static void unlock_log(void) { log_mutex.unlock(); }
+static const int log_atfork = pthread_atfork(lock_log, unlock_log, unlock_log);
+
 void
 set_log_file(FILE * f)
 {
+    std::lock_guard<std::recursive_mutex> lock(log_mutex);
     log_file = f;
 }
 
@@ -63,6 +78,7 @@ do_log(const int severity, const char *fmt, va_list args)
 {
     FILE *f;
     char nowstr[16];
+    std::lock_guard<std::recursive_mutex> lock(log_mutex);
 
     if (log_file) {
         time_t current_time;
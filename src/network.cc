@@ -36,6 +36,10 @@
 #include <netinet/tcp.h>
 #include <atomic>
 #include <vector>
+#include <poll.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 
 #include "options.h"
 #include "config.h"
@@ -48,6 +52,9 @@
 #include "timers.h"
 #include "utils.h"
 #include "map.h"
+#ifdef USE_TLS
+#include "thpool.h"
+#endif
 
 static struct proto proto;
 static int eol_length;      /* == strlen(proto.eol_out_string) */
@@ -71,10 +78,20 @@ static int *pocket_descriptors = nullptr;   /* fds we keep around in case we nee
 SSL_CTX *tls_ctx;
 #endif
 
+/* Output is queued as a list of text_blocks, each of which points into a
+ * reference-counted, immutable output_buffer.  A single buffer may be
+ * shared by the output queues of many connections (see notify_all()).
+ */
+typedef struct output_buffer {
+    unsigned int refcount;
+    int length;
+    char *data;
+} output_buffer;
+
 typedef struct text_block {
     struct text_block *next;
-    char *buffer;
-    char *start;
+    output_buffer *buffer;
+    const char *start;
     int length;
 } text_block;
 
@@ -108,23 +125,52 @@ typedef struct nhandle {
     uint8_t keep_alive_count;
     sa_family_t protocol_family;            // AF_INET, AF_INET6
     bool last_input_was_CR;
-    bool input_suspended;
+    std::atomic<bool> input_suspended;
     bool outbound, binary;
     bool client_echo;
     bool keep_alive;
     TelnetState telnet_state;
     Stream *command_stream;    // Accumulates telnet command currently being processed
     unsigned char telnet_cmd;  // Current command byte being processed
+    char *read_buffer;                      // grows and shrinks with the size of reads
+    int read_buffer_size;
+    int largest_read;
+    uint64_t reads;                         // number of reads returning data
+    uint64_t bytes_read;
 
 #ifdef USE_TLS
     SSL *tls;                               // TLS context; not TLS if null
     bool connected;
     bool want_write;
+    bool handshake_pending;                 // a TLS worker thread owns `tls'
+#endif
+#ifdef NETWORK_THREAD
+    struct io_state *io;                    // non-null if the network thread owns the socket
 #endif
 } nhandle;
 
 static nhandle *all_nhandles = nullptr;
 
+#ifdef USE_TLS
+/* The server side of a TLS handshake is expensive, so each step of it is run
+ * on a small pool of worker threads. While a step is in flight, the worker
+ * owns the connection's SSL object and holds a reference to the nhandle; the
+ * main loop ignores the connection until the worker pushes the result onto
+ * the lock-free `finished_handshakes' stack and wakes it up through
+ * `tls_wakeup_fds'.
+ */
+typedef struct tls_handshake {
+    struct tls_handshake *next;
+    nhandle *h;
+    int error;
+    char error_string[256];
+} tls_handshake;
+
+static threadpool tls_pool = nullptr;
+static std::atomic<tls_handshake *> finished_handshakes(nullptr);
+static int tls_wakeup_fds[2] = {-1, -1};
+#endif
+
 typedef struct nlistener {
     struct nlistener *next, **prev;
     server_listener slistener;
@@ -143,6 +189,54 @@ typedef struct nlistener {
 
 static nlistener *all_nlisteners = nullptr;
 
+#ifdef NETWORK_THREAD
+/* With NETWORK_THREAD, a dedicated thread owns the sockets of plain (non-TLS)
+ * connections. Each connection has two single-producer/single-consumer rings:
+ * the network thread reads into `input' and the main loop splits it into
+ * lines; the main loop hands text_blocks to `output' and the network thread
+ * writes them. In each ring the producer only ever advances `head' and the
+ * consumer only ever advances its own index. Handed-off text_blocks belong to
+ * the main thread and are freed by it once the network thread has written them.
+ * Only about half of max_queued_output is handed off at a time; the rest waits
+ * in the usual output queue, where make_room_for_output() can still discard it.
+ */
+#define IO_INPUT_RING_SIZE      65536   /* bytes; must be a power of two */
+#define IO_OUTPUT_RING_SIZE     256     /* text_blocks; must be a power of two */
+
+enum io_status {
+    IO_OK, IO_EOF, IO_ERROR
+};
+
+typedef struct io_state {
+    nhandle *h;
+    char input[IO_INPUT_RING_SIZE];
+    std::atomic<size_t> input_head;         // network thread
+    std::atomic<size_t> input_tail;         // main thread
+    text_block *output[IO_OUTPUT_RING_SIZE];
+    std::atomic<size_t> output_head;        // main thread
+    std::atomic<size_t> output_written;     // network thread
+    size_t output_reclaimed;                // main thread
+    size_t output_bytes;                    // main thread; bytes handed off and not yet reclaimed
+    size_t output_offset;                   // network thread; bytes of the current block already sent
+    std::atomic<int> status;                // network thread
+    std::atomic<bool> detach;               // main thread asks the network thread to let go
+    bool detached;                          // protected by io_mutex
+} io_state;
+
+static pthread_t io_thread;
+static bool io_thread_running = false;
+static std::atomic<bool> io_thread_stop(false);
+static std::mutex io_mutex;                 // guards io_pending and io_state::detached
+static std::condition_variable io_detached_cv;
+static std::vector<io_state *> io_pending;  // connections waiting to be picked up
+static int io_wakeup_fds[2] = {-1, -1};     // wakes the network thread
+static int main_wakeup_fds[2] = {-1, -1};   // wakes the main loop
+static std::atomic<bool> io_wakeup_pending(false);
+static std::atomic<bool> main_wakeup_pending(false);
+
+static int handoff_output(nhandle *h);
+#endif /* NETWORK_THREAD */
+
 typedef struct {
     void *data;
     network_fd_callback readable;
@@ -235,10 +329,33 @@ check_registered_fds(void)
 }
 
 
+static output_buffer *
+new_output_buffer(const char *bytes, int length, bool add_eol)
+{
+    int total = length + (add_eol ? eol_length : 0);
+    output_buffer *buf = (output_buffer *) mymalloc(sizeof(output_buffer) + total, M_NETWORK);
+
+    buf->refcount = 1;
+    buf->length = total;
+    buf->data = (char *) (buf + 1);
+    memcpy(buf->data, bytes, length);
+    if (add_eol)
+        memcpy(buf->data + length, proto.eol_out_string, eol_length);
+
+    return buf;
+}
+
+static void
+release_output_buffer(output_buffer *buf)
+{
+    if (--buf->refcount == 0)
+        myfree(buf, M_NETWORK);
+}
+
 static void
 free_text_block(text_block * b)
 {
-    myfree(b->buffer, M_NETWORK);
+    release_output_buffer(b->buffer);
     myfree(b, M_NETWORK);
 }
 
@@ -315,6 +432,10 @@ push_network_buffer_overflow(nhandle *h)
 static int
 push_output(nhandle * h)
 {
+#ifdef NETWORK_THREAD
+    if (h->io)
+        return handoff_output(h);
+#endif
 #ifdef USE_TLS
     if (h->tls && !h->connected)
         return 1;
@@ -468,57 +589,271 @@ process_telnet_byte(nhandle *h, Stream *input_stream, Stream *oob_stream, unsign
     return 1;
 }
 
+/* Process a chunk of ordinary text input, containing no telnet commands,
+ * a run of bytes at a time rather than byte by byte.  This is equivalent
+ * to feeding each byte to process_telnet_byte() in TELNET_STATE_NORMAL.
+ */
+static void
+process_plain_text(nhandle *h, Stream *input_stream, const char *ptr, const char *end)
+{
+    const char *next_cr = nullptr, *next_lf = nullptr;
+
+    while (ptr < end) {
+        if (!next_cr || next_cr < ptr) {
+            next_cr = (const char *) memchr(ptr, '\r', end - ptr);
+            if (!next_cr)
+                next_cr = end;
+        }
+        if (!next_lf || next_lf < ptr) {
+            next_lf = (const char *) memchr(ptr, '\n', end - ptr);
+            if (!next_lf)
+                next_lf = end;
+        }
+        const char *eol = next_cr < next_lf ? next_cr : next_lf;
+
+        if (eol > ptr) {
+            while (ptr < eol) {
+                const char *run = ptr;
+                while (ptr < eol && (isgraph((unsigned char) *ptr) || *ptr == ' ' || *ptr == '\t'))
+                    ptr++;
+                if (ptr > run)
+                    stream_add_bytes(input_stream, run, ptr - run);
+                if (ptr < eol) {
+#ifdef INPUT_APPLY_BACKSPACE
+                    if (*ptr == 0x08 || *ptr == 0x7F)
+                        stream_delete_char(input_stream);
+#endif
+                    ptr++;
+                }
+            }
+            h->last_input_was_CR = false;
+        }
+
+        if (eol == end)
+            break;
+
+        if (*eol == '\r' || !h->last_input_was_CR)
+            server_receive_line(h->shandle, reset_stream(input_stream), 0);
+        h->last_input_was_CR = (*eol == '\r');
+        ptr = eol + 1;
+    }
+}
+
 static int
-pull_input(nhandle * h)
+process_input(nhandle *h, const char *buffer, int count)
 {
     Stream *s = h->input;
 
-    if (stream_length(s) >= MAX_LINE_BYTES) {
-        errlog("Connection `%s` closed for exceeding MAX_LINE_BYTES! (%" PRIdN " /%" PRIdN ")\n", h->name,
-               stream_length(s), MAX_LINE_BYTES);
-        return 0;
+    if (h->binary) {
+        stream_add_raw_bytes_to_binary(s, buffer, count);
+        server_receive_line(h->shandle, reset_stream(s), false);
+        h->last_input_was_CR = 0;
+    } else if (h->telnet_state == TELNET_STATE_NORMAL && !memchr(buffer, TN_IAC, count)) {
+        process_plain_text(h, s, buffer, buffer + count);
+    } else {
+        Stream *oob = new_stream(100);
+        const char *ptr, *end;
+
+        for (ptr = buffer, end = buffer + count; ptr < end; ptr++) {
+            if (!process_telnet_byte(h, s, oob, *ptr)) {
+                free_stream(oob);
+                return 0;  // Close connection due to oversize telnet command
+            }
+        }
+
+        if (stream_length(oob) > 0) {
+            server_receive_line(h->shandle, reset_stream(oob), 1);
+        }
+
+        free_stream(oob);
     }
+    return 1;
+}
 
-    int count;
-    char buffer[1024];
-    char *ptr, *end;
+/* Adjust the size of H's read buffer after a read of COUNT bytes: grow it
+ * when a read fills it and shrink it again when reads use a small fraction.
+ */
+static void
+resize_read_buffer(nhandle *h, int count)
+{
+    int size = h->read_buffer_size;
+
+    if (count == size && size < NETWORK_READ_BUFFER_MAX)
+        size *= 2;
+    else if (count < size / 4 && size > NETWORK_READ_BUFFER_MIN)
+        size /= 2;
+    else
+        return;
+
+    myfree(h->read_buffer, M_NETWORK);
+    h->read_buffer = (char *) mymalloc(size, M_NETWORK);
+    h->read_buffer_size = size;
+}
 
 #ifdef USE_TLS
-    if (h->tls) {
-        int error = 0;
-        if (!h->connected) {
-            int tls_success = SSL_accept(h->tls);
-            error = SSL_get_error(h->tls, tls_success);
-            ERR_clear_error();
-            switch (error) {
-                case SSL_ERROR_WANT_READ:
-                case SSL_ERROR_WANT_WRITE:
-                    return 1;
-                    break;
-                case SSL_ERROR_SYSCALL:
-                    return 0;
-                    break;
-                case SSL_ERROR_NONE:
-                    h->connected = true;
-                    break;
-                default: {
-                    pthread_mutex_lock(h->name_mutex);
-                    errlog("TLS: Accept failed (%i) from %s: %s\n", error, h->name, ERR_error_string(ERR_get_error(), nullptr));
-                    pthread_mutex_unlock(h->name_mutex);
-                    return 0;
-                }
-            }
-#ifdef LOG_TLS_CONNECTIONS
+/* Act on the result of one SSL_accept() step.  Returns 0 if the connection
+ * should be closed.
+ */
+static int
+finish_tls_accept(nhandle *h, int error, const char *error_string)
+{
+    switch (error) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return 1;
+            break;
+        case SSL_ERROR_SYSCALL:
+            return 0;
+            break;
+        case SSL_ERROR_NONE:
+            h->connected = true;
+            break;
+        default: {
             pthread_mutex_lock(h->name_mutex);
-            oklog("TLS: %s for %s. Cipher: %s\n", SSL_state_string_long(h->tls), h->name, SSL_get_cipher(h->tls));
+            errlog("TLS: Accept failed (%i) from %s: %s\n", error, h->name, error_string);
             pthread_mutex_unlock(h->name_mutex);
+            return 0;
+        }
+    }
+#ifdef LOG_TLS_CONNECTIONS
+    pthread_mutex_lock(h->name_mutex);
+    oklog("TLS: %s for %s. Cipher: %s\n", SSL_state_string_long(h->tls), h->name, SSL_get_cipher(h->tls));
+    pthread_mutex_unlock(h->name_mutex);
 #endif
-            return 1;
+    return 1;
+}
+
+static void
+run_tls_accept(nhandle *h, int *error, char *error_string, size_t length)
+{
+    int tls_success = SSL_accept(h->tls);
+
+    *error = SSL_get_error(h->tls, tls_success);
+    if (*error != SSL_ERROR_NONE && *error != SSL_ERROR_WANT_READ && *error != SSL_ERROR_WANT_WRITE)
+        ERR_error_string_n(ERR_get_error(), error_string, length);
+    else
+        *error_string = '\0';
+    ERR_clear_error();
+}
+
+/* Runs on a TLS worker thread. */
+static void
+tls_handshake_worker(void *data)
+{
+    tls_handshake *job = (tls_handshake *) data;
+
+    run_tls_accept(job->h, &job->error, job->error_string, sizeof(job->error_string));
+
+    job->next = finished_handshakes.load();
+    while (!finished_handshakes.compare_exchange_weak(job->next, job))
+        ;
+    write(tls_wakeup_fds[1], "1", 1);
+}
+
+/* Called by the main loop when a worker has finished a handshake step. */
+static void
+tls_handshakes_finished(int fd, void *data)
+{
+    char buffer[64];
+
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+        ;
+
+    tls_handshake *job = finished_handshakes.exchange(nullptr);
+    while (job) {
+        tls_handshake *next = job->next;
+        nhandle *h = job->h;
+        network_handle nh;
+
+        nh.ptr = h;
+        h->handshake_pending = false;
+        if (get_nhandle_refcount(h) == 1) {
+            /* The connection was closed while the worker had it. */
+            decrement_nhandle_refcount(nh);
         } else {
-            count = SSL_read(h->tls, buffer, sizeof(buffer));
+            decrement_nhandle_refcount(nh);
+            if (!finish_tls_accept(h, job->error, job->error_string) && get_nhandle_refcount(h) == 1) {
+                server_close(h->shandle);
+                decrement_nhandle_refcount(nh);
+            }
+        }
+        myfree(job, M_NETWORK);
+        job = next;
+    }
+}
+
+static int
+continue_tls_accept(nhandle *h)
+{
+    if (tls_pool) {
+        tls_handshake *job = (tls_handshake *) mymalloc(sizeof(tls_handshake), M_NETWORK);
+        network_handle nh;
+
+        nh.ptr = job->h = h;
+        h->handshake_pending = true;
+        increment_nhandle_refcount(nh);
+        if (thpool_add_work(tls_pool, tls_handshake_worker, job) == 0)
+            return 1;
+
+        errlog("TLS: Error adding handshake to thread pool\n");
+        h->handshake_pending = false;
+        h->refcount--;
+        myfree(job, M_NETWORK);
+    }
+
+    int error;
+    char error_string[256];
+
+    run_tls_accept(h, &error, error_string, sizeof(error_string));
+    return finish_tls_accept(h, error, error_string);
+}
+
+static void
+init_tls_handshake_pool(void)
+{
+    if (TLS_HANDSHAKE_THREADS <= 0)
+        return;
+
+    if (pipe(tls_wakeup_fds) < 0) {
+        log_perror("Creating TLS wakeup pipe");
+        return;
+    }
+    network_set_nonblocking(tls_wakeup_fds[0]);
+    network_set_nonblocking(tls_wakeup_fds[1]);
+    network_register_fd(tls_wakeup_fds[0], tls_handshakes_finished, nullptr, nullptr);
+    tls_pool = thpool_init(TLS_HANDSHAKE_THREADS);
+}
+#endif /* USE_TLS */
+
+static int
+pull_input(nhandle * h)
+{
+    Stream *s = h->input;
+    int count;
+    int budget = NETWORK_READ_BUDGET;
+
+#ifdef USE_TLS
+    if (h->tls && !h->connected)
+        return continue_tls_accept(h);
+#endif
+
+    /* Drain the connection until it would block, input gets suspended, or
+     * we've used up this connection's share of the main loop. */
+    do {
+        if (stream_length(s) >= MAX_LINE_BYTES) {
+            errlog("Connection `%s` closed for exceeding MAX_LINE_BYTES! (%" PRIdN " /%" PRIdN ")\n", h->name,
+                   stream_length(s), MAX_LINE_BYTES);
+            return 0;
+        }
+
+        int size = h->read_buffer_size;
+
+#ifdef USE_TLS
+        if (h->tls) {
+            count = SSL_read(h->tls, h->read_buffer, size);
 
             if (count <= 0) {
-                error = SSL_get_error(h->tls, count);
+                int error = SSL_get_error(h->tls, count);
                 ERR_clear_error();
                 switch (error) {
                     case SSL_ERROR_WANT_READ:
@@ -538,39 +873,418 @@ pull_input(nhandle * h)
                     }
                 }
             }
-        }
-    } else
+        } else
 #endif
-        count = read(h->rfd, buffer, sizeof(buffer));
+            count = read(h->rfd, h->read_buffer, size);
+
+        if (count <= 0)
+            return (count == 0 && !proto.believe_eof)
+                   || (count < 0 && (errno == eagain || errno == ewouldblock));
+
+        h->reads++;
+        h->bytes_read += count;
+        if (count > h->largest_read)
+            h->largest_read = count;
+
+        if (!process_input(h, h->read_buffer, count))
+            return 0;
+
+        resize_read_buffer(h, count);
+        budget -= count;
+
+        /* A short read from a plain socket means it's been drained. TLS reads
+           return at most one record, so keep going until OpenSSL says to wait. */
+        if (count < size
+#ifdef USE_TLS
+                && !h->tls
+#endif
+           )
+            break;
+    } while (budget > 0 && !h->input_suspended);
+
+    return 1;
+}
+
+#ifdef NETWORK_THREAD
+static void
+wake_fd(int fd, std::atomic<bool> *pending)
+{
+    if (!pending->exchange(true))
+        write(fd, "1", 1);
+}
+
+static void
+drain_fd(int fd, std::atomic<bool> *pending)
+{
+    char buffer[64];
+
+    pending->store(false);
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+/* Free the blocks the network thread has finished writing. */
+static void
+reclaim_output(nhandle *h)
+{
+    io_state *io = h->io;
+    size_t written = io->output_written.load(std::memory_order_acquire);
+
+    while (io->output_reclaimed != written) {
+        text_block *b = io->output[io->output_reclaimed & (IO_OUTPUT_RING_SIZE - 1)];
+        h->output_length -= b->length;
+        io->output_bytes -= b->length;
+        free_text_block(b);
+        io->output_reclaimed++;
+    }
+}
+
+static inline void
+handoff_block(io_state *io, text_block *b)
+{
+    size_t head = io->output_head.load(std::memory_order_relaxed);
+
+    io->output[head & (IO_OUTPUT_RING_SIZE - 1)] = b;
+    io->output_bytes += b->length;
+    io->output_head.store(head + 1, std::memory_order_release);
+}
+
+/* Whether a block of LENGTH bytes may join the output ring now.  Anything
+ * goes into an empty ring, so that a single large block still gets written.
+ */
+static inline bool
+ring_has_room(io_state *io, size_t length)
+{
+    size_t used = io->output_head.load(std::memory_order_relaxed) - io->output_reclaimed;
+
+    return used == 0 || (used < IO_OUTPUT_RING_SIZE
+                         && io->output_bytes + length <= (size_t) server_flag_option_cached(SVO_MAX_QUEUED_OUTPUT) / 2);
+}
+
+/* The threaded equivalent of push_output(): move as much of the main
+ * thread's output queue as ring_has_room() allows into the output ring and
+ * wake up the network thread.  Returns 0 if the network thread has given up
+ * on the connection.
+ */
+static int
+handoff_output(nhandle *h)
+{
+    io_state *io = h->io;
+    text_block *b;
+    bool handed_off = false;
+
+    reclaim_output(h);
+
+    if (io->status.load(std::memory_order_acquire) == IO_ERROR)
+        return 0;
 
-    if (count > 0) {
-        if (h->binary) {
-            stream_add_raw_bytes_to_binary(s, buffer, count);
-            server_receive_line(h->shandle, reset_stream(s), false);
-            h->last_input_was_CR = 0;
+    if (h->output_lines_flushed > 0) {
+        char buf[100];
+        int length = sprintf(buf,
+                             "%s>> Network buffer overflow: %i line%s of output to you %s been lost <<%s",
+                             proto.eol_out_string,
+                             h->output_lines_flushed,
+                             h->output_lines_flushed == 1 ? "" : "s",
+                             h->output_lines_flushed == 1 ? "has" : "have", proto.eol_out_string);
+
+        if (ring_has_room(io, length)) {
+            b = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+            b->buffer = new_output_buffer(buf, length, false);
+            b->start = b->buffer->data;
+            b->length = b->buffer->length;
+            h->output_length += b->length;
+            handoff_block(io, b);
+            h->output_lines_flushed = 0;
+            handed_off = true;
+        }
+    }
+
+    /* Nothing may overtake the overflow notice. */
+    while (h->output_lines_flushed == 0 && (b = h->output_head) != nullptr && ring_has_room(io, b->length)) {
+        h->output_head = b->next;
+        b->next = nullptr;
+        handoff_block(io, b);
+        handed_off = true;
+    }
+
+    if (h->output_head == nullptr)
+        h->output_tail = &(h->output_head);
+
+    if (handed_off)
+        wake_fd(io_wakeup_fds[1], &io_wakeup_pending);
+
+    return 1;
+}
+
+/* Feed whatever the network thread has read into the usual input
+ * processing.  Returns 0 if the connection should be closed.
+ */
+static int
+drain_input(nhandle *h)
+{
+    io_state *io = h->io;
+    int status = io->status.load(std::memory_order_acquire);
+    size_t head = io->input_head.load(std::memory_order_acquire);
+    size_t tail = io->input_tail.load(std::memory_order_relaxed);
+
+    while (tail != head && !h->input_suspended) {
+        if (stream_length(h->input) >= MAX_LINE_BYTES) {
+            errlog("Connection `%s` closed for exceeding MAX_LINE_BYTES! (%" PRIdN " /%" PRIdN ")\n", h->name,
+                   stream_length(h->input), MAX_LINE_BYTES);
+            return 0;
+        }
+
+        size_t offset = tail & (IO_INPUT_RING_SIZE - 1);
+        size_t count = head - tail;
+
+        if (count > IO_INPUT_RING_SIZE - offset)
+            count = IO_INPUT_RING_SIZE - offset;
+
+        h->reads++;
+        h->bytes_read += count;
+        if ((int) count > h->largest_read)
+            h->largest_read = count;
+
+        int ok = process_input(h, io->input + offset, count);
+        tail += count;
+        io->input_tail.store(tail, std::memory_order_release);
+        if (!ok)
+            return 0;
+    }
+
+    /* Nothing more will arrive once the network thread has seen EOF or an error. */
+    return status == IO_OK || tail != head;
+}
+
+/* Runs on the network thread: read as much as fits into the input ring. */
+static void
+io_read(io_state *io)
+{
+    size_t tail = io->input_tail.load(std::memory_order_acquire);
+    size_t head = io->input_head.load(std::memory_order_relaxed);
+
+    while (head - tail < IO_INPUT_RING_SIZE) {
+        size_t offset = head & (IO_INPUT_RING_SIZE - 1);
+        size_t room = IO_INPUT_RING_SIZE - (head - tail);
+
+        if (room > IO_INPUT_RING_SIZE - offset)
+            room = IO_INPUT_RING_SIZE - offset;
+
+        ssize_t count = read(io->h->rfd, io->input + offset, room);
+
+        if (count > 0) {
+            head += count;
+            io->input_head.store(head, std::memory_order_release);
+            if ((size_t) count < room)
+                break;
         } else {
-            Stream *oob = new_stream(100);
-            
-            for (ptr = buffer, end = buffer + count; ptr < end; ptr++) {
-                if (!process_telnet_byte(h, s, oob, *ptr)) {
-                    free_stream(oob);
-                    return 0;  // Close connection due to oversize telnet command
+            if (count == 0 && proto.believe_eof)
+                io->status.store(IO_EOF, std::memory_order_release);
+            else if (count < 0 && errno != eagain && errno != ewouldblock)
+                io->status.store(IO_ERROR, std::memory_order_release);
+            break;
+        }
+    }
+}
+
+/* Runs on the network thread: write handed-off blocks until the socket is full. */
+static void
+io_write(io_state *io)
+{
+    size_t head = io->output_head.load(std::memory_order_acquire);
+    size_t written = io->output_written.load(std::memory_order_relaxed);
+
+    while (written != head) {
+        text_block *b = io->output[written & (IO_OUTPUT_RING_SIZE - 1)];
+        ssize_t count = write(io->h->wfd, b->start + io->output_offset, b->length - io->output_offset);
+
+        if (count < 0) {
+            if (errno != eagain && errno != ewouldblock)
+                io->status.store(IO_ERROR, std::memory_order_release);
+            break;
+        }
+        io->output_offset += count;
+        if (io->output_offset < (size_t) b->length)
+            break;
+        io->output_offset = 0;
+        io->output_written.store(++written, std::memory_order_release);
+    }
+}
+
+static void *
+network_thread(void *arg)
+{
+    std::vector<io_state *> conns;
+    std::vector<struct pollfd> fds;
+
+    while (!io_thread_stop.load()) {
+        {
+            std::lock_guard<std::mutex> lock(io_mutex);
+
+            conns.insert(conns.end(), io_pending.begin(), io_pending.end());
+            io_pending.clear();
+
+            for (auto it = conns.begin(); it != conns.end();) {
+                io_state *io = *it;
+                if (io->detach.load()) {
+                    if (io->status.load() != IO_ERROR)
+                        io_write(io);       /* one last try, like close_nhandle() */
+                    io->detached = true;
+                    it = conns.erase(it);
+                } else {
+                    ++it;
                 }
             }
+        }
+        io_detached_cv.notify_all();
+
+        fds.resize(conns.size() + 1);
+        fds[0].fd = io_wakeup_fds[0];
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < conns.size(); i++) {
+            io_state *io = conns[i];
+            short events = 0;
+
+            if (io->status.load(std::memory_order_relaxed) == IO_OK) {
+                if (!io->h->input_suspended
+                        && io->input_head.load(std::memory_order_relaxed)
+                           - io->input_tail.load(std::memory_order_acquire) < IO_INPUT_RING_SIZE)
+                    events |= POLLIN;
+                if (io->output_written.load(std::memory_order_relaxed)
+                        != io->output_head.load(std::memory_order_acquire))
+                    events |= POLLOUT;
+            }
+            fds[i + 1].fd = events ? io->h->rfd : -1;
+            fds[i + 1].events = events;
+            fds[i + 1].revents = 0;
+        }
 
-            if (stream_length(oob) > 0) {
-                server_receive_line(h->shandle, reset_stream(oob), 1);
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno != EINTR)
+                log_perror("Network thread poll");
+            continue;
+        }
+
+        if (fds[0].revents)
+            drain_fd(io_wakeup_fds[0], &io_wakeup_pending);
+
+        bool wake_main = false;
+        for (size_t i = 0; i < conns.size(); i++) {
+            io_state *io = conns[i];
+            short revents = fds[i + 1].revents;
+
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                io_read(io);
+                wake_main = true;
+            }
+            if (revents & POLLOUT) {
+                io_write(io);
+                wake_main = true;   /* so written blocks get reclaimed */
             }
+        }
+        if (wake_main)
+            wake_fd(main_wakeup_fds[1], &main_wakeup_pending);
+    }
+
+    return nullptr;
+}
+
+static void
+main_wakeup(int fd, void *data)
+{
+    drain_fd(fd, &main_wakeup_pending);
+}
+
+static void
+network_thread_attach(nhandle *h)
+{
+    io_state *io = new io_state;
 
-            free_stream(oob);
+    io->h = h;
+    io->input_head = io->input_tail = 0;
+    io->output_head = io->output_written = 0;
+    io->output_reclaimed = io->output_offset = 0;
+    io->output_bytes = 0;
+    io->status = IO_OK;
+    io->detach = false;
+    io->detached = false;
+    h->io = io;
+
+    {
+        std::lock_guard<std::mutex> lock(io_mutex);
+        io_pending.push_back(io);
+    }
+    wake_fd(io_wakeup_fds[1], &io_wakeup_pending);
+}
+
+/* Take the socket back from the network thread, waiting until it has
+ * finished with it, and free everything still in the output ring.
+ */
+static void
+network_thread_detach(nhandle *h)
+{
+    io_state *io = h->io;
+
+    {
+        std::unique_lock<std::mutex> lock(io_mutex);
+        auto it = std::find(io_pending.begin(), io_pending.end(), io);
+
+        if (it != io_pending.end()) {
+            io_pending.erase(it);
+        } else {
+            io->detach = true;
+            wake_fd(io_wakeup_fds[1], &io_wakeup_pending);
+            io_detached_cv.wait(lock, [io] { return io->detached; });
         }
-        return 1;
-    } else {
-        return (count == 0 && !proto.believe_eof)
-               || (count < 0 && (errno == eagain || errno == ewouldblock));
     }
+
+    reclaim_output(h);
+    while (io->output_reclaimed != io->output_head.load()) {
+        free_text_block(io->output[io->output_reclaimed & (IO_OUTPUT_RING_SIZE - 1)]);
+        io->output_reclaimed++;
+    }
+    delete io;
+    h->io = nullptr;
+}
+
+static void
+start_network_thread(void)
+{
+    sigset_t all, old;
+
+    if (pipe(io_wakeup_fds) < 0 || pipe(main_wakeup_fds) < 0) {
+        log_perror("Creating network thread pipes");
+        return;
+    }
+    network_set_nonblocking(io_wakeup_fds[0]);
+    network_set_nonblocking(io_wakeup_fds[1]);
+    network_set_nonblocking(main_wakeup_fds[0]);
+    network_set_nonblocking(main_wakeup_fds[1]);
+    network_register_fd(main_wakeup_fds[0], main_wakeup, nullptr, nullptr);
+
+    /* Timer and other signals are meant for the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&io_thread, nullptr, network_thread, nullptr) != 0)
+        log_perror("Creating network thread");
+    else
+        io_thread_running = true;
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
 }
 
+static void
+stop_network_thread(void)
+{
+    if (!io_thread_running)
+        return;
+
+    io_thread_stop = true;
+    write(io_wakeup_fds[1], "1", 1);
+    pthread_join(io_thread, nullptr);
+    io_thread_running = false;
+}
+#endif /* NETWORK_THREAD */
+
 static nhandle *
 new_nhandle(const int rfd, const int wfd, const bool outbound, uint16_t listen_port, const char *listen_hostname,
             const char *listen_ipaddr, uint16_t local_port, const char *local_hostname,
@@ -625,10 +1339,25 @@ new_nhandle(const int rfd, const int wfd, const bool outbound, uint16_t listen_p
     h->telnet_state = TELNET_STATE_NORMAL;
     h->command_stream = new_stream(100);  // Initial size
     h->telnet_cmd = 0;
+    h->read_buffer_size = NETWORK_READ_BUFFER_MIN;
+    h->read_buffer = (char *) mymalloc(h->read_buffer_size, M_NETWORK);
+    h->largest_read = 0;
+    h->reads = 0;
+    h->bytes_read = 0;
 #ifdef USE_TLS
     h->tls = tls;
     h->connected = false;
     h->want_write = false;
+    h->handshake_pending = false;
+#endif
+#ifdef NETWORK_THREAD
+    h->io = nullptr;
+    if (io_thread_running
+#ifdef USE_TLS
+            && !h->tls
+#endif
+       )
+        network_thread_attach(h);
 #endif
 
     if (h->keep_alive) {
@@ -646,6 +1375,10 @@ close_nhandle(nhandle * h)
     text_block *b, *bb;
 
     (void)push_output(h);
+#ifdef NETWORK_THREAD
+    if (h->io)
+        network_thread_detach(h);
+#endif
     *(h->prev) = h->next;
     if (h->next)
         h->next->prev = h->prev;
@@ -657,6 +1390,7 @@ close_nhandle(nhandle * h)
     }
     free_stream(h->input);
     free_stream(h->command_stream);
+    myfree(h->read_buffer, M_NETWORK);
     network_close_connection(h->rfd, h->wfd);
     free_str(h->name);
     free_str(h->source_address);
@@ -1270,6 +2004,8 @@ network_initialize(int argc, char **argv, Var *desc)
         SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char*)"ToastStunt", 10);
         SSL_CTX_set_mode(tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_RELEASE_BUFFERS);
 
+        init_tls_handshake_pool();
+
 #ifdef VERIFY_TLS_PEERS
         if (!SSL_CTX_set_default_verify_paths(tls_ctx))
             errlog("TLS: Unable to load CA! Peer verification will likely fail.\n");
@@ -1282,6 +2018,10 @@ network_initialize(int argc, char **argv, Var *desc)
     eol_length = strlen(proto.eol_out_string);
     get_pocket_descriptors();
 
+#ifdef NETWORK_THREAD
+    start_network_thread();
+#endif
+
     /* we don't care about SIGPIPE, we notice it in mplex_wait() and write() */
     signal(SIGPIPE, SIG_IGN);
 
@@ -1327,19 +2067,20 @@ network_listen(network_listener nl)
 
     nlistener *l = (nlistener *) nl.ptr;
 
-    int status = listen(l->fd, 5);
+    int status = listen(l->fd, SOMAXCONN);
     if (status < 0)
         log_perror("Failed to listen");
     return status < 0 ? 0 : 1;
 }
 
+/* Make room in H's output queue for LENGTH more bytes, discarding the oldest
+ * queued output if that would exceed $server_options.max_queued_output and
+ * FLUSH_OK is true.  Returns 1 if the new output should be queued, 0 if it
+ * must be refused, and -1 if it should be silently dropped.
+ */
 static int
-enqueue_output(network_handle nh, const char *line, int line_length, int add_eol, int flush_ok)
+make_room_for_output(nhandle *h, int length, int flush_ok)
 {
-    nhandle *h = (nhandle *) nh.ptr;
-    int length = line_length + (add_eol ? eol_length : 0);
-    char *buffer;
-    text_block *block;
     bool move_output_head = true;
     /* If SSL_ERROR_WANT_WRITE, we need to preserve the first output_head. This flag indicates that the while loop below won't
        change the output head and will instead move 'next' around. */
@@ -1359,7 +2100,7 @@ enqueue_output(network_handle nh, const char *line, int line_length, int add_eol
             if (h->output_head->next == nullptr) {
                 /* Not much we can do here. OpenSSL expects the exact same data as before,
                    so output_head must remain intact. But we have nothing else to flush... */
-                return 1;
+                return -1;
             }
             next = h->output_head->next;
             move_output_head = false;
@@ -1382,17 +2123,41 @@ enqueue_output(network_handle nh, const char *line, int line_length, int add_eol
             h->output_tail = &(h->output_head->next);
     }
 
-    buffer = (char *)mymalloc(length * sizeof(char), M_NETWORK);
-    block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
-    memcpy(buffer, line, line_length);
-    if (add_eol)
-        memcpy(buffer + line_length, proto.eol_out_string, eol_length);
-    block->buffer = block->start = buffer;
-    block->length = length;
+    return 1;
+}
+
+/* Append BUF to the end of H's output queue.  The queue takes over the
+ * caller's reference to BUF.
+ */
+static void
+append_output_block(nhandle *h, output_buffer *buf)
+{
+    text_block *block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+
+    block->buffer = buf;
+    block->start = buf->data;
+    block->length = buf->length;
     block->next = nullptr;
     *(h->output_tail) = block;
     h->output_tail = &(block->next);
-    h->output_length += length;
+    h->output_length += buf->length;
+#ifdef NETWORK_THREAD
+    /* Let the network thread start on it now rather than after the current task. */
+    if (h->io)
+        (void)handoff_output(h);
+#endif
+}
+
+static int
+enqueue_output(network_handle nh, const char *line, int line_length, int add_eol, int flush_ok)
+{
+    nhandle *h = (nhandle *) nh.ptr;
+    int room = make_room_for_output(h, line_length + (add_eol ? eol_length : 0), flush_ok);
+
+    if (room <= 0)
+        return room < 0;
+
+    append_output_block(h, new_output_buffer(line, line_length, add_eol));
 
     return 1;
 }
@@ -1409,6 +2174,37 @@ network_send_bytes(network_handle nh, const char *buffer, int buflen, int flush_
     return enqueue_output(nh, buffer, buflen, 0, flush_ok);
 }
 
+network_buffer
+network_new_buffer(const char *bytes, int length, bool add_eol)
+{
+    network_buffer nb;
+
+    nb.ptr = new_output_buffer(bytes, length, add_eol);
+    return nb;
+}
+
+int
+network_send_buffer(network_handle nh, network_buffer nb, int flush_ok)
+{
+    nhandle *h = (nhandle *) nh.ptr;
+    output_buffer *buf = (output_buffer *) nb.ptr;
+    int room = make_room_for_output(h, buf->length, flush_ok);
+
+    if (room <= 0)
+        return room < 0;
+
+    buf->refcount++;
+    append_output_block(h, buf);
+
+    return 1;
+}
+
+void
+network_release_buffer(network_buffer nb)
+{
+    release_output_buffer((output_buffer *) nb.ptr);
+}
+
 int
 network_buffered_output_length(network_handle nh)
 {
@@ -1444,6 +2240,14 @@ network_process_io(int timeout)
     for (l = all_nlisteners; l; l = l->next)
         mplex_add_reader(l->fd);
     for (h = all_nhandles; h; h = h->next) {
+#ifdef USE_TLS
+        if (h->handshake_pending)
+            continue;
+#endif
+#ifdef NETWORK_THREAD
+        if (h->io)
+            continue;
+#endif
         if (!h->input_suspended)
         {
             mplex_add_reader(h->rfd);
@@ -1459,7 +2263,24 @@ network_process_io(int timeout)
     }
     add_registered_fds();
 
-    if (mplex_wait(timeout) && !pending_tls)
+#ifdef NETWORK_THREAD
+    bool threaded_input = false;
+
+    for (h = all_nhandles; h; h = h->next)
+        if (h->io && !h->input_suspended
+                && (h->io->input_head.load(std::memory_order_acquire) != h->io->input_tail.load(std::memory_order_relaxed)
+                    || h->io->status.load(std::memory_order_acquire) != IO_OK)) {
+            threaded_input = true;
+            timeout = 0;
+            break;
+        }
+#endif
+
+    if (mplex_wait(timeout) && !pending_tls
+#ifdef NETWORK_THREAD
+            && !threaded_input
+#endif
+       )
         return 0;
     else {
         for (l = all_nlisteners; l; l = l->next)
@@ -1467,6 +2288,21 @@ network_process_io(int timeout)
                 accept_new_connection(l);
         for (h = all_nhandles; h; h = hnext) {
             hnext = h->next;
+#ifdef USE_TLS
+            if (h->handshake_pending)
+                continue;
+#endif
+#ifdef NETWORK_THREAD
+            if (h->io) {
+                if ((!drain_input(h) || !handoff_output(h)) && get_nhandle_refcount(h) == 1) {
+                    server_close(h->shandle);
+                    network_handle nh;
+                    nh.ptr = h;
+                    decrement_nhandle_refcount(nh);
+                }
+                continue;
+            }
+#endif
             if (((fd_is_readable(h) && !pull_input(h))
                     || (mplex_is_writable(h->wfd) && !push_output(h))) && get_nhandle_refcount(h) == 1) {
                 server_close(h->shandle);
@@ -1680,6 +2516,26 @@ network_protocol(const network_handle nh)
     }
 }
 
+Var
+network_read_stats(const network_handle nh)
+{
+    static Var reads_key = str_dup_to_var("reads");
+    static Var bytes_key = str_dup_to_var("bytes");
+    static Var average_key = str_dup_to_var("average");
+    static Var largest_key = str_dup_to_var("largest");
+    static Var buffer_key = str_dup_to_var("buffer_size");
+    const nhandle *h = (nhandle *)nh.ptr;
+    Var ret = new_map();
+
+    ret = mapinsert(ret, var_ref(reads_key), Var::new_int(h->reads));
+    ret = mapinsert(ret, var_ref(bytes_key), Var::new_int(h->bytes_read));
+    ret = mapinsert(ret, var_ref(average_key), Var::new_int(h->reads ? h->bytes_read / h->reads : 0));
+    ret = mapinsert(ret, var_ref(largest_key), Var::new_int(h->largest_read));
+    ret = mapinsert(ret, var_ref(buffer_key), Var::new_int(h->read_buffer_size));
+
+    return ret;
+}
+
 #ifdef USE_TLS
 int
 network_handle_is_tls(const network_handle nh)
@@ -1707,7 +2563,7 @@ tls_connection_info(const network_handle nh)
     Var ret = new_map();
 
     ret = mapinsert(ret, var_ref(active_key_name), Var::new_int(h->tls != nullptr));
-    if (h->tls) {
+    if (h->tls && !h->handshake_pending) {
         ret = mapinsert(ret, var_ref(cyphersuite_key_name), str_dup_to_var(SSL_get_cipher(h->tls)));
         ret = mapinsert(ret, var_ref(tls_version), str_dup_to_var(SSL_get_version(h->tls)));
     }
@@ -1868,6 +2724,13 @@ network_shutdown(void)
      * we're shutting down anyway, may as well do it the lazy way. */
     std::vector<network_handle> handles;
 
+#ifdef USE_TLS
+    if (tls_pool) {
+        thpool_wait(tls_pool);
+        tls_handshakes_finished(tls_wakeup_fds[0], nullptr);
+    }
+#endif
+
     for (nhandle *h = all_nhandles; h; h = h->next) {
         network_handle nh;
         nh.ptr = h;
@@ -1879,6 +2742,10 @@ network_shutdown(void)
 
     while (all_nlisteners)
         close_nlistener(all_nlisteners);
+
+#ifdef NETWORK_THREAD
+    stop_network_thread();
+#endif
 }
 
 Var
@@ -450,63 +450,59 @@ bf_tofloat(Var arglist, Byte next, void *vdata, Objid progr)
 }
 
 static package
-bf_min(Var arglist, Byte next, void *vdata, Objid progr)
+bf_min(Var *args, int nargs, Objid progr)
 {
     Var r;
-    int i, nargs = arglist.v.list[0].v.num;
+    int i;
     int bad_types = 0;
 
-    r = arglist.v.list[1];
+    r = args[0];
     if (r.type == TYPE_INT) {   /* integers */
-        for (i = 2; i <= nargs; i++)
-            if (arglist.v.list[i].type != TYPE_INT)
+        for (i = 1; i < nargs; i++)
+            if (args[i].type != TYPE_INT)
                 bad_types = 1;
-            else if (arglist.v.list[i].v.num < r.v.num)
-                r = arglist.v.list[i];
+            else if (args[i].v.num < r.v.num)
+                r = args[i];
     } else {            /* floats */
-        for (i = 2; i <= nargs; i++)
-            if (arglist.v.list[i].type != TYPE_FLOAT)
+        for (i = 1; i < nargs; i++)
+            if (args[i].type != TYPE_FLOAT)
                 bad_types = 1;
-            else if (arglist.v.list[i].v.fnum < r.v.fnum)
-                r = arglist.v.list[i];
+            else if (args[i].v.fnum < r.v.fnum)
+                r = args[i];
     }
 
-    r = var_ref(r);
-    free_var(arglist);
     if (bad_types)
         return make_error_pack(E_TYPE);
     else
-        return make_var_pack(r);
+        return make_var_pack(var_ref(r));
 }
 
 static package
-bf_max(Var arglist, Byte next, void *vdata, Objid progr)
+bf_max(Var *args, int nargs, Objid progr)
 {
     Var r;
-    int i, nargs = arglist.v.list[0].v.num;
+    int i;
     int bad_types = 0;
 
-    r = arglist.v.list[1];
+    r = args[0];
     if (r.type == TYPE_INT) {   /* integers */
-        for (i = 2; i <= nargs; i++)
-            if (arglist.v.list[i].type != TYPE_INT)
+        for (i = 1; i < nargs; i++)
+            if (args[i].type != TYPE_INT)
                 bad_types = 1;
-            else if (arglist.v.list[i].v.num > r.v.num)
-                r = arglist.v.list[i];
+            else if (args[i].v.num > r.v.num)
+                r = args[i];
     } else {            /* floats */
-        for (i = 2; i <= nargs; i++)
-            if (arglist.v.list[i].type != TYPE_FLOAT)
+        for (i = 1; i < nargs; i++)
+            if (args[i].type != TYPE_FLOAT)
                 bad_types = 1;
-            else if (arglist.v.list[i].v.fnum > r.v.fnum)
-                r = arglist.v.list[i];
+            else if (args[i].v.fnum > r.v.fnum)
+                r = args[i];
     }
 
-    r = var_ref(r);
-    free_var(arglist);
     if (bad_types)
         return make_error_pack(E_TYPE);
     else
-        return make_var_pack(r);
+        return make_var_pack(var_ref(r));
 }
 
 static package
@@ -932,8 +928,8 @@ register_numbers(void)
 
     register_function("toint", 1, 1, bf_toint, TYPE_ANY);
     register_function("tofloat", 1, 1, bf_tofloat, TYPE_ANY);
-    register_function("min", 1, -1, bf_min, TYPE_NUMERIC);
-    register_function("max", 1, -1, bf_max, TYPE_NUMERIC);
+    register_function_fast("min", 1, -1, bf_min, TYPE_NUMERIC);
+    register_function_fast("max", 1, -1, bf_max, TYPE_NUMERIC);
     register_function("abs", 1, 1, bf_abs, TYPE_NUMERIC);
     register_function("random", 0, 2, bf_random, TYPE_INT, TYPE_INT);
     register_function("reseed_random", 0, 0, bf_reseed_random);
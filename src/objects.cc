@@ -270,30 +270,26 @@ bf_toobj(Var arglist, Byte next, void *vdata, Objid progr)
 }
 
 static package
-bf_typeof(Var arglist, Byte next, void *vdata, Objid progr)
+bf_typeof(Var *args, int nargs, Objid progr)
 {
     Var r;
     r.type = TYPE_INT;
-    r.v.num = (int) arglist.v.list[1].type & TYPE_DB_MASK;
-    free_var(arglist);
+    r.v.num = (int) args[0].type & TYPE_DB_MASK;
     return make_var_pack(r);
 }
 
 static package
-bf_valid(Var arglist, Byte next, void *vdata, Objid progr)
+bf_valid(Var *args, int nargs, Objid progr)
 {   /* (object) */
     Var r;
 
-    if (arglist.v.list[1].is_object()) {
+    if (args[0].is_object()) {
         r.type = TYPE_INT;
-        r.v.num = is_valid(arglist.v.list[1]);
+        r.v.num = is_valid(args[0]);
     }
-    else {
-        free_var(arglist);
+    else
         return make_error_pack(E_TYPE);
-    }
 
-    free_var(arglist);
     return make_var_pack(r);
 }
 
@@ -993,12 +989,10 @@ bf_players(Var arglist, Byte next, void *vdata, Objid progr)
 }
 
 static package
-bf_is_player(Var arglist, Byte next, void *vdata, Objid progr)
+bf_is_player(Var *args, int nargs, Objid progr)
 {   /* (object) */
     Var r;
-    Objid oid = arglist.v.list[1].v.obj;
-
-    free_var(arglist);
+    Objid oid = args[0].v.obj;
 
     if (!valid(oid))
         return make_error_pack(E_INVARG);
@@ -1095,34 +1089,13 @@ bf_isa(Var arglist, Byte next, void *vdata, Objid progr)
 }
 
 /* Locate an object in the database by name more quickly than is possible in-DB.
- * To avoid numerous list reallocations, we put everything in a vector and then
- * transfer it over to a list when we know how many values we have. */
+ * The DB layer keeps an index of name trigrams, so this takes time proportional
+ * to the number of candidates rather than to the size of the database. */
 static void locate_by_name_callback(Var arglist, Var *ret)
 {
-    Var name, object;
-    object.type = TYPE_OBJ;
-    std::vector<int> tmp;
-
     const int case_matters = arglist.v.list[0].v.num < 2 ? 0 : is_true(arglist.v.list[2]);
-    const int string_length = memo_strlen(arglist.v.list[1].v.str);
 
-    const Objid last_objid = db_last_used_objid();
-    for (int x = 0; x <= last_objid; x++)
-    {
-        if (!valid(x))
-            continue;
-
-        object.v.obj = x;
-        db_find_property(object, "name", &name);
-        if (strindex(name.v.str, memo_strlen(name.v.str), arglist.v.list[1].v.str, string_length, case_matters))
-            tmp.push_back(x);
-    }
-
-    *ret = new_list(tmp.size());
-    const auto vector_size = tmp.size();
-    for (size_t x = 0; x < vector_size; x++) {
-        ret->v.list[x + 1] = Var::new_obj(tmp[x]);
-    }
+    *ret = db_locate_by_name(arglist.v.list[1].v.str, memo_strlen(arglist.v.list[1].v.str), case_matters);
 }
 
 static package
@@ -1317,19 +1290,7 @@ bf_owned_objects(Var arglist, Byte next, void *vdata, Objid progr)
     if (!valid(who))
         return make_error_pack(E_INVIND);
 
-    std::vector<Objid> tmp;
-    Objid max_obj = db_last_used_objid();
-
-    for (Objid x = 0; x <= max_obj; x++) {
-        if (valid(x) && who == db_object_owner(x))
-            tmp.push_back(x);
-    }
-
-    Var ret = new_list(tmp.size());
-    for (size_t x = 1; x <= tmp.size(); x++) {
-        ret.v.list[x].type = TYPE_OBJ;
-        ret.v.list[x].v.obj = tmp[x - 1];
-    }
+    Var ret = db_owned_objects(who);
 
     return make_var_pack(ret);
 }
@@ -1347,7 +1308,7 @@ register_objects(void)
     none.type = TYPE_NONE;
 
     register_function("toobj", 1, 1, bf_toobj, TYPE_ANY);
-    register_function("typeof", 1, 1, bf_typeof, TYPE_ANY);
+    register_function_fast("typeof", 1, 1, bf_typeof, TYPE_ANY);
     register_function_with_read_write("create", 1, 4, bf_create,
                                       bf_create_read, bf_create_write,
                                       TYPE_ANY, TYPE_ANY, TYPE_ANY, TYPE_ANY);
@@ -1358,7 +1319,7 @@ register_objects(void)
                                       bf_recycle_read, bf_recycle_write,
                                       TYPE_ANY);
     register_function("object_bytes", 1, 1, bf_object_bytes, TYPE_ANY);
-    register_function("valid", 1, 1, bf_valid, TYPE_ANY);
+    register_function_fast("valid", 1, 1, bf_valid, TYPE_ANY);
     register_function("chparents", 2, 2, bf_chparent_chparents,
                       TYPE_ANY, TYPE_LIST);
     register_function("chparent", 2, 2, bf_chparent_chparents,
@@ -1372,7 +1333,7 @@ register_objects(void)
                       TYPE_ANY, TYPE_ANY);
     register_function("max_object", 0, 0, bf_max_object);
     register_function("players", 0, 0, bf_players);
-    register_function("is_player", 1, 1, bf_is_player, TYPE_OBJ);
+    register_function_fast("is_player", 1, 1, bf_is_player, TYPE_OBJ);
     register_function("set_player_flag", 2, 2, bf_set_player_flag,
                       TYPE_OBJ, TYPE_ANY);
     register_function_with_read_write("move", 2, 3, bf_move,
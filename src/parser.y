@@ -44,15 +44,17 @@
 #include "version.h"
 #include "waif.h"
 
-static Stmt            *prog_start;
-static int              dollars_ok;
-static DB_Version       language_version;
+/* The parser is used on several threads at once while the database is being
+ * loaded, so everything it keeps between calls is per-thread.
+ */
+static thread_local Stmt       *prog_start;
+static thread_local int         dollars_ok;
+static thread_local DB_Version  language_version;
 
 static void     error(const char *, const char *);
 static void     warning(const char *, const char *);
 static int      find_id(char *name);
 static void     yyerror(const char *s);
-static int      yylex(void);
 static Scatter *scatter_from_arglist(Arg_List *);
 static Scatter *add_scatter_item(Scatter *, Scatter *);
 static void     vet_scatter(Scatter *);
@@ -66,6 +68,8 @@ enum loop_exit_kind { LOOP_BREAK, LOOP_CONTINUE };
 static void     check_loop_name(const char *, enum loop_exit_kind);
 %}
 
+%define api.pure full
+
 %union {
   Stmt         *stmt;
   Expr         *expr;
@@ -81,6 +85,10 @@ static void     check_loop_name(const char *, enum loop_exit_kind);
   Scatter      *scatter;
 }
 
+%code {
+static int      yylex(YYSTYPE *);
+}
+
 %type   <stmt>   statements statement elsepart
 %type   <arm>    elseifs
 %type   <expr>   expr default
@@ -409,7 +417,6 @@ expr:
 		    Expr *prop = alloc_var(TYPE_STR);
 			char *newstr;
             asprintf(&newstr, "%c%s", WAIF_PROP_PREFIX, $4);
-			dealloc_string($4);
 		    prop->e.var.v.str = alloc_string(newstr);
 			free(newstr);
 		    $$ = alloc_binary(EXPR_PROP, $1, prop);
@@ -511,7 +518,6 @@ expr:
 		    } else {
 			$$->e.call.func = f_no;
 			$$->e.call.args = $3;
-			dealloc_string($1);
 		    }
 		}
 	| expr '+' expr
@@ -780,18 +786,15 @@ scatter_item:
 
 %%
 
-static int              lineno, nerrors, must_rename_keywords;
-static Parser_Client    client;
-static void            *client_data;
-static Names           *local_names;
+static thread_local int            lineno, nerrors, must_rename_keywords;
+static thread_local Parser_Client  client;
+static thread_local void          *client_data;
+static thread_local Names         *local_names;
 
 static int
 find_id(char *name)
 {
-    int slot = find_or_add_name(&local_names, name);
-
-    dealloc_string(name);
-    return slot;
+    return find_or_add_name(&local_names, name);
 }
 
 static void
@@ -803,7 +806,7 @@ yyerror(const char *s)
 static const char *
 fmt_error(const char *s, const char *t)
 {
-    static Stream      *str = 0;
+    static thread_local Stream *str = 0;
 
     if (str == 0)
 	str = new_stream(100);
@@ -830,7 +833,7 @@ warning(const char *s, const char *t)
 	error(s, t);
 }
 
-static int unget_buffer[5], unget_count;
+static thread_local int unget_buffer[5], unget_count;
 
 static int
 lex_getc(void)
@@ -870,11 +873,12 @@ check_two_dots(void)     /* look ahead for .. but don't consume */
     return c1 == '.' && c2 == '.';
 }
 
-static Stream  *token_stream = 0;
+static thread_local Stream *token_stream = 0;
 
 static int
-yylex(void)
+yylex(YYSTYPE *lvalp)
 {
+    YYSTYPE    &yylval = *lvalp;
     int c;
 
     reset_stream(token_stream);
@@ -1091,8 +1095,6 @@ scatter_from_arglist(Arg_List *a)
 						       : SCAT_REST,
 				 a->expr->e.id, 0);
 	    anext = a->next;
-	    dealloc_node(a->expr);
-	    dealloc_node(a);
 	} else {
 	    yyerror("Scattering assignment targets must be simple variables.");
 	    return 0;
@@ -1127,7 +1129,7 @@ struct loop_entry {
     int                 is_barrier;
 };
 
-static struct loop_entry *loop_stack;
+static thread_local struct loop_entry *loop_stack;
 
 static void
 push_loop_name(const char *name)
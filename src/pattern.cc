@@ -19,11 +19,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <string>
+#include <vector>
+
 #include "config.h"
 #include "pattern.h"
+#include "server.h"
 #include "storage.h"
 #include "streams.h"
 
+#ifdef PCRE2_FOUND
+#include "pcre_moo.h"
+#endif
+
 extern "C" {
 #include "regexpr.h"
 }
@@ -108,6 +116,309 @@ fail:
 
 #define MOO_SYNTAX  (RE_CONTEXT_INDEP_OPS)
 
+/* Every pattern is compiled by the old engine, which decides what is a
+ * valid pattern and remains the reference for its semantics. When PCRE2 is
+ * available and the pattern can be expressed exactly in PCRE2 syntax, a JIT
+ * compiled copy is used to find matches; see translate_to_pcre().
+ */
+struct compiled_pattern {
+    regexp_t re;
+#ifdef PCRE2_FOUND
+    pcre2_code *code;
+    bool has_groups;
+#endif
+};
+
+#ifdef PCRE2_FOUND
+
+/* Word constituents for %w, %b and friends: letters and digits only. */
+#define PCRE_WORD       "[A-Za-z0-9]"
+#define PCRE_NOT_WORD   "[^A-Za-z0-9]"
+
+static void
+add_pcre_byte(std::string &out, unsigned char c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (isalnum(c))
+        out += c;
+    else {
+        out += "\\x";
+        out += hex[c >> 4];
+        out += hex[c & 0xf];
+    }
+}
+
+/* Emit the bytes in `set' as a character class. */
+static void
+add_pcre_set(std::string &out, const bool set[256])
+{
+    std::string body;
+    int c = 0;
+
+    while (c < 256) {
+        if (!set[c]) {
+            c++;
+            continue;
+        }
+        int last = c;
+        while (last + 1 < 256 && set[last + 1])
+            last++;
+        add_pcre_byte(body, c);
+        if (last > c) {
+            body += '-';
+            add_pcre_byte(body, last);
+        }
+        c = last + 1;
+    }
+
+    if (body.empty())
+        out += "(?:(?!))";
+    else
+        out += "[" + body + "]";
+}
+
+struct translate_frame {
+    bool alt_nullable;          /* every atom so far in this alternative can be empty */
+    bool any_nullable;          /* some earlier alternative can be empty */
+    size_t start;               /* where the group's `(' is in the output */
+};
+
+/* Translate `re', a pattern in the old engine's syntax that it has already
+ * compiled successfully, into an equivalent PCRE2 pattern. This mirrors
+ * re_compile_pattern() in regexpr.c, including its quirks:
+ *
+ *   - `^' and `$' match at line boundaries as well as the ends of the string
+ *   - %b matches at both ends of the string; %B matches at neither, and
+ *     elsewhere, despite its name, only at a word boundary
+ *   - a quoted letter is never case folded, so it can't match when
+ *     case doesn't matter
+ *   - a character set is folded as it is parsed, ranges included
+ *   - a repeat operator after `^' is ignored, and stacked operators apply
+ *     to everything before them
+ *   - `*' and `+' loops that re_match() decides can't need backtracking are
+ *     never backtracked into, even where zero-width operators after them
+ *     make that decision wrong; `possessive' holds those decisions in
+ *     pattern order and they are emitted as possessive quantifiers
+ *
+ * Returns false for constructs whose behaviour PCRE2 can't reproduce:
+ * back-references, whose groups the old engine doesn't reset when it
+ * backtracks, and `*' or `+' applied to something that can match the empty
+ * string, which the old engine loops on.
+ */
+static bool
+translate_to_pcre(const char *re, int len, const char *fold,
+                  const std::vector<char> &possessive, std::string &out,
+                  bool &has_groups)
+{
+    std::vector<translate_frame> frames;
+    size_t atom = std::string::npos;
+    bool atom_nullable = false, atom_repeated = false, atom_assertion = false;
+    size_t loops = 0;
+    int i = 0;
+
+#define NEXT(c)  (c = (unsigned char)re[i++], c = fold ? (unsigned char)fold[c] : c)
+
+    auto commit_atom = [&]() {
+        if (atom != std::string::npos && !atom_nullable)
+            frames.back().alt_nullable = false;
+        atom = std::string::npos;
+    };
+    auto start_atom = [&](bool nullable, bool assertion) {
+        commit_atom();
+        atom = out.size();
+        atom_nullable = nullable;
+        atom_repeated = false;
+        atom_assertion = assertion;
+    };
+
+    has_groups = false;
+    frames.push_back({true, false, 0});
+
+    while (i < len) {
+        unsigned char c;
+
+        switch (NEXT(c)) {
+            case '\\':
+                /* The quoted character itself isn't folded. */
+                c = (unsigned char)re[i++];
+                switch (c) {
+                    case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9':
+                        return false;
+                    case '(':
+                        commit_atom();
+                        frames.push_back({true, false, out.size()});
+                        out += '(';
+                        has_groups = true;
+                        break;
+                    case ')': {
+                        commit_atom();
+                        translate_frame group = frames.back();
+                        frames.pop_back();
+                        out += ')';
+                        atom = group.start;
+                        atom_nullable = group.alt_nullable || group.any_nullable;
+                        atom_repeated = false;
+                        atom_assertion = false;
+                        break;
+                    }
+                    case '|':
+                        commit_atom();
+                        frames.back().any_nullable |= frames.back().alt_nullable;
+                        frames.back().alt_nullable = true;
+                        out += '|';
+                        break;
+                    case 'w':
+                        start_atom(false, false);
+                        out += PCRE_WORD;
+                        break;
+                    case 'W':
+                        start_atom(false, false);
+                        out += PCRE_NOT_WORD;
+                        break;
+                    case '<':
+                        start_atom(true, true);
+                        out += "(?<!" PCRE_WORD ")(?=" PCRE_WORD ")";
+                        break;
+                    case '>':
+                        start_atom(true, true);
+                        out += "(?<=" PCRE_WORD ")(?!" PCRE_WORD ")";
+                        break;
+                    case 'b':
+                        start_atom(true, true);
+                        out += "(?:\\A|\\z|(?<=" PCRE_WORD ")(?!" PCRE_WORD ")|(?<!" PCRE_WORD ")(?=" PCRE_WORD "))";
+                        break;
+                    case 'B':
+                        start_atom(true, true);
+                        out += "(?!\\A|\\z)(?:(?<=" PCRE_WORD ")(?!" PCRE_WORD ")|(?<!" PCRE_WORD ")(?=" PCRE_WORD "))";
+                        break;
+                    case '`':
+                        start_atom(true, true);
+                        out += "\\A";
+                        break;
+                    case '\'':
+                        start_atom(true, true);
+                        out += "\\z";
+                        break;
+                    default:
+                        start_atom(false, false);
+                        if (fold && (unsigned char)fold[c] != c)
+                            out += "(?:(?!))";
+                        else
+                            add_pcre_byte(out, c);
+                        break;
+                }
+                break;
+            case '*':
+            case '+':
+            case '?':
+                if (atom == std::string::npos)
+                    break;      /* after `^'; the old engine ignores it */
+                if (atom_assertion || (c != '?' && atom_nullable))
+                    return false;
+                if (atom_repeated) {
+                    out.insert(atom, "(?:");
+                    out += ')';
+                }
+                out += c;
+                if (c != '?') {
+                    if (loops >= possessive.size())
+                        return false;
+                    if (possessive[loops++])
+                        out += '+';
+                }
+                atom_repeated = true;
+                if (c != '+')
+                    atom_nullable = true;
+                break;
+            case '[': {
+                bool bits[256] = {false}, set[256];
+                bool complement, first = true;
+                int prev = -1, range = 0;
+
+                NEXT(c);
+                if ((complement = (c == '^')))
+                    NEXT(c);
+                while (c != ']' || first) {
+                    first = false;
+                    if (range) {
+                        for (int a = prev; a <= (int)c; a++)
+                            bits[a] = true;
+                        prev = -1;
+                        range = 0;
+                    } else if (prev != -1 && c == '-')
+                        range = 1;
+                    else {
+                        bits[c] = true;
+                        prev = c;
+                    }
+                    NEXT(c);
+                }
+                if (range)
+                    bits['-'] = true;
+                /* The old engine folds the subject before testing the set. */
+                for (int a = 0; a < 256; a++)
+                    set[a] = bits[fold ? (unsigned char)fold[a] : a] != complement;
+                start_atom(false, false);
+                add_pcre_set(out, set);
+                break;
+            }
+            case '^':
+                commit_atom();
+                out += "(?<![^\\n])";
+                break;
+            case '$':
+                commit_atom();
+                out += "(?![^\\n])";
+                break;
+            case '.':
+                start_atom(false, false);
+                out += "[^\\n]";
+                break;
+            default:
+                start_atom(false, false);
+                add_pcre_byte(out, c);
+                break;
+        }
+    }
+
+#undef NEXT
+
+    return loops == possessive.size();
+}
+
+static pcre2_code *
+compile_pcre(regexp_t buf, const char *tpattern, int tpatlen, int case_matters,
+             bool &has_groups)
+{
+    std::vector<char> possessive(re_possessive_loops(buf, nullptr, 0));
+    std::string translated;
+
+    re_possessive_loops(buf, possessive.data(), possessive.size());
+    if (!translate_to_pcre(tpattern, tpatlen, case_matters ? nullptr : casefold,
+                           possessive, translated, has_groups))
+        return nullptr;
+
+    int errorcode;
+    PCRE2_SIZE error_offset;
+    pcre2_code *code = pcre2_compile((PCRE2_SPTR)translated.c_str(), translated.size(),
+                                     case_matters ? 0 : PCRE2_CASELESS,
+                                     &errorcode, &error_offset, nullptr);
+    if (code == nullptr)
+        return nullptr;
+
+    /* Without the JIT there's nothing to gain over the old engine. */
+    if (pcre2_jit_compile(code, PCRE2_JIT_COMPLETE) < 0) {
+        pcre2_code_free(code);
+        return nullptr;
+    }
+
+    return code;
+}
+
+#endif /* PCRE2_FOUND */
+
 Pattern
 new_pattern(const char *pattern, int case_matters)
 {
@@ -127,7 +438,13 @@ new_pattern(const char *pattern, int case_matters)
             && !re_compile_pattern((char *)tpattern, tpatlen, buf)) {
         buf->fastmap = (char *)mymalloc(256 * sizeof(char), M_PATTERN);
         re_compile_fastmap(buf);
-        p.ptr = buf;
+
+        compiled_pattern *cp = (compiled_pattern *)mymalloc(sizeof(compiled_pattern), M_PATTERN);
+        cp->re = buf;
+#ifdef PCRE2_FOUND
+        cp->code = compile_pcre(buf, tpattern, tpatlen, case_matters, cp->has_groups);
+#endif
+        p.ptr = cp;
     } else {
         if (buf->buffer)
             free(buf->buffer);
@@ -138,25 +455,117 @@ new_pattern(const char *pattern, int case_matters)
     return p;
 }
 
+static void
+copy_registers(const struct re_registers *regs, Match_Indices * indices)
+{
+    for (int i = 0; i < 10; i++) {
+        /* Convert from 0-based open interval to 1-based closed one. */
+        indices[i].start = regs->start[i] + 1;
+        indices[i].end = regs->end[i];
+    }
+}
+
+#ifdef PCRE2_FOUND
+
+/* Find the same match the old engine's re_search() would, using the JIT
+ * compiled pattern. Captures still come from the old engine, run once at the
+ * position PCRE2 found, since it doesn't reset groups when it backtracks and
+ * PCRE2 does.
+ */
+static Match_Result
+match_pcre(compiled_pattern *cp, const char *string, Match_Indices * indices,
+           int is_reverse)
+{
+    static pcre2_match_data *match_data = pcre2_match_data_create(1, nullptr);
+
+    regexp_t buf = cp->re;
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+    pcre2_match_context *context = pcre_match_context();
+    int len = strlen(string);
+    int start, rc;
+
+    if (!is_reverse) {
+        rc = pcre2_match(cp->code, (PCRE2_SPTR)string, len, 0, 0, match_data, context);
+        if (rc == PCRE2_ERROR_NOMATCH)
+            return MATCH_FAILED;
+        else if (rc < 0)
+            return MATCH_ABORTED;
+        start = ovector[0];
+    } else {
+        /* re_search() gives up on a backwards search anchored with %` unless
+           the string is empty, and only tries the end of the string if the
+           pattern's fastmap allows it. Positions the fastmap rules out can't
+           match, so skip them too. */
+        const char *fastmap = buf->can_be_null == 1 ? nullptr : buf->fastmap;
+        const char *translate = buf->translate;
+
+        if (buf->anchor == 2 && len != 0)
+            return MATCH_FAILED;
+
+        for (start = len; start >= 0; start--) {
+            if (fastmap && start > 0) {
+                unsigned char c = string[start];
+                if (!fastmap[translate ? (unsigned char)translate[c] : c])
+                    continue;
+            }
+            if (buf->anchor == 1 && start > 0 && string[start - 1] != '\n')
+                continue;
+            rc = pcre2_match(cp->code, (PCRE2_SPTR)string, len, start, PCRE2_ANCHORED,
+                             match_data, context);
+            if (rc >= 0)
+                break;
+            else if (rc != PCRE2_ERROR_NOMATCH)
+                return MATCH_ABORTED;
+        }
+        if (start < 0)
+            return MATCH_FAILED;
+    }
+
+    if (cp->has_groups) {
+        struct re_registers regs;
+
+        switch (re_match(buf, (char *)string, len, start, &regs)) {
+            case -1:
+                return MATCH_FAILED;
+            case -2:
+                return MATCH_ABORTED;
+        }
+        copy_registers(&regs, indices);
+    } else {
+        indices[0].start = start + 1;
+        indices[0].end = ovector[1];
+        for (int i = 1; i < 10; i++) {
+            indices[i].start = 0;
+            indices[i].end = -1;
+        }
+    }
+
+    return MATCH_SUCCEEDED;
+}
+
+#endif /* PCRE2_FOUND */
+
 Match_Result
 match_pattern(Pattern p, const char *string, Match_Indices * indices,
               int is_reverse)
 {
-    regexp_t buf = (regexp_t)p.ptr;
-    int len = strlen(string);
-    int i;
+    compiled_pattern *cp = (compiled_pattern *)p.ptr;
+    regexp_t buf = cp->re;
+    int len;
     struct re_registers regs;
 
+#ifdef PCRE2_FOUND
+    if (cp->code && !server_flag_option_cached(SVO_LEGACY_MATCH_ENGINE))
+        return match_pcre(cp, string, indices, is_reverse);
+#endif
+
+    len = strlen(string);
     switch (re_search(buf, (char *)string, len,
                       is_reverse ? len : 0,
                       is_reverse ? -len : len,
                       &regs)) {
         default:
-            for (i = 0; i < 10; i++) {
-                /* Convert from 0-based open interval to 1-based closed one. */
-                indices[i].start = regs.start[i] + 1;
-                indices[i].end = regs.end[i];
-            }
+            copy_registers(&regs, indices);
             return MATCH_SUCCEEDED;
         case -1:
             return MATCH_FAILED;
@@ -168,11 +577,38 @@ match_pattern(Pattern p, const char *string, Match_Indices * indices,
 void
 free_pattern(Pattern p)
 {
-    regexp_t buf = (regexp_t)p.ptr;
+    compiled_pattern *cp = (compiled_pattern *)p.ptr;
+
+    if (cp) {
+        regexp_t buf = cp->re;
 
-    if (buf) {
         free(buf->buffer);
         myfree(buf->fastmap, M_PATTERN);
         myfree(buf, M_PATTERN);
+#ifdef PCRE2_FOUND
+        if (cp->code)
+            pcre2_code_free(cp->code);
+#endif
+        myfree(cp, M_PATTERN);
+    }
+}
+
+size_t
+pattern_size(Pattern p)
+{
+    compiled_pattern *cp = (compiled_pattern *)p.ptr;
+
+    if (!cp)
+        return 0;
+
+    size_t bytes = sizeof(*cp) + sizeof(*cp->re) + cp->re->allocated + 256 * sizeof(char);
+#ifdef PCRE2_FOUND
+    if (cp->code) {
+        size_t code_size = 0, jit_size = 0;
+        (void)pcre2_pattern_info(cp->code, PCRE2_INFO_SIZE, &code_size);
+        (void)pcre2_pattern_info(cp->code, PCRE2_INFO_JITSIZE, &jit_size);
+        bytes += code_size + jit_size;
     }
+#endif
+    return bytes;
 }
@@ -3,12 +3,11 @@
 #ifdef PCRE2_FOUND
 
 #include <ctype.h>
-#include <pthread.h>
-#include <unordered_map>
 #include <limits.h>
 #include <string>
 
 #include "pcre_moo.h"
+#include "regex_cache.h"
 #include "functions.h"
 #include "list.h"
 #include "utils.h"
@@ -18,28 +17,6 @@
 #include "dependencies/pcrs.h"
 #include "dependencies/xtrapbits.h"
 
-template<>
-struct std::hash<cache_type>
-{
-    std::size_t operator()(const cache_type& t) const noexcept
-    {
-        return std::hash<std::string>{}(std::string(t.first) + (char)t.second);
-    }
-};
-
-struct CacheEqual
-{
-public:
-    bool operator() (const cache_type& c1, const cache_type& c2) const
-    {
-        return strcmp(c1.first, c2.first) == 0 && c1.second == c2.second;
-    }
-};
-
-static pthread_mutex_t cache_mutex;
-typedef std::pair<const char*, unsigned char> cache_type;
-static std::unordered_map<cache_type, pcre_cache_entry*, std::hash<cache_type>, CacheEqual> pcre_pattern_cache;
-
 /* Global match context with security limits to prevent ReDoS attacks */
 static pcre2_match_context *global_match_ctx = nullptr;
 
@@ -56,80 +33,90 @@ static void init_global_match_context()
     }
 }
 
-static struct pcre_cache_entry *
-get_pcre(const char *string, unsigned char options)
+/* The same limits apply to match() patterns translated to PCRE2. */
+pcre2_match_context *
+pcre_match_context(void)
 {
-    pcre_cache_entry *entry = nullptr;
-
-    pthread_mutex_lock(&cache_mutex);
-    cache_type pair = std::make_pair(string, options);
-    if (pcre_pattern_cache.count(pair) != 0) {
-        entry = pcre_pattern_cache[pair];
-        entry->cache_hits++;
-        entry->refcount++;
-    } else {
-        /* If the cache is too large, remove the entry with the least amount of hits. */
-        if (pcre_pattern_cache.size() >= PCRE_PATTERN_CACHE_SIZE) {
-            std::unordered_map<cache_type, pcre_cache_entry*, std::hash<cache_type>, CacheEqual>::iterator entry_to_delete = pcre_pattern_cache.begin(), it = entry_to_delete;
-            while (it != pcre_pattern_cache.end()) {
-                if (it->second->cache_hits < entry_to_delete->second->cache_hits) {
-                    entry_to_delete = it;
-                    /* Don't bother trying to find anything less than 0... waste of string comparisons. */
-                    if (it->second->cache_hits == 0)
-                        break;
-                }
-                it++;
-            }
-            /* We could use delete_cache_entry here, and arguably it would be cleaner, but that would cause an extra pointless
-               iteration full of string comparisons. Fortunately we have enough information here to deal with it directly. */
-            auto entry = *entry_to_delete;
-            pcre_pattern_cache.erase(entry_to_delete);
-            free_entry(entry.second);
-            free_str(entry.first.first);
-        }
+    init_global_match_context();
+    return global_match_ctx;
+}
 
-        int errorcode;
-        PCRE2_SIZE error_offset;
-        char buf[256];
+static void
+free_pcre_entry(void *ptr)
+{
+    pcre_cache_entry *entry = (pcre_cache_entry *)ptr;
 
-        entry = (pcre_cache_entry*)malloc(sizeof(pcre_cache_entry));
-        if (entry == nullptr) {
-            pthread_mutex_unlock(&cache_mutex);
-            return nullptr;
-        }
-        entry->error = nullptr;
-        entry->re = nullptr;
-        entry->captures = 0;
-        entry->cache_hits = 0;
-        /* Refcount starts at 1 for the caller */
-        entry->refcount = 1;
-
-        entry->re = pcre2_compile((PCRE2_SPTR)string, PCRE2_ZERO_TERMINATED, options, &errorcode, &error_offset, nullptr);
-        if (entry->re == nullptr) {
-            PCRE2_UCHAR error_buffer[256];
-            pcre2_get_error_message(errorcode, error_buffer, sizeof(error_buffer));
-            snprintf(buf, sizeof(buf), "PCRE2 compile error at offset %zu: %s", error_offset, (char*)error_buffer);
-            entry->error = str_dup(buf);
-        } else {
-            int jit_result = pcre2_jit_compile(entry->re, PCRE2_JIT_COMPLETE);
-            if (jit_result < 0) {
-                PCRE2_UCHAR error_buffer[256];
-                pcre2_get_error_message(jit_result, error_buffer, sizeof(error_buffer));
-                entry->error = str_dup((const char*)error_buffer);
-            } else {
-                (void)pcre2_pattern_info(entry->re, PCRE2_INFO_CAPTURECOUNT, &(entry->captures));
-            }
-        }
+    if (entry->match_data != nullptr)
+        pcre2_match_data_free(entry->match_data);
+    pcre2_code_free(entry->re);
+    delete entry;
+}
 
-        if (entry->error == nullptr) {
-            /* Add a second reference for the cache itself */
-            entry->refcount++;
-            pcre_pattern_cache[std::make_pair(str_dup(string), options)] = entry;
-        }
+/* Returns a referenced cache entry holding the compiled pattern. On failure,
+   returns nullptr with a message in `error'. Release it with
+   regex_cache_release(). */
+static regex_cache_entry *
+get_pcre(const char *string, unsigned char options, char *error, size_t error_size)
+{
+    regex_cache_entry *cached = regex_cache_find(REGEX_PCRE, options, string);
+    if (cached != nullptr)
+        return cached;
+
+    int errorcode;
+    PCRE2_SIZE error_offset;
+    PCRE2_UCHAR error_buffer[256];
+
+    pcre2_code *re = pcre2_compile((PCRE2_SPTR)string, PCRE2_ZERO_TERMINATED, options, &errorcode, &error_offset, nullptr);
+    if (re == nullptr) {
+        pcre2_get_error_message(errorcode, error_buffer, sizeof(error_buffer));
+        snprintf(error, error_size, "PCRE2 compile error at offset %zu: %s", error_offset, (char*)error_buffer);
+        return nullptr;
+    }
+
+    int jit_result = pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+    if (jit_result < 0) {
+        pcre2_get_error_message(jit_result, error_buffer, sizeof(error_buffer));
+        snprintf(error, error_size, "%s", (char*)error_buffer);
+        pcre2_code_free(re);
+        return nullptr;
     }
 
-    pthread_mutex_unlock(&cache_mutex);
-    return entry;
+    pcre_cache_entry *entry = new pcre_cache_entry;
+    entry->re = re;
+    entry->captures = 0;
+    (void)pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &(entry->captures));
+    entry->match_data = pcre2_match_data_create_from_pattern(re, nullptr);
+    entry->match_data_busy.clear();
+
+    size_t code_size = 0, jit_size = 0;
+    (void)pcre2_pattern_info(re, PCRE2_INFO_SIZE, &code_size);
+    (void)pcre2_pattern_info(re, PCRE2_INFO_JITSIZE, &jit_size);
+    size_t bytes = sizeof(pcre_cache_entry) + code_size + jit_size;
+    if (entry->match_data != nullptr)
+        bytes += pcre2_get_match_data_size(entry->match_data);
+
+    return regex_cache_insert(REGEX_PCRE, options, string, entry, bytes, free_pcre_entry);
+}
+
+/* Each cached pattern keeps one match data block sized for it. Whoever gets
+   there first borrows it; anyone matching the same pattern concurrently
+   (SQLite's REGEXP runs on other threads) gets a fresh one. */
+static pcre2_match_data *
+acquire_match_data(pcre_cache_entry *entry)
+{
+    if (entry->match_data != nullptr && !entry->match_data_busy.test_and_set(std::memory_order_acquire))
+        return entry->match_data;
+
+    return pcre2_match_data_create_from_pattern(entry->re, nullptr);
+}
+
+static void
+release_match_data(pcre_cache_entry *entry, pcre2_match_data *match_data)
+{
+    if (match_data == entry->match_data)
+        entry->match_data_busy.clear(std::memory_order_release);
+    else
+        pcre2_match_data_free(match_data);
 }
 
 static package
@@ -159,26 +146,19 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr)
     }
 
     /* Compile the pattern */
-    struct pcre_cache_entry *entry = get_pcre(pattern, options);
+    regex_cache_entry *cached = get_pcre(pattern, options, err, sizeof(err));
 
-    if (entry == nullptr) {
+    if (cached == nullptr) {
         free_var(arglist);
-        return make_raise_pack(E_QUOTA, "Out of memory compiling pattern", var_ref(zero));
+        return make_raise_pack(E_INVARG, err, var_ref(zero));
     }
 
-    if (entry->error != nullptr)
-    {
-        package r = make_raise_pack(E_INVARG, entry->error, var_ref(zero));
-        free_entry(entry);
-        free_var(arglist);
-        /* We don't need to remove it from the cache because error entries never make it to begin with. */
-        return r;
-    }
+    pcre_cache_entry *entry = (pcre_cache_entry *)cached->value;
 
-    /* Create match data for PCRE2 */
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(entry->re, nullptr);
+    /* Borrow the pattern's match data */
+    pcre2_match_data *match_data = acquire_match_data(entry);
     if (match_data == nullptr) {
-        free_entry(entry);
+        regex_cache_release(cached);
         free_var(arglist);
         return make_raise_pack(E_QUOTA, "Failed to allocate PCRE2 match data", var_ref(zero));
     }
@@ -216,9 +196,9 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr)
             PCRE2_UCHAR error_buffer[256];
             pcre2_get_error_message(rc, error_buffer, sizeof(error_buffer));
             snprintf(err, sizeof(err), "pcre2_match returned error: %s (%d)", (char*)error_buffer, rc);
-            pcre2_match_data_free(match_data);
+            release_match_data(entry, match_data);
             /* Don't delete cache entry on match errors - pattern compiled successfully */
-            free_entry(entry);
+            regex_cache_release(cached);
             free_var(arglist);
             return make_raise_pack(E_INVARG, err, var_ref(zero));
         } else if (rc == PCRE2_ERROR_NOMATCH) {
@@ -227,9 +207,9 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr)
         } else if (loops >= total_loops) {
             /* The loop has iterated beyond the maximum limit, probably locking the server. Kill it. */
             snprintf(err, sizeof(err), "Too many iterations of matching loop: %u", loops);
-            pcre2_match_data_free(match_data);
+            release_match_data(entry, match_data);
             /* Don't delete cache entry - pattern is valid, just too many matches */
-            free_entry(entry);
+            regex_cache_release(cached);
             free_var(arglist);
             return make_raise_pack(E_MAXREC, err, var_ref(zero));
         } else {
@@ -318,38 +298,12 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr)
             break;
     }
 
-    pcre2_match_data_free(match_data);
-    free_entry(entry);
+    release_match_data(entry, match_data);
+    regex_cache_release(cached);
     free_var(arglist);
     return make_var_pack(ret);
 }
 
-static void free_entry(pcre_cache_entry *entry)
-{
-    if (--entry->refcount > 0) {
-        return;
-    }
-    if (entry->re != nullptr)
-        pcre2_code_free(entry->re);
-
-    if (entry->error != nullptr)
-        free_str(entry->error);
-
-    free(entry);
-}
-
-static void delete_cache_entry(const char *pattern, unsigned char options)
-{
-    cache_type pair = std::make_pair(pattern, options);
-    pthread_mutex_lock(&cache_mutex);
-    auto it = pcre_pattern_cache.find(pair);
-    auto entry = *it;
-    pcre_pattern_cache.erase(it);
-    free_str(entry.first.first);
-    free_entry(entry.second);
-    pthread_mutex_unlock(&cache_mutex);
-}
-
 /* Create a two element list with the substring indices. */
 static Var result_indices(PCRE2_SIZE ovector[], int n)
 {
@@ -411,44 +365,14 @@ bf_pcre_replace(Var arglist, Byte next, void *vdata, Objid progr)
     }
 }
 
-static package
-bf_pcre_cache_stats(Var arglist, Byte next, void *vdata, Objid progr)
-{
-    free_var(arglist);
-
-    if (!is_wizard(progr))
-        return make_error_pack(E_PERM);
-
-    Var ret = new_list(pcre_pattern_cache.size());
-
-    int count = 0;
-    for (const auto& x : pcre_pattern_cache) {
-        count++;
-        Var entry = new_list(2);
-        entry.v.list[1] = str_dup_to_var(x.first.first);
-        entry.v.list[2] = Var::new_int(x.second->cache_hits);
-        ret.v.list[count] = entry;
-    }
-
-    return make_var_pack(ret);
-}
-
 void
 pcre_shutdown(void)
 {
-    for (const auto& x : pcre_pattern_cache) {
-        free_entry(x.second);
-        free_str(x.first.first);
-    }
-
-    pcre_pattern_cache.clear();
-
     if (global_match_ctx != nullptr) {
         pcre2_match_context_free(global_match_ctx);
         global_match_ctx = nullptr;
     }
 
-    pthread_mutex_destroy(&cache_mutex);
 }
 
 #ifdef SQLITE3_FOUND
@@ -468,26 +392,29 @@ void sqlite_regexp(sqlite3_context *ctx, int argc, sqlite3_value **argv)
         return;
     }
 
-    struct pcre_cache_entry *entry = get_pcre(pattern, 0);
-    if (entry == nullptr) {
-        sqlite3_result_error(ctx, "Out of memory compiling pattern", -1);
-        return;
-    }
-    if (entry->error != nullptr)
+    char err[256];
+    regex_cache_entry *cached = get_pcre(pattern, 0, err, sizeof(err));
+    if (cached == nullptr)
     {
-        sqlite3_result_error(ctx, entry->error, -1);
-        free_entry(entry);
+        sqlite3_result_error(ctx, err, -1);
         return;
     }
 
+    pcre_cache_entry *entry = (pcre_cache_entry *)cached->value;
+
     /* Initialize global match context with security limits */
     init_global_match_context();
 
-    pcre2_match_data *match_data = pcre2_match_data_create(0, nullptr);
+    pcre2_match_data *match_data = acquire_match_data(entry);
+    if (match_data == nullptr) {
+        regex_cache_release(cached);
+        sqlite3_result_error(ctx, "Failed to allocate PCRE2 match data", -1);
+        return;
+    }
     int result = pcre2_match(entry->re, (PCRE2_SPTR)string, strlen(string), 0, 0, match_data, global_match_ctx);
-    pcre2_match_data_free(match_data);
+    release_match_data(entry, match_data);
 
-    free_entry(entry);
+    regex_cache_release(cached);
     sqlite3_result_int(ctx, result >= 0);
 }
 #endif /* SQLITE3_FOUND */
@@ -507,15 +434,6 @@ register_pcre() {
     //                                                   string    pattern   ?case     ?find_all
     register_function("pcre_match", 2, 4, bf_pcre_match, TYPE_STR, TYPE_STR, TYPE_INT, TYPE_INT);
     register_function("pcre_replace", 2, 2, bf_pcre_replace, TYPE_STR, TYPE_STR);
-    register_function("pcre_cache_stats", 0, 0, bf_pcre_cache_stats);
-
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-
-    pthread_mutex_init(&cache_mutex, &attr);
-
-    pthread_mutexattr_destroy(&attr);
 }
 
 #else /* PCRE2_FOUND */
@@ -0,0 +1,395 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <string.h>
+#include <sys/time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "bf_register.h"
+#include "db.h"
+#include "decompile.h"
+#include "functions.h"
+#include "list.h"
+#include "program.h"
+#include "utils.h"
+
+bool profiler_active = false;
+std::atomic<int> profile_sample_due(0);
+
+enum profile_mode {
+    PROFILE_CALLS, PROFILE_SAMPLES
+};
+
+struct profile_frame {
+    int parent;                 /* index into `frames', or -1 for the first
+                                   verb of a task */
+    unsigned call_pc;           /* where in the parent this one was called */
+    Program *prog;              /* referenced until the profile is cleared */
+    int vector;
+    std::string name;           /* "#obj:verbname" */
+    Num calls;
+    Num ticks;
+    double seconds;
+    std::map<unsigned, Num> samples;    /* by pc */
+};
+
+struct frame_key {
+    int parent;
+    unsigned call_pc;
+    Program *prog;
+    int vector;
+
+    bool operator==(const frame_key &k) const {
+        return parent == k.parent && call_pc == k.call_pc
+               && prog == k.prog && vector == k.vector;
+    }
+};
+
+struct frame_key_hash {
+    size_t operator()(const frame_key &k) const {
+        size_t h = std::hash<Program *>()(k.prog);
+        h = h * 31 + std::hash<int>()(k.parent);
+        h = h * 31 + std::hash<unsigned>()(k.call_pc);
+        return h * 31 + std::hash<int>()(k.vector);
+    }
+};
+
+static profile_mode mode = PROFILE_CALLS;
+static double sample_interval = 0.01;
+static std::vector<profile_frame> frames;
+static std::unordered_map<frame_key, int, frame_key_hash> frame_index;
+
+/* The frames of the running task, one for each of its activations.  When
+ * this doesn't match the activation stack (because the profile was started
+ * part way through a task) it is rebuilt from the stack.
+ */
+static std::vector<int> running;
+static std::chrono::steady_clock::time_point last_time;
+static int last_ticks;
+
+static void
+clear_profile()
+{
+    for (auto &f : frames)
+        free_program(f.prog);
+    frames.clear();
+    frame_index.clear();
+    running.clear();
+}
+
+static int
+find_frame(int parent, unsigned call_pc, activation *a, int vector)
+{
+    frame_key key = {parent, call_pc, a->prog, vector};
+    auto it = frame_index.find(key);
+    if (it != frame_index.end())
+        return it->second;
+
+    profile_frame f;
+    f.parent = parent;
+    f.call_pc = call_pc;
+    f.prog = program_ref(a->prog);
+    f.vector = vector;
+    if (a->vloc.type == TYPE_OBJ)
+        f.name = "#" + std::to_string(a->vloc.v.obj) + ":" + a->verbname;
+    else
+        f.name = std::string("*anonymous*:") + a->verbname;
+    f.calls = f.ticks = 0;
+    f.seconds = 0.0;
+
+    int index = frames.size();
+    frames.push_back(std::move(f));
+    frame_index.emplace(key, index);
+    return index;
+}
+
+static void
+rebuild_running(activation *stack, int top, int root_vector)
+{
+    running.clear();
+    for (int i = 0; i <= top; i++) {
+        if (i == 0)
+            running.push_back(find_frame(-1, 0, &stack[0], root_vector));
+        else
+            running.push_back(find_frame(running.back(), stack[i - 1].error_pc,
+                                         &stack[i], MAIN_VECTOR));
+    }
+}
+
+static void
+reset_clock(int ticks)
+{
+    last_time = std::chrono::steady_clock::now();
+    last_ticks = ticks;
+}
+
+/* Charge what has been used since the last call or return to the frame
+ * that was running.
+ */
+static void
+charge_running(int ticks)
+{
+    if (mode != PROFILE_CALLS || running.empty())
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    profile_frame &f = frames[running.back()];
+    f.seconds += std::chrono::duration<double>(now - last_time).count();
+    f.ticks += last_ticks - ticks;
+    last_time = now;
+    last_ticks = ticks;
+}
+
+void
+profile_task_begin(activation *stack, int top, int root_vector, int ticks)
+{
+    rebuild_running(stack, top, root_vector);
+    reset_clock(ticks);
+    /* A task that is resuming has moved past the start of its verb. */
+    if (mode == PROFILE_CALLS && top == 0 && stack[0].pc == 0)
+        frames[running.back()].calls++;
+}
+
+void
+profile_call(activation *stack, int top, int root_vector, int ticks)
+{
+    if ((int)running.size() == top) {
+        charge_running(ticks);
+        running.push_back(find_frame(running.back(), stack[top - 1].error_pc,
+                                     &stack[top], MAIN_VECTOR));
+    } else {
+        rebuild_running(stack, top, root_vector);
+        reset_clock(ticks);
+    }
+    if (mode == PROFILE_CALLS)
+        frames[running.back()].calls++;
+}
+
+void
+profile_return(activation *stack, int top, int root_vector, int ticks)
+{
+    if ((int)running.size() == top + 1) {
+        charge_running(ticks);
+        running.pop_back();
+    } else {
+        if (top > 0)
+            rebuild_running(stack, top - 1, root_vector);
+        else
+            running.clear();
+        reset_clock(ticks);
+    }
+}
+
+void
+profile_task_end(int ticks)
+{
+    charge_running(ticks);
+    running.clear();
+}
+
+void
+profile_sample(activation *stack, int top, int root_vector)
+{
+    if (mode != PROFILE_SAMPLES)
+        return;
+    if ((int)running.size() != top + 1)
+        rebuild_running(stack, top, root_vector);
+    frames[running.back()].samples[stack[top].error_pc]++;
+}
+
+#if defined(SIGPROF) && defined(ITIMER_PROF)
+
+static void
+profile_timer(int sig)
+{
+    profile_sample_due.store(1, std::memory_order_release);
+    interpreter_interrupt.store(1, std::memory_order_release);
+}
+
+static bool
+set_profile_timer(double interval)
+{
+    struct itimerval it;
+
+    it.it_interval.tv_sec = (time_t) interval;
+    it.it_interval.tv_usec = (suseconds_t) ((interval - it.it_interval.tv_sec) * 1000000);
+    it.it_value = it.it_interval;
+    if (interval > 0)
+        signal(SIGPROF, profile_timer);
+    return setitimer(ITIMER_PROF, &it, nullptr) == 0;
+}
+
+#else
+
+static bool
+set_profile_timer(double interval)
+{
+    return interval <= 0;
+}
+
+#endif
+
+/**** built in functions ****/
+
+static package
+bf_profile_start(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    int nargs = arglist.v.list[0].v.num;
+    profile_mode new_mode = PROFILE_CALLS;
+    double interval = 0.01;
+
+    if (!is_wizard(progr)) {
+        free_var(arglist);
+        return make_error_pack(E_PERM);
+    }
+    if (nargs >= 1) {
+        const char *m = arglist.v.list[1].v.str;
+        if (!strcasecmp(m, "samples"))
+            new_mode = PROFILE_SAMPLES;
+        else if (strcasecmp(m, "calls")) {
+            free_var(arglist);
+            return make_error_pack(E_INVARG);
+        }
+    }
+    if (nargs >= 2) {
+        Var v = arglist.v.list[2];
+        interval = v.type == TYPE_INT ? (double) v.v.num : v.v.fnum;
+        if (interval < 0.001) {
+            free_var(arglist);
+            return make_error_pack(E_INVARG);
+        }
+    }
+    free_var(arglist);
+
+    set_profile_timer(0);
+    clear_profile();
+    mode = new_mode;
+    sample_interval = interval;
+    profile_sample_due.store(0, std::memory_order_relaxed);
+    if (mode == PROFILE_SAMPLES && !set_profile_timer(sample_interval))
+        return make_raise_pack(E_INVARG, "Sampling is not supported on this system", var_ref(zero));
+    profiler_active = true;
+
+    return no_var_pack();
+}
+
+static package
+bf_profile_stop(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    if (profiler_active && mode == PROFILE_SAMPLES)
+        set_profile_timer(0);
+    profiler_active = false;
+    profile_sample_due.store(0, std::memory_order_relaxed);
+    running.clear();
+
+    return no_var_pack();
+}
+
+/* Frames are written the way flame graph tools expect them: the verbs from
+ * the outermost in, separated by `;', then a space and the value.  Callers
+ * carry the line they made the call from.  In samples mode each line of a
+ * verb is its own entry, and the innermost verb carries its line too.  Each
+ * stack appears once.
+ */
+static package
+bf_profile_dump(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    enum { TICKS, USECS, CALLS, SAMPLES } what = mode == PROFILE_SAMPLES ? SAMPLES : TICKS;
+
+    if (!is_wizard(progr)) {
+        free_var(arglist);
+        return make_error_pack(E_PERM);
+    }
+    if (arglist.v.list[0].v.num >= 1) {
+        const char *w = arglist.v.list[1].v.str;
+        if (!strcasecmp(w, "ticks"))
+            what = TICKS;
+        else if (!strcasecmp(w, "usecs"))
+            what = USECS;
+        else if (!strcasecmp(w, "calls"))
+            what = CALLS;
+        else if (!strcasecmp(w, "samples"))
+            what = SAMPLES;
+        else {
+            free_var(arglist);
+            return make_error_pack(E_INVARG);
+        }
+    }
+    free_var(arglist);
+
+    /* Finding a line means decompiling the verb, so do it once per call site. */
+    std::map<std::pair<int, unsigned>, std::string> labels;
+    auto label = [&labels](int i, unsigned pc) -> const std::string & {
+        auto it = labels.find({i, pc});
+        if (it == labels.end()) {
+            const profile_frame &f = frames[i];
+            unsigned line = find_line_number(f.prog, f.vector, pc);
+            it = labels.emplace(std::make_pair(i, pc), f.name + ":" + std::to_string(line)).first;
+        }
+        return it->second;
+    };
+    auto path = [&label](int i) -> std::string {
+        std::string p;
+        for (int child = i, parent = frames[i].parent; parent >= 0;
+             child = parent, parent = frames[parent].parent)
+            p = label(parent, frames[child].call_pc) + ";" + p;
+        return p;
+    };
+
+    /* Several pcs on one line, or calls made from different pcs on the same
+       line, fold to the same stack; add those up into one entry. */
+    std::vector<std::pair<std::string, Num>> folded;
+    std::unordered_map<std::string, size_t> folded_index;
+    auto add = [&folded, &folded_index](std::string stack, Num value) {
+        auto it = folded_index.find(stack);
+        if (it != folded_index.end()) {
+            folded[it->second].second += value;
+            return;
+        }
+        folded_index.emplace(stack, folded.size());
+        folded.emplace_back(std::move(stack), value);
+    };
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        const profile_frame &f = frames[i];
+        if (what == SAMPLES) {
+            if (f.samples.empty())
+                continue;
+            std::string p = path(i);
+            for (const auto &s : f.samples)
+                add(p + label(i, s.first), s.second);
+            continue;
+        }
+
+        Num value = what == TICKS ? f.ticks
+                    : what == CALLS ? f.calls
+                    : (Num) (f.seconds * 1000000 + 0.5);
+        if (value == 0)
+            continue;
+        add(path(i) + f.name, value);
+    }
+
+    Var r = new_list(folded.size());
+    for (size_t i = 0; i < folded.size(); i++) {
+        std::string line = folded[i].first + " " + std::to_string(folded[i].second);
+        r.v.list[i + 1] = str_dup_to_var(line.c_str());
+    }
+
+    return make_var_pack(r);
+}
+
+void
+register_profiler(void)
+{
+    register_function("profile_start", 0, 2, bf_profile_start, TYPE_STR, TYPE_NUMERIC);
+    register_function("profile_stop", 0, 0, bf_profile_stop);
+    register_function("profile_dump", 0, 1, bf_profile_dump, TYPE_STR);
+}
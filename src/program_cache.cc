@@ -0,0 +1,142 @@
+#include "program_cache.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "bf_register.h"
+#include "db.h"
+#include "functions.h"
+#include "map.h"
+#include "server.h"
+#include "utils.h"
+
+/* The key is the database version, followed by each line of the code ended
+   by a NUL, which can't occur in a MOO string. */
+static std::string
+cache_key(Var code)
+{
+    std::string key;
+    key += (char)current_db_version;
+    for (int i = 1; i <= code.v.list[0].v.num; i++) {
+        key += code.v.list[i].v.str;
+        key += '\0';
+    }
+    return key;
+}
+
+struct cache_slot {
+    std::string key;
+    Program *program;
+    size_t bytes;
+};
+
+typedef std::list<cache_slot> lru_list;
+
+/* Most recently used at the front. */
+static lru_list lru;
+static std::unordered_map<std::string, lru_list::iterator> by_key;
+
+static size_t total_bytes = 0;
+static uint64_t total_hits = 0, total_misses = 0, total_evictions = 0;
+
+static void
+evict(lru_list::iterator it)
+{
+    total_bytes -= it->bytes;
+    free_program(it->program);
+    by_key.erase(it->key);
+    lru.erase(it);
+}
+
+/* Drop least recently used entries until there's room for `incoming' more
+   bytes and one more entry. */
+static void
+make_room(size_t incoming)
+{
+    const size_t max_entries = server_int_option_cached(SVO_PROGRAM_CACHE_SIZE);
+    const size_t max_bytes = server_int_option_cached(SVO_PROGRAM_CACHE_BYTES);
+
+    while (!lru.empty() && (lru.size() >= max_entries || total_bytes + incoming > max_bytes)) {
+        evict(std::prev(lru.end()));
+        total_evictions++;
+    }
+}
+
+Program *
+program_cache_find(Var code)
+{
+    if (server_int_option_cached(SVO_PROGRAM_CACHE_SIZE) <= 0) {
+        /* Let go of what was cached before it was turned off. */
+        while (!lru.empty())
+            evict(lru.begin());
+        return nullptr;
+    }
+
+    auto found = by_key.find(cache_key(code));
+    if (found == by_key.end())
+        return nullptr;
+
+    lru.splice(lru.begin(), lru, found->second);
+    total_hits++;
+    return program_ref(found->second->program);
+}
+
+void
+program_cache_insert(Var code, Program *program)
+{
+    const size_t max_bytes = server_int_option_cached(SVO_PROGRAM_CACHE_BYTES);
+
+    if (server_int_option_cached(SVO_PROGRAM_CACHE_SIZE) <= 0)
+        return;
+
+    total_misses++;
+    if (!program)
+        return;
+
+    std::string key = cache_key(code);
+    size_t bytes = program_bytes(program) + sizeof(cache_slot) + 2 * key.size();
+
+    if (bytes > max_bytes || by_key.count(key))
+        return;
+
+    make_room(bytes);
+
+    lru.push_front({key, program_ref(program), bytes});
+    by_key.emplace(std::move(key), lru.begin());
+    total_bytes += bytes;
+}
+
+void
+program_cache_shutdown(void)
+{
+    while (!lru.empty())
+        evict(lru.begin());
+}
+
+/* program_cache_stats() => a map of cache-wide totals. */
+static package
+bf_program_cache_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    Var ret = new_map();
+    ret = mapinsert(ret, str_dup_to_var("entries"), Var::new_int(lru.size()));
+    ret = mapinsert(ret, str_dup_to_var("bytes"), Var::new_int(total_bytes));
+    ret = mapinsert(ret, str_dup_to_var("max_entries"), Var::new_int(server_int_option_cached(SVO_PROGRAM_CACHE_SIZE)));
+    ret = mapinsert(ret, str_dup_to_var("max_bytes"), Var::new_int(server_int_option_cached(SVO_PROGRAM_CACHE_BYTES)));
+    ret = mapinsert(ret, str_dup_to_var("hits"), Var::new_int(total_hits));
+    ret = mapinsert(ret, str_dup_to_var("misses"), Var::new_int(total_misses));
+    ret = mapinsert(ret, str_dup_to_var("evictions"), Var::new_int(total_evictions));
+
+    return make_var_pack(ret);
+}
+
+void
+register_program_cache(void)
+{
+    register_function("program_cache_stats", 0, 0, bf_program_cache_stats);
+}
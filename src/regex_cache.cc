@@ -0,0 +1,198 @@
+#include "regex_cache.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "bf_register.h"
+#include "functions.h"
+#include "list.h"
+#include "map.h"
+#include "server.h"
+#include "utils.h"
+
+/* The key is the kind and options packed into two leading bytes, followed by
+   the pattern itself, so a single string hash covers all three. */
+static std::string
+cache_key(regex_kind kind, unsigned char options, const char *pattern)
+{
+    std::string key;
+    key.reserve(strlen(pattern) + 2);
+    key += (char)kind;
+    key += (char)options;
+    key += pattern;
+    return key;
+}
+
+struct cache_slot {
+    std::string key;
+    regex_cache_entry *entry;
+};
+
+typedef std::list<cache_slot> lru_list;
+
+/* Most recently used at the front. */
+static lru_list lru;
+static std::unordered_map<std::string, lru_list::iterator> by_key;
+static std::mutex cache_mutex;
+
+static size_t total_bytes = 0;
+static uint64_t total_hits = 0, total_misses = 0, total_evictions = 0;
+
+/* The refcount is atomic, so callers can release outside the cache lock. */
+void
+regex_cache_release(regex_cache_entry *entry)
+{
+    if (--entry->refcount > 0)
+        return;
+
+    entry->free_value(entry->value);
+    delete entry;
+}
+
+static void
+evict(lru_list::iterator it)
+{
+    regex_cache_entry *entry = it->entry;
+
+    total_bytes -= entry->bytes;
+    by_key.erase(it->key);
+    lru.erase(it);
+    regex_cache_release(entry);
+}
+
+/* Drop least recently used entries until there's room for `incoming' more
+   bytes and one more entry. */
+static void
+make_room(size_t incoming)
+{
+    const size_t max_entries = server_int_option_cached(SVO_PATTERN_CACHE_SIZE);
+    const size_t max_bytes = server_int_option_cached(SVO_PATTERN_CACHE_BYTES);
+
+    while (!lru.empty() && (lru.size() >= max_entries || total_bytes + incoming > max_bytes)) {
+        evict(std::prev(lru.end()));
+        total_evictions++;
+    }
+}
+
+regex_cache_entry *
+regex_cache_find(regex_kind kind, unsigned char options, const char *pattern)
+{
+    std::string key = cache_key(kind, options, pattern);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    auto found = by_key.find(key);
+    if (found == by_key.end()) {
+        total_misses++;
+        return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, found->second);
+    regex_cache_entry *entry = found->second->entry;
+    entry->hits++;
+    entry->refcount++;
+    total_hits++;
+    return entry;
+}
+
+regex_cache_entry *
+regex_cache_insert(regex_kind kind, unsigned char options, const char *pattern,
+                   void *value, size_t bytes, void (*free_value)(void *))
+{
+    std::string key = cache_key(kind, options, pattern);
+    bytes += sizeof(regex_cache_entry) + sizeof(cache_slot) + 2 * key.size();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    auto found = by_key.find(key);
+    if (found != by_key.end()) {
+        /* Lost a race with another thread compiling the same pattern. */
+        free_value(value);
+        lru.splice(lru.begin(), lru, found->second);
+        regex_cache_entry *entry = found->second->entry;
+        entry->refcount++;
+        return entry;
+    }
+
+    regex_cache_entry *entry = new regex_cache_entry;
+    entry->value = value;
+    entry->free_value = free_value;
+    entry->bytes = bytes;
+    entry->hits = 0;
+    /* One reference for the caller and one for the cache. */
+    entry->refcount = 2;
+
+    make_room(bytes);
+
+    lru.push_front({key, entry});
+    by_key.emplace(std::move(key), lru.begin());
+    total_bytes += bytes;
+
+    return entry;
+}
+
+void
+regex_cache_shutdown(void)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    while (!lru.empty())
+        evict(lru.begin());
+}
+
+/* pcre_cache_stats([summary]) =>
+ *   {{pattern, hits, kind, bytes}, ...} from most to least recently used, or,
+ *   when `summary' is true, a map of cache-wide totals. */
+static package
+bf_pcre_cache_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    static const Var entries_key = str_dup_to_var("entries");
+    static const Var bytes_key = str_dup_to_var("bytes");
+    static const Var max_entries_key = str_dup_to_var("max_entries");
+    static const Var max_bytes_key = str_dup_to_var("max_bytes");
+    static const Var hits_key = str_dup_to_var("hits");
+    static const Var misses_key = str_dup_to_var("misses");
+    static const Var evictions_key = str_dup_to_var("evictions");
+    static const Var match_kind = str_dup_to_var("match");
+    static const Var pcre_kind = str_dup_to_var("pcre");
+
+    const bool summary = arglist.v.list[0].v.num >= 1 && is_true(arglist.v.list[1]);
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    if (summary) {
+        Var ret = new_map();
+        ret = mapinsert(ret, var_ref(entries_key), Var::new_int(lru.size()));
+        ret = mapinsert(ret, var_ref(bytes_key), Var::new_int(total_bytes));
+        ret = mapinsert(ret, var_ref(max_entries_key), Var::new_int(server_int_option_cached(SVO_PATTERN_CACHE_SIZE)));
+        ret = mapinsert(ret, var_ref(max_bytes_key), Var::new_int(server_int_option_cached(SVO_PATTERN_CACHE_BYTES)));
+        ret = mapinsert(ret, var_ref(hits_key), Var::new_int(total_hits));
+        ret = mapinsert(ret, var_ref(misses_key), Var::new_int(total_misses));
+        ret = mapinsert(ret, var_ref(evictions_key), Var::new_int(total_evictions));
+        return make_var_pack(ret);
+    }
+
+    Var ret = new_list(lru.size());
+    int count = 0;
+    for (const auto& slot : lru) {
+        Var entry = new_list(4);
+        entry.v.list[1] = str_dup_to_var(slot.key.c_str() + 2);
+        entry.v.list[2] = Var::new_int(slot.entry->hits);
+        entry.v.list[3] = var_ref(slot.key[0] == REGEX_PCRE ? pcre_kind : match_kind);
+        entry.v.list[4] = Var::new_int(slot.entry->bytes);
+        ret.v.list[++count] = entry;
+    }
+
+    return make_var_pack(ret);
+}
+
+void
+register_regex_cache(void)
+{
+    register_function("pcre_cache_stats", 0, 1, bf_pcre_cache_stats, TYPE_ANY);
+}
@@ -877,6 +877,114 @@ re_compile_fastmap(bufp)
 #define MAX_FAILURES   100000	/* max # of failure points before failing */
 
 
+/* Added for ToastStunt: decide whether the star or plus loop whose star_jump
+   ends just before `code' (jumping back by `a') can never need to backtrack
+   into fewer iterations, in which case re_match_2() turns it into an
+   update_failure_jump.  Split out of re_match_2() so re_possessive_loops()
+   can report the same decisions. */
+static int star_jump_cannot_backtrack PROTO((regexp_t, char *, int));
+static int
+star_jump_cannot_backtrack(bufp, code, a)
+    regexp_t bufp;
+    char *code;
+    int a;
+{
+    int b, ch;
+    char map[256], can_be_null;
+    char *p1, *p2;
+
+    p1 = code + a + 3;	/* skip the failure_jump */
+    assert(p1[-3] == Cfailure_jump);
+    p2 = code;
+    /* p1 points inside loop, p2 points to after loop */
+    if (!re_do_compile_fastmap(bufp->buffer, bufp->used,
+		       p2 - bufp->buffer, &can_be_null, map))
+	return 0;
+    /* If we might introduce a new update point inside the loop,
+       we can't optimize because then update_jump would update a
+       wrong failure point.  Thus we have to be quite careful here. */
+  loop_p1:
+    /* loop until we find something that consumes a character */
+    switch (*p1++) {
+    case Cbol:
+    case Ceol:
+    case Cbegbuf:
+    case Cendbuf:
+    case Cwordbeg:
+    case Cwordend:
+    case Cwordbound:
+    case Cnotwordbound:
+#ifdef emacs
+    case Cemacs_at_dot:
+#endif				/* emacs */
+	goto loop_p1;
+    case Cstart_memory:
+    case Cend_memory:
+	p1++;
+	goto loop_p1;
+    case Cexact:
+	ch = (unsigned char) *p1++;
+	if (map[ch])
+	    return 0;
+	break;
+    case Canychar:
+	for (b = 0; b < 256; b++)
+	    if (b != '\n' && map[b])
+		return 0;
+	break;
+    case Cset:
+	for (b = 0; b < 256; b++)
+	    if ((p1[b >> 3] & (1 << (b & 7))) && map[b])
+		return 0;
+	p1 += 256 / 8;
+	break;
+    default:
+	return 0;
+    }
+    /* now we know that we can't backtrack. */
+    while (p1 != p2 - 3) {
+	switch (*p1++) {
+	case Cend:
+	    abort();	/* we certainly shouldn't get this inside loop */
+	    /*NOTREACHED */
+	case Cbol:
+	case Ceol:
+	case Canychar:
+	case Cbegbuf:
+	case Cendbuf:
+	case Cwordbeg:
+	case Cwordend:
+	case Cwordbound:
+	case Cnotwordbound:
+#ifdef emacs
+	case Cemacs_at_dot:
+#endif				/* emacs */
+	    break;
+	case Cset:
+	    p1 += 256 / 8;
+	    break;
+	case Cexact:
+	case Cstart_memory:
+	case Cend_memory:
+	case Cmatch_memory:
+	case Csyntaxspec:
+	case Cnotsyntaxspec:
+	    p1++;
+	    break;
+	case Cjump:
+	case Cstar_jump:
+	case Cfailure_jump:
+	case Cupdate_failure_jump:
+	case Cdummy_failure_jump:
+	    return 0;
+	default:
+	    printf("regexpr.c: processing star_jump: unknown op %d\n", p1[-1]);
+	    break;
+	}
+    }
+    return 1;
+}
+
 int
 re_match_2(bufp, string1, size1, string2, size2, pos, regs, mstop)
     regexp_t bufp;
@@ -1084,102 +1192,8 @@ re_match_2(bufp, string1, size1, string2, size2, pos, regs, mstop)
 	    a = (unsigned char) *code++;
 	    a |= (unsigned char) *code++ << 8;
 	    a = (int) (short) a;
-	    {
-		char map[256], can_be_null;
-		char *p1, *p2;
-
-		p1 = code + a + 3;	/* skip the failure_jump */
-		assert(p1[-3] == Cfailure_jump);
-		p2 = code;
-		/* p1 points inside loop, p2 points to after loop */
-		if (!re_do_compile_fastmap(bufp->buffer, bufp->used,
-				   p2 - bufp->buffer, &can_be_null, map))
-		    goto make_normal_jump;
-		/* If we might introduce a new update point inside the loop,
-		   we can't optimize because then update_jump would update a
-		   wrong failure point.  Thus we have to be quite careful here. */
-	      loop_p1:
-		/* loop until we find something that consumes a character */
-		switch (*p1++) {
-		case Cbol:
-		case Ceol:
-		case Cbegbuf:
-		case Cendbuf:
-		case Cwordbeg:
-		case Cwordend:
-		case Cwordbound:
-		case Cnotwordbound:
-#ifdef emacs
-		case Cemacs_at_dot:
-#endif				/* emacs */
-		    goto loop_p1;
-		case Cstart_memory:
-		case Cend_memory:
-		    p1++;
-		    goto loop_p1;
-		case Cexact:
-		    ch = (unsigned char) *p1++;
-		    if (map[ch])
-			goto make_normal_jump;
-		    break;
-		case Canychar:
-		    for (b = 0; b < 256; b++)
-			if (b != '\n' && map[b])
-			    goto make_normal_jump;
-		    break;
-		case Cset:
-		    for (b = 0; b < 256; b++)
-			if ((p1[b >> 3] & (1 << (b & 7))) && map[b])
-			    goto make_normal_jump;
-		    p1 += 256 / 8;
-		    break;
-		default:
-		    goto make_normal_jump;
-		}
-		/* now we know that we can't backtrack. */
-		while (p1 != p2 - 3) {
-		    switch (*p1++) {
-		    case Cend:
-			abort();	/* we certainly shouldn't get this inside loop */
-			/*NOTREACHED */
-		    case Cbol:
-		    case Ceol:
-		    case Canychar:
-		    case Cbegbuf:
-		    case Cendbuf:
-		    case Cwordbeg:
-		    case Cwordend:
-		    case Cwordbound:
-		    case Cnotwordbound:
-#ifdef emacs
-		    case Cemacs_at_dot:
-#endif				/* emacs */
-			break;
-		    case Cset:
-			p1 += 256 / 8;
-			break;
-		    case Cexact:
-		    case Cstart_memory:
-		    case Cend_memory:
-		    case Cmatch_memory:
-		    case Csyntaxspec:
-		    case Cnotsyntaxspec:
-			p1++;
-			break;
-		    case Cjump:
-		    case Cstar_jump:
-		    case Cfailure_jump:
-		    case Cupdate_failure_jump:
-		    case Cdummy_failure_jump:
-			goto make_normal_jump;
-		    default:
-			printf("regexpr.c: processing star_jump: unknown op %d\n", p1[-1]);
-			break;
-		    }
-		}
+	    if (star_jump_cannot_backtrack(bufp, code, a))
 		goto make_update_jump;
-	    }
-	  make_normal_jump:
 	    /* printf("changing to normal jump\n"); */
 	    code -= 3;
 	    *code = Cjump;
@@ -1351,6 +1365,49 @@ re_match(bufp, string, size, pos, regs)
     return re_match_2(bufp, string, size, (char *) NULL, 0, pos, regs, size);
 }
 
+int
+re_possessive_loops(bufp, possessive, max)
+    regexp_t bufp;
+    char *possessive;
+    int max;
+{
+    char *code = bufp->buffer, *end = bufp->buffer + bufp->used;
+    int a, loops = 0;
+
+    while (code < end) {
+	switch (*code++) {
+	case Cset:
+	    code += 256 / 8;
+	    break;
+	case Cexact:
+	case Cstart_memory:
+	case Cend_memory:
+	case Cmatch_memory:
+	case Csyntaxspec:
+	case Cnotsyntaxspec:
+	    code++;
+	    break;
+	case Cjump:
+	case Cfailure_jump:
+	case Cupdate_failure_jump:
+	case Cdummy_failure_jump:
+	    code += 2;
+	    break;
+	case Cstar_jump:
+	    a = (unsigned char) *code++;
+	    a |= (unsigned char) *code++ << 8;
+	    a = (int) (short) a;
+	    if (loops < max)
+		possessive[loops] = star_jump_cannot_backtrack(bufp, code, a);
+	    loops++;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return loops;
+}
+
 int
 re_search_2(bufp, string1, size1, string2, size2, pos, range, regs,
 	    mstop)
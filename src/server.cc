@@ -34,6 +34,10 @@
 #include <fstream>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 #include <getopt.h>
 #include <sys/types.h>      /* must be first on some systems */
 #include <signal.h>
@@ -79,6 +83,8 @@
 #include "background.h"
 #include "map.h"
 #include "pcre_moo.h" /* pcre shutdown */
+#include "regex_cache.h" /* regex cache shutdown */
+#include "program_cache.h" /* program cache shutdown */
 
 #ifdef JEMALLOC_FOUND
 #include <jemalloc/jemalloc.h>
@@ -751,6 +757,150 @@ read_values_pending_finalization(void)
     return 1;
 }
 
+/**** timing the main loop ****/
+
+enum loop_phase {
+    PHASE_GC, PHASE_CHECKPOINT, PHASE_RECYCLE, PHASE_NETWORK, PHASE_TASKS,
+    PHASE_CHILDREN, PHASE_CONNECTIONS, NUM_LOOP_PHASES
+};
+
+static const char *loop_phase_names[NUM_LOOP_PHASES] = {
+    "gc", "checkpoint", "recycle", "network", "tasks", "children", "connections"
+};
+
+/* Phase times are counted in buckets of under 10us, 100us, 1ms, 10ms,
+ * 100ms, 1s and the rest.
+ */
+#define LOOP_TIME_BUCKETS 7
+
+static struct {
+    Num iterations;
+    Num lagged;                 /* passes over main_loop_lag_msecs */
+    struct {
+        double seconds;
+        double max_seconds;
+        Num times[LOOP_TIME_BUCKETS];
+    } phases[NUM_LOOP_PHASES];
+} loop_stats;
+
+typedef std::chrono::steady_clock loop_clock;
+
+/* The phase the main loop is in and when it started its current pass, for
+ * the watchdog.
+ */
+static std::atomic<int> current_loop_phase(PHASE_GC);
+static std::atomic<loop_clock::rep> loop_pass_start;
+
+/* Charge the time since *SINCE to PHASE and move on to NEXT. */
+static void
+end_loop_phase(loop_phase phase, loop_phase next, loop_clock::time_point *since,
+               double *pass)
+{
+    loop_clock::time_point now = loop_clock::now();
+    double t = std::chrono::duration<double>(now - *since).count();
+    int bucket = 0;
+
+    for (double limit = 0.00001; bucket < LOOP_TIME_BUCKETS - 1 && t >= limit; limit *= 10)
+        bucket++;
+    loop_stats.phases[phase].times[bucket]++;
+    loop_stats.phases[phase].seconds += t;
+    if (t > loop_stats.phases[phase].max_seconds)
+        loop_stats.phases[phase].max_seconds = t;
+
+    pass[phase] = t;
+    *since = now;
+    current_loop_phase = next;
+}
+
+/* Log a pass through the main loop that spent too long outside of waiting
+ * for input.
+ */
+static void
+check_loop_lag(const double *pass)
+{
+    int threshold = server_int_option_cached(SVO_MAIN_LOOP_LAG_MSECS);
+    double busy = 0;
+
+    for (int i = 0; i < NUM_LOOP_PHASES; i++)
+        if (i != PHASE_NETWORK)
+            busy += pass[i];
+    if (threshold <= 0 || busy * 1000 < threshold)
+        return;
+
+    loop_stats.lagged++;
+    Stream *s = new_stream(100);
+    for (int i = 0; i < NUM_LOOP_PHASES; i++)
+        stream_printf(s, "%s%s %.3f", i ? ", " : "", loop_phase_names[i], pass[i]);
+    errlog("LAG: Main loop pass took %.3f seconds (%s)\n", busy, reset_stream(s));
+    free_stream(s);
+}
+
+static std::mutex watchdog_mutex;
+static std::condition_variable watchdog_wakeup;
+static bool watchdog_stopping = false;
+
+/* $server_options.watchdog_seconds, copied here by the main loop on each
+ * pass since the options are only safe to read on the main thread.
+ */
+static std::atomic<int> watchdog_seconds;
+
+/* Warn when the main loop hasn't finished a pass in watchdog_seconds.  If
+ * a task is running then, the interpreter logs its stack at its next tick.
+ */
+static void
+watchdog(void)
+{
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    loop_clock::rep reported = 0;
+
+    while (!watchdog_wakeup.wait_for(lock, std::chrono::seconds(1),
+                                     [] { return watchdog_stopping; })) {
+        int limit = watchdog_seconds.load(std::memory_order_relaxed);
+        loop_clock::rep started = loop_pass_start;
+        double stalled = std::chrono::duration<double>(loop_clock::now()
+                         - loop_clock::time_point(loop_clock::duration(started))).count();
+
+        if (limit <= 0 || stalled < limit || started == reported)
+            continue;
+        reported = started;
+        errlog("WATCHDOG: Main loop has been in its %s phase for %.0f seconds\n",
+               loop_phase_names[current_loop_phase], stalled);
+        if (current_loop_phase == PHASE_TASKS || current_loop_phase == PHASE_CHECKPOINT) {
+            stall_report_due.store(1, std::memory_order_release);
+            interpreter_interrupt.store(1, std::memory_order_release);
+        }
+    }
+}
+
+static package
+bf_main_loop_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    Var phases = new_map();
+    for (int i = 0; i < NUM_LOOP_PHASES; i++) {
+        Var times = new_list(LOOP_TIME_BUCKETS);
+        for (int j = 0; j < LOOP_TIME_BUCKETS; j++)
+            times.v.list[j + 1] = Var::new_int(loop_stats.phases[i].times[j]);
+
+        Var phase = new_map();
+        phase = mapinsert(phase, str_dup_to_var("seconds"), Var::new_float(loop_stats.phases[i].seconds));
+        phase = mapinsert(phase, str_dup_to_var("max"), Var::new_float(loop_stats.phases[i].max_seconds));
+        phase = mapinsert(phase, str_dup_to_var("times"), times);
+        phases = mapinsert(phases, str_dup_to_var(loop_phase_names[i]), phase);
+    }
+
+    Var r = new_map();
+    r = mapinsert(r, str_dup_to_var("iterations"), Var::new_int(loop_stats.iterations));
+    r = mapinsert(r, str_dup_to_var("lagged"), Var::new_int(loop_stats.lagged));
+    r = mapinsert(r, str_dup_to_var("phases"), phases);
+
+    return make_var_pack(r);
+}
+
 static void
 main_loop(void)
 {
@@ -794,6 +944,10 @@ main_loop(void)
     run_server_task(-1, Var::new_obj(SYSTEM_OBJECT), "server_started", new_list(0), "", nullptr);
     set_checkpoint_timer(1);
 
+    loop_pass_start = loop_clock::now().time_since_epoch().count();
+    watchdog_seconds.store(server_int_option_cached(SVO_WATCHDOG_SECONDS), std::memory_order_relaxed);
+    std::thread watchdog_thread(watchdog);
+
     /* Now, we enter the main server loop */
     while (!shutdown_triggered) {
         /* Check how long we have until the next task will be ready to run.
@@ -803,12 +957,20 @@ main_loop(void)
         int task_useconds = next_task_start();
         int useconds_left = task_useconds < 0 ? 1000000 : task_useconds;
         shandle *h, *nexth;
+        loop_clock::time_point since = loop_clock::now();
+        double pass[NUM_LOOP_PHASES];
+
+        loop_stats.iterations++;
+        loop_pass_start = since.time_since_epoch().count();
+        current_loop_phase = PHASE_GC;
+        watchdog_seconds.store(server_int_option_cached(SVO_WATCHDOG_SECONDS), std::memory_order_relaxed);
 
 #ifdef ENABLE_GC
         if (gc_run_called || gc_roots_count > GC_ROOTS_LIMIT
                 || checkpoint_requested != CHKPT_OFF)
             gc_collect();
 #endif
+        end_loop_phase(PHASE_GC, PHASE_CHECKPOINT, &since, pass);
 
         if (reopen_logfile_requested) {
             reopen_logfile_requested = false;
@@ -818,8 +980,10 @@ main_loop(void)
 
             new_log = fopen(get_log_file_name(), "a");
             if (new_log) {
-                fclose(get_log_file());
+                FILE *old_log = get_log_file();
+
                 set_log_file(new_log);
+                fclose(old_log);
                 oklog("LOGFILE: Reopening due to remote request signal.\n");
             } else {
                 log_perror("Error reopening log file");
@@ -847,16 +1011,21 @@ main_loop(void)
             checkpoint_finished = 0;
         }
 #endif
+        end_loop_phase(PHASE_CHECKPOINT, PHASE_RECYCLE, &since, pass);
 
         recycle_anonymous_objects();
         recycle_waifs();
+        end_loop_phase(PHASE_RECYCLE, PHASE_NETWORK, &since, pass);
 
         network_process_io(useconds_left);
+        end_loop_phase(PHASE_NETWORK, PHASE_TASKS, &since, pass);
 
         run_ready_tasks();
+        end_loop_phase(PHASE_TASKS, PHASE_CHILDREN, &since, pass);
 
         /* If a exec'd child process exited, deal with it here */
         deal_with_child_exit();
+        end_loop_phase(PHASE_CHILDREN, PHASE_CONNECTIONS, &since, pass);
 
         {   /* Get rid of old un-logged-in or useless connections */
             int now = time(nullptr);
@@ -924,8 +1093,18 @@ main_loop(void)
             }
             all_shandles_mutex.unlock();
         }
+        end_loop_phase(PHASE_CONNECTIONS, PHASE_GC, &since, pass);
+
+        check_loop_lag(pass);
     }
 
+    {
+        std::lock_guard<std::mutex> lock(watchdog_mutex);
+        watchdog_stopping = true;
+    }
+    watchdog_wakeup.notify_one();
+    watchdog_thread.join();
+
     applog(LOG_WARNING, "SHUTDOWN: %s\n", shutdown_message.str().c_str());
     send_shutdown_message(shutdown_message.str().c_str());
 }
@@ -2363,6 +2542,8 @@ main(int argc, char **argv)
     db_clear_ancestor_cache();
     sqlite_shutdown();
     curl_shutdown();
+    regex_cache_shutdown();
+    program_cache_shutdown();
     pcre_shutdown();
 
     free_str(this_program);
@@ -2469,6 +2650,20 @@ bf_memory_usage(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(s);
 }
 
+#ifdef MEMORY_STATS
+/* Returns live bytes, live blocks and total allocations for each type of allocation. */
+static package
+bf_memory_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    return make_var_pack(memory_stats());
+}
+#endif
+
 #ifdef JEMALLOC_FOUND
 /* Returns a LIST of stats from jemalloc about memory usage.
  * NOTE: jemalloc must have been compiled with stats enabled for this to work.
@@ -2957,6 +3152,82 @@ bf_notify(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+static package
+bf_notify_all(Var arglist, Byte next, void *vdata, Objid progr)
+{   /* (players, string [, no_flush [, no_newline]]) */
+    Var players = arglist.v.list[1];
+    const char *line = arglist.v.list[2].v.str;
+    int no_flush = (arglist.v.list[0].v.num > 2
+                    ? is_true(arglist.v.list[3])
+                    : 0);
+    int no_newline = (arglist.v.list[0].v.num > 3
+                      ? is_true(arglist.v.list[4]) : 0);
+    int count = players.v.list[0].v.num;
+    bool wizard = is_wizard(progr);
+    bool any_binary = false;
+    std::vector<shandle *> handles(count);
+
+    for (int i = 1; i <= count; i++) {
+        if (players.v.list[i].type != TYPE_OBJ) {
+            free_var(arglist);
+            return make_error_pack(E_TYPE);
+        }
+        Objid conn = players.v.list[i].v.obj;
+        if (!wizard && progr != conn) {
+            free_var(arglist);
+            return make_error_pack(E_PERM);
+        }
+        shandle *h = find_shandle(conn);
+        if (h && h->disconnect_me.load())
+            h = nullptr;
+        else if (h && h->binary)
+            any_binary = true;
+        handles[i - 1] = h;
+    }
+
+    /* Each recipient's output queue shares one of (at most) two buffers:
+     * the line as text, and the line decoded as raw bytes for binary
+     * connections. */
+    network_buffer text_buf = {nullptr}, binary_buf = {nullptr};
+
+    if (any_binary) {
+        int length;
+        const char *raw = binary_to_raw_bytes(line, &length);
+
+        if (!raw) {
+            free_var(arglist);
+            return make_error_pack(E_INVARG);
+        }
+        binary_buf = network_new_buffer(raw, length, false);
+    }
+
+    Num queued = 0;
+    for (int i = 0; i < count; i++) {
+        shandle *h = handles[i];
+        if (h) {
+            if (h->binary)
+                queued += network_send_buffer(h->nhandle, binary_buf, !no_flush);
+            else {
+                if (!text_buf.ptr)
+                    text_buf = network_new_buffer(line, memo_strlen(line), !no_newline);
+                queued += network_send_buffer(h->nhandle, text_buf, !no_flush);
+            }
+        } else {
+            if (in_emergency_mode)
+                emergency_notify(players.v.list[i + 1].v.obj, line);
+            queued++;
+        }
+    }
+
+    if (text_buf.ptr)
+        network_release_buffer(text_buf);
+    if (binary_buf.ptr)
+        network_release_buffer(binary_buf);
+
+    free_var(arglist);
+    return make_var_pack(Var::new_int(queued));
+}
+
 static package
 bf_boot_player(Var arglist, Byte next, void *vdata, Objid progr)
 {   /* (object) */
@@ -3052,6 +3323,7 @@ bf_connection_info(Var arglist, Byte next, void *vdata, Objid progr)
     static Var dest_port =  str_dup_to_var("destination_port");
     static Var protocol =   str_dup_to_var("protocol");
     static Var is_outbound = str_dup_to_var("outbound");
+    static Var read_stats = str_dup_to_var("read_stats");
 
     network_handle nh = h->nhandle;
 
@@ -3066,6 +3338,7 @@ bf_connection_info(Var arglist, Byte next, void *vdata, Objid progr)
     ret = mapinsert(ret, var_ref(dest_ip), str_dup_to_var(network_ip_address(nh)));
     ret = mapinsert(ret, var_ref(protocol), str_dup_to_var(network_protocol(nh)));
     ret = mapinsert(ret, var_ref(is_outbound), Var::new_int(h->outbound));
+    ret = mapinsert(ret, var_ref(read_stats), network_read_stats(nh));
 #ifdef USE_TLS
     ret = mapinsert(ret, var_ref(tls_key), tls_connection_info(nh));
 #endif
@@ -3277,6 +3550,10 @@ register_server(void)
     register_function("renumber", 1, 1, bf_renumber, TYPE_OBJ);
     register_function("reset_max_object", 0, 0, bf_reset_max_object);
     register_function("memory_usage", 0, 0, bf_memory_usage);
+    register_function("main_loop_stats", 0, 0, bf_main_loop_stats);
+#ifdef MEMORY_STATS
+    register_function("memory_stats", 0, 0, bf_memory_stats);
+#endif
 #ifdef JEMALLOC_FOUND
     register_function("malloc_stats", 0, 0, bf_malloc_stats);
 #endif
@@ -3293,6 +3570,7 @@ register_server(void)
     register_function("idle_seconds", 1, 1, bf_idle_seconds, TYPE_OBJ);
     register_function("connection_name", 1, 2, bf_connection_name, TYPE_OBJ, TYPE_INT);
     register_function("notify", 2, 4, bf_notify, TYPE_OBJ, TYPE_STR, TYPE_ANY, TYPE_ANY);
+    register_function("notify_all", 2, 4, bf_notify_all, TYPE_LIST, TYPE_STR, TYPE_ANY, TYPE_ANY);
     register_function("boot_player", 1, 1, bf_boot_player, TYPE_OBJ);
     register_function("set_connection_option", 3, 3, bf_set_connection_option,
                       TYPE_OBJ, TYPE_STR, TYPE_ANY);
@@ -15,12 +15,21 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <mutex>
 
+#ifdef __MACH__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
 #include "config.h"
 #include "list.h"
+#include "log.h"
+#include "map.h"
 #include "options.h"
 #include "server.h"
 #include "storage.h"
@@ -52,6 +61,360 @@ refcount_overhead(Memory_Type type)
     return total;
 }
 
+#ifdef POOL_ALLOCATOR
+/* Small blocks of the types below come from per-size-class pools.  Blocks
+ * are carved out of slabs that are aligned on their own size, so the size
+ * class of any pointer can be found from its address through a two-level
+ * page map and blocks need no header.  Each thread keeps a free list per
+ * class and trades whole chains of blocks with a shared depot, so the
+ * common case never takes a lock.
+ */
+#define POOL_GRANULE    16
+#define POOL_CLASSES    (POOL_MAX_BLOCK / POOL_GRANULE)
+#define POOL_SLAB_SHIFT 16
+#define POOL_SLAB_SIZE  (1 << POOL_SLAB_SHIFT)
+#define POOL_BATCH      128     /* blocks per chain moved to or from the depot */
+
+typedef struct pool_block {
+    struct pool_block *next;        /* next free block in the same chain */
+    struct pool_block *next_chain;  /* next chain in the depot */
+} pool_block;
+
+/* Size class + 1 of every slab, indexed by address bits 32..47 and 16..31. */
+static std::atomic<unsigned char *> pool_page_map[1 << 16];
+
+static std::mutex pool_depot_lock;
+static pool_block *pool_depot[POOL_CLASSES];
+
+struct pool_cache {
+    pool_block *free[POOL_CLASSES];
+    unsigned count[POOL_CLASSES];
+    bool dead;
+
+    ~pool_cache();
+};
+
+static thread_local pool_cache thread_pool_cache;
+
+static inline bool
+pooled(Memory_Type type)
+{
+    switch (type) {
+        case M_STRING:
+        case M_LIST:
+        case M_TREE:
+        case M_NODE:
+        case M_TASK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline int
+pool_class_of(const void *ptr)
+{
+    uintptr_t addr = (uintptr_t) ptr;
+
+    if (addr >> 48)
+        return -1;
+
+    unsigned char *leaf = pool_page_map[addr >> 32].load(std::memory_order_acquire);
+    return leaf ? (int) leaf[(addr >> POOL_SLAB_SHIFT) & 0xffff] - 1 : -1;
+}
+
+static void
+pool_depot_push(int size_class, pool_block *chain)
+{
+    std::lock_guard<std::mutex> lock(pool_depot_lock);
+
+    chain->next_chain = pool_depot[size_class];
+    pool_depot[size_class] = chain;
+}
+
+/* Carve a new slab into a chain of free blocks of SIZE_CLASS. */
+static pool_block *
+pool_new_slab(int size_class)
+{
+    const size_t block_size = (size_class + 1) * POOL_GRANULE;
+    char *slab = (char *) aligned_alloc(POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+    uintptr_t addr = (uintptr_t) slab;
+
+    if (!slab)
+        return nullptr;
+    if (addr >> 48) {
+        free(slab);
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_depot_lock);
+        unsigned char *leaf = pool_page_map[addr >> 32].load(std::memory_order_relaxed);
+
+        if (!leaf) {
+            leaf = (unsigned char *) calloc(1 << 16, 1);
+            if (!leaf) {
+                free(slab);
+                return nullptr;
+            }
+            pool_page_map[addr >> 32].store(leaf, std::memory_order_release);
+        }
+        leaf[(addr >> POOL_SLAB_SHIFT) & 0xffff] = size_class + 1;
+    }
+
+    pool_block *chain = nullptr;
+    for (size_t offset = POOL_SLAB_SIZE - POOL_SLAB_SIZE % block_size; offset >= block_size;) {
+        offset -= block_size;
+        pool_block *b = (pool_block *) (slab + offset);
+        b->next = chain;
+        chain = b;
+    }
+    return chain;
+}
+
+static void *
+pool_alloc(int size_class)
+{
+    pool_cache *c = &thread_pool_cache;
+    pool_block *b = c->free[size_class];
+
+    if (c->dead)
+        return nullptr;
+
+    if (!b) {
+        {
+            std::lock_guard<std::mutex> lock(pool_depot_lock);
+            if ((b = pool_depot[size_class]) != nullptr)
+                pool_depot[size_class] = b->next_chain;
+        }
+        if (!b && !(b = pool_new_slab(size_class)))
+            return nullptr;
+
+        unsigned count = 0;
+        for (pool_block *x = b; x; x = x->next)
+            count++;
+        c->count[size_class] = count;
+    }
+
+    c->free[size_class] = b->next;
+    c->count[size_class]--;
+    return b;
+}
+
+static void
+pool_free(void *ptr, int size_class)
+{
+    pool_cache *c = &thread_pool_cache;
+    pool_block *b = (pool_block *) ptr;
+
+    if (c->dead) {
+        b->next = nullptr;
+        pool_depot_push(size_class, b);
+        return;
+    }
+
+    b->next = c->free[size_class];
+    c->free[size_class] = b;
+
+    /* Keep at most two chains' worth per thread; hand one back at a time. */
+    if (++c->count[size_class] >= 2 * POOL_BATCH) {
+        pool_block *tail = b;
+        for (int i = 1; i < POOL_BATCH; i++)
+            tail = tail->next;
+        c->free[size_class] = tail->next;
+        c->count[size_class] -= POOL_BATCH;
+        tail->next = nullptr;
+        pool_depot_push(size_class, b);
+    }
+}
+
+pool_cache::~pool_cache()
+{
+    for (int i = 0; i < POOL_CLASSES; i++)
+        if (free[i])
+            pool_depot_push(i, free[i]);
+    dead = true;
+}
+#endif /* POOL_ALLOCATOR */
+
+#ifdef MEMORY_STATS
+static const char *memory_type_names[NUM_MEMORY_TYPES] = {
+    "ast_pool", "ast", "program", "pval", "network", "string", "verbdef",
+    "list", "prep", "propdef", "object_table", "object", "float", "int",
+    "stream", "names", "env", "task", "pattern",
+
+    "bytecodes", "fork_vectors", "lit_list",
+    "prototype", "code_gen", "disassemble", "decompile",
+
+    "rt_stack", "rt_env", "bi_func_data", "vm",
+
+    "ref_entry", "ref_table", "vc_entry", "vc_table", "string_ptrs",
+    "intern_pointer", "intern_entry", "intern_hunk",
+
+    "tree", "node", "trav",
+
+    "anon",
+
+    "waif", "waif_xtra",
+
+    "struct", "array"
+};
+
+/* Each thread only ever writes its own counters, so updating them needs no
+ * atomic read-modify-write; readers add up every thread's counters plus
+ * those left behind by threads that have exited.  Blocks freed by a thread
+ * other than the one that allocated them can leave a single thread's
+ * counts negative, but the totals come out right.
+ */
+struct memory_counters {
+    std::atomic<int64_t> bytes[NUM_MEMORY_TYPES];
+    std::atomic<int64_t> blocks[NUM_MEMORY_TYPES];
+    std::atomic<int64_t> allocations[NUM_MEMORY_TYPES];
+    memory_counters *next;
+
+    memory_counters();
+    ~memory_counters();
+};
+
+static std::mutex memory_counters_lock;
+static memory_counters *all_memory_counters = nullptr;
+static int64_t retired_counters[3][NUM_MEMORY_TYPES];  /* protected by memory_counters_lock */
+
+static thread_local memory_counters thread_memory_counters;
+
+memory_counters::memory_counters()
+{
+    for (int i = 0; i < NUM_MEMORY_TYPES; i++)
+        bytes[i] = blocks[i] = allocations[i] = 0;
+
+    std::lock_guard<std::mutex> lock(memory_counters_lock);
+    next = all_memory_counters;
+    all_memory_counters = this;
+}
+
+memory_counters::~memory_counters()
+{
+    std::lock_guard<std::mutex> lock(memory_counters_lock);
+    memory_counters **c;
+
+    for (c = &all_memory_counters; *c != this; c = &(*c)->next)
+        ;
+    *c = next;
+
+    for (int i = 0; i < NUM_MEMORY_TYPES; i++) {
+        retired_counters[0][i] += bytes[i];
+        retired_counters[1][i] += blocks[i];
+        retired_counters[2][i] += allocations[i];
+    }
+}
+
+static inline void
+count_memory(Memory_Type type, int64_t bytes, int blocks)
+{
+    memory_counters *c = &thread_memory_counters;
+
+    c->bytes[type].store(c->bytes[type].load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    c->blocks[type].store(c->blocks[type].load(std::memory_order_relaxed) + blocks, std::memory_order_relaxed);
+    if (blocks > 0)
+        c->allocations[type].store(c->allocations[type].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static inline size_t
+block_size(void *ptr, Memory_Type type)
+{
+#ifdef POOL_ALLOCATOR
+    int size_class;
+
+    if (pooled(type) && (size_class = pool_class_of(ptr)) >= 0)
+        return (size_class + 1) * POOL_GRANULE;
+#endif
+#ifdef __MACH__
+    return malloc_size(ptr);
+#else
+    return malloc_usable_size(ptr);
+#endif
+}
+
+static void
+sum_memory_counters(int64_t totals[3][NUM_MEMORY_TYPES])
+{
+    std::lock_guard<std::mutex> lock(memory_counters_lock);
+
+    memcpy(totals, retired_counters, sizeof(retired_counters));
+    for (memory_counters *c = all_memory_counters; c; c = c->next)
+        for (int i = 0; i < NUM_MEMORY_TYPES; i++) {
+            totals[0][i] += c->bytes[i].load(std::memory_order_relaxed);
+            totals[1][i] += c->blocks[i].load(std::memory_order_relaxed);
+            totals[2][i] += c->allocations[i].load(std::memory_order_relaxed);
+        }
+}
+
+Var
+memory_stats(void)
+{
+    int64_t totals[3][NUM_MEMORY_TYPES];
+    static Var bytes_key = str_dup_to_var("bytes");
+    static Var blocks_key = str_dup_to_var("blocks");
+    static Var allocations_key = str_dup_to_var("allocations");
+
+    sum_memory_counters(totals);
+
+    Var ret = new_map();
+    for (int i = 0; i < NUM_MEMORY_TYPES; i++) {
+        if (totals[2][i] == 0)
+            continue;
+
+        Var entry = new_map();
+        entry = mapinsert(entry, var_ref(bytes_key), Var::new_int(totals[0][i]));
+        entry = mapinsert(entry, var_ref(blocks_key), Var::new_int(totals[1][i]));
+        entry = mapinsert(entry, var_ref(allocations_key), Var::new_int(totals[2][i]));
+        ret = mapinsert(ret, str_dup_to_var(memory_type_names[i]), entry);
+    }
+
+    return ret;
+}
+
+void
+log_memory_stats(void)
+{
+    int64_t totals[3][NUM_MEMORY_TYPES];
+
+    sum_memory_counters(totals);
+
+    for (int i = 0; i < NUM_MEMORY_TYPES; i++)
+        if (totals[1][i] != 0)
+            oklog("MEMORY: %-14s %12" PRId64 " bytes in %10" PRId64 " blocks\n",
+                  memory_type_names[i], totals[0][i], totals[1][i]);
+}
+#endif /* MEMORY_STATS */
+
+static inline void *
+raw_alloc(size_t size, Memory_Type type)
+{
+#ifdef POOL_ALLOCATOR
+    if (size <= POOL_MAX_BLOCK && pooled(type)) {
+        void *ptr = pool_alloc((size - 1) / POOL_GRANULE);
+        if (ptr)
+            return ptr;
+    }
+#endif
+    return malloc(size);
+}
+
+static inline void
+raw_free(void *ptr, Memory_Type type)
+{
+#ifdef POOL_ALLOCATOR
+    int size_class;
+
+    if (pooled(type) && (size_class = pool_class_of(ptr)) >= 0) {
+        pool_free(ptr, size_class);
+        return;
+    }
+#endif
+    free(ptr);
+}
+
 void *
 mymalloc(unsigned size, Memory_Type type)
 {
@@ -63,12 +426,16 @@ mymalloc(unsigned size, Memory_Type type)
         size = 1;
 
     offs = refcount_overhead(type);
-    memptr = (char *) malloc(offs + size);
+    memptr = (char *) raw_alloc(offs + size, type);
     if (!memptr) {
         sprintf(msg, "memory allocation (size %u) failed!", size);
         panic_moo(msg);
     }
 
+#ifdef MEMORY_STATS
+    count_memory(type, block_size(memptr, type), 1);
+#endif
+
     if (offs) {
         memptr += offs;
         var_metadata *metadata = (var_metadata *)(memptr - sizeof(var_metadata));
@@ -130,18 +497,51 @@ myrealloc(void *ptr, unsigned size, Memory_Type type)
 {
     int offs = refcount_overhead(type);
     static char msg[100];
+    char *block = ptr ? (char *) ptr - offs : nullptr;
+    char *_new;
+
+#ifdef MEMORY_STATS
+    int64_t old_size = block ? block_size(block, type) : 0;
+#endif
 
-    ptr = realloc((char *) ptr - offs, size + offs);
-    if (!ptr) {
+#ifdef POOL_ALLOCATOR
+    int size_class;
+
+    if (block && pooled(type) && (size_class = pool_class_of(block)) >= 0) {
+        size_t have = (size_class + 1) * POOL_GRANULE;
+
+        if (size + offs <= have)
+            return ptr;
+
+        _new = (char *) raw_alloc(size + offs, type);
+        if (_new) {
+            memcpy(_new, block, have);
+            pool_free(block, size_class);
+        }
+    } else
+#endif
+        _new = (char *) realloc(block, size + offs);
+
+    if (!_new) {
         sprintf(msg, "memory re-allocation (size %u) failed!", size);
         panic_moo(msg);
     }
 
-    return (char *) ptr + offs;
+#ifdef MEMORY_STATS
+    count_memory(type, block_size(_new, type) - old_size, block ? 0 : 1);
+#endif
+
+    return _new + offs;
 }
 
 void
 myfree(void *ptr, Memory_Type type)
 {
-    free((char *) ptr - refcount_overhead(type));
+    void *block = (char *) ptr - refcount_overhead(type);
+
+#ifdef MEMORY_STATS
+    if (ptr)
+        count_memory(type, -(int64_t) block_size(block, type), -1);
+#endif
+    raw_free(block, type);
 }
@@ -1,3 +1,4 @@
+#include <mutex>
 #include <stdlib.h>
 #include <string.h>
 
@@ -94,6 +95,8 @@ static struct intern_entry **intern_table;
 static int intern_table_size = 0;
 static int intern_table_count = 0;
 
+static std::mutex intern_lock;
+
 static int intern_bytes_saved = 0;
 static int intern_allocations_saved = 0;
 
@@ -240,6 +243,10 @@ str_intern(const char *s)
 
     hash = str_hash(s);
 
+    /* Verbs being compiled on several threads during the load intern their
+     * literals here too. */
+    std::lock_guard<std::mutex> lock(intern_lock);
+
     e = find_interned_string(s, hash);
 
     if (e != nullptr) {
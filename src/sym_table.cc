@@ -15,6 +15,7 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include <mutex>
 #include <stdio.h>
 
 #include "ast.h"
@@ -78,8 +79,9 @@ Names *
 new_builtin_names(DB_Version version)
 {
     static Names *builtins[Num_DB_Versions];
+    static std::once_flag built[Num_DB_Versions];
 
-    if (builtins[version] == nullptr) {
+    std::call_once(built[version], [version]() {
         Names *bi = new_names(first_user_slot(version));
 
         builtins[version] = bi;
@@ -120,7 +122,7 @@ new_builtin_names(DB_Version version)
             bi->names[SLOT_TRUE] = str_dup("true");
             bi->names[SLOT_FALSE] = str_dup("false");
         }
-    }
+    });
     return copy_names(builtins[version]);
 }
 
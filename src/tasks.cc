@@ -21,6 +21,7 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include <vector>
 
 #include "config.h"
 #include "db.h"
@@ -164,7 +165,7 @@ typedef struct tqueue {
      *
      * If an unconnected queue becomes empty, it is destroyed.
      */
-    struct tqueue *next, **prev;    /* prev only valid on idle_tqueues */       
+    struct tqueue *next, **prev;    /* on active_tqueues or idle_tqueues */
     task *first_input, **last_input;
     task *first_itail, **last_itail;
     /* The input queue alternates between contiguous sequences of TASK_OOBs
@@ -197,9 +198,21 @@ typedef struct tqueue {
     int total_input_length;
     int last_input_task_id;
     int input_suspended;
-    int usage;              /* a kind of inverted priority */
     int num_bg_tasks;       /* in either here or waiting_tasks */
 
+    /* Scheduling.  `usage' is the time this queue's tasks have spent
+     * running, divided by `weight' and decayed by half every
+     * $server_options.scheduler_half_life seconds; the active queue with the
+     * least usage runs next.  It is kept multiplied by usage_scale() so that
+     * decaying it doesn't mean touching every queue.
+     */
+    double usage;           /* a kind of inverted priority */
+    double weight;          /* from $server_options.scheduler_weights */
+    double run_time;        /* seconds spent running tasks, undecayed */
+    Num tasks_run;
+    Num turn;               /* when last queued, to take turns at equal usage */
+    int heap_index;         /* in active_heap, or -1 if idle */
+
     /* Used in emergency mode and when handling the `.program'
      * intrinsic command.  `program_object' _could_ be changed to hold
      * a reference to either a permanent or anonymous object, however
@@ -226,12 +239,23 @@ typedef struct ext_queue {
 #define INPUT_HIWAT MAX_QUEUED_INPUT
 #define INPUT_LOWAT (INPUT_HIWAT / 2)
 
-#define NO_USAGE    -1
-
 Var current_local;
 int current_task_id;
 static tqueue *idle_tqueues = nullptr, *active_tqueues = nullptr;
+static std::vector<tqueue *> active_heap;  /* active_tqueues, least usage first */
+static Num next_turn = 0;
+static Var scheduler_weights;   /* $server_options.scheduler_weights, if a map */
 static task *waiting_tasks = nullptr;   /* forked and suspended tasks */
+
+/* What run_ready_tasks() has done, for scheduler_stats() */
+static struct {
+    Num iterations;     /* main loop passes that ran at least one task */
+    Num tasks;          /* tasks run in those passes */
+    Num max_tasks;      /* most tasks run in a single pass */
+    Num waited;         /* forked and suspended tasks timed in their queues */
+    double wait;        /* total seconds they waited after becoming ready */
+    double max_wait;    /* longest of those waits */
+} batch_stats;
 static ext_queue *external_queues = nullptr;
 #ifdef SAVE_FINISHED_TASKS
 Var finished_tasks = new_list(0);
@@ -379,47 +403,207 @@ reset_http_parsing_state(struct http_parsing_state *state)
 #undef RESET_VAR
 }
 
+/* The time since usage_epoch, in half-lives, to the power of two.  Usage
+ * charged now is multiplied by this, so older usage counts for less; when it
+ * gets large, or the half-life is changed, every queue's usage is divided by
+ * it and the epoch starts again.  Dividing them all by the same amount keeps
+ * them in the same order.
+ */
+static struct timeval usage_epoch;
+static int usage_half_life = DEFAULT_SCHEDULER_HALF_LIFE;
+
+#define USAGE_RESCALE_LIMIT     1e12
+
+static bool
+tqueue_before(const tqueue *a, const tqueue *b)
+{
+    return a->usage < b->usage || (a->usage == b->usage && a->turn < b->turn);
+}
+
 static void
-deactivate_tqueue(tqueue * tq)
+place_in_heap(tqueue *tq, int i)
+{
+    active_heap[i] = tq;
+    tq->heap_index = i;
+}
+
+static void
+sift_up(tqueue *tq)
+{
+    int i = tq->heap_index;
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!tqueue_before(tq, active_heap[parent]))
+            break;
+        place_in_heap(active_heap[parent], i);
+        i = parent;
+    }
+    place_in_heap(tq, i);
+}
+
+static void
+sift_down(tqueue *tq)
+{
+    int n = active_heap.size();
+    int i = tq->heap_index;
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= n)
+            break;
+        if (child + 1 < n && tqueue_before(active_heap[child + 1], active_heap[child]))
+            child++;
+        if (!tqueue_before(active_heap[child], tq))
+            break;
+        place_in_heap(active_heap[child], i);
+        i = child;
+    }
+    place_in_heap(tq, i);
+}
+
+static void
+rescale_usage(double scale)
+{
+    tqueue *tq;
+
+    for (tq = active_tqueues; tq; tq = tq->next)
+        tq->usage /= scale;
+    for (tq = idle_tqueues; tq; tq = tq->next)
+        tq->usage /= scale;
+
+    /* Rounding may have made some usages equal that weren't */
+    for (int i = active_heap.size() / 2 - 1; i >= 0; i--)
+        sift_down(active_heap[i]);
+}
+
+static double
+usage_scale(const struct timeval *now)
+{
+    const int half_life = server_int_option_cached(SVO_SCHEDULER_HALF_LIFE);
+
+    if (usage_epoch.tv_sec == 0)
+        usage_epoch = *now;
+
+    double elapsed = (now->tv_sec - usage_epoch.tv_sec)
+                     + (now->tv_usec - usage_epoch.tv_usec) / 1000000.0;
+    double scale = exp2(elapsed / usage_half_life);
+
+    if (scale > USAGE_RESCALE_LIMIT || half_life != usage_half_life) {
+        rescale_usage(scale);
+        usage_epoch = *now;
+        usage_half_life = half_life;
+        scale = 1.0;
+    }
+
+    return scale;
+}
+
+static double
+scheduler_weight(Objid player)
+{
+    Var v;
+
+    if (scheduler_weights.type == TYPE_MAP
+            && maplookup(scheduler_weights, Var::new_obj(player), &v, 0)) {
+        if (v.type == TYPE_INT && v.v.num > 0)
+            return v.v.num;
+        if (v.type == TYPE_FLOAT && v.v.fnum > 0)
+            return v.v.fnum;
+    }
+
+    return 1.0;
+}
+
+static void
+link_tqueue(tqueue *tq, tqueue **list)
 {
-    tq->usage = NO_USAGE;
+    tq->next = *list;
+    tq->prev = list;
+    if (*list)
+        (*list)->prev = &(tq->next);
+    *list = tq;
+}
 
-    tq->next = idle_tqueues;
-    tq->prev = &idle_tqueues;
-    if (idle_tqueues)
-        idle_tqueues->prev = &(tq->next);
-    idle_tqueues = tq;
+static void
+unlink_tqueue(tqueue *tq)
+{
+    *(tq->prev) = tq->next;
+    if (tq->next)
+        tq->next->prev = tq->prev;
 }
 
 static void
-activate_tqueue(tqueue * tq)
+deactivate_tqueue(tqueue * tq)
 {
-    tqueue **qq = &active_tqueues;
+    /* Precondition: tq is on active_tqueues */
+    tqueue *last = active_heap.back();
 
-    while (*qq && (*qq)->usage <= tq->usage)
-        qq = &((*qq)->next);
+    active_heap.pop_back();
+    if (last != tq) {
+        place_in_heap(last, tq->heap_index);
+        sift_up(last);
+        sift_down(last);
+    }
+    tq->heap_index = -1;
 
-    tq->next = *qq;
-    tq->prev = nullptr;
-    *qq = tq;
+    unlink_tqueue(tq);
+    link_tqueue(tq, &idle_tqueues);
+}
+
+/* Charge tq for `seconds' of running its tasks and let the others have a
+ * turn before it runs again at the same usage.
+ */
+static void
+charge_tqueue(tqueue * tq, double seconds, const struct timeval *now)
+{
+    tq->usage += seconds * usage_scale(now) / tq->weight;
+    tq->run_time += seconds;
+    tq->tasks_run++;
+    tq->turn = next_turn++;
+    sift_down(tq);
 }
 
 static void
 ensure_usage(tqueue * tq)
 {
-    if (tq->usage == NO_USAGE) {
-        tq->usage = active_tqueues ? active_tqueues->usage : 0;
+    if (tq->heap_index < 0) {
+        /* A queue coming back keeps what's left of its usage, but doesn't get
+         * ahead of the queues that have been waiting all along.
+         */
+        if (!active_heap.empty() && tq->usage < active_heap[0]->usage)
+            tq->usage = active_heap[0]->usage;
+        tq->turn = next_turn++;
 
-        /* Remove tq from idle_tqueues... */
-        *(tq->prev) = tq->next;
-        if (tq->next)
-            tq->next->prev = tq->prev;
+        unlink_tqueue(tq);
+        link_tqueue(tq, &active_tqueues);
 
-        /* ...and put it on active_tqueues. */
-        activate_tqueue(tq);
+        active_heap.push_back(tq);
+        tq->heap_index = active_heap.size() - 1;
+        sift_up(tq);
     }
 }
 
+void
+load_scheduler_weights(void)
+{
+    Var v;
+    tqueue *tq;
+
+    free_var(scheduler_weights);
+    if (get_server_option(SYSTEM_OBJECT, "scheduler_weights", &v) && v.type == TYPE_MAP)
+        scheduler_weights = var_ref(v);
+    else
+        scheduler_weights = Var::new_int(0);
+
+    for (tq = active_tqueues; tq; tq = tq->next)
+        tq->weight = scheduler_weight(tq->player);
+    for (tq = idle_tqueues; tq; tq = tq->next)
+        tq->weight = scheduler_weight(tq->player);
+}
+
 char *
 default_flush_command(void)
 {
@@ -446,7 +630,13 @@ find_tqueue(Objid player, int create_if_not_found)
 
     tq = (tqueue *)mymalloc(sizeof(tqueue), M_TASK);
 
-    deactivate_tqueue(tq);
+    link_tqueue(tq, &idle_tqueues);
+    tq->heap_index = -1;
+    tq->usage = 0.0;
+    tq->weight = scheduler_weight(player);
+    tq->run_time = 0.0;
+    tq->tasks_run = 0;
+    tq->turn = 0;
 
     tq->player = player;
     tq->handler = 0;
@@ -495,9 +685,7 @@ free_tqueue(tqueue * tq)
         myfree(tq->parsing_state, M_STRUCT);
     }
 
-    *(tq->prev) = tq->next;
-    if (tq->next)
-        tq->next->prev = tq->prev;
+    unlink_tqueue(tq);
 
     myfree(tq, M_TASK);
 }
@@ -925,6 +1113,7 @@ do_login_task(tqueue * tq, char *command)
         task *t;
 
         tq->player = new_player;
+        tq->weight = scheduler_weight(new_player);
         if (tq->num_bg_tasks) {
             /* Cute; this un-logged-in connection has some queued tasks!
              * Must copy them over to their own tqueue for accounting...
@@ -1329,8 +1518,7 @@ resume_task(vm the_vm, Var value)
 
     t->kind = TASK_SUSPENDED;
     t->t.suspended.the_vm = the_vm;
-    t->t.suspended.start_tv.tv_sec = 0; /* ready now */
-    t->t.suspended.start_tv.tv_usec = 0;
+    gettimeofday(&t->t.suspended.start_tv, nullptr);    /* ready now */
     t->t.suspended.value = value;
 
     ensure_usage(tq);
@@ -1613,6 +1801,45 @@ static http_parser_settings settings = {on_message_begin_callback,
                                         on_message_complete_callback
                                        };
 
+static void
+enqueue_ready_tasks(const struct timeval *now)
+{
+    task *t, *next_t;
+
+    for (t = waiting_tasks; t && timercmp(GET_START_TIME(t), now, <= ); t = next_t) {
+        Objid progr = (t->kind == TASK_FORKED
+                       ? t->t.forked.a.progr
+                       : progr_of_cur_verb(t->t.suspended.the_vm));
+        tqueue *tq = find_tqueue(progr, 1);
+
+        next_t = t->next;
+        ensure_usage(tq);
+        enqueue_bg_task(tq, t);
+    }
+    waiting_tasks = t;
+}
+
+/* Note how long a forked or suspended task sat ready in its queue.  Tasks
+ * restarted after a checkpoint have no recorded start time and aren't counted.
+ */
+static void
+note_queue_wait(task *t, const struct timeval *now)
+{
+    struct timeval *start_tv = GET_START_TIME(t);
+    struct timeval waited;
+
+    if (start_tv->tv_sec == 0 && start_tv->tv_usec == 0)
+        return;
+
+    timersub(now, start_tv, &waited);
+    double seconds = waited.tv_sec + waited.tv_usec / 1000000.0;
+
+    batch_stats.waited++;
+    batch_stats.wait += seconds;
+    if (seconds > batch_stats.max_wait)
+        batch_stats.max_wait = seconds;
+}
+
 /* There is surprisingness in how tasks actually get created in
  * response to player input, so I'm documenting it here.
  * `run_ready_tasks' turns player input into tasks (and verb calls).
@@ -1628,30 +1855,27 @@ static http_parser_settings settings = {on_message_begin_callback,
 void
 run_ready_tasks(void)
 {
-    task *t, *next_t;
+    task *t;
     struct timeval now;
     tqueue *tq, *next_tq;
 
     gettimeofday(&now, nullptr);
-    for (t = waiting_tasks; t && timercmp(GET_START_TIME(t), &now, <= ); t = next_t) {
-        Objid progr = (t->kind == TASK_FORKED
-                       ? t->t.forked.a.progr
-                       : progr_of_cur_verb(t->t.suspended.the_vm));
-        tqueue *tq = find_tqueue(progr, 1);
-
-        next_t = t->next;
-        ensure_usage(tq);
-        enqueue_bg_task(tq, t);
-    }
-    waiting_tasks = t;
+    enqueue_ready_tasks(&now);
 
     {
-        int did_one = 0;
-        time_t start = time(nullptr);
+        const struct timeval batch_start = now;
+        const int batch_size = server_int_option_cached(SVO_TASK_BATCH_SIZE);
+        const int batch_useconds = server_int_option_cached(SVO_TASK_BATCH_USECONDS);
+        int ran = 0;
 
-        /* Loop over tqueues, looking for a task */
-        while (active_tqueues && !did_one) {
-            tq = active_tqueues;
+        /* Loop over tqueues, taking a task from the one that has used the
+         * least time so far, until the batch is full or its time is up.
+         */
+        while (!active_heap.empty()) {
+            int did_one = 0;
+            struct timeval start = now;
+
+            tq = active_heap[0];
 
             if (tq->reading && is_out_of_input(tq)) {
                 Var v;
@@ -1772,6 +1996,7 @@ run_ready_tasks(void)
                     case TASK_FORKED:
                     {
                         forked_task ft;
+                        note_queue_wait(t, &now);
                         ft = t->t.forked;
                         current_task_id = ft.id;
                         current_local = new_map();
@@ -1784,6 +2009,7 @@ run_ready_tasks(void)
                     }
                     break;
                     case TASK_SUSPENDED:
+                        note_queue_wait(t, &now);
                         current_task_id = t->t.suspended.the_vm->task_id;
                         current_local = var_ref(t->t.suspended.the_vm->local);
                         resume_from_previous_vm(t->t.suspended.the_vm,
@@ -1798,18 +2024,36 @@ run_ready_tasks(void)
                 free_task(t, 0);
             }
 
-            active_tqueues = tq->next;
-
             if (did_one) {
                 /* Bump the usage level of this tqueue */
-                time_t end = time(nullptr);
+                struct timeval used;
 
-                tq->usage += end - start;
-                activate_tqueue(tq);
+                gettimeofday(&now, nullptr);
+                timersub(&now, &start, &used);
+                charge_tqueue(tq, used.tv_sec + used.tv_usec / 1000000.0, &now);
             } else {
                 /* There was nothing to do on this tqueue, so deactivate it */
                 deactivate_tqueue(tq);
+                continue;
             }
+
+            if (++ran >= batch_size || is_shutdown_triggered())
+                break;
+
+            struct timeval elapsed;
+            timersub(&now, &batch_start, &elapsed);
+            if (elapsed.tv_sec * 1000000L + elapsed.tv_usec >= batch_useconds)
+                break;
+
+            /* Pick up tasks forked or resumed by the ones just run */
+            enqueue_ready_tasks(&now);
+        }
+
+        if (ran > 0) {
+            batch_stats.iterations++;
+            batch_stats.tasks += ran;
+            if (ran > batch_stats.max_tasks)
+                batch_stats.max_tasks = ran;
         }
     }
 
@@ -2272,6 +2516,10 @@ bf_queue_info(Var arglist, Byte next, void *vdata, Objid progr)
         static Var queue_reading = str_dup_to_var("reading");
         static Var queue_parsing = str_dup_to_var("parsing");
         static Var queue_vm = str_dup_to_var("reading_task_id");
+        static Var queue_weight = str_dup_to_var("weight");
+        static Var queue_run_time = str_dup_to_var("run_time");
+        static Var queue_tasks_run = str_dup_to_var("tasks_run");
+        static Var queue_active = str_dup_to_var("active");
 
         Objid who = arglist.v.list[1].v.obj;
         tqueue *tq = find_tqueue(who, 0);
@@ -2287,15 +2535,23 @@ bf_queue_info(Var arglist, Byte next, void *vdata, Objid progr)
             res = mapinsert(res, var_ref(queue_total_input_length), Var::new_int(tq->total_input_length));
             res = mapinsert(res, var_ref(queue_last_input_task_id), Var::new_int(tq->last_input_task_id));
             res = mapinsert(res, var_ref(queue_suspended), Var::new_bool(tq->input_suspended));
-            res = mapinsert(res, var_ref(queue_usage), Var::new_int(tq->usage));
+            struct timeval now;
+            gettimeofday(&now, nullptr);
+            double scale = usage_scale(&now);   /* may rescale tq->usage */
+
+            res = mapinsert(res, var_ref(queue_usage), Var::new_float(tq->usage / scale));
             res = mapinsert(res, var_ref(queue_num_bg_tasks), Var::new_int(tq->num_bg_tasks));
-            res = mapinsert(res, var_ref(queue_hold_input), Var::new_bool(tq->usage));
+            res = mapinsert(res, var_ref(queue_hold_input), Var::new_bool(tq->hold_input));
             res = mapinsert(res, var_ref(queue_disable_oob), Var::new_bool(tq->disable_oob));
             res = mapinsert(res, var_ref(queue_reading), Var::new_bool(tq->reading));
             res = mapinsert(res, var_ref(queue_parsing), Var::new_bool(tq->parsing));
             res = mapinsert(res, var_ref(queue_vm), tq->reading ?
                             Var::new_int(tq->reading_vm->task_id) :
                             Var::new_int(0));
+            res = mapinsert(res, var_ref(queue_weight), Var::new_float(tq->weight));
+            res = mapinsert(res, var_ref(queue_run_time), Var::new_float(tq->run_time));
+            res = mapinsert(res, var_ref(queue_tasks_run), Var::new_int(tq->tasks_run));
+            res = mapinsert(res, var_ref(queue_active), Var::new_bool(tq->heap_index >= 0));
         }
 
     } else {
@@ -2982,6 +3238,7 @@ bf_switch_player(Var arglist, Byte next, void *vdata, Objid progr)
     task *t;
 
     tq->player = new_player;
+    tq->weight = scheduler_weight(new_player);
     if (tq->num_bg_tasks) {
         /* Cute; this un-logged-in connection has some queued tasks!
          * Must copy them over to their own tqueue for accounting...
@@ -3024,6 +3281,25 @@ bf_finished_tasks(Var arglist, Byte next, void *vdata, Objid progr)
 }
 #endif
 
+static package
+bf_scheduler_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+        return make_error_pack(E_PERM);
+
+    Var r = new_map();
+    r = mapinsert(r, str_dup_to_var("iterations"), Var::new_int(batch_stats.iterations));
+    r = mapinsert(r, str_dup_to_var("tasks"), Var::new_int(batch_stats.tasks));
+    r = mapinsert(r, str_dup_to_var("max_tasks"), Var::new_int(batch_stats.max_tasks));
+    r = mapinsert(r, str_dup_to_var("waited"), Var::new_int(batch_stats.waited));
+    r = mapinsert(r, str_dup_to_var("wait"), Var::new_float(batch_stats.wait));
+    r = mapinsert(r, str_dup_to_var("max_wait"), Var::new_float(batch_stats.max_wait));
+
+    return make_var_pack(r);
+}
+
 static package
 bf_set_thread_mode(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -3061,4 +3337,5 @@ register_tasks(void)
     register_function("switch_player", 2, 3, bf_switch_player,
                       TYPE_OBJ, TYPE_OBJ, TYPE_INT);
     register_function("set_thread_mode", 0, 1, bf_set_thread_mode, TYPE_INT);
+    register_function("scheduler_stats", 0, 0, bf_scheduler_stats);
 }
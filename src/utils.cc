@@ -495,16 +495,25 @@ equality(Var lhs, Var rhs, int case_matters)
 void
 stream_add_strsub(Stream *str, const char *source, const char *what, const char *with, int case_counts)
 {
-    int lwhat = strlen(what);
-
-    while (*source) {
-        if (!(case_counts ? strncmp(source, what, lwhat)
-                : strncasecmp(source, what, lwhat))) {
-            stream_add_string(str, with);
-            source += lwhat;
-        } else
-            stream_add_char(str, *source++);
+    std::string copy;
+    int lsource = strlen(source), lwhat = strlen(what), lwith = strlen(with);
+    int pos;
+
+    /* Some callers hand us the stream's own (just reset) buffer. */
+    if (source >= str->buffer && source < str->buffer + str->buflen) {
+        copy.assign(source, lsource);
+        source = copy.c_str();
     }
+
+    if (lwhat > 0)
+        while ((pos = strindex(source, lsource, what, lwhat, case_counts)) > 0) {
+            stream_add_bytes(str, source, pos - 1);
+            stream_add_bytes(str, with, lwith);
+            source += pos - 1 + lwhat;
+            lsource -= pos - 1 + lwhat;
+        }
+
+    stream_add_bytes(str, source, lsource);
 }
 
 const char *
@@ -542,17 +551,78 @@ strtr(const char *source, int source_len,
     return reset_stream(str);
 }
 
+/* The substring searches below use memchr()/memmem(), which the C library
+ * vectorizes, to find candidate positions and only then compare the rest of
+ * the needle.  Case-insensitive searches look for both cases of the first
+ * byte at once and compare through FOLDS, which folds bytes the same way
+ * strncasecmp() does.
+ */
+static struct case_folds {
+    unsigned char lower[256];
+    unsigned char other[256];   /* the other byte that folds to the same value, or itself */
+
+    case_folds() {
+        for (int c = 0; c < 256; c++) {
+            lower[c] = tolower(c);
+            other[c] = c;
+        }
+        for (int c = 0; c < 256; c++)
+            if (lower[c] != c)
+                other[c] = lower[c], other[lower[c]] = c;
+    }
+} folds;
+
+static inline bool
+folded_equal(const char *a, const char *b, int len)
+{
+    for (int i = 0; i < len; i++)
+        if (folds.lower[(unsigned char) a[i]] != folds.lower[(unsigned char) b[i]])
+            return false;
+    return true;
+}
+
+static inline const char *
+find_byte_backward(const char *s, int c, size_t n)
+{
+#ifdef __GLIBC__
+    return (const char *) memrchr(s, c, n);
+#else
+    while (n-- > 0)
+        if ((unsigned char) s[n] == c)
+            return s + n;
+    return nullptr;
+#endif
+}
+
 int
 strindex(const char *source, int source_len,
          const char *what, int what_len, int case_counts)
 {
-    const char *s, *e;
+    if (what_len > source_len)
+        return 0;
+    if (what_len == 0)
+        return 1;
+
+    if (case_counts) {
+        const char *s = (const char *) memmem(source, source_len, what, what_len);
+        return s ? s - source + 1 : 0;
+    }
+
+    /* Candidates are the positions at which the needle still fits. */
+    const char *end = source + source_len - what_len + 1;
+    const unsigned char first = what[0], other = folds.other[first];
+    const char *a = (const char *) memchr(source, first, end - source);
+    const char *b = other != first ? (const char *) memchr(source, other, end - source) : nullptr;
+
+    while (a || b) {
+        const char *s = !b || (a && a < b) ? a : b;
 
-    for (s = source, e = source + source_len - what_len; s <= e; s++) {
-        if (!(case_counts ? strncmp(s, what, what_len)
-                : strncasecmp(s, what, what_len))) {
+        if (folded_equal(s + 1, what + 1, what_len - 1))
             return s - source + 1;
-        }
+        if (s == a)
+            a = (const char *) memchr(a + 1, first, end - a - 1);
+        else
+            b = (const char *) memchr(b + 1, other, end - b - 1);
     }
     return 0;
 }
@@ -561,13 +631,26 @@ int
 strrindex(const char *source, int source_len,
           const char *what, int what_len, int case_counts)
 {
-    const char *s;
+    if (what_len > source_len)
+        return 0;
+    if (what_len == 0)
+        return source_len + 1;
+
+    const size_t candidates = source_len - what_len + 1;
+    const unsigned char first = what[0], other = case_counts ? first : folds.other[first];
+    const char *a = find_byte_backward(source, first, candidates);
+    const char *b = other != first ? find_byte_backward(source, other, candidates) : nullptr;
 
-    for (s = source + source_len - what_len; s >= source; s--) {
-        if (!(case_counts ? strncmp(s, what, what_len)
-                : strncasecmp(s, what, what_len))) {
+    while (a || b) {
+        const char *s = !b || (a && a > b) ? a : b;
+
+        if (case_counts ? !memcmp(s + 1, what + 1, what_len - 1)
+                : folded_equal(s + 1, what + 1, what_len - 1))
             return s - source + 1;
-        }
+        if (s == a)
+            a = find_byte_backward(source, first, a - source);
+        else
+            b = find_byte_backward(source, other, b - source);
     }
     return 0;
 }
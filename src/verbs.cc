@@ -26,6 +26,7 @@
 #include "match.h"
 #include "parse_cmd.h"
 #include "parser.h"
+#include "program_cache.h"
 #include "server.h"
 #include "storage.h"
 #include "structures.h"
@@ -500,6 +501,25 @@ bf_verb_code(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(code);
 }
 
+/* Compile CODE, a list of strings, or find it already compiled. */
+static Program *
+compile_code(Var code, Var *errors)
+{
+    Program *program = program_cache_find(code);
+
+    if (program) {
+        *errors = new_list(0);
+        return program;
+    }
+    program = parse_list_as_program(code, errors);
+    /* Once the task is out of time the parser sees end-of-input early, and
+     * whatever it read up to there may still compile.  That isn't the
+     * program for CODE, so neither cache it nor count the lookup. */
+    if (!task_timed_out)
+        program_cache_insert(code, program);
+    return program;
+}
+
 static package
 bf_set_verb_code(Var arglist, Byte next, void *vdata, Objid progr)
 {   /* (object, verb-desc, code) */
@@ -533,7 +553,7 @@ bf_set_verb_code(Var arglist, Byte next, void *vdata, Objid progr)
         free_var(arglist);
         return make_error_pack(E_PERM);
     }
-    program = parse_list_as_program(code, &errors);
+    program = compile_code(code, &errors);
     if (program) {
         if (task_timed_out)
             free_program(program);
@@ -614,7 +634,7 @@ bf_eval(Var arglist, Byte next, void *data, Objid progr)
             p = make_error_pack(E_TYPE);
         } else {
             Var errors;
-            Program *program = parse_list_as_program(arglist, &errors);
+            Program *program = compile_code(arglist, &errors);
 
 #ifdef LOG_EVALS
             oklog("CODE_EVAL: %s (#%" PRIdN ") evaluated: %s\n", db_object_name(progr), progr, arglist.v.list[1]);
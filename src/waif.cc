@@ -48,18 +48,18 @@ static int refers_to(Var target, Var key, bool);
 static int
 count_set_bits(unsigned long x)
 {
-    unsigned long i = x;    /* take no chances! */
-
-    /* clever trick for adding bits together in parallel to count them */
-    i = ((i & 0xAAAAAAAA) >> 1) + (i & ~0xAAAAAAAA);
-    i = ((i & 0xCCCCCCCC) >> 2) + (i & ~0xCCCCCCCC);
-    i = ((i & 0xF0F0F0F0) >> 4) + (i & ~0xF0F0F0F0);
-    i = ((i & 0xFF00FF00) >> 8) + (i & ~0xFF00FF00);
-    i = ((i & 0xFFFF0000) >> 16) + (i & ~0xFFFF0000);
-
-    return i;
+    /* only the low 32 bits of a map word are used */
+    return __builtin_popcountl(x & 0xFFFFFFFFUL);
 }
 
+/* How often waif property accesses found the property in the class's
+ * slot table, how often the name wasn't there, and how many tables have
+ * been built.  Reported by waif_stats().
+ */
+static unsigned long waif_prop_hits = 0;
+static unsigned long waif_prop_misses = 0;
+static unsigned long waif_propdef_builds = 0;
+
 void
 free_waif_propdefs(WaifPropdefs *wpd)
 {
@@ -72,6 +72,11 @@ free_waif_propdefs(WaifPropdefs *wpd)
     for (i = 0; i < wpd->length; ++i)
         free_str(wpd->defs[i].name);
 
+    if (wpd->slots)
+        myfree(wpd->slots, M_WAIF_XTRA);
+    if (wpd->info)
+        myfree(wpd->info, M_WAIF_XTRA);
+
     /* the actual defs are allocated right with the header. */
     myfree(wpd, M_WAIF_XTRA);
 }
@@ -83,6 +88,59 @@ ref_waif_propdefs(WaifPropdefs *wpd)
     return wpd;
 }
 
+/* (Re)build the table for finding propdefs by name.  Names are hashed
+ * without their WAIF_PROP_PREFIX, since that's how they're looked up.
+ */
+static void
+build_waif_slots(WaifPropdefs *wpd)
+{
+    int size = 1, i;
+
+    while (size < wpd->length * 2)
+        size *= 2;
+
+    if (wpd->slots && wpd->slot_mask + 1 != size) {
+        myfree(wpd->slots, M_WAIF_XTRA);
+        wpd->slots = nullptr;
+    }
+    if (!wpd->slots)
+        wpd->slots = (WaifSlot *) mymalloc(size * sizeof(WaifSlot), M_WAIF_XTRA);
+    wpd->slot_mask = size - 1;
+
+    for (i = 0; i < size; ++i)
+        wpd->slots[i].def = -1;
+
+    for (i = 0; i < wpd->length; ++i) {
+        int hash = str_hash(wpd->defs[i].name + 1);
+        int j = hash & wpd->slot_mask;
+
+        while (wpd->slots[j].def >= 0)
+            j = (j + 1) & wpd->slot_mask;
+        wpd->slots[j].hash = hash;
+        wpd->slots[j].def = i;
+    }
+}
+
+/* Find a property, named without its WAIF_PROP_PREFIX, returning its
+ * index in the propdefs or -1 if there's no such property.
+ */
+static int
+find_waif_propdef(WaifPropdefs *wpd, const char *name)
+{
+    int hash = str_hash(name);
+    int j;
+
+    for (j = hash & wpd->slot_mask; wpd->slots[j].def >= 0; j = (j + 1) & wpd->slot_mask)
+        if (wpd->slots[j].hash == hash
+                && !strcasecmp(wpd->defs[wpd->slots[j].def].name + 1, name)) {
+            ++waif_prop_hits;
+            return wpd->slots[j].def;
+        }
+
+    ++waif_prop_misses;
+    return -1;
+}
+
 /* Find all of the .:props defined on an object or its ancestors and
  * build a useful structure for keeping track of them within waifs.
  *
@@ -121,7 +179,14 @@ gen_waif_propdefs(Object *o)
 
     wpd->refcount = 1;
     wpd->length = cnt;
+    wpd->slots = nullptr;
+    wpd->info = cnt ? (WaifPropinfo *) mymalloc(cnt * sizeof(WaifPropinfo), M_WAIF_XTRA) : nullptr;
     cnt = 0;
+
+    /* The class's property values are laid out in the same order, so
+     * the offset of each value can be noted along the way.
+     */
+    int offset = 0;
     FOR_EACH(ancestor, ancestors, x, c) {
         p = dbpriv_find_object(ancestor.v.obj);
         Propdef *pd = p->propdefs.l;
@@ -130,11 +195,17 @@ gen_waif_propdefs(Object *o)
             if (pd->name[0] == WAIF_PROP_PREFIX) {
                 wpd->defs[cnt].name = str_ref(pd->name);
                 wpd->defs[cnt].hash = pd->hash;
+                wpd->info[cnt].pval = offset + i;
+                wpd->info[cnt].definer = p->id;
+                wpd->info[cnt].index = i;
                 ++cnt;
             }
+        offset += p->propdefs.cur_length;
     }
+    build_waif_slots(wpd);
     o->waif_propdefs = wpd;
     free_var(ancestors);
+    ++waif_propdef_builds;
 }
 
 /* Rename a property in a set of propdefs.
@@ -162,6 +233,7 @@ waif_rename_propdef(Object *o, const char *old, const char *_new)
                 free_str(old);
                 wpd->defs[i].name = str_ref(_new);
                 wpd->defs[i].hash = str_hash(_new);
+                build_waif_slots(wpd);
                 return;
             }
         panic_moo("waif_rename_propdef(): missing old propdef?");
@@ -287,26 +359,13 @@ new_waif(Objid _class, Objid owner)
     return res;
 }
 
-/* Find the offset into the waif properties for the class (pidx) and
- * the offset into this waif's propvals.
+/* Find the offset into this waif's propvals of the value of the class's
+ * i'th waif property, or -1 if the value is clear.
  */
 static int
-find_propval_offset(Waif *w, const char *name, int *pidx)
+propval_offset(Waif *w, int i)
 {
-    int i, j, idx;
-    int hash = str_hash(name);
-    struct Propdef *pd;
-
-    /* First find the offset into the list of possible properties
-     */
-    for (i = 0, pd = w->propdefs->defs; i < w->propdefs->length; ++i, ++pd)
-        if (pd->hash == hash && !strcasecmp(pd->name, name))
-            goto found;
-    return -2;
-
-found:
-    if (pidx)
-        *pidx = i;
+    int j, idx;
 
     /* Now determine the offset into the actual property values.  Use a
      * bitmap that indicates which values aren't clear, so we don't have
@@ -621,6 +680,12 @@ bf_waif_stats(Var arglist, Byte next, void *vdata, Objid progr)
     r = mapinsert(r, str_dup_to_var("total"), Var::new_int(waif_count));
     r = mapinsert(r, str_dup_to_var("pending_recycle"), Var::new_int(destroyed_waifs.size()));
 
+    Var props = new_map();
+    props = mapinsert(props, str_dup_to_var("hits"), Var::new_int(waif_prop_hits));
+    props = mapinsert(props, str_dup_to_var("misses"), Var::new_int(waif_prop_misses));
+    props = mapinsert(props, str_dup_to_var("builds"), Var::new_int(waif_propdef_builds));
+    r = mapinsert(r, str_dup_to_var("properties"), props);
+
     for (auto& x : waif_class_count) {
         r = mapinsert(r, Var::new_obj(x.first), Var::new_int(x.second));
     }
@@ -650,6 +715,20 @@ waif_property_allows(Waif *w, db_prop_handle h, Objid progr, db_prop_flag flag)
            is_wizard(progr);
 }
 
+/* Make a handle for the class's slot for its def'th waif property,
+ * without searching for it by name.
+ */
+static db_prop_handle
+waif_class_prop(Object *classp, WaifPropdefs *wpd, int def)
+{
+    db_prop_handle h;
+
+    h.built_in = BP_NONE;
+    h.definer = dbpriv_find_object(wpd->info[def].definer);
+    h.ptr = classp->propval + wpd->info[def].pval;
+    return h;
+}
+
 /* called from execute.c run() when reading a property value.  This returns
  * the prop ALREADY REFERENCED because the interpreter is going to free OBJ
  * immediately upon return, and if that is the last ref the prop returned
@@ -659,7 +738,6 @@ enum error
 waif_get_prop(Waif *w, const char *name, Var *prop, Objid progr)
 {
     db_prop_handle h;
-    static Stream *s;
     int idx;
 
     update_waif_propdefs(w);
@@ -681,43 +759,29 @@ waif_get_prop(Waif *w, const char *name, Var *prop, Objid progr)
     } else if (!valid(w->_class))
         return E_INVIND;
 
-    /* There doesn't seem to be any way around constructing the
-     * prefixed name when doing the db_find_property later.
+    /* Find the property in the class's table, then the offset into
+     * the waif's own propvals for it.
      */
-    if (!s)
-        s = new_stream(50);
-    stream_add_char(s, WAIF_PROP_PREFIX);
-    stream_add_string(s, name);
-    name = reset_stream(s);
-
-    /* First find the in offset into the waif's own propvals for
-     * this property.  This will tell us more quickly if it doesn't
-     * exist.
+    Object *classp = dbpriv_find_object(w->_class);
+    WaifPropdefs *wpd = w->propdefs;
+    int def = find_waif_propdef(wpd, name);
+    if (def < 0)
+        return E_PROPNF;
+
+    idx = propval_offset(w, def);
+    if (idx >= 0)
+        *prop = w->propvals[idx];
+    else
+        prop->type = TYPE_CLEAR;
+
+    /* The class's slot for it has the flags and owner, and, if the
+     * waif's value is clear, leads to the value it inherits.
      */
-    idx = find_propval_offset(w, name, nullptr);
-    switch (idx) {
-        case -2:
-            return E_PROPNF;
-        case -1:
-            /* clear, note that */
-            prop->type = TYPE_CLEAR;
-            break;
-        default:
-            *prop = w->propvals[idx];
-            break;
-    }
-
-    /* If it exists, we have to find the class's def of it to get
-     * flags and owner.  Get the value from the class object if
-     * the waif's value is clear.
-     */
-    h = db_find_property(Var::new_obj(w->_class), name,
-                         prop->type == TYPE_CLEAR ? prop : nullptr);
-    if (!h.ptr)
-        panic_moo("waif propdef update failed in waif_get_prop");
-    else if (h.built_in != BP_NONE)
-        panic_moo("built-in property beginning with WAIF_PROP_PREFIX?!");
-    else if (!waif_property_allows(w, h, progr, PF_READ))
+    h = waif_class_prop(classp, wpd, def);
+    if (prop->type == TYPE_CLEAR)
+        *prop = dbpriv_inherited_property_value(classp, (Pval *)h.ptr,
+                                                (Object *)h.definer, wpd->info[def].index);
+    if (!waif_property_allows(w, h, progr, PF_READ))
         return E_PERM;
 
     *prop = var_ref(*prop);
@@ -730,8 +794,7 @@ enum error
 waif_put_prop(Waif *w, const char *name, Var val, Objid progr)
 {
     db_prop_handle h;
-    static Stream *s;
-    int idx, pdef_idx;
+    int idx;
     Var *dest;
 
     update_waif_propdefs(w);
@@ -752,44 +815,28 @@ waif_put_prop(Waif *w, const char *name, Var val, Objid progr)
     else if (!valid(w->_class))
         return E_INVIND;
 
-    /* There doesn't seem to be any way around constructing the
-     * prefixed name when doing the db_find_property later.
-     */
-    if (!s)
-        s = new_stream(50);
-    stream_add_char(s, WAIF_PROP_PREFIX);
-    stream_add_string(s, name);
-    name = reset_stream(s);
-
-    /* First find the in offset into the waif's own propvals for
-     * this property.  This will tell us more quickly if it doesn't
-     * exist.
+    /* Find the property in the class's table, then the offset into
+     * the waif's own propvals for it.
      */
-    idx = find_propval_offset(w, name, &pdef_idx);
-    switch (idx) {
-        case -2:
-            return E_PROPNF;
-        case -1:
-            /* clear, we'll need to allocate a slot for it later.  It
-             * would be cleaner to do it here but we could still fail
-             * with E_PERM so let's hold off.
-             */
-            dest = nullptr;
-            break;
-        default:
-            dest = &w->propvals[idx];
-            break;
-    }
+    WaifPropdefs *wpd = w->propdefs;
+    int def = find_waif_propdef(wpd, name);
+    if (def < 0)
+        return E_PROPNF;
+
+    idx = propval_offset(w, def);
+    if (idx < 0)
+        /* clear, we'll need to allocate a slot for it later.  It
+         * would be cleaner to do it here but we could still fail
+         * with E_PERM so let's hold off.
+         */
+        dest = nullptr;
+    else
+        dest = &w->propvals[idx];
 
-    /* If it exists, we have to find the class's def of it to get
-     * flags and owner.
+    /* The class's slot for it has the flags and owner.
      */
-    h = db_find_property(Var::new_obj(w->_class), name, nullptr);
-    if (!h.ptr)
-        panic_moo("waif propdef update failed in waif_put_prop");
-    else if (h.built_in != BP_NONE)
-        panic_moo("built-in property beginning with WAIF_PROP_PREFIX?!");
-    else if (!waif_property_allows(w, h, progr, PF_WRITE))
+    h = waif_class_prop(dbpriv_find_object(w->_class), wpd, def);
+    if (!waif_property_allows(w, h, progr, PF_WRITE))
         return E_PERM;
 
     /* Could do this sooner, but it doesn't really matter.  Disallow
@@ -813,7 +860,7 @@ waif_put_prop(Waif *w, const char *name, Var val, Objid progr)
     } else {
         /* This will require mapping a new propval slot.
          */
-        idx = alloc_propval_offset(w, pdef_idx);
+        idx = alloc_propval_offset(w, def);
         w->propvals[idx] = var_ref(val);
     }
     return E_NONE;
@@ -0,0 +1,46 @@
+# Measures allocator throughput and memory growth under list, map and
+# string churn. Run it against servers built with and without POOL_ALLOCATOR
+# in options.h, and with cmake -DUSE_JEMALLOC=ON, to compare them.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/alloc_churn.rb [host] [port] [rounds] [server pid]
+#
+# Each workload is sent as a series of evals small enough to stay under the
+# tick limit. If the server's pid is given, its resident set size is read
+# from /proc before and after each workload.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 200).to_i
+pid = ARGV[3]
+
+WORKLOADS = {
+  'small lists' => 'for i in [1..2000] l = {i, i + 1, tostr(i)}; l = {@l, i}; endfor',
+  'list append' => 'l = {}; for i in [1..1500] l = {@l, i}; endfor',
+  'small maps' => 'for i in [1..1000] m = ["a" -> i, "b" -> {i}]; m["c"] = tostr(i); m = mapdelete(m, "a"); endfor',
+  'map build' => 'm = []; for i in [1..800] m[i] = tostr(i); endfor for i in [1..800] m = mapdelete(m, i); endfor',
+  'short strings' => 'for i in [1..2000] s = tostr("item-", i); s = s + "!"; endfor'
+}.freeze
+
+def rss_kb(pid)
+  return nil unless pid
+  File.read("/proc/#{pid}/status")[/^VmRSS:\s+(\d+)/, 1].to_i
+end
+
+socket = connect_wizard(host, port)
+
+WORKLOADS.each do |name, code|
+  before = rss_kb(pid)
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  rounds.times { run_eval(socket, code) }
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+  after = rss_kb(pid)
+
+  line = format('%-14s %8.2fs  %8.1f evals/s', name, elapsed, rounds / elapsed)
+  line += format('  rss %d -> %d KB', before, after) if before
+  puts line
+end
+
+socket.close
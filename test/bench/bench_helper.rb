@@ -0,0 +1,59 @@
+# What the benchmarks in this directory have in common: connecting as the
+# wizard, running and timing evals, and raising server limits while a
+# benchmark runs.
+
+require 'socket'
+
+PREFIX = '-=!-^-!=-'.freeze
+SUFFIX = '-=!-v-!=-'.freeze
+
+# Connects as the wizard, with the output prefix and suffix that run_eval()
+# looks for.
+def connect_wizard(host, port)
+  socket = TCPSocket.new(host, port)
+  socket.write("connect wizard\nPREFIX #{PREFIX}\nSUFFIX #{SUFFIX}\n")
+  socket
+end
+
+# Evaluates CODE and returns the last line of its output, which is its
+# result.
+def run_eval(socket, code)
+  socket.write("; #{code}\n")
+  state = :before
+  result = nil
+  while (line = socket.gets)
+    line = line.chomp
+    if line == PREFIX
+      state = :inside
+    elsif line == SUFFIX && state == :inside
+      return result
+    elsif state == :inside
+      result = line
+    end
+  end
+  raise 'connection closed'
+end
+
+# Returns the seconds taken to evaluate CODE ROUNDS times.
+def time_evals(socket, code, rounds)
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  rounds.times { run_eval(socket, code) }
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+end
+
+# MOO code that sets the server options in LIMITS, a list of {name, value}
+# pairs, keeping the values they had in player.bench_limits, which must
+# already exist.
+def raise_limits(limits)
+  "player.bench_limits = {}; for l in (#{limits}) " \
+    'if (l[1] in properties($server_options)) player.bench_limits = {@player.bench_limits, {l[1], $server_options.(l[1])}}; ' \
+    'else add_property($server_options, l[1], 0, {player, "r"}); endif $server_options.(l[1]) = l[2]; endfor ' \
+    'load_server_options();'
+end
+
+# MOO code that puts back the server options raise_limits() changed.
+def restore_limits(limits)
+  "for l in (#{limits}) delete_property($server_options, l[1]); endfor " \
+    'for l in (player.bench_limits) add_property($server_options, l[1], l[2], {player, "r"}); endfor ' \
+    'load_server_options();'
+end
@@ -0,0 +1,55 @@
+# Measures calls to built-in functions that take their arguments straight
+# from the stack, next to the same calls made through a list with `@'.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/builtin_calls.rb [host] [port] [rounds]
+#
+# Each workload makes 1,000,000 calls in a loop; an empty loop is timed as
+# well and taken off the others.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+LOOPS = 1_000_000
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+RESTORE = "#{restore_limits(LIMITS)} delete_property(player, \"bench_limits\");".freeze
+
+def loop_over(body)
+  "l = {1, 2, 3}; s = \"abc\"; o = player; for i in [1..#{LOOPS}] #{body} endfor"
+end
+
+WORKLOADS = {
+  'empty loop' => loop_over(''),
+  'length(l)' => loop_over('length(l);'),
+  'length(s)' => loop_over('length(s);'),
+  'typeof(l)' => loop_over('typeof(l);'),
+  'valid(o)' => loop_over('valid(o);'),
+  'is_player(o)' => loop_over('is_player(o);'),
+  'min(i, 5)' => loop_over('min(i, 5);'),
+  'max(i, 1, 5)' => loop_over('max(i, 1, 5);'),
+  'length(@{l})' => loop_over('length(@{l});')
+}.freeze
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'add_property(player, "bench_limits", {}, {player, ""});')
+run_eval(socket, SETUP)
+
+empty = nil
+WORKLOADS.each do |name, code|
+  elapsed = time_evals(socket, code, rounds) / rounds
+  if empty.nil?
+    empty = elapsed
+    next
+  end
+  puts format('%-14s %8.1f ns/call', name, (elapsed - empty) * 1e9 / LOOPS)
+end
+
+run_eval(socket, RESTORE)
+socket.close
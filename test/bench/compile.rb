@@ -0,0 +1,59 @@
+# Measures how fast verbs compile and decompile: every verb in the database
+# is compiled again with set_verb_code(), then a long generated verb is
+# compiled and listed with verb_code() over and over.
+#
+# Start a server on the database to measure (test/Test.db or Minimal.db),
+# then run:
+#     ruby bench/compile.rb [host] [port] [rounds]
+#
+# The compiled-program cache is turned off while this runs, so every call
+# goes through the parser.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+COMPILES = 2_000
+LARGE = 200
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}, {"program_cache_size", 0}}'.freeze
+
+PROPERTIES = '{"bench_limits", "bench_object", "bench_code"}'.freeze
+
+SETUP = "#{raise_limits(LIMITS)} " \
+        'player.bench_code = {}; for o in [#0..max_object()] if (valid(o)) for i in [1..length(verbs(o))] ' \
+        'player.bench_code = {@player.bench_code, verb_code(o, i)}; endfor endif endfor ' \
+        'player.bench_object = o = create($nothing); ' \
+        'add_verb(o, {player, "xd", "scratch"}, {"this", "none", "this"}); ' \
+        'add_verb(o, {player, "xd", "large"}, {"this", "none", "this"}); ' \
+        'c = {}; for i in [1..100] c = {@c, tostr("x", i, " = {\"s", i, "\", player.name, ", i, " * 2 + 1};"), ' \
+        'tostr("if (x", i, "[3] > 2 && !(\"abc\" in x", i, "))"), ' \
+        'tostr("y = $string_utils:from_list(x", i, ", \"abc\")[1..2];"), "endif"}; endfor ' \
+        'set_verb_code(o, "large", c); return length(player.bench_code);'.freeze
+
+RESTORE = "#{restore_limits(LIMITS)} recycle(player.bench_object); " \
+          "for p in (#{PROPERTIES}) delete_property(player, p); endfor".freeze
+
+socket = connect_wizard(host, port)
+run_eval(socket, "for p in (#{PROPERTIES}) add_property(player, p, {}, {player, \"\"}); endfor")
+verbs = run_eval(socket, SETUP).sub(/\A\{1, (\d+)\}\z/, '\1').to_i
+passes = [COMPILES / [verbs, 1].max, 1].max
+
+workloads = {
+  "#{verbs} database verbs" => ["o = player.bench_object; for r in [1..#{passes}] " \
+                                'for c in (player.bench_code) set_verb_code(o, "scratch", c); endfor endfor',
+                                passes * verbs],
+  'large verb, compile' => ["o = player.bench_object; c = verb_code(o, \"large\"); for r in [1..#{LARGE}] " \
+                            'set_verb_code(o, "scratch", c); endfor', LARGE],
+  'large verb, list' => ["o = player.bench_object; for r in [1..#{LARGE}] verb_code(o, \"large\"); endfor", LARGE]
+}
+
+workloads.each do |name, (code, count)|
+  elapsed = time_evals(socket, code, rounds) / rounds
+  puts format('%-24s %8.1f us/verb', name, elapsed * 1e6 / count)
+end
+
+run_eval(socket, RESTORE)
+socket.close
@@ -0,0 +1,59 @@
+# Measures eval() of the same short snippets over and over, with the
+# compiled-program cache on and with it turned off.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/eval_cache.rb [host] [port] [rounds]
+#
+# Each workload makes 20,000 calls to eval() in a loop; an empty loop is
+# timed as well and taken off the others.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+LOOPS = 20_000
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}, {"program_cache_size", 256}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+RESTORE = "#{restore_limits(LIMITS)} delete_property(player, \"bench_limits\");".freeze
+
+def loop_over(body)
+  "for i in [1..#{LOOPS}] #{body} endfor"
+end
+
+WORKLOADS = {
+  'empty loop' => loop_over(''),
+  'return' => loop_over('eval("return 1;");'),
+  'expression' => loop_over('eval("return {player.name, 1 + 2 * 3, \\"abc\\"[2..3]};");'),
+  'statements' => loop_over('eval("x = 0;", "for j in [1..3]", "x = x + j;", "endfor", "return x;");')
+}.freeze
+
+def cache_size(size)
+  "$server_options.program_cache_size = #{size}; load_server_options();"
+end
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'add_property(player, "bench_limits", {}, {player, ""});')
+run_eval(socket, SETUP)
+
+{ 'cached' => 256, 'uncached' => 0 }.each do |label, size|
+  run_eval(socket, cache_size(size))
+  puts label
+  empty = nil
+  WORKLOADS.each do |name, code|
+    elapsed = time_evals(socket, code, rounds) / rounds
+    if empty.nil?
+      empty = elapsed
+      next
+    end
+    puts format('  %-12s %8.1f us/eval', name, (elapsed - empty) * 1e6 / LOOPS)
+  end
+end
+puts "program_cache_stats: #{run_eval(socket, 'return program_cache_stats();')}"
+
+run_eval(socket, RESTORE)
+socket.close
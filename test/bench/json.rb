@@ -0,0 +1,70 @@
+# Measures generate_json() and parse_json(), and the file_write_json() and
+# file_read_json() functions that stream documents through a file, on
+# documents of about 1KB, 1MB and 100MB.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/json.rb [host] [port] [rounds]
+#
+# Each document is a list of rows, a map holding a few numbers and a string
+# of about 900 bytes, so most of the time goes to producing and scanning
+# text rather than to building values. The file workloads use
+# files/bench_json.tmp, which is removed at the end.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+SIZES = { '1KB' => 1, '1MB' => 1_000, '100MB' => 100_000 }.freeze
+
+# The larger documents need more ticks, seconds and list bytes than the
+# defaults, so the script raises those limits while it runs.
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}, {"max_list_value_bytes", 1000000000}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+RESTORE = "#{restore_limits(LIMITS)} " \
+          'for p in ({"bench_limits", "bench_value", "bench_json"}) delete_property(player, p); endfor'.freeze
+
+# Rows are appended in blocks, since appending to a long list copies it.
+def build(rows)
+  'text = ""; for i in [1..56] text = text + "0123456789abcdef"; endfor ' \
+    "v = {}; while (length(v) < #{rows}) block = {}; " \
+    "for i in [1..min(1000, #{rows} - length(v))] " \
+    'block = {@block, ["id" -> length(v) + i, "score" -> tofloat(length(v) + i) / 7.0, "tag" -> tostr(i), "text" -> text]}; ' \
+    'endfor v = {@v, @block}; endwhile ' \
+    'player.bench_value = v; set_thread_mode(0); player.bench_json = generate_json(v); ' \
+    'return length(player.bench_json);'
+end
+
+# generate_json() and the file functions normally run on a background
+# thread and suspend the task, and the server sends the output suffix as
+# soon as the task suspends, so each workload turns threading off for its
+# own task.
+WORKLOADS = {
+  'generate_json' => 'set_thread_mode(0); generate_json(player.bench_value);',
+  'parse_json' => 'set_thread_mode(0); parse_json(player.bench_json);',
+  'file_write_json' => 'set_thread_mode(0); fh = file_open("bench_json.tmp", "w-tn"); ' \
+                       'file_write_json(fh, player.bench_value); file_close(fh);',
+  'file_read_json' => 'set_thread_mode(0); fh = file_open("bench_json.tmp", "r-tn"); ' \
+                      'file_read_json(fh); file_close(fh);'
+}.freeze
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'for p in ({"bench_limits", "bench_value", "bench_json"}) ' \
+                 'add_property(player, p, {}, {player, ""}); endfor')
+run_eval(socket, SETUP)
+
+SIZES.each do |name, rows|
+  bytes = run_eval(socket, build(rows))[/\d+(?=\}$)/].to_i
+  puts "#{name} document: #{rows} rows, #{bytes} bytes"
+  WORKLOADS.each do |workload, code|
+    elapsed = time_evals(socket, code, rounds) / rounds
+    puts format('  %-16s %10.2f ms %9.1f MB/s', workload, elapsed * 1000, bytes / elapsed / 1_000_000)
+  end
+end
+
+run_eval(socket, 'file_remove("bench_json.tmp");')
+run_eval(socket, RESTORE)
+socket.close
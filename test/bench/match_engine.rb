@@ -0,0 +1,51 @@
+# Measures match() and rmatch() on PCRE2's JIT against the original matcher,
+# which $server_options.legacy_match_engine forces.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/match_engine.rb [host] [port] [rounds]
+#
+# Every eval first builds a 16KB subject, then matches it repeatedly; the
+# time to build the subject is measured separately and subtracted. Patterns
+# are cached after their first use, so compilation isn't what's measured.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 50).to_i
+
+SUBJECT = 's = ""; for i in [1..512] s = s + "the quick brown fox jumps"; s = s + " ov"; endfor ' \
+          's = s + "NEEDLE in a haystack, at the very end of it all";'.freeze
+
+WORKLOADS = {
+  'literal' => 'for i in [1..100] match(s, "haystack"); endfor',
+  'nocase word' => 'for i in [1..100] match(s, "%<needle%>"); endfor',
+  'alternation' => 'for i in [1..100] match(s, "zebra%|haystack%|needle", 1); endfor',
+  'set loop' => 'for i in [1..100] match(s, "[A-Z]+ in"); endfor',
+  'backtracking' => 'for i in [1..100] match(s, "q.*k.*N"); endfor',
+  'groups' => 'for i in [1..100] match(s, "%(%w+%) in a %(%w+%)"); endfor',
+  'miss' => 'for i in [1..100] match(s, "x[0-9]+y"); endfor',
+  'rmatch' => 'for i in [1..20] rmatch(s, "quick %w+"); endfor'
+}.freeze
+
+def use_legacy(socket, legacy)
+  run_eval(socket, "$server_options.legacy_match_engine = #{legacy}; load_server_options();")
+end
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'add_property($server_options, "legacy_match_engine", 0, {player, "r"});')
+
+baseline = time_evals(socket, SUBJECT, rounds)
+
+WORKLOADS.each do |name, code|
+  times = [1, 0].map do |legacy|
+    use_legacy(socket, legacy)
+    run_eval(socket, "#{SUBJECT} #{code}")
+    time_evals(socket, "#{SUBJECT} #{code}", rounds) - baseline
+  end
+  puts format('%-13s legacy %8.2f ms/eval  pcre %8.2f ms/eval  %5.1fx',
+              name, times[0] * 1000 / rounds, times[1] * 1000 / rounds, times[0] / times[1])
+end
+
+run_eval(socket, 'delete_property($server_options, "legacy_match_engine"); load_server_options();')
+socket.close
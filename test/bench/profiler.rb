@@ -0,0 +1,50 @@
+# Measures what the profiler costs: a loop of verb calls is timed with no
+# profile being taken, while profiling calls, and while sampling.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/profiler.rb [host] [port] [rounds]
+#
+# Each workload makes 200,000 calls to a verb that returns at once, so the
+# numbers are close to the worst case per call.  Run it against a server
+# built without the profiler to see what it costs when it is off.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+LOOPS = 200_000
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}}'.freeze
+
+SETUP = "#{raise_limits(LIMITS)} " \
+        'player.bench_object = o = create($nothing); ' \
+        'add_verb(o, {player, "xd", "f"}, {"this", "none", "this"}); set_verb_code(o, "f", {"return 1;"});'.freeze
+
+RESTORE = "#{restore_limits(LIMITS)} recycle(player.bench_object); " \
+          'for p in ({"bench_limits", "bench_object"}) delete_property(player, p); endfor'.freeze
+
+CALLS = "o = player.bench_object; for i in [1..#{LOOPS}] o:f(); endfor".freeze
+
+WORKLOADS = {
+  'off' => CALLS,
+  'calls' => "profile_start(\"calls\"); #{CALLS} profile_stop();",
+  'samples' => "profile_start(\"samples\", 0.001); #{CALLS} profile_stop();"
+}.freeze
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'for p in ({"bench_limits", "bench_object"}) add_property(player, p, {}, {player, ""}); endfor')
+run_eval(socket, SETUP)
+
+profiler = run_eval(socket, 'return `function_info("profile_start") ! E_INVARG => 0\';') != '{1, 0}'
+
+WORKLOADS.each do |name, code|
+  next unless name == 'off' || profiler
+
+  elapsed = time_evals(socket, code, rounds) / rounds
+  puts format('%-8s %8.1f ns/call', name, elapsed * 1e9 / LOOPS)
+end
+
+run_eval(socket, RESTORE)
+socket.close
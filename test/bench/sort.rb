@@ -0,0 +1,68 @@
+# Measures sort() on a million strings, a million integers and 128,000 mixed
+# values, plain, natural, reversed and by a list of keys.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/sort.rb [host] [port] [rounds]
+#
+# The lists are built once and kept in properties.  Strings are random
+# base64 fragments, so they differ in case and length.  The mixed list holds
+# integers, strings, floats and objects, which sort() rejected before it had
+# an order across types.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+# Building the lists takes far more than the default tick limit, and the
+# argument list of sort(strings, ints) is bigger than the default
+# max_list_value_bytes, so the script raises those limits while it runs.
+# Lists are built in blocks, since appending to a long list copies it.
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}, {"max_list_value_bytes", 1000000000}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+WORDS = 'explode(strsub(strsub(encode_base64(random_bytes(9000)), "/", " "), "+", " "))'.freeze
+
+BUILD = 's = {}; while (length(s) < 1000000) block = {}; ' \
+        "while (length(block) < 10000) block = {@block, @#{WORDS}}; endwhile s = {@s, @block}; endwhile " \
+        'player.bench_strings = s[1..1000000]; ' \
+        'n = {}; for b in [1..100] block = {}; for c in [1..100] chunk = {}; ' \
+        'for i in [1..100] chunk = {@chunk, random(1000000000)}; endfor block = {@block, @chunk}; endfor ' \
+        'n = {@n, @block}; endfor player.bench_ints = n; ' \
+        'm = {}; for i in [1..1000] m = {@m, n[i], s[i], tofloat(n[i + 1000]), toobj(n[i + 2000])}; endfor ' \
+        'm = {@m, @m}; m = {@m, @m}; m = {@m, @m}; m = {@m, @m}; m = {@m, @m}; ' \
+        'player.bench_mixed = m;'.freeze
+
+RESTORE = "#{restore_limits(LIMITS)} " \
+          'for p in ({"bench_limits", "bench_strings", "bench_ints", "bench_mixed"}) delete_property(player, p); endfor'.freeze
+
+# sort() normally suspends the task while it runs on a background thread, and
+# the server sends the output suffix as soon as the task suspends, so each
+# workload turns threading off for its own task.  Sorts of large lists still
+# use several threads.
+WORKLOADS = {
+  'strings' => 'set_thread_mode(0); sort(player.bench_strings);',
+  'strings natural' => 'set_thread_mode(0); sort(player.bench_strings, {}, 1);',
+  'strings reverse' => 'set_thread_mode(0); sort(player.bench_strings, {}, 0, 1);',
+  'ints' => 'set_thread_mode(0); sort(player.bench_ints);',
+  'strings by ints' => 'set_thread_mode(0); sort(player.bench_strings, player.bench_ints);',
+  'mixed' => 'set_thread_mode(0); sort(player.bench_mixed);'
+}.freeze
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'for p in ({"bench_limits", "bench_strings", "bench_ints", "bench_mixed"}) ' \
+                 'add_property(player, p, {}, {player, ""}); endfor')
+run_eval(socket, SETUP)
+run_eval(socket, BUILD)
+puts "#{run_eval(socket, 'return length(player.bench_strings);')[/\d+(?=\}$)/]} strings and integers, " \
+     "#{run_eval(socket, 'return length(player.bench_mixed);')[/\d+(?=\}$)/]} mixed values"
+
+WORKLOADS.each do |name, code|
+  elapsed = time_evals(socket, code, rounds)
+  puts format('%-16s %9.2f ms/sort', name, elapsed * 1000 / rounds)
+end
+
+run_eval(socket, RESTORE)
+socket.close
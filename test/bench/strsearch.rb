@@ -0,0 +1,39 @@
+# Measures index(), rindex() and strsub() on long subjects with short and
+# long needles, with and without case sensitivity.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/strsearch.rb [host] [port] [rounds]
+#
+# Every eval first builds a 16KB subject with the needle near the end, then
+# searches it repeatedly; the time to build the subject is measured
+# separately and subtracted.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 50).to_i
+
+SUBJECT = 's = ""; for i in [1..512] s = s + "the quick brown fox jumps"; s = s + " ov"; endfor ' \
+          's = s + "NEEDLE in a haystack, at the very end of it all";'.freeze
+
+WORKLOADS = {
+  'index short' => 'for i in [1..200] index(s, "hay", 1); endfor',
+  'index long' => 'for i in [1..200] index(s, "NEEDLE in a haystack, at the very end", 1); endfor',
+  'index nocase' => 'for i in [1..200] index(s, "needle in a haystack"); endfor',
+  'rindex nocase' => 'for i in [1..200] rindex(s, "THE QUICK"); endfor',
+  'index miss' => 'for i in [1..200] index(s, "zebra"); endfor',
+  'strsub short' => 'for i in [1..20] strsub(s, "fox", "cat", 1); endfor',
+  'strsub nocase' => 'for i in [1..20] strsub(s, "QUICK", "slow"); endfor'
+}.freeze
+
+socket = connect_wizard(host, port)
+
+baseline = time_evals(socket, SUBJECT, rounds)
+
+WORKLOADS.each do |name, code|
+  elapsed = time_evals(socket, "#{SUBJECT} #{code}", rounds) - baseline
+  puts format('%-14s %8.3fs  %8.2f ms/eval', name, elapsed, elapsed * 1000 / rounds)
+end
+
+socket.close
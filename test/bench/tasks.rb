@@ -0,0 +1,53 @@
+# Measures how quickly the server works through a queue of forked tasks,
+# with $server_options.task_batch_size set to 1 (one task per pass through
+# the main loop) and to its default.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/tasks.rb [host] [port] [rounds]
+#
+# Each round forks 20,000 tasks that each bump a counter, then asks for the
+# counter until it reaches the number forked.  200 idle connections are held
+# open throughout, as the network is checked once per pass.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+TASKS = 20_000
+IDLE_CONNECTIONS = 200
+BATCH_SIZES = [1, 100].freeze
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}, {"queued_task_limit", -1}, {"task_batch_size", 100}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+RESTORE = "#{restore_limits(LIMITS)} " \
+          'for p in ({"bench_limits", "bench_done"}) delete_property(player, p); endfor'.freeze
+
+FORK = "player.bench_done = 0; for i in [1..#{TASKS}] " \
+       'fork (0) player.bench_done = player.bench_done + 1; endfork endfor'.freeze
+
+def time_round(socket)
+  t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  run_eval(socket, FORK)
+  sleep 0.01 until run_eval(socket, 'return player.bench_done;') == "{1, #{TASKS}}"
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+end
+
+idle = Array.new(IDLE_CONNECTIONS) { TCPSocket.new(host, port) }
+socket = connect_wizard(host, port)
+run_eval(socket, 'for p in ({"bench_limits", "bench_done"}) add_property(player, p, 0, {player, ""}); endfor')
+run_eval(socket, SETUP)
+
+BATCH_SIZES.each do |size|
+  run_eval(socket, "$server_options.task_batch_size = #{size}; load_server_options();")
+  elapsed = Array.new(rounds) { time_round(socket) }.sum / rounds
+  puts format('task_batch_size %-4d %8.0f tasks/s', size, TASKS / elapsed)
+end
+puts "scheduler_stats: #{run_eval(socket, 'return `call_function("scheduler_stats") ! E_INVARG => 0\';')}"
+
+run_eval(socket, RESTORE)
+socket.close
+idle.each(&:close)
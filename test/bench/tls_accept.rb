@@ -0,0 +1,62 @@
+# Measures how long a ToastStunt server takes to accept a burst of TLS
+# connections (e.g. a reconnect storm after a restart).
+#
+# Start a server with a TLS listener, then run:
+#     ruby bench/tls_accept.rb [host] [port] [connections] [concurrency]
+#
+# Each connection records the time from TCP connect until the TLS handshake
+# completes. Connections are held open until all of them have been made.
+
+require 'socket'
+require 'openssl'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7443).to_i
+connections = (ARGV[2] || 500).to_i
+concurrency = (ARGV[3] || 50).to_i
+
+context = OpenSSL::SSL::SSLContext.new
+context.verify_mode = OpenSSL::SSL::VERIFY_NONE
+
+latencies = []
+failures = 0
+sockets = []
+lock = Mutex.new
+queue = Queue.new
+connections.times { |i| queue << i }
+
+started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+workers = Array.new(concurrency) do
+  Thread.new do
+    loop do
+      begin
+        queue.pop(true)
+      rescue ThreadError
+        break
+      end
+      begin
+        t0 = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        tcp = TCPSocket.new(host, port)
+        ssl = OpenSSL::SSL::SSLSocket.new(tcp, context)
+        ssl.sync_close = true
+        ssl.connect
+        elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t0
+        lock.synchronize { latencies << elapsed; sockets << ssl }
+      rescue StandardError => e
+        lock.synchronize { failures += 1 }
+        warn "connection failed: #{e.message}"
+      end
+    end
+  end
+end
+workers.each(&:join)
+total = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+sockets.each { |s| s.close rescue nil }
+
+latencies.sort!
+pct = ->(p) { latencies.empty? ? 0 : latencies[[(latencies.length * p).ceil - 1, 0].max] * 1000 }
+
+puts "connections: #{latencies.length} ok, #{failures} failed in #{'%.2f' % total}s " \
+     "(#{'%.1f' % (latencies.length / total)}/s)"
+puts "accept latency (ms): min #{'%.2f' % pct.call(0)}  p50 #{'%.2f' % pct.call(0.5)}  " \
+     "p95 #{'%.2f' % pct.call(0.95)}  p99 #{'%.2f' % pct.call(0.99)}  max #{'%.2f' % pct.call(1.0)}"
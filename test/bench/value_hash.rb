@@ -0,0 +1,55 @@
+# Measures value_hash(), value_hmac() and value_hash64() on a nested value
+# whose literal is about 10MB.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/value_hash.rb [host] [port] [rounds] [server pid]
+#
+# The value is built once and kept in a property. Given the server's pid
+# (and a server on the same machine), the script also reports the server's
+# peak resident set size before and after hashing, which shows whether
+# hashing needed memory in proportion to the size of the literal.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 5).to_i
+pid = ARGV[3]
+
+# Each eval adds 100 rows of ten small maps to the value, to stay within the
+# tick limit; ten of them make a value whose literal is about 10MB.
+CREATE = 'add_property(player, "bench_value", {}, {player, ""});'.freeze
+ADD_ROWS = 'base = ""; for i in [1..64] base = base + "0123456789abcdef"; endfor ' \
+           'v = player.bench_value; player.bench_value = 0; ' \
+           'for i in [1..100] row = {}; for j in [1..10] row = {@row, ["k" -> base + tostr(length(v), ".", j), "n" -> i * j]}; endfor v = {@v, row}; endfor ' \
+           'player.bench_value = v;'.freeze
+
+WORKLOADS = {
+  'value_hash sha256' => 'value_hash(player.bench_value);',
+  'value_hash md5' => 'value_hash(player.bench_value, "md5");',
+  'value_hmac sha256' => 'value_hmac(player.bench_value, "key");',
+  'value_hash64' => 'value_hash64(player.bench_value);'
+}.freeze
+
+def peak_rss(pid)
+  return nil unless pid
+  File.readlines("/proc/#{pid}/status").grep(/^VmHWM/).first.split[1].to_i
+end
+
+socket = connect_wizard(host, port)
+run_eval(socket, CREATE)
+10.times { run_eval(socket, ADD_ROWS) }
+
+before = peak_rss(pid)
+
+WORKLOADS.each do |name, code|
+  elapsed = time_evals(socket, code, rounds)
+  puts format('%-18s %8.2f ms/eval', name, elapsed * 1000 / rounds)
+end
+
+puts format('peak RSS: %d KB before hashing, %d KB after', before, peak_rss(pid)) if before
+literal = run_eval(socket, 'return length(toliteral(player.bench_value));')[/\d+(?=\}$)/]
+puts "literal: #{literal} bytes"
+
+run_eval(socket, 'delete_property(player, "bench_value");')
+socket.close
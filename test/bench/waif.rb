@@ -0,0 +1,66 @@
+# Measures reading and writing waif properties on classes with 4, 32 and 120
+# properties, half of them defined on the class's parent.
+#
+# Start a server on test/Test.db, then run:
+#     ruby bench/waif.rb [host] [port] [rounds]
+#
+# Each workload touches the last property defined, so a search through the
+# property names has the most to look at, in a loop of 200,000 accesses.  An
+# empty loop is timed as well and taken off the others.  Clear reads find
+# the value on the class; set reads and writes use the waif's own value.
+
+require_relative 'bench_helper'
+
+host = ARGV[0] || 'localhost'
+port = (ARGV[1] || 7777).to_i
+rounds = (ARGV[2] || 3).to_i
+
+COUNTS = [4, 32, 120].freeze
+LOOPS = 200_000
+
+LIMITS = '{{"fg_ticks", 1000000000}, {"fg_seconds", 3600}}'.freeze
+
+SETUP = raise_limits(LIMITS).freeze
+
+RESTORE = "#{restore_limits(LIMITS)} " \
+          'for o in (player.bench_classes) recycle(o); endfor ' \
+          'for p in ({"bench_limits", "bench_classes", "bench_waif"}) delete_property(player, p); endfor'.freeze
+
+# The parent holds the first half of the properties and the class the rest.
+def build(count)
+  'p = create($waif); c = create(p); player.bench_classes = {@player.bench_classes, c, p}; ' \
+    "for i in [1..#{count}] add_property(i <= #{count / 2} ? p | c, \":p\" + tostr(i), i, {player, \"r\"}); endfor " \
+    'player.bench_waif = c:new();'
+end
+
+def workloads(count)
+  {
+    'empty loop' => "w = player.bench_waif; for i in [1..#{LOOPS}] endfor",
+    'read clear' => "w = player.bench_waif; for i in [1..#{LOOPS}] v = w.p#{count}; endfor",
+    'write' => "w = player.bench_waif; for i in [1..#{LOOPS}] w.p#{count} = i; endfor player.bench_waif = w;",
+    'read set' => "w = player.bench_waif; for i in [1..#{LOOPS}] v = w.p#{count}; endfor"
+  }
+end
+
+socket = connect_wizard(host, port)
+run_eval(socket, 'for p in ({"bench_limits", "bench_classes", "bench_waif"}) ' \
+                 'add_property(player, p, {}, {player, ""}); endfor')
+run_eval(socket, SETUP)
+
+COUNTS.each do |count|
+  run_eval(socket, build(count))
+  puts "#{count} properties"
+  empty = nil
+  workloads(count).each do |name, code|
+    elapsed = time_evals(socket, code, rounds) / rounds
+    if empty.nil?
+      empty = elapsed
+      next
+    end
+    puts format('  %-12s %8.1f ns/access', name, (elapsed - empty) * 1e9 / LOOPS)
+  end
+end
+puts "waif_stats: #{run_eval(socket, 'return waif_stats()["properties"];')}"
+
+run_eval(socket, RESTORE)
+socket.close
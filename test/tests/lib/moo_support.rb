@@ -646,8 +646,12 @@ module MooSupport
     simplify command %|; return file_openmode(#{value_ref(fh)});|
   end
 
-  def file_readline(fh)
-    simplify command %|; return file_readline(#{value_ref(fh)});|
+  def file_readline(fh, count = nil)
+    if count
+      simplify command %|; return file_readline(#{value_ref(fh)}, #{value_ref(count)});|
+    else
+      simplify command %|; return file_readline(#{value_ref(fh)});|
+    end
   end
 
   def file_readlines(fh, s, e)
@@ -666,6 +670,25 @@ module MooSupport
     simplify command %|; return file_write(#{value_ref(fh)}, #{value_ref(data)});|
   end
 
+  def file_grep(fh, str, *rest)
+    args = [fh, str, *rest].map { |a| value_ref(a) }.join(', ')
+    simplify command %|; return file_grep(#{args});|
+  end
+
+  def file_count_lines(fh)
+    simplify command %|; return file_count_lines(#{value_ref(fh)});|
+  end
+
+  def file_write_json(fh, value, *rest)
+    args = [fh, value, *rest].map { |a| value_ref(a) }.join(', ')
+    simplify command %|; return file_write_json(#{args});|
+  end
+
+  def file_read_json(fh, *rest)
+    args = [fh, *rest].map { |a| value_ref(a) }.join(', ')
+    simplify command %|; return file_read_json(#{args});|
+  end
+
   def file_tell(fh)
     simplify command %|; return file_tell(#{value_ref(fh)});|
   end
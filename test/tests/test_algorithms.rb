@@ -255,6 +255,31 @@ class TestAlgorithms < Test::Unit::TestCase
     end
   end
 
+  def test_that_value_hash_of_a_large_value_matches_its_literal
+    run_test_as('programmer') do
+      # Long enough, and with enough quotes and backslashes, that the literal
+      # is hashed in several pieces.
+      setup = 's = ""; for i in [1..3000] s = s + "ab\\"c\\\\d"; endfor v = {}; for i in [1..8] v = {@v, s, [i -> {s, 1.5, #3}]}; endfor'
+      assert_equal 1, simplify(command(%Q|; #{setup} return value_hash(v) == string_hash(toliteral(v));|))
+      assert_equal 1, simplify(command(%Q|; #{setup} return value_hash(v, "md5", 1) == string_hash(toliteral(v), "md5", 1);|))
+      assert_equal 1, simplify(command(%Q|; #{setup} return value_hmac(v, "key") == string_hmac(toliteral(v), "key");|))
+    end
+  end
+
+  def test_that_value_hash64_works
+    run_test_as('programmer') do
+      assert_equal 1, simplify(command('; return typeof(value_hash64({1, "two", [3 -> 4.0]})) == INT;'))
+      assert_equal 1, simplify(command('; return value_hash64({1, "two"}) == value_hash64({1, "two"});'))
+      assert_equal 1, simplify(command('; return value_hash64(["a" -> 1, "b" -> 2]) == value_hash64(["b" -> 2, "a" -> 1]);'))
+      assert_equal 1, simplify(command('; return value_hash64(0.0) == value_hash64(-0.0);'))
+      assert_equal 0, simplify(command('; return value_hash64(1) == value_hash64(1.0);'))
+      assert_equal 0, simplify(command('; return value_hash64(1) == value_hash64("1");'))
+      assert_equal 0, simplify(command('; return value_hash64({"ab"}) == value_hash64({"a", "b"});'))
+      assert_equal 0, simplify(command('; return value_hash64("abc") == value_hash64("ABC");'))
+      assert_equal 0, simplify(command('; return value_hash64("abc") == value_hash64("abc", 1);'))
+    end
+  end
+
   M0 = "~d1~31~dd~02~c5~e6~ee~c4~69~3d~9a~06~98~af~f9~5c~2f~ca~b5~87~12~46~7e~ab~40~04~58~3e~b8~fb~7f~89" +
     "~55~ad~34~06~09~f4~b3~02~83~e4~88~83~25~71~41~5a~08~51~25~e8~f7~cd~c9~9f~d9~1d~bd~f2~80~37~3c~5b"
   M1 = "~d1~31~dd~02~c5~e6~ee~c4~69~3d~9a~06~98~af~f9~5c~2f~ca~b5~07~12~46~7e~ab~40~04~58~3e~b8~fb~7f~89" +
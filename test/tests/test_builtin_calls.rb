@@ -0,0 +1,118 @@
+require 'test_helper'
+
+class TestBuiltinCalls < Test::Unit::TestCase
+
+  # `length()', `typeof()', `valid()', `is_player()', `min()' and `max()'
+  # take their arguments straight from the stack unless called with `@'.
+
+  def test_that_fast_calls_return_what_list_calls_do
+    run_test_as('programmer') do
+      [
+        %Q|length({1, 2, 3})|, %Q|length("abc")|, %Q|length([1 -> 2])|,
+        %Q|typeof(1.5)|, %Q|valid(#0)|, %Q|valid(#-1)|, %Q|is_player(player)|,
+        %Q|min(3, 1, 2)|, %Q|max(1.0, 3.0)|, %Q|min(5)|
+      ].each do |call|
+        name, args = call.match(/\A(\w+)\((.*)\)\z/).captures
+        assert_equal simplify(command(%Q|; return #{call};|)),
+                     simplify(command(%Q|; return #{name}(@{#{args}});|)), call
+        assert_equal simplify(command(%Q|; return #{call};|)),
+                     simplify(command(%Q|; return call_function("#{name}", #{args});|)), call
+      end
+    end
+  end
+
+  def test_that_fast_calls_check_their_arguments
+    run_test_as('programmer') do
+      assert_equal E_ARGS, simplify(command(%Q|; return length();|))
+      assert_equal E_ARGS, simplify(command(%Q|; return length(1, 2);|))
+      assert_equal E_TYPE, simplify(command(%Q|; return length(1);|))
+      assert_equal E_TYPE, simplify(command(%Q|; return is_player("x");|))
+      assert_equal E_TYPE, simplify(command(%Q|; return max(1, 2.0);|))
+      assert_equal "Type mismatch (args[1] of is_player() expected object; got string)",
+                   simplify(command(%Q|; try is_player("x"); except e (ANY) return e[2]; endtry|))
+    end
+  end
+
+  def test_that_only_calls_without_splices_are_compiled_to_fast_calls
+    run_test_as('programmer') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'fast'], ['this', 'none', 'this'])
+      set_verb_code(o, 'fast') do |vc|
+        vc << %Q|return length(args);|
+      end
+      add_verb(o, ['player', 'xd', 'slow'], ['this', 'none', 'this'])
+      set_verb_code(o, 'slow') do |vc|
+        vc << %Q|return length(@args);|
+      end
+      assert disassemble(o, 'fast').any? { |l| l =~ /CALL_FUNC_FAST length 1/ }
+      assert disassemble(o, 'slow').none? { |l| l =~ /CALL_FUNC_FAST/ }
+      assert_equal 2, call(o, 'fast', 1, 2)
+      assert_equal 3, call(o, 'slow', 'abc')
+      assert_equal ['return length(args);'], verb_code(o, 'fast')
+    end
+  end
+
+  def test_that_protected_fast_functions_call_their_bf_verbs
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "protect_length", 1, {player, "r"})')
+      evaluate('load_server_options()')
+      add_verb('#0', ['player', 'xd', 'bf_length'], ['this', 'none', 'this'])
+      set_verb_code('#0', 'bf_length') do |vc|
+        vc << %Q|return {"bf_length", @args};|
+      end
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'test'], ['this', 'none', 'this'])
+      set_verb_code(o, 'test') do |vc|
+        vc << %Q|return {length("abc"), length(1, 2)};|
+      end
+      assert_equal [['bf_length', 'abc'], ['bf_length', 1, 2]], call(o, 'test')
+      delete_verb('#0', 'bf_length')
+      evaluate('delete_property($server_options, "protect_length")')
+      evaluate('load_server_options()')
+      assert_equal [3, E_ARGS], simplify(command(%Q|; return {length("abc"), `length(1, 2) ! ANY'};|))
+    end
+  end
+
+  def test_that_function_stats_requires_wizard_permissions
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return function_stats();|))
+    end
+    run_test_as('wizard') do
+      assert_equal E_INVARG, simplify(command(%Q|; return function_stats("no_such_function");|))
+    end
+  end
+
+  def test_that_function_stats_counts_calls_and_errors
+    run_test_as('wizard') do
+      before = simplify(command(%Q|; return function_stats("tostr");|))
+      command(%Q|; for i in [1..10] tostr(i); `tostr(@{}, 1, #0, [1 -> 2]) ! ANY'; endfor|)
+      after = simplify(command(%Q|; return function_stats("tostr");|))
+      assert_equal 20, after['calls'] - before['calls']
+      assert_equal 0, after['threaded'] - before['threaded']
+
+      before = simplify(command(%Q|; return function_stats("length");|))
+      command(%Q|; for i in [1..10] length({i}); `length(1) ! ANY'; endfor|)
+      after = simplify(command(%Q|; return function_stats("length");|))
+      assert_equal 20, after['calls'] - before['calls']
+      assert_equal 10, after['errors'] - before['errors']
+
+      assert simplify(command(%Q|; return function_stats();|)).key?('length')
+    end
+  end
+
+  def test_that_function_stats_times_calls_when_asked_to
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "function_timing", 1, {player, "r"})')
+      evaluate('load_server_options()')
+      before = simplify(command(%Q|; return function_stats("ctime");|))
+      command(%Q|; for i in [1..10] ctime(); endfor|)
+      after = simplify(command(%Q|; return function_stats("ctime");|))
+      evaluate('delete_property($server_options, "function_timing")')
+      evaluate('load_server_options()')
+      assert_equal 10, after['times'].sum - before['times'].sum
+      assert after['seconds'] > before['seconds']
+      assert after['max'] >= after['average']
+    end
+  end
+
+end
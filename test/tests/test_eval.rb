@@ -36,4 +36,62 @@ class TestEval < Test::Unit::TestCase
     end
   end
 
+  def test_that_repeated_evals_reuse_the_compiled_program
+    run_test_as('wizard') do
+      before = simplify(command(%Q|; return program_cache_stats();|))
+      assert_equal [[1, [1, 1]], [1, [2, 2]], [1, [3, 3]]],
+                   simplify(command(%Q|; return {eval("return {1, 1};"), eval("return {2, 2};"), eval("return {3, 3};")};|))
+      assert_equal [[1, 5], [1, 5], [1, 5]],
+                   simplify(command(%Q|; r = {}; for i in [1..3] r = {@r, eval("x = 5; return x;")}; endfor return r;|))
+      after = simplify(command(%Q|; return program_cache_stats();|))
+      assert after['hits'] - before['hits'] >= 2
+      assert_equal [0, ['Line 1:  syntax error']], simplify(command(%Q|; return eval("return 1 +;");|))
+      assert_equal [0, ['Line 1:  syntax error']], simplify(command(%Q|; return eval("return 1 +;");|))
+    end
+  end
+
+  def test_that_set_verb_code_shares_programs_between_verbs
+    run_test_as('wizard') do
+      o = create(:nothing)
+      %w[a b].each do |name|
+        add_verb(o, ['player', 'xd', name], ['this', 'none', 'this'])
+        set_verb_code(o, name) do |vc|
+          vc << %Q|return {verb, @args};|
+        end
+      end
+      assert_equal ['a', 1], call(o, 'a', 1)
+      assert_equal ['b', 2], call(o, 'b', 2)
+      set_verb_code(o, 'a') do |vc|
+        vc << %Q|return "changed";|
+      end
+      assert_equal 'changed', call(o, 'a')
+      assert_equal ['b', 2], call(o, 'b', 2)
+      assert_equal ['return {verb, @args};'], verb_code(o, 'b')
+    end
+  end
+
+  def test_that_long_verbs_compile_and_list_the_same
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'test'], ['this', 'none', 'this'])
+      long = 'x' * 20000
+      set_verb_code(o, 'test') do |vc|
+        vc << %Q|s = {};|
+        300.times do |i|
+          vc << %Q|s = {@s, "same", "s#{i}", #{i}};|
+        end
+        vc << %Q|return {length(s), s[1] == s[4], length("#{long}")};|
+      end
+      assert_equal [900, 1, 20000], call(o, 'test')
+      assert_equal 302, verb_code(o, 'test').length
+      assert_equal 's = {@s, "same", "s298", 298};', verb_code(o, 'test')[300]
+    end
+  end
+
+  def test_that_program_cache_stats_requires_wizard_permissions
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return program_cache_stats();|))
+    end
+  end
+
 end
@@ -224,10 +224,140 @@ class TestFileio < Test::Unit::TestCase
       line = file_read(fh, 100)
       eof = file_eof(fh)
       file_close(fh)
-      assert_equal E_FILE, line
+      assert_equal({'error' => E_FILE, 'message' => 'End of file'}, line)
       assert_equal 1, eof
       file_remove('test_fileio.tmp')
     end
   end
 
+  def test_that_count_lines_and_grep_find_lines
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      file_writeline(fh, 'one fish')
+      file_writeline(fh, 'two fish')
+      file_writeline(fh, 'red fish')
+      file_write(fh, 'blue fish')
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal 4, file_count_lines(fh)
+      assert_equal [['two fish', 2]], file_grep(fh, 'TWO')
+      assert_equal [['one fish', 1], ['two fish', 2], ['red fish', 3], ['blue fish', 4]], file_grep(fh, 'fish', 1)
+      assert_equal [], file_grep(fh, 'cat', 1)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_file_functions_work_with_threading_disabled
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      5.times { |i| file_writeline(fh, "line #{i + 1}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      threaded = simplify(command(%Q|; return {file_readlines(#{fh}, 2, 3), file_count_lines(#{fh}), file_grep(#{fh}, "4")};|))
+      unthreaded = simplify(command(%Q|; set_thread_mode(0); return {file_readlines(#{fh}, 2, 3), file_count_lines(#{fh}), file_grep(#{fh}, "4")};|))
+      assert_equal [['line 2', 'line 3'], 5, [['line 4', 4]]], threaded
+      assert_equal threaded, unthreaded
+      # Errors come back the same way whether or not the work is threaded.
+      assert_equal({'error' => E_FILE, 'message' => 'End of file'}, simplify(command(%Q|; return file_readlines(#{fh}, 7, 8);|)))
+      assert_equal({'error' => E_FILE, 'message' => 'End of file'}, simplify(command(%Q|; set_thread_mode(0); return file_readlines(#{fh}, 7, 8);|)))
+      assert_equal({'error' => E_FILE, 'message' => 'No such file or directory'}, simplify(command(%Q|; return file_list("test_fileio.missing");|)))
+      assert_equal({'error' => E_FILE, 'message' => 'No such file or directory'}, simplify(command(%Q|; set_thread_mode(0); return file_list("test_fileio.missing");|)))
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_file_io_max_bytes_limits_each_task
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "file_io_max_bytes", 25, {player, "r"})')
+      evaluate('load_server_options()')
+      fh = file_open('test_fileio.tmp', 'w-bn')
+      assert_equal [10, 10, {'error' => E_QUOTA, 'message' => 'File I/O limit exceeded'}], simplify(command(%Q|; return {file_write(#{fh}, "0123456789"), file_write(#{fh}, "0123456789"), file_write(#{fh}, "0123456789")};|))
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-bn')
+      assert_equal ['0123456789', {'error' => E_QUOTA, 'message' => 'File I/O limit exceeded'}], simplify(command(%Q|; return {file_read(#{fh}, 10), file_read(#{fh}, 20)};|))
+      assert_equal '0123456789', file_read(fh, 20)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+      evaluate('delete_property($server_options, "file_io_max_bytes")')
+      evaluate('load_server_options()')
+    end
+  end
+
+  def test_that_readline_with_a_count_reads_chunks
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      7.times { |i| file_writeline(fh, "line #{i + 1}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal E_INVARG, file_readline(fh, 0)
+      assert_equal ['line 1', 'line 2', 'line 3'], file_readline(fh, 3)
+      assert_equal 'line 4', file_readline(fh)
+      assert_equal ['line 5', 'line 6', 'line 7'], file_readline(fh, 5)
+      assert_equal [], file_readline(fh, 5)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_grep_can_continue_from_a_line
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      10.times { |i| file_writeline(fh, i.even? ? "even #{i}" : "odd #{i}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal E_INVARG, file_grep(fh, 'even', 1, 0)
+      assert_equal E_INVARG, file_grep(fh, 'even', 1, 1, -1)
+      assert_equal [['even 0', 1], ['even 2', 3]], file_grep(fh, 'even', 1, 1, 2)
+      assert_equal [['even 4', 5], ['even 6', 7]], file_grep(fh, 'even', 1, 4, 2)
+      assert_equal [['even 8', 9]], file_grep(fh, 'even', 1, 8, 2)
+      assert_equal [['odd 9', 10]], file_grep(fh, 'odd', 0, 9)
+      assert_equal [], file_grep(fh, 'odd', 1, 11)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_chunked_readlines_notice_changes_to_the_file
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      6.times { |i| file_writeline(fh, "line #{i + 1}") }
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r+tn')
+      assert_equal ['line 1', 'line 2'], file_readlines(fh, 1, 2)
+      assert_equal ['line 3', 'line 4'], file_readlines(fh, 3, 4)
+      file_seek(fh, 0, 'SEEK_SET')
+      file_writeline(fh, 'x')
+      assert_equal ['line 3', 'line 4'], file_readlines(fh, 4, 5)
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
+
+  def test_that_json_documents_can_be_written_to_and_read_from_a_file
+    run_test_as('wizard') do
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      assert_equal 20, file_write_json(fh, [1, 'two', {'k' => 3.5}])
+      assert_equal 3, file_write_json(fh, 12)
+      assert_equal 9, file_write_json(fh, MooObj.new(3), 'embedded-types')
+      assert_equal E_INVARG, file_write_json(fh, 1, 'bogus')
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal E_INVARG, file_read_json(fh, 'common-subset', 0)
+      assert_equal [[1, 'two', {'k' => 3.5}]], file_read_json(fh)
+      assert_equal [12, MooObj.new(3)], file_read_json(fh, 'embedded-types', 5)
+      assert_equal [], file_read_json(fh)
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'w-tn')
+      file_write(fh, '[1, 2] {"a": 1} 17 [3')
+      file_close(fh)
+      fh = file_open('test_fileio.tmp', 'r-tn')
+      assert_equal [[1, 2], {'a' => 1}, 17], file_read_json(fh, 'common-subset', 3)
+      assert_equal 19, file_tell(fh)
+      assert_equal({'error' => E_INVARG, 'message' => 'Invalid JSON'}, file_read_json(fh))
+      file_close(fh)
+      file_remove('test_fileio.tmp')
+    end
+  end
 end
@@ -407,6 +407,23 @@ class TestJson < Test::Unit::TestCase
     end
   end
 
+  def test_that_large_documents_round_trip
+    run_test_as('programmer') do
+      # Long strings and many elements both cross the boundaries of the
+      # chunks the generator writes and the parser reads.
+      assert_equal [1, 1, 1], simplify(command(%q|; x = "a\\"b"; for i in [1..14] x = x + x; endfor v = {}; for i in [1..2000] v = {@v, [tostr(i) -> {i, #1, E_PERM, x[1..i]}]}; endfor set_thread_mode(0); s = generate_json(v, "embedded-types"); return {length(s) > 16384, parse_json(s, "embedded-types") == v, parse_json(generate_json({x, x})) == {x, x}}; |))
+    end
+  end
+
+  def test_that_generate_json_gives_the_same_result_with_and_without_threading
+    run_test_as('programmer') do
+      assert_equal '[1,"#2",{"a":1.5}]', simplify(command(%q|; set_thread_mode(0); return generate_json({1, #2, ["a" -> 1.5]}); |))
+      assert_equal '[1,"#2",{"a":1.5}]', simplify(command(%q|; set_thread_mode(1); return generate_json({1, #2, ["a" -> 1.5]}); |))
+      assert_equal E_INVARG, simplify(command(%q|; set_thread_mode(0); return generate_json(create($nothing, 1)); |))
+      assert_equal E_INVARG, simplify(command(%q|; set_thread_mode(0); return generate_json(1, "bogus"); |))
+    end
+  end
+
   def generate_json(value, mode = nil, disable_binary_escapes = nil)
     if !disable_binary_escapes.nil?
       simplify command %Q|; return generate_json(#{value_ref(value)}, #{value_ref(mode)}, #{value_ref(disable_binary_escapes)});|
@@ -0,0 +1,70 @@
+require 'test_helper'
+
+# match() and rmatch() run patterns that translate exactly on PCRE2's JIT and
+# the rest on the original engine. These compare both against the original
+# engine, which `$server_options.legacy_match_engine' forces.
+
+class TestMatchEngines < Test::Unit::TestCase
+
+  PATTERNS = [
+    'o', 'o+', 'lo*', 'l+o?', '.', '.*', '.+o', 'o.*o', '[a-z]+', '[^a-z]+',
+    '[]a]', '[^]a]+', '[A-Z][a-z]*', '%w+', '%W+', '%bw', 'o%b', '%Bo', '%<W',
+    'o%>', '%<%w+%>', '^H', '^%w+', 'd$', '%w+$', '^$', '%`H', 'd%\'', '[^a]+%<',
+    'x*', '%(o%)', '%(l+%)%(o%)', '%(%w+%) %(%w+%)', 'a%|o', '%(Hel%|Wor%)ld?',
+    '%(o%|%)+', '%(%w%)%1', 'l%{2%}', '[0-9]+', 'o*+', '%%', '%.'
+  ].freeze
+
+  # MOO expressions, so the newline can be built with chr().
+  SUBJECTS = [
+    '"Hello World"', '"hello world"', '"HELLO"', '""', '"xyzzy"', '"aaa bbb"',
+    '"foo.bar baz"', '"two" + chr(10) + "lines"', '"  leading space"',
+    '"100% done"', '"Mississippi"'
+  ].freeze
+
+  def setup
+    run_test_as('wizard') do
+      evaluate('add_property($server_options, "legacy_match_engine", 0, {player, "r"})')
+      evaluate('load_server_options();')
+    end
+  end
+
+  def teardown
+    run_test_as('wizard') do
+      evaluate('delete_property($server_options, "legacy_match_engine")')
+      evaluate('load_server_options();')
+    end
+  end
+
+  def results_with(legacy, builtin, subject, case_matters)
+    evaluate("$server_options.legacy_match_engine = #{legacy};")
+    evaluate('load_server_options();')
+    PATTERNS.map do |pattern|
+      simplify(command(%Q|; return `#{builtin}(#{subject}, #{value_ref(pattern)}, #{case_matters}) ! ANY';|))
+    end
+  end
+
+  def test_that_match_agrees_with_the_legacy_engine
+    run_test_as('wizard') do
+      SUBJECTS.each do |subject|
+        [0, 1].each do |case_matters|
+          assert_equal results_with(1, 'match', subject, case_matters),
+                       results_with(0, 'match', subject, case_matters),
+                       "match(#{subject}, ..., #{case_matters})"
+        end
+      end
+    end
+  end
+
+  def test_that_rmatch_agrees_with_the_legacy_engine
+    run_test_as('wizard') do
+      SUBJECTS.each do |subject|
+        [0, 1].each do |case_matters|
+          assert_equal results_with(1, 'rmatch', subject, case_matters),
+                       results_with(0, 'rmatch', subject, case_matters),
+                       "rmatch(#{subject}, ..., #{case_matters})"
+        end
+      end
+    end
+  end
+
+end
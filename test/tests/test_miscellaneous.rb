@@ -37,4 +37,83 @@ class TestMiscellaneous < Test::Unit::TestCase
     end
   end
 
+  def test_that_notify_all_sends_the_line_to_every_recipient
+    run_test_as('programmer') do
+      assert_equal ['foo', 'foo'], command(%Q|; notify_all({player, player}, "foo"); |)[0..1]
+      assert_equal 0, simplify(command(%Q|; return notify_all({}, "foo"); |))
+    end
+    run_test_as('wizard') do
+      assert_equal 2, simplify(command(%Q|; return notify_all({#0, #1}, "foo"); |))
+    end
+  end
+
+  def test_that_notify_all_fails_on_invalid_arguments
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return notify_all({player, #0}, "foo"); |))
+      assert_equal E_TYPE, simplify(command(%Q|; return notify_all({player, 1}, "foo"); |))
+      assert_equal E_TYPE, simplify(command(%Q|; return notify_all(player, "foo"); |))
+    end
+  end
+
+  def test_that_output_to_a_connection_that_is_not_reading_stays_within_max_queued_output
+    idle = TCPSocket.open(options['host'], options['port'])
+    idle.setsockopt(Socket::SOL_SOCKET, Socket::SO_RCVBUF, 4096)
+    begin
+      run_test_as('wizard') do
+        # Give or take the overflow notice and a line, the queue never grows
+        # past max_queued_output, however much is sent.
+        peak = simplify(command(%Q|; c = $nothing; for x in (connected_players(1)) if (connection_info(x)["destination_port"] == #{idle.local_address.ip_port}) c = x; endif endfor line = "x"; while (length(line) < 1000) line = line + line; endwhile peak = 0; for i in [1..20000] notify(c, line); peak = max(peak, buffered_output_length(c)); if (i % 1000 == 0) suspend(0); endif endfor return peak - buffered_output_length(); |))
+        assert peak <= 2048, "queued #{peak} bytes more than max_queued_output"
+      end
+    ensure
+      idle.close
+    end
+  end
+
+  def test_that_sort_orders_values_of_one_type
+    run_test_as('programmer') do
+      assert_equal [-5, 1, 2, 3, 10], simplify(command(%Q|; return sort({3, 1, 2, -5, 10}); |))
+      assert_equal ['Apple', 'apple pie', 'applesauce', 'APPLESAUCE!', 'b', 'banana'], simplify(command(%Q|; return sort({"banana", "applesauce", "b", "Apple", "APPLESAUCE!", "apple pie"}); |))
+      assert_equal ['File1', 'file2', 'file10'], simplify(command(%Q|; return sort({"file10", "file2", "File1"}, {}, 1); |))
+      assert_equal ['X 1', 'x1a', 'x1b', 'x9', 'x10'], simplify(command(%Q|; return sort({"x10", "x9", "X 1", "x1b", "x1a"}, {}, 1); |))
+      assert_equal [10, 3, 2, 1], simplify(command(%Q|; return sort({1, 3, 10, 2}, {}, 0, 1); |))
+      assert_equal [-2.5, 1.5, 1.0e10], simplify(command(%Q|; return sort({1.5, 1.0e10, -2.5}); |))
+    end
+  end
+
+  def test_that_sort_is_stable
+    run_test_as('programmer') do
+      assert_equal ['b', 'd', 'a', 'c'], simplify(command(%Q|; return sort({"a", "b", "c", "d"}, {2, 1, 2, 1}); |))
+      assert_equal ['a', 'c', 'b', 'd'], simplify(command(%Q|; return sort({"a", "b", "c", "d"}, {2, 1, 2, 1}, 0, 1); |))
+      assert_equal ['x', 'X', 'x'], simplify(command(%Q|; return sort({"x", "X", "x"}); |))
+    end
+  end
+
+  def test_that_sort_orders_values_of_different_types
+    run_test_as('programmer') do
+      assert_equal '{false, true, 2, 2.5, 3, #1, E_PERM, "a", {1}, {1, 2}, ["a" -> 1]}', simplify(command(%Q|; return toliteral(sort({"a", 3, #1, true, 2.5, {1, 2}, ["a" -> 1], {1}, E_PERM, false, 2})); |))
+      # Sorting by a list of lists sorts by several keys at once.
+      assert_equal ['d', 'b', 'c', 'a'], simplify(command(%Q|; return sort({"a", "b", "c", "d"}, {{2, "x"}, {1, "z"}, {2, "a"}, {1, "y"}}); |))
+    end
+  end
+
+  def test_that_sort_handles_lists_long_enough_to_sort_in_parallel
+    values = (1..70_000).map { |i| ((i * 7919) % 70_001).to_s }
+    ids = (1..70_000).map(&:to_s)
+    keys = (1..70_000).map { |i| (i % 3).to_s }
+    by_key = ids.each_with_index.sort_by { |id, i| [keys[i], i] }.map(&:first)
+    run_test_as('programmer') do
+      assert_equal 1, simplify(command(%Q|; return sort(explode("#{values.join(' ')}")) == explode("#{values.sort.join(' ')}");|))
+      assert_equal 1, simplify(command(%Q|; return sort(explode("#{ids.join(' ')}"), explode("#{keys.join(' ')}")) == explode("#{by_key.join(' ')}");|))
+    end
+  end
+
+  def test_that_sort_fails_on_invalid_arguments
+    run_test_as('programmer') do
+      assert_equal E_INVARG, simplify(command(%Q|; return sort({1, 2}, {1}); |))
+      assert_equal E_TYPE, simplify(command(%Q|; return sort({1, create($nothing, 1)}); |))
+      assert_equal E_TYPE, simplify(command(%Q|; return sort({1, {2, create($nothing, 1)}}); |))
+    end
+  end
+
 end
@@ -2012,6 +2012,33 @@ class TestObject < Test::Unit::TestCase
     end
   end
 
+  def test_that_owned_objects_follows_ownership_changes
+    run_test_as('wizard') do
+      a = create(:nothing)
+      b = create(:nothing)
+      assert_equal [a, b], simplify(command(%Q|; return owned_objects(player); |)).last(2)
+      simplify(command(%Q|; #{a}.owner = #{b}; |))
+      assert_equal [a], simplify(command(%Q|; return owned_objects(#{b}); |))
+      recycle(a)
+      assert_equal [], simplify(command(%Q|; return owned_objects(#{b}); |))
+    end
+  end
+
+  def test_that_locate_by_name_follows_name_changes
+    run_test_as('wizard') do
+      a = create(:nothing)
+      b = create(:nothing)
+      set(a, 'name', 'Xyzzy Lamp')
+      set(b, 'name', 'plugh xyzzy')
+      assert_equal [a, b], simplify(command(%Q|; return locate_by_name("xyzzy"); |))
+      assert_equal [b], simplify(command(%Q|; return locate_by_name("xyzzy", 1); |))
+      set(b, 'name', 'plugh')
+      assert_equal [a], simplify(command(%Q|; return locate_by_name("xyzzy"); |))
+      recycle(a)
+      assert_equal [], simplify(command(%Q|; return locate_by_name("xyzzy"); |))
+    end
+  end
+
   private
 
   def kahuna(parent, location, name)
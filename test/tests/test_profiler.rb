@@ -0,0 +1,91 @@
+require 'test_helper'
+
+class TestProfiler < Test::Unit::TestCase
+
+  def test_that_the_profiler_requires_wizard_permissions
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return profile_start();|))
+      assert_equal E_PERM, simplify(command(%Q|; return profile_stop();|))
+      assert_equal E_PERM, simplify(command(%Q|; return profile_dump();|))
+    end
+  end
+
+  def test_that_profile_start_checks_its_arguments
+    run_test_as('wizard') do
+      assert_equal E_INVARG, simplify(command(%Q|; return profile_start("lines");|))
+      assert_equal E_INVARG, simplify(command(%Q|; return profile_start("samples", 0);|))
+      assert_equal E_INVARG, simplify(command(%Q|; return profile_dump("seconds");|))
+      assert_equal E_TYPE, simplify(command(%Q|; return profile_start(1);|))
+    end
+  end
+
+  def test_that_calls_are_folded_into_stacks
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'inner'], ['this', 'none', 'this'])
+      set_verb_code(o, 'inner') do |vc|
+        vc << %Q|x = 0;|
+        vc << %Q|for i in [1..100]|
+        vc << %Q|x = x + i;|
+        vc << %Q|endfor|
+        vc << %Q|return x;|
+      end
+      add_verb(o, ['player', 'xd', 'outer'], ['this', 'none', 'this'])
+      set_verb_code(o, 'outer') do |vc|
+        vc << %Q|s = 0;|
+        vc << %Q|for j in [1..5]|
+        vc << %Q|s = s + this:inner();|
+        vc << %Q|endfor|
+        vc << %Q|return s;|
+      end
+
+      assert_equal 25250, simplify(command(%Q|; profile_start(); r = #{o}:outer(); profile_stop(); return r;|))
+
+      calls = simplify(command(%Q|; return profile_dump("calls");|))
+      assert calls.any? { |l| l =~ /;#{o}:outer 1\z/ }
+      assert calls.any? { |l| l =~ /;#{o}:outer:3;#{o}:inner 5\z/ }
+
+      ticks = simplify(command(%Q|; return profile_dump("ticks");|))
+      inner = ticks.find { |l| l =~ /;#{o}:inner \d+\z/ }
+      assert inner.split(' ').last.to_i >= 500
+
+      assert_equal [], simplify(command(%Q|; return profile_dump("samples");|))
+      assert_equal calls, simplify(command(%Q|; return profile_dump("calls");|))
+    end
+  end
+
+  def test_that_calls_from_one_line_are_folded_together
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'inner'], ['this', 'none', 'this'])
+      set_verb_code(o, 'inner') do |vc|
+        vc << %Q|return 1;|
+      end
+      add_verb(o, ['player', 'xd', 'outer'], ['this', 'none', 'this'])
+      set_verb_code(o, 'outer') do |vc|
+        vc << %Q|return this:inner() + this:inner();|
+      end
+
+      assert_equal 2, simplify(command(%Q|; profile_start(); r = #{o}:outer(); profile_stop(); return r;|))
+
+      calls = simplify(command(%Q|; return profile_dump("calls");|)).grep(/;#{o}:outer:1;#{o}:inner /)
+      assert_equal 1, calls.length
+      assert calls[0].end_with?(' 2')
+    end
+  end
+
+  def test_that_profile_start_throws_away_the_last_profile
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'test'], ['this', 'none', 'this'])
+      set_verb_code(o, 'test') do |vc|
+        vc << %Q|return 1;|
+      end
+      command(%Q|; profile_start(); #{o}:test(); profile_stop();|)
+      assert simplify(command(%Q|; return profile_dump("calls");|)).any? { |l| l =~ /#{o}:test 1\z/ }
+      command(%Q|; profile_start(); profile_stop();|)
+      assert simplify(command(%Q|; return profile_dump("calls");|)).none? { |l| l =~ /#{o}:test/ }
+    end
+  end
+
+end
@@ -70,6 +70,25 @@ class TestStringOperations < Test::Unit::TestCase
     end
   end
 
+  def test_that_index_and_rindex_match_mixed_case_needles
+    run_test_as('programmer') do
+      assert_equal 4, index('xAyaBz', 'ab')
+      assert_equal 0, index('xAyaBz', 'ab', 1)
+      assert_equal 4, rindex('aBxAbz', 'AB')
+      assert_equal 1, rindex('aBxAbz', 'aB', 1)
+      assert_equal 1, index('foobar', '')
+      assert_equal 7, rindex('foobar', '')
+    end
+  end
+
+  def test_that_strsub_replaces_every_occurrence
+    run_test_as('programmer') do
+      assert_equal 'bye bye bye', simplify(command(%Q|; return strsub("Hello hello HELLO", "hello", "bye"); |))
+      assert_equal 'Hello bye HELLO', simplify(command(%Q|; return strsub("Hello hello HELLO", "hello", "bye", 1); |))
+      assert_equal 'bba', simplify(command(%Q|; return strsub("aaaaa", "aa", "b"); |))
+    end
+  end
+
   def test_that_strtr_replaces_characters
     run_test_as('programmer') do
       assert_equal 'fbboar', strtr('foobar', 'ob', 'bo')
@@ -151,4 +170,18 @@ class TestStringOperations < Test::Unit::TestCase
     end
   end
 
+  def test_that_match_and_pcre_match_share_the_pattern_cache
+    run_test_as('wizard') do
+      assert_equal 1, simplify(command(%Q|; before = pcre_cache_stats(1)["hits"]; match("foobar", "o+b"); match("foobar", "o+b"); return pcre_cache_stats(1)["hits"] > before; |))
+      assert_equal ["match", "pcre"], simplify(command(%Q|; match("xyzzy", "z+"); pcre_match("xyzzy", "z+"); kinds = {}; for e in (pcre_cache_stats()) if (e[1] == "z+") kinds = setadd(kinds, e[3]); endif endfor return sort(kinds); |))
+      assert_equal 0, simplify(command(%Q|; `match("x", "[") ! E_INVARG'; for e in (pcre_cache_stats()) if (e[1] == "[") return 1; endif endfor return 0; |))
+    end
+  end
+
+  def test_that_pcre_cache_stats_requires_wizperms
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return pcre_cache_stats(); |))
+    end
+  end
+
 end
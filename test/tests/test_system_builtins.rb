@@ -32,4 +32,120 @@ class TestSystemBuiltins < Test::Unit::TestCase
     end
   end
 
+  def test_that_memory_stats_requires_wizperms
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return memory_stats(); |))
+    end
+  end
+
+  def test_that_memory_stats_counts_live_strings
+    run_test_as('wizard') do
+      assert_equal 1, simplify(command(%Q|; return memory_stats()["string"]["blocks"] > 0; |))
+      assert_equal 1, simplify(command(%Q|; before = memory_stats()["list"]["blocks"]; x = {}; for i in [1..100] x = {@x, {i}}; endfor return memory_stats()["list"]["blocks"] >= before + 100; |))
+    end
+  end
+
+  def test_that_scheduler_stats_requires_wizperms
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return scheduler_stats(); |))
+    end
+  end
+
+  def test_that_scheduler_stats_counts_forked_tasks
+    run_test_as('wizard') do
+      before = simplify(command(%Q|; return scheduler_stats(); |))
+      send_string %Q|; for i in [1..10] fork (0) endfork endfor suspend(0); return scheduler_stats();|
+
+      line = nil
+      while (true)
+        line = @sock.gets.chomp
+        break if line[0] == ?{
+      end
+
+      after = simplify(line)
+      assert after['tasks'] >= before['tasks'] + 11
+      assert after['waited'] >= before['waited'] + 11
+      assert after['max_tasks'] >= 1
+      assert after['wait'] >= before['wait']
+    end
+  end
+
+  def test_that_main_loop_stats_requires_wizperms
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return main_loop_stats(); |))
+    end
+  end
+
+  def test_that_main_loop_stats_times_each_phase
+    run_test_as('wizard') do
+      before = simplify(command(%Q|; return main_loop_stats(); |))
+      command(%Q|; suspend(0); |)
+      after = simplify(command(%Q|; return main_loop_stats(); |))
+      assert after['iterations'] > before['iterations']
+      assert_equal %w[checkpoint children connections gc network recycle tasks], after['phases'].keys.sort
+      after['phases'].each do |name, phase|
+        assert_equal 7, phase['times'].length, name
+        assert (after['iterations'] - phase['times'].sum).between?(0, 1), name
+        assert phase['max'] <= phase['seconds'], name
+      end
+    end
+  end
+
+  def test_that_forked_tasks_run_in_order_whatever_the_batch_size
+    run_test_as('wizard') do
+      add_property(player, 'order', {}, [player, ''])
+      [1, 100].each do |size|
+        evaluate(%Q|add_property($server_options, "task_batch_size", #{size}, {player, "r"})|)
+        evaluate('load_server_options()')
+        send_string %Q|; player.order = {}; for i in [1..5] fork (0) player.order = {@player.order, i}; endfork endfor suspend(0.5); return player.order;|
+
+        line = nil
+        while (true)
+          line = @sock.gets.chomp
+          break if line[0] == ?{
+        end
+
+        assert_equal [1, 2, 3, 4, 5], simplify(line)
+        evaluate('delete_property($server_options, "task_batch_size")')
+        evaluate('load_server_options()')
+      end
+    end
+  end
+
+  def test_that_queue_info_reports_scheduling
+    run_test_as('wizard') do
+      info = simplify(command(%Q|; return queue_info(player);|))
+      assert_equal 1.0, info['weight']
+      assert_equal true, info['active']
+      assert info['tasks_run'] > 0
+      assert info['run_time'] > 0.0
+      assert info['usage'].is_a?(Float)
+      assert_equal false, info['hold_input']
+    end
+  end
+
+  def test_that_scheduler_weights_give_players_a_larger_share
+    run_test_as('wizard') do
+      add_property(player, 'order', {}, [player, 'rw'])
+      a = create(:nothing)
+      b = create(:nothing)
+      set(a, 'programmer', 1)
+      set(b, 'programmer', 1)
+      evaluate(%Q|add_property($server_options, "scheduler_weights", [#{a} -> 3], {player, "r"})|)
+      evaluate('load_server_options()')
+      send_string %Q|; for p in ({#{a}, #{b}}) fork (0) set_task_perms(p); for i in [1..200] fork (0) for j in [1..3000] endfor player.order = {@player.order, task_perms()}; endfork endfor endfork endfor while (length(player.order) < 400) suspend(0.1); endwhile n = 0; for p in (player.order[1..200]) n = n + (p == #{a}); endfor return n;|
+
+      line = nil
+      while (true)
+        line = @sock.gets.chomp
+        break if line[0] == ?{
+      end
+
+      n = simplify(line)
+      assert n > 125, "#{n} of the first 200 tasks were #{a}'s"
+      evaluate('delete_property($server_options, "scheduler_weights")')
+      evaluate('load_server_options()')
+    end
+  end
+
 end
@@ -237,7 +237,7 @@ class TestWaif < Test::Unit::TestCase
       end
       call(a, 'go')
       call(a, 'gc')
-      assert_equal({"pending_recycle" => 0, "total" => 0}, simplify(command(";; return waif_stats();")))
+      assert_equal({"pending_recycle" => 0, "total" => 0}, simplify(command(%Q|;; return mapdelete(waif_stats(), "properties");|)))
     end
   end
 
@@ -338,5 +338,46 @@ class TestWaif < Test::Unit::TestCase
     end
   end
 
+  def test_that_waif_properties_follow_changes_to_the_class
+    run_test_as('programmer') do
+      x = create(:waif)
+      add_property(x, ':a', 1, ['player', 'r'])
+      y = create(x)
+      add_property(y, ':b', 2, ['player', 'r'])
+
+      assert_equal [1, 2, 'z', 2, E_PROPNF, 'z', 'yz'], simplify(command(%Q|; w = #{y}:new(); r = {w.a, w.b}; add_property(#{x}, ":z", "z", {player, "r"}); r = {@r, w.z}; delete_property(#{x}, ":a"); r = {@r, w.b, `w.a ! ANY'}; set_property_info(#{x}, ":z", {player, "r", ":zz"}); r = {@r, w.zz}; #{y}.(":zz") = "yz"; return {@r, w.zz};|))
+    end
+  end
+
+  def test_that_waif_properties_survive_renumbering_the_class
+    run_test_as('wizard') do
+      j = create(:nothing)
+      x = create(:waif)
+      add_property(x, ':a', 5, ['player', 'r'])
+      y = create(x)
+      assert_equal [5, 5, 5], simplify(command(%Q|; w = #{y}:new(); r = {w.a}; recycle(#{j}); renumber(#{x}); return {@r, w.a, #{y}:new().a};|))
+    end
+  end
+
+  def test_that_waifs_with_many_properties_read_and_write_them
+    run_test_as('programmer') do
+      x = create(:waif)
+      simplify(command(%Q|; for i in [1..120] add_property(#{x}, ":p" + tostr(i), i, {player, "r"}); endfor|))
+      assert_equal [2340, 1000, -120, 5], simplify(command(%Q|; w = #{x}:new(); for i in [1..120] if (i % 3 == 0) w.("p" + tostr(i)) = -i; endif endfor s = 0; for i in [1..120] s = s + w.("p" + tostr(i)); endfor #{x}.(":p1") = 1000; #{x}.(":p119") = 5; return {s, w.P1, w.p120, w.p119};|))
+    end
+  end
+
+  def test_that_waif_stats_counts_property_lookups
+    run_test_as('wizard') do
+      x = create(:waif)
+      add_property(x, ':a', 1, ['player', 'r'])
+      before = simplify(command(%Q|; return waif_stats()["properties"];|))
+      simplify(command(%Q|; w = #{x}:new(); w.a; w.a; `w.b ! E_PROPNF';|))
+      after = simplify(command(%Q|; return waif_stats()["properties"];|))
+      assert_equal before['hits'] + 2, after['hits']
+      assert_equal before['misses'] + 1, after['misses']
+    end
+  end
+
 
 end